@@ -129,7 +129,7 @@ static inline int get_cpu_id(void) {
  * Just offset into the cpu array with mhartid :^). I love this arch.
  * No need for bloated thread pointer bogus or nothin'
  */
-cpu::Core &cpu::current(void) { return *cpu::get(get_cpu_id()); }
+cpu::Core *cpu::get(void) { return cpu::get(get_cpu_id()); }
 
 
 void cpu::switch_vm(ck::ref<Thread> thd) { /* TODO: nothin' */
@@ -125,7 +125,7 @@ struct rv::hart_state &rv::get_hstate(void) {
  * Just offset into the cpu array with mhartid :^). I love this arch.
  * No need for bloated thread pointer bogus or nothin'
  */
-cpu::Core &cpu::current(void) { return *rv::get_hstate().cpu; }
+cpu::Core *cpu::get(void) { return rv::get_hstate().cpu; }
 
 
 void cpu::switch_vm(ck::ref<Thread> thd) {
@@ -166,7 +166,7 @@ void cpu::switch_vm(ck::ref<struct Thread> thd) {
   if (thd->tls_uaddr != 0) wrmsr(FS_BASE_MSR, thd->tls_uaddr);
 }
 
-cpu::Core &cpu::current() {
-  return *__get_cpu_struct();
+cpu::Core *cpu::get() {
+  return __get_cpu_struct();
 }
 
@@ -0,0 +1,364 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// iobench - a small fio-like storage benchmark
+//
+//   iobench [-w workload] [-b bs] [-j jobs] [-t seconds] [-s size] [-y] path
+//
+// Runs a sequential or random read or write workload against a file or a
+// block device. Each job is a thread with its own file descriptor that does
+// synchronous I/O, so the number of jobs is the queue depth the kernel
+// sees. At the end, IOPS, bandwidth and latency percentiles are reported.
+
+enum workload { SEQ_READ, SEQ_WRITE, RAND_READ, RAND_WRITE };
+
+static const char *workload_names[] = {"read", "write", "randread", "randwrite"};
+
+struct options {
+  const char *path = NULL;
+  enum workload workload = SEQ_READ;
+  size_t bs = 4096;
+  int jobs = 1;
+  int seconds = 5;
+  off_t size = 0;     // how much of the file to use. 0 means all of it
+  bool fsync = false;  // sync the file before stopping the clock on writes
+};
+
+
+// Latencies are recorded in a log-linear histogram: values below 16us are
+// exact, and every power of two above that is split in 16 linear buckets,
+// so percentiles are within ~6% of the real value.
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[HIST_BUCKETS];
+};
+
+static int hist_index(uint64_t v) {
+  if (v < HIST_SUB) return v;
+  int msb = 63 - __builtin_clzll(v);
+  int sub = (v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1);
+  return (msb - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+// the largest value that would land in bucket `i`
+static uint64_t hist_value(int i) {
+  if (i < HIST_SUB) return i;
+  int msb = i / HIST_SUB + HIST_SUB_BITS - 1;
+  uint64_t sub = i % HIST_SUB;
+  return ((HIST_SUB + sub + 1) << (msb - HIST_SUB_BITS)) - 1;
+}
+
+static void hist_add(struct histogram *h, uint64_t v) {
+  if (h->count == 0 || v < h->min) h->min = v;
+  if (v > h->max) h->max = v;
+  h->count++;
+  h->sum += v;
+  h->buckets[hist_index(v)]++;
+}
+
+static void hist_merge(struct histogram *into, struct histogram *h) {
+  if (h->count == 0) return;
+  if (into->count == 0 || h->min < into->min) into->min = h->min;
+  if (h->max > into->max) into->max = h->max;
+  into->count += h->count;
+  into->sum += h->sum;
+  for (int i = 0; i < HIST_BUCKETS; i++)
+    into->buckets[i] += h->buckets[i];
+}
+
+static uint64_t hist_percentile(struct histogram *h, double p) {
+  uint64_t want = (uint64_t)(h->count * p / 100.0);
+  if (want >= h->count) want = h->count - 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen > want) {
+      uint64_t v = hist_value(i);
+      return v > h->max ? h->max : v;
+    }
+  }
+  return h->max;
+}
+
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+struct job {
+  pthread_t thread;
+  int id;
+  int fd;
+  struct options *opts;
+  off_t region_start;  // sequential jobs each work on their own slice
+  off_t region_size;
+  uint64_t deadline;
+
+  uint64_t ios;
+  uint64_t bytes;
+  int error;
+  struct histogram lat;
+};
+
+
+// xorshift64*, so every job has its own cheap random stream
+static uint64_t next_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+static void *run_job(void *arg) {
+  auto *j = (struct job *)arg;
+  auto *o = j->opts;
+  bool write = o->workload == SEQ_WRITE || o->workload == RAND_WRITE;
+  bool random = o->workload == RAND_READ || o->workload == RAND_WRITE;
+
+  auto *buf = (uint8_t *)malloc(o->bs);
+  for (size_t i = 0; i < o->bs; i++)
+    buf[i] = i * 31 + j->id;
+
+  uint64_t seed = 0x9E3779B97F4A7C15ULL * (j->id + 1);
+  off_t nblocks = j->region_size / o->bs;
+  off_t cursor = 0;
+
+  while (now_us() < j->deadline) {
+    off_t block;
+    if (random) {
+      block = next_random(&seed) % nblocks;
+    } else {
+      block = cursor;
+      cursor = (cursor + 1) % nblocks;
+    }
+    off_t off = j->region_start + block * o->bs;
+
+    uint64_t start = now_us();
+    ssize_t n = write ? pwrite(j->fd, buf, o->bs, off) : pread(j->fd, buf, o->bs, off);
+    uint64_t end = now_us();
+
+    if (n != (ssize_t)o->bs) {
+      j->error = n < 0 ? errno : EIO;
+      break;
+    }
+
+    hist_add(&j->lat, end - start);
+    j->ios++;
+    j->bytes += n;
+  }
+
+  free(buf);
+  return NULL;
+}
+
+
+// make sure a regular file is at least `size` bytes, so reads have
+// something to hit and writes measure overwrites, not allocation
+static int lay_out(int fd, off_t size, size_t bs) {
+  struct stat st;
+  if (fstat(fd, &st) < 0) return -1;
+  if (st.st_size >= size) return 0;
+
+  printf("laying out %lld bytes...\n", (long long)size);
+  if (lseek(fd, st.st_size, SEEK_SET) != st.st_size) return -1;
+  auto *buf = (uint8_t *)calloc(1, bs);
+  for (off_t off = st.st_size; off < size; off += bs) {
+    if (write(fd, buf, bs) != (ssize_t)bs) {
+      free(buf);
+      return -1;
+    }
+  }
+  free(buf);
+  return 0;
+}
+
+
+static off_t parse_size(const char *s) {
+  char *end;
+  off_t v = strtoull(s, &end, 10);
+  switch (*end) {
+    case 'k':
+    case 'K':
+      return v << 10;
+    case 'm':
+    case 'M':
+      return v << 20;
+    case 'g':
+    case 'G':
+      return v << 30;
+    case '\0':
+      return v;
+  }
+  return -1;
+}
+
+
+static void usage(void) {
+  fprintf(stderr, "usage: iobench [-w workload] [-b bs] [-j jobs] [-t seconds] [-s size] [-y] path\n");
+  fprintf(stderr, "  -w   read, write, randread or randwrite (default read)\n");
+  fprintf(stderr, "  -b   block size of each I/O (default 4k)\n");
+  fprintf(stderr, "  -j   number of jobs, each with one I/O in flight (default 1)\n");
+  fprintf(stderr, "  -t   how long to run in seconds (default 5)\n");
+  fprintf(stderr, "  -s   how much of the file to use (default: the whole device, or 16M for files)\n");
+  fprintf(stderr, "  -y   sync before stopping the clock on write workloads\n");
+}
+
+
+int main(int argc, char **argv) {
+  struct options o;
+
+  int ch;
+  while ((ch = getopt(argc, argv, "w:b:j:t:s:yh")) != -1) {
+    switch (ch) {
+      case 'w': {
+        bool found = false;
+        for (int i = 0; i < 4; i++) {
+          if (strcmp(optarg, workload_names[i]) == 0) {
+            o.workload = (enum workload)i;
+            found = true;
+          }
+        }
+        if (!found) {
+          fprintf(stderr, "iobench: unknown workload '%s'\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      }
+      case 'b':
+        o.bs = parse_size(optarg);
+        break;
+      case 'j':
+        o.jobs = atoi(optarg);
+        break;
+      case 't':
+        o.seconds = atoi(optarg);
+        break;
+      case 's':
+        o.size = parse_size(optarg);
+        break;
+      case 'y':
+        o.fsync = true;
+        break;
+      default:
+        usage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  argc -= optind;
+  argv += optind;
+  if (argc != 1 || (ssize_t)o.bs <= 0 || o.jobs <= 0 || o.seconds <= 0 || o.size < 0) {
+    usage();
+    return EXIT_FAILURE;
+  }
+  o.path = argv[0];
+
+  bool write = o.workload == SEQ_WRITE || o.workload == RAND_WRITE;
+
+  int fd = open(o.path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    perror(o.path);
+    return EXIT_FAILURE;
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+  bool device = S_ISBLK(st.st_mode);
+  if (o.size == 0) o.size = device ? st.st_size : 16 * 1024 * 1024;
+  if (device && o.size > st.st_size) o.size = st.st_size;
+
+  if (!device && lay_out(fd, o.size, o.bs) < 0) {
+    perror("iobench: failed to lay out file");
+    return EXIT_FAILURE;
+  }
+  close(fd);
+
+  off_t slice = o.size / o.jobs;
+  bool random = o.workload == RAND_READ || o.workload == RAND_WRITE;
+  if ((random ? o.size : slice) < (off_t)o.bs) {
+    fprintf(stderr, "iobench: %lld bytes is too small for %d jobs of %zu byte I/O\n", (long long)o.size, o.jobs,
+            o.bs);
+    return EXIT_FAILURE;
+  }
+
+  printf("%s: %s, bs=%zu, jobs=%d, size=%lld, %ds\n", o.path, workload_names[o.workload], o.bs, o.jobs,
+         (long long)o.size, o.seconds);
+
+  auto *jobs = (struct job *)calloc(o.jobs, sizeof(struct job));
+  for (int i = 0; i < o.jobs; i++) {
+    jobs[i].id = i;
+    jobs[i].opts = &o;
+    jobs[i].fd = open(o.path, O_RDWR);
+    if (jobs[i].fd < 0) {
+      perror(o.path);
+      return EXIT_FAILURE;
+    }
+    jobs[i].region_start = random ? 0 : slice * i;
+    jobs[i].region_size = random ? o.size : slice;
+  }
+
+  uint64_t start = now_us();
+  for (int i = 0; i < o.jobs; i++) {
+    jobs[i].deadline = start + (uint64_t)o.seconds * 1000000;
+    pthread_create(&jobs[i].thread, NULL, run_job, &jobs[i]);
+  }
+
+  static struct histogram lat;
+  uint64_t ios = 0, bytes = 0;
+  for (int i = 0; i < o.jobs; i++) {
+    pthread_join(jobs[i].thread, NULL);
+    if (jobs[i].error) fprintf(stderr, "iobench: job %d: %s\n", i, strerror(jobs[i].error));
+    hist_merge(&lat, &jobs[i].lat);
+    ios += jobs[i].ios;
+    bytes += jobs[i].bytes;
+  }
+  // writes aren't done until they reach the disk
+  if (write && o.fsync) fsync(jobs[0].fd);
+  uint64_t elapsed = now_us() - start;
+
+  for (int i = 0; i < o.jobs; i++)
+    close(jobs[i].fd);
+  free(jobs);
+
+  if (ios == 0) {
+    fprintf(stderr, "iobench: no I/O completed\n");
+    return EXIT_FAILURE;
+  }
+
+  double secs = elapsed / 1000000.0;
+  printf("  ios: %llu in %.2fs\n", (unsigned long long)ios, secs);
+  printf("  iops: %.1f\n", ios / secs);
+  printf("  bw: %.2f MiB/s\n", bytes / secs / (1024.0 * 1024.0));
+  printf("  lat (us): min=%llu avg=%.1f max=%llu\n", (unsigned long long)lat.min, (double)lat.sum / lat.count,
+         (unsigned long long)lat.max);
+
+  double percentiles[] = {50, 90, 95, 99, 99.9, 99.99};
+  printf("  lat percentiles (us):");
+  for (double p : percentiles) {
+    printf(" p%g=%llu", p, (unsigned long long)hist_percentile(&lat, p));
+  }
+  printf("\n");
+
+  return 0;
+}
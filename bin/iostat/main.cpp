@@ -0,0 +1,165 @@
+#include <sys/sysbind.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chariot/kctl.h>
+#include <chariot/iostat.h>
+
+// iostat [-h] [interval]
+//
+// Print the per block device I/O counters the kernel exposes in `blk.io`.
+// With an interval (in seconds), keep printing what changed in each period.
+// With -h, also print the request latency and queue time histograms
+
+#define MAX_DEVICES 32
+
+struct device {
+  char name[32];
+  unsigned long long reads, writes, rsect, wsect, merges;
+  long long inflight;
+  unsigned long long lat[IOSTAT_BUCKETS];
+  unsigned long long queue[IOSTAT_BUCKETS];
+};
+
+
+static char *read_io_stats(void) {
+  off_t name[] = {KCTL_BLK, KCTL_IO};
+
+  size_t len = 0;
+  if (sysbind_kctl(name, 2, NULL, &len, NULL, 0) < 0) return NULL;
+
+  // leave room for a device being added between the two calls
+  len += 512;
+  char *buf = (char *)malloc(len);
+  if (sysbind_kctl(name, 2, buf, &len, NULL, 0) < 0) {
+    free(buf);
+    return NULL;
+  }
+  return buf;
+}
+
+
+static int parse_hist(char *s, unsigned long long *hist) {
+  for (int i = 0; i < IOSTAT_BUCKETS; i++) {
+    char *end;
+    hist[i] = strtoull(s, &end, 10);
+    if (end == s) return -1;
+    s = end;
+    if (*s == ',') s++;
+  }
+  return 0;
+}
+
+
+static int parse(char *text, struct device *devs) {
+  int n = 0;
+  char *line = text;
+  while (line && *line && n < MAX_DEVICES) {
+    char *next = strchr(line, '\n');
+    if (next) *next++ = '\0';
+
+    struct device *d = &devs[n];
+    char lat[512], queue[512];
+    int got = sscanf(line, "%31s %llu %llu %llu %llu %llu %lld %511s %511s", d->name, &d->reads, &d->writes,
+                     &d->rsect, &d->wsect, &d->merges, &d->inflight, lat, queue);
+    if (got == 9 && parse_hist(lat, d->lat) == 0 && parse_hist(queue, d->queue) == 0) n++;
+
+    line = next;
+  }
+  return n;
+}
+
+
+static struct device *find(struct device *devs, int n, const char *name) {
+  for (int i = 0; i < n; i++) {
+    if (strcmp(devs[i].name, name) == 0) return &devs[i];
+  }
+  return NULL;
+}
+
+
+static void print_hist(const char *title, unsigned long long *hist) {
+  unsigned long long total = 0;
+  int last = -1;
+  for (int i = 0; i < IOSTAT_BUCKETS; i++) {
+    total += hist[i];
+    if (hist[i] != 0) last = i;
+  }
+  if (total == 0) return;
+
+  printf("  %s\n", title);
+  for (int i = 0; i <= last; i++) {
+    int width = (int)(hist[i] * 40 / total);
+    printf("  %10llu us | %8llu |", 1ULL << (i + 1), hist[i]);
+    for (int j = 0; j < width; j++)
+      putchar('#');
+    putchar('\n');
+  }
+}
+
+
+int main(int argc, char **argv) {
+  bool histograms = false;
+  int interval = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      histograms = true;
+    } else {
+      interval = atoi(argv[i]);
+      if (interval <= 0) {
+        fprintf(stderr, "usage: iostat [-h] [interval]\n");
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  static struct device prev[MAX_DEVICES], curr[MAX_DEVICES];
+  int nprev = 0;
+
+  while (1) {
+    char *text = read_io_stats();
+    if (text == NULL) {
+      fprintf(stderr, "iostat: failed to read blk.io\n");
+      return EXIT_FAILURE;
+    }
+    int ncurr = parse(text, curr);
+    free(text);
+
+    printf("%-10s %10s %10s %12s %12s %8s %8s\n", "device", "reads", "writes", "rsect", "wsect", "merges",
+           "inflight");
+    for (int i = 0; i < ncurr; i++) {
+      struct device d = curr[i];
+      // after the first report, only show what happened in the last interval
+      struct device *p = find(prev, nprev, d.name);
+      if (p != NULL) {
+        d.reads -= p->reads;
+        d.writes -= p->writes;
+        d.rsect -= p->rsect;
+        d.wsect -= p->wsect;
+        d.merges -= p->merges;
+        for (int b = 0; b < IOSTAT_BUCKETS; b++) {
+          d.lat[b] -= p->lat[b];
+          d.queue[b] -= p->queue[b];
+        }
+      }
+
+      printf("%-10s %10llu %10llu %12llu %12llu %8llu %8lld\n", d.name, d.reads, d.writes, d.rsect, d.wsect,
+             d.merges, d.inflight);
+      if (histograms) {
+        print_hist("latency (dispatch to completion)", d.lat);
+        print_hist("queue time (request to dispatch)", d.queue);
+      }
+    }
+
+    if (interval == 0) break;
+
+    memcpy(prev, curr, sizeof(curr));
+    nprev = ncurr;
+    printf("\n");
+    sleep(interval);
+  }
+
+  return 0;
+}
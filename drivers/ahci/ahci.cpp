@@ -7,11 +7,11 @@
 
 #include <dev/driver.h>
 #include <lock.h>
-#include <ck/map.h>
 #include <mem.h>
 #include <module.h>
 #include <pci.h>
 #include <phys.h>
+#include <time.h>
 #include <util.h>
 
 #define SATA_SIG_ATA 0x00000101    // SATA drive
@@ -28,35 +28,10 @@
 #define HBA_PORT_IPM_ACTIVE 1
 #define HBA_PORT_DET_PRESENT 3
 
-static ck::map<int, struct ahci::disk *> ahci_table;
-static spinlock ahci_table_lock;
-
-// register an ahci port to a device minor number
-int ahci::register_disk(struct ahci::disk *port) {
-  int min = -1;
-  ahci_table_lock.lock();
-  /* find the smallest index */
-  for (int i = 0; true; i++) {
-    if (!ahci_table.contains(i)) {
-      min = i;
-      break;
-    }
-  }
-  ahci_table_lock.unlock();
-  return min;
-}
-
-struct ahci::disk *ahci::get_disk(int minor) {
-  struct ahci::disk *disk = NULL;
-  ahci_table_lock.lock();
-  /* grab the port for a given minor number */
-  if (ahci_table.contains(minor)) disk = ahci_table[minor];
-  ahci_table_lock.unlock();
-  return disk;
-}
+DECLARE_STUB_DRIVER("ahci", ahci_driver)
 
 // Check device type
-static int check_type(ahci::hba_port *port) {
+static int check_type(volatile ahci::hba_port *port) {
   uint32_t ssts = port->ssts;
 
   uint8_t ipm = (ssts >> 8) & 0x0F;
@@ -81,7 +56,8 @@ static int check_type(ahci::hba_port *port) {
 /**
  * probe_port - find all the ports and initialize them
  */
-static void probe_port(ahci::hba_mem *abar) {
+static void probe_port(ahci::hba *hba) {
+  auto *abar = hba->abar;
   // Search disk in implemented ports
   uint32_t pi = abar->pi;
   for (int i = 0; i < 32; i++) {
@@ -90,7 +66,12 @@ static void probe_port(ahci::hba_mem *abar) {
       int dt = check_type(port);
       if (dt == AHCI_DEV_SATA) {
         AHCI_INFO("SATA drive found at port %d\n", i);
-        ahci::init_sata(ck::make_box<ahci::disk>(abar, port));
+        auto *disk = new ahci::disk(*hba, abar, port);
+        hba->ports[i] = disk;
+        if (ahci::init_sata(disk) != 0) {
+          hba->ports[i] = nullptr;
+          delete disk;
+        }
       } else if (dt == AHCI_DEV_SATAPI) {
         AHCI_INFO("SATAPI drive found at port %d\n", i);
       } else if (dt == AHCI_DEV_SEMB) {
@@ -106,76 +87,139 @@ static void probe_port(ahci::hba_mem *abar) {
   }
 }
 
+
+static void ahci_irq_handler(int intr, reg_t *fr, void *data) {
+  auto *hba = (ahci::hba *)data;
+  uint32_t is = hba->abar->is;
+
+  for (int i = 0; i < 32; i++) {
+    if ((is & (1U << i)) == 0) continue;
+    auto *disk = hba->ports[i];
+    if (disk != nullptr) {
+      disk->drive_lock.lock();
+      disk->process_completions();
+      disk->drive_lock.unlock();
+    } else {
+      // nobody is driving this port, just acknowledge it
+      hba->abar->ports[i].is = hba->abar->ports[i].is;
+    }
+  }
+
+  // Port interrupts must be cleared before the global status
+  hba->abar->is = is;
+  irq::eoi(intr);
+}
+
 /**
  * init_device - using a PCI device, initialize all the drives
  */
 static void init_device(pci::device *dev) {
   AHCI_INFO("Found Host Bus Adapter [%04x:%04x]\n", dev->vendor_id, dev->device_id);
 
+  auto *hba = new ahci::hba;
+  memset(hba->ports, 0, sizeof(hba->ports));
+  hba->dev = dev;
+
   /* AHCI stores it's ABAR in bar5 of the HBA's PCI registers */
   u64 bar = dev->get_bar(5).raw;
-  auto *abar = (ahci::hba_mem *)p2v(bar); /* do not free() */
-  /* Enable bus mastering so the controller can DMA and all that. */
+  hba->abar = (volatile ahci::hba_mem *)p2v(bar); /* do not free() */
+  /* Enable bus mastering so the controller can DMA and all that, and make sure INTx is on */
   dev->enable_bus_mastering();
+  dev->adjust_ctrl_bits(PCI_CMD_BME | PCI_CMD_MSE, PCI_CMD_ID);
+
+  /* Make sure we are in AHCI mode (not legacy IDE emulation) */
+  hba->abar->ghc = hba->abar->ghc | HBA_GHC_AE;
+  hba->nslots = HBA_CAP_NCS(hba->abar->cap);
+  AHCI_INFO("%d command slots, ncq: %s\n", hba->nslots, (hba->abar->cap & HBA_CAP_SNCQ) ? "yes" : "no");
+
+  irq::install(dev->interrupt, ahci_irq_handler, "AHCI", (void *)hba);
+  hba->abar->is = hba->abar->is;
+  hba->abar->ghc = hba->abar->ghc | HBA_GHC_IE;
+
   /* Probe the ABAR for drives */
-  probe_port(abar);
+  probe_port(hba);
 }
 
 
-ahci::disk::disk(struct hba_mem *abar, struct hba_port *port) : abar(abar), port(port) {}
+ahci::disk::disk(struct ahci::hba &hba, volatile struct hba_mem *abar, volatile struct hba_port *port)
+    : dev::Disk(ahci_driver), abar(abar), port(port), hba(hba) {}
 
-struct ahci::hba_cmd_hdr *ahci::disk::get_cmd_hdr(void) {
-  u64 clb = port->clb | ((u64)port->clbu << 32);
-  auto cmd_hdr = (struct ahci::hba_cmd_hdr *)p2v(clb);
-  return cmd_hdr;
-}
-struct ahci::hba_cmd *ahci::disk::get_cmd_table(void) {
-  auto cmd_hdr = get_cmd_hdr();
-  auto cmd_table = (struct ahci::hba_cmd *)p2v(cmd_hdr->ctba | ((u64)cmd_hdr->ctbau << 32));
-  return cmd_table;
+ahci::disk::~disk(void) {
+  // the HBA must be done with the command list and tables before they go
+  port->ie = 0;
+  stop_cmd();
+  if (cmd_list != nullptr) phys::kfree(cmd_list, 1);
+  for (int i = 0; i < 32; i++) {
+    if (cmd_tables[i] != nullptr) phys::kfree(cmd_tables[i], 1);
+  }
 }
 
 
+// Wait for `cond` to become true, giving up after 500ms
+template <typename Fn>
+static bool wait_for(Fn cond) {
+  auto deadline = time::now_ms() + 500;
+  while (!cond()) {
+    if (time::now_ms() > deadline) return false;
+    arch_relax();
+  }
+  return true;
+}
 
-void ahci::disk::rebase(void) {
-  /* Stop the command engine */
-  port->cmd = 0;
-  stop_cmd();
 
+bool ahci::disk::rebase(void) {
+  /* Stop the command engine */
+  if (!stop_cmd()) return false;
+
+  // The command list (32 headers, 1K) and the received FIS area (256 bytes)
+  // share a page. Each command table gets a page of its own.
+  cmd_list = (struct ahci::hba_cmd_hdr *)phys::kalloc(1);
+  memset(cmd_list, 0, PGSIZE);
+  u64 clb = (u64)v2p(cmd_list);
+  u64 fb = clb + 1024;
+  port->clb = clb & 0xFFFFFFFF;
+  port->clbu = clb >> 32;
+  port->fb = fb & 0xFFFFFFFF;
+  port->fbu = fb >> 32;
+
+  for (int i = 0; i < hba.nslots; i++) {
+    cmd_tables[i] = (struct ahci::hba_cmd *)phys::kalloc(1);
+    memset(cmd_tables[i], 0, PGSIZE);
+    u64 ctba = (u64)v2p(cmd_tables[i]);
+    cmd_list[i].ctba = ctba & 0xFFFFFFFF;
+    cmd_list[i].ctbau = ctba >> 32;
+  }
+  free_slots = hba.nslots == 32 ? ~0U : (1U << hba.nslots) - 1;
 
-  // auto clb = (u64)phys::alloc(1 /* TODO */);
-  // printf("clb=%p\n", clb);
+  // Clear any stale errors and interrupts, then tell the port what we care about
+  port->serr = ~0U;
+  port->is = ~0U;
+  port->ie = HBA_PxIS_DHRS | HBA_PxIS_PSS | HBA_PxIS_DSS | HBA_PxIS_SDBS | HBA_PxIS_ERROR;
 
   /* Start command engine back up. */
-  start_cmd();
+  return start_cmd();
 }
 
-bool ahci::disk::read(off_t sector, uint32_t count, void *dst) { return true; }
-
 
-void ahci::disk::stop_cmd(void) {
+bool ahci::disk::stop_cmd(void) {
   // Clear ST (bit0)
   port->cmd = port->cmd & ~HBA_PxCMD_ST;
+  // Wait until CR (bit15) is cleared
+  if (!wait_for([&] { return (port->cmd & HBA_PxCMD_CR) == 0; })) return false;
 
-  // Wait until FR (bit14), CR (bit15) are cleared
-  while (1) {
-    if (port->cmd & HBA_PxCMD_FR) continue;
-    if (port->cmd & HBA_PxCMD_CR) continue;
-    break;
-  }
-
-  // Clear FRE (bit4)
+  // Clear FRE (bit4), and wait for FR (bit14) to clear
   port->cmd = port->cmd & ~HBA_PxCMD_FRE;
+  return wait_for([&] { return (port->cmd & HBA_PxCMD_FR) == 0; });
 }
 
-void ahci::disk::start_cmd(void) {
+bool ahci::disk::start_cmd(void) {
   // Wait until CR (bit15) is cleared
-  while (port->cmd & HBA_PxCMD_CR)
-    ;
+  if (!wait_for([&] { return (port->cmd & HBA_PxCMD_CR) == 0; })) return false;
 
   // Set FRE (bit4) and ST (bit0)
   port->cmd = port->cmd | HBA_PxCMD_FRE;
   port->cmd = port->cmd | HBA_PxCMD_ST;
+  return true;
 }
 
 
@@ -3,6 +3,9 @@
 #include <lock.h>
 #include <types.h>
 #include <printf.h>
+#include <wait.h>
+#include <pci.h>
+#include <dev/disk.h>
 #include <ck/ptr.h>
 
 
@@ -13,6 +16,26 @@
 #define HBA_PxCMD_FR 0x4000
 #define HBA_PxCMD_CR 0x8000
 
+#define HBA_CAP_SNCQ (1U << 30)          // Supports native command queueing
+#define HBA_CAP_NCS(cap) ((((cap) >> 8) & 0x1F) + 1)  // Number of command slots
+#define HBA_GHC_IE (1U << 1)             // Interrupt enable
+#define HBA_GHC_AE (1U << 31)            // AHCI enable
+
+// Port interrupt status/enable bits
+#define HBA_PxIS_DHRS (1U << 0)   // Device to host register FIS
+#define HBA_PxIS_PSS (1U << 1)    // PIO setup FIS
+#define HBA_PxIS_DSS (1U << 2)    // DMA setup FIS
+#define HBA_PxIS_SDBS (1U << 3)   // Set device bits FIS
+#define HBA_PxIS_IFS (1U << 27)   // Interface fatal error
+#define HBA_PxIS_HBDS (1U << 28)  // Host bus data error
+#define HBA_PxIS_HBFS (1U << 29)  // Host bus fatal error
+#define HBA_PxIS_TFES (1U << 30)  // Task file error
+#define HBA_PxIS_ERROR (HBA_PxIS_IFS | HBA_PxIS_HBDS | HBA_PxIS_HBFS | HBA_PxIS_TFES)
+
+#define HBA_PxTFD_BSY 0x80
+#define HBA_PxTFD_DRQ 0x08
+#define HBA_PxTFD_ERR 0x01
+
 #define FIS_TYPE_REG_H2D 0x27    // Register FIS - host to device
 #define FIS_TYPE_REG_D2H 0x34    // Register FIS - device to host
 #define FIS_TYPE_DMA_ACT 0x39    // DMA activate FIS - device to host
@@ -99,6 +122,9 @@ namespace ahci {
     struct hba_prdt prdt_entry[1];
   };
 
+  // We give each command table a page, which leaves room for this many PRDT entries
+#define AHCI_MAX_PRDT ((4096 - 0x80) / sizeof(struct ahci::hba_prdt))
+
   struct hba_cmd_hdr {
     // DW0
     uint8_t cfl : 5;  // Command FIS length in DWORDS, 2 ~ 16
@@ -286,32 +312,77 @@ namespace ahci {
     };
   };  // namespace fis
 
+  struct hba;
+
+  /* An in-flight command, indexed by command slot (which is also the NCQ tag) */
+  struct cmd_slot {
+    volatile bool done = false;
+    bool error = false;
+    struct wait_queue wq;
+  };
+
   /* hba_disk - Holds both port and ABAR */
-  struct disk {
+  struct disk : public dev::Disk {
     // do not free either of these on dtor.
-    struct hba_mem *abar;
-    struct hba_port *port;
+    volatile struct hba_mem *abar;
+    volatile struct hba_port *port;
+    struct ahci::hba &hba;
 
     spinlock drive_lock;
 
-    inline disk(struct hba_mem *abar, struct hba_port *port);
+    // Command list and received FIS area (one page) and a page per command table
+    struct ahci::hba_cmd_hdr *cmd_list = nullptr;
+    struct ahci::hba_cmd *cmd_tables[32] = {};
+
+    struct ahci::cmd_slot slots[32];
+    // slots that are free to use, and slots that the HBA currently owns
+    uint32_t free_slots = 0;
+    uint32_t issued = 0;
+    struct wait_queue slot_wq;
 
-    struct ahci::hba_cmd_hdr *get_cmd_hdr(void);
-    struct ahci::hba_cmd *get_cmd_table(void);
+    // use READ/WRITE FPDMA QUEUED instead of READ/WRITE DMA EXT
+    bool ncq = false;
+    // have we installed an irq handler that can complete requests?
+    bool irq_ready = false;
+
+    disk(struct ahci::hba &hba, volatile struct hba_mem *abar, volatile struct hba_port *port);
+    virtual ~disk();
 
     /* Allocate buffers and whatnot and reset the device */
-    void rebase();
+    bool rebase(void);
+
+    bool stop_cmd(void);
+    bool start_cmd(void);
+
+    // read or write `count` sectors starting at `sector`
+    bool rw(uint64_t sector, uint32_t count, void *buf, bool write);
+    // Send IDENTIFY DEVICE and configure the disk from the result
+    bool identify(void);
 
-    // read `count` sectors into dst
-    bool read(uint64_t sector, uint32_t count, void *dst);
+    /* Called with drive_lock held. Reap finished commands and handle errors */
+    void process_completions(void);
 
-    void stop_cmd(void);
-    void start_cmd(void);
+    // ^dev::BlockDevice
+    virtual int read_blocks(uint32_t sector, void *data, int n);
+    virtual int write_blocks(uint32_t sector, const void *data, int n);
+
+   private:
+    int alloc_slot(bool poll);
+    void free_slot(int slot);
+    bool setup_slot(int slot, uint8_t command, uint64_t lba, uint32_t count, void *buf, size_t bytes, bool write);
+    bool execute(int slot, bool poll);
   };
 
-  int /* minor */ register_disk(struct ahci::disk *);
-  struct ahci::disk *get_disk(int minor);
+
+  /* A host bus adapter and the disks attached to its ports */
+  struct hba {
+    pci::device *dev;
+    volatile struct hba_mem *abar;
+    // number of command slots per port
+    int nslots;
+    struct ahci::disk *ports[32];
+  };
 
   /* Initialize a SATA disk. impl in sata.cpp */
-  int init_sata(ck::box<struct ahci::disk>);
+  int init_sata(struct ahci::disk *);
 };  // namespace ahci
@@ -1,33 +1,298 @@
+#include <arch.h>
+#include <mem.h>
 #include <phys.h>
 #include <util.h>
 #include "ahci.h"
 
-int ahci::init_sata(ck::box<struct ahci::disk> disk) {
-  return -1;
-  AHCI_INFO("disk: %p\n", disk.get());
+#define ATA_CMD_IDENTIFY 0xEC
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
 
-  u64 clb = disk->port->clb | ((u64)disk->port->clbu << 32);
+#define ATA_DEV_LBA (1 << 6)
+
+// Largest transfer a single command will do. Keeps the PRDT (and the NCQ
+// sector count) comfortably in range
+#define AHCI_MAX_XFER_BYTES (512 * 1024)
+
+// A PRDT entry can describe at most 4MB, and the count must be even
+#define PRDT_MAX_BYTES (4 * 1024 * 1024)
+
+
+int ahci::init_sata(struct ahci::disk *disk) {
+  AHCI_INFO("disk: %p\n", disk);
 
   // initialize the port
-  disk->rebase();
+  if (!disk->rebase()) {
+    AHCI_INFO("failed to rebase port\n");
+    return -1;
+  }
+
+  if (!disk->identify()) {
+    AHCI_INFO("failed to identify disk\n");
+    return -1;
+  }
+
+  // Completions are interrupt driven from here on
+  disk->irq_ready = true;
+  dev::register_disk(disk);
+  return 0;
+}
+
+
+bool ahci::disk::identify(void) {
+  auto *id = (uint16_t *)phys::kalloc(1);
+  memset(id, 0, PGSIZE);
+
+  int slot = alloc_slot(true);
+  setup_slot(slot, ATA_CMD_IDENTIFY, 0, 0, id, 512, false);
+  bool ok = execute(slot, true);
+  if (!ok) {
+    phys::kfree(id, 1);
+    return false;
+  }
+
+  // ATA8-ACS 7.16 IDENTIFY DEVICE data
+  uint64_t sectors = id[60] | ((uint32_t)id[61] << 16);
+  if (id[83] & (1 << 10)) {
+    // 48 bit addressing
+    sectors = id[100] | ((uint64_t)id[101] << 16) | ((uint64_t)id[102] << 32) | ((uint64_t)id[103] << 48);
+  }
+
+  size_t sector_size = 512;
+  if ((id[106] & 0xC000) == 0x4000 && (id[106] & (1 << 12))) {
+    sector_size = 2 * (id[117] | ((uint32_t)id[118] << 16));
+  }
+
+  // NCQ needs both the HBA and the drive to support it
+  int depth = (id[75] & 0x1F) + 1;
+  ncq = (abar->cap & HBA_CAP_SNCQ) && (id[76] & (1 << 8));
+  if (ncq && depth < hba.nslots) {
+    // don't hand the drive more tags than it can queue
+    free_slots = (1U << depth) - 1;
+  }
+
+  AHCI_INFO("%llu sectors of %zu bytes, ncq: %s (depth %d)\n", sectors, sector_size, ncq ? "yes" : "no",
+            ncq ? min(depth, hba.nslots) : hba.nslots);
+
+  set_block_size(sector_size);
+  set_block_count(sectors);
+  set_size(sector_size * sectors);
+
+  phys::kfree(id, 1);
+  return true;
+}
+
+
+int ahci::disk::alloc_slot(bool poll) {
+  while (true) {
+    bool f = drive_lock.lock_irqsave();
+    if (free_slots != 0) {
+      int slot = __builtin_ctz(free_slots);
+      free_slots &= ~(1U << slot);
+      drive_lock.unlock_irqrestore(f);
+      return slot;
+    }
+
+    if (poll) {
+      process_completions();
+      drive_lock.unlock_irqrestore(f);
+      arch_relax();
+      continue;
+    }
+
+    struct wait_entry ent;
+    prepare_to_wait(slot_wq, ent, false);
+    drive_lock.unlock_irqrestore(f);
+    do_wait(ent);
+    finish_wait(slot_wq, ent);
+  }
+}
+
+
+void ahci::disk::free_slot(int slot) {
+  bool f = drive_lock.lock_irqsave();
+  free_slots |= (1U << slot);
+  drive_lock.unlock_irqrestore(f);
+  slot_wq.wake_up();
+}
+
+
+bool ahci::disk::setup_slot(int slot, uint8_t command, uint64_t lba, uint32_t count, void *buf, size_t bytes, bool write) {
+  auto *hdr = &cmd_list[slot];
+  auto *tbl = cmd_tables[slot];
+  memset(tbl, 0, sizeof(*tbl) - sizeof(tbl->prdt_entry));
 
-  auto cmd_hdr = disk->get_cmd_hdr();
-  auto cmd_table = disk->get_cmd_table();
+  // Build the scatter gather list, merging physically contiguous pages
+  int n = 0;
+  auto *p = (uint8_t *)buf;
+  size_t left = bytes;
+  while (left > 0) {
+    off_t pa = (off_t)v2p(p);
+    size_t chunk = min(left, PGSIZE - (pa & (PGSIZE - 1)));
 
-  for (int i = 0; i < cmd_hdr->prdtl; i++) {
-    auto &ent = cmd_table->prdt_entry[i];
-    u64 dba = ent.dba | ((u64)ent.dbau << 32);
-    void *buf = p2v(dba);
-    printf("%d: %p\n", i, dba);
-    hexdump(buf, ent.dbc, true);
-    printf("\n");
+    auto *prev = n > 0 ? &tbl->prdt_entry[n - 1] : nullptr;
+    off_t prev_end = prev ? (((off_t)prev->dbau << 32) | prev->dba) + prev->dbc + 1 : -1;
+    if (prev && prev_end == pa && prev->dbc + 1 + chunk <= PRDT_MAX_BYTES) {
+      prev->dbc += chunk;
+    } else {
+      if (n == AHCI_MAX_PRDT) return false;
+      auto &ent = tbl->prdt_entry[n++];
+      ent.dba = pa & 0xFFFFFFFF;
+      ent.dbau = (uint64_t)pa >> 32;
+      ent.dbc = chunk - 1;  // zero based
+      ent.i = 0;
+    }
+
+    p += chunk;
+    left -= chunk;
+  }
+
+  auto *fis = (ahci::fis::reg_h2d *)tbl->cfis;
+  fis->fis_type = FIS_TYPE_REG_H2D;
+  fis->c = 1;
+  fis->command = command;
+
+  if (command != ATA_CMD_IDENTIFY) {
+    fis->lba0 = lba & 0xFF;
+    fis->lba1 = (lba >> 8) & 0xFF;
+    fis->lba2 = (lba >> 16) & 0xFF;
+    fis->lba3 = (lba >> 24) & 0xFF;
+    fis->lba4 = (lba >> 32) & 0xFF;
+    fis->lba5 = (lba >> 40) & 0xFF;
+    fis->device = ATA_DEV_LBA;
+
+    if (command == ATA_CMD_READ_FPDMA_QUEUED || command == ATA_CMD_WRITE_FPDMA_QUEUED) {
+      // FPDMA commands put the sector count in the feature register and the tag in the count
+      fis->featurel = count & 0xFF;
+      fis->featureh = (count >> 8) & 0xFF;
+      fis->countl = slot << 3;
+    } else {
+      fis->countl = count & 0xFF;
+      fis->counth = (count >> 8) & 0xFF;
+    }
+  }
+
+  hdr->cfl = sizeof(ahci::fis::reg_h2d) / sizeof(uint32_t);
+  hdr->a = 0;
+  hdr->w = write ? 1 : 0;
+  hdr->prdtl = n;
+  hdr->prdbc = 0;
+  return true;
+}
+
+
+bool ahci::disk::execute(int slot, bool poll) {
+  auto &s = slots[slot];
+  bool queued = ncq && cmd_tables[slot]->cfis[2] != ATA_CMD_IDENTIFY;
+
+  bool f = drive_lock.lock_irqsave();
+  s.done = false;
+  s.error = false;
+  issued |= (1U << slot);
+  barrier();
+  // For NCQ, the tag must be marked active before the command is issued
+  if (queued) port->sact = (1U << slot);
+  port->ci = (1U << slot);
+  drive_lock.unlock_irqrestore(f);
+
+  if (poll) {
+    while (!s.done) {
+      f = drive_lock.lock_irqsave();
+      process_completions();
+      drive_lock.unlock_irqrestore(f);
+      if (!s.done) arch_relax();
+    }
+  } else {
+    while (!s.done) {
+      struct wait_entry ent;
+      prepare_to_wait(s.wq, ent, false);
+      if (!s.done) do_wait(ent);
+      finish_wait(s.wq, ent);
+    }
+  }
+  barrier();
+
+  bool ok = !s.error;
+  free_slot(slot);
+  return ok;
+}
+
+
+void ahci::disk::process_completions(void) {
+  uint32_t is = port->is;
+  port->is = is;
+
+  uint32_t failed = 0;
+  if (is & HBA_PxIS_ERROR) {
+    AHCI_INFO("port error: is=%08x tfd=%08x serr=%08x\n", is, port->tfd, port->serr);
+    // 6.2.2.1 Non-queued error recovery. Stopping the port clears CI and SACT,
+    // so everything that was outstanding has failed and has to be retried.
+    failed = issued;
+    stop_cmd();
+    port->serr = ~0U;
+    port->is = ~0U;
+    start_cmd();
   }
 
-  // char buf[512];
-  // memset(buf, 0, 512);
-  // disk->read(0, 1, buf);
-  // hexdump(buf, 512, true);
+  // Any issued command that the HBA no longer considers active has finished
+  uint32_t busy = port->ci | port->sact;
+  uint32_t finished = (issued & ~busy) | failed;
+
+  for (int i = 0; finished != 0; i++, finished >>= 1) {
+    if ((finished & 1) == 0) continue;
+    auto &s = slots[i];
+    s.error = (failed & (1U << i)) != 0;
+    issued &= ~(1U << i);
+    barrier();
+    s.done = true;
+    s.wq.wake_up_all();
+  }
+}
+
+
+bool ahci::disk::rw(uint64_t sector, uint32_t count, void *buf, bool write) {
+  bool poll = !irq_ready || !arch_irqs_enabled();
+  uint8_t command;
+  if (ncq) {
+    command = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+  } else {
+    command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+  }
+
+  auto *p = (uint8_t *)buf;
+  uint32_t max_sectors = AHCI_MAX_XFER_BYTES / block_size();
+
+  while (count > 0) {
+    uint32_t n = min(count, max_sectors);
+    size_t bytes = n * block_size();
+
+    int slot = alloc_slot(poll);
+    if (!setup_slot(slot, command, sector, n, p, bytes, write)) {
+      free_slot(slot);
+      return false;
+    }
+
+    if (!execute(slot, poll)) {
+      AHCI_INFO("%s of %u sectors at %llu failed\n", write ? "write" : "read", n, sector);
+      return false;
+    }
+
+    p += bytes;
+    sector += n;
+    count -= n;
+  }
+  return true;
+}
+
+
+int ahci::disk::read_blocks(uint32_t sector, void *data, int n) {
+  if (n <= 0) return false;
+  return rw(sector, n, data, false);
+}
 
-  AHCI_INFO("CLB=%p\n", clb);
-  return -1;
+int ahci::disk::write_blocks(uint32_t sector, const void *data, int n) {
+  if (n <= 0) return false;
+  return rw(sector, n, (void *)data, true);
 }
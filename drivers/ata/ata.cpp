@@ -47,6 +47,10 @@ static ck::ref<ATADriver> ata_driver = nullptr;
 #define ATA_IRQ2 (11)
 #define ATA_IRQ3 (9)
 
+// Larger requests are split. A DMA request is bounded by the size of the
+// bounce buffer, and PIO transfers wait for the drive before every sector
+#define ATA_DMA_MAX_SECTORS 64
+
 #define ATA_CMD_READ_PIO 0x20
 #define ATA_CMD_READ_DMA 0xC8
 #define ATA_CMD_WRITE_DMA 0xCA
@@ -220,6 +224,16 @@ bool dev::ATADisk::identify() {
 int dev::ATADisk::read_blocks(uint32_t sector, void* data, int n) {
   TRACE;
 
+  int max = use_dma ? ATA_DMA_MAX_SECTORS : 1;
+  if (n > max) {
+    for (int i = 0; i < n; i += max) {
+      // stop at the first chunk that fails, the rest would be reported as
+      // success otherwise
+      if (!read_blocks(sector + i, (char*)data + i * sector_size, min(max, n - i))) return false;
+    }
+    return true;
+  }
+
   // TODO: also check for scheduler avail
   if (use_dma) {
     return read_blocks_dma(sector, data, n);
@@ -230,7 +244,7 @@ int dev::ATADisk::read_blocks(uint32_t sector, void* data, int n) {
 
   // printf("read block %d\n", sector);
 
-  if (sector & 0xF0000000) return -EINVAL;
+  if (sector & 0xF0000000) return false;
 
 
   // select the correct device, and put bits of the address
@@ -261,12 +275,22 @@ int dev::ATADisk::read_blocks(uint32_t sector, void* data, int n) {
     buf[i + 1] = (d >> 8) & 0xFF;
   }
 
-  return 0;
+  return true;
 }
 
 int dev::ATADisk::write_blocks(uint32_t sector, const void* vbuf, int n) {
   TRACE;
 
+  int max = use_dma ? ATA_DMA_MAX_SECTORS : 1;
+  if (n > max) {
+    for (int i = 0; i < n; i += max) {
+      // stop at the first chunk that fails, the rest would be reported as
+      // success otherwise
+      if (!write_blocks(sector + i, (const char*)vbuf + i * sector_size, min(max, n - i))) return false;
+    }
+    return true;
+  }
+
   // TODO: also check for scheduler avail
   if (use_dma) {
     return write_blocks_dma(sector, vbuf, n);
@@ -278,7 +302,7 @@ int dev::ATADisk::write_blocks(uint32_t sector, const void* vbuf, int n) {
   scoped_lock lck(drive_lock);
 
 
-  if (sector & 0xF0000000) return -EINVAL;
+  if (sector & 0xF0000000) return false;
 
   // select the correct device, and put bits of the address
   device_port.out((master ? 0xE0 : 0xF0) | ((sector & 0x0F000000) >> 24));
@@ -299,9 +323,7 @@ int dev::ATADisk::write_blocks(uint32_t sector, const void* vbuf, int n) {
     data_port.out(d);
   }
 
-  flush();
-
-  return 0;
+  return flush();
 }
 
 bool dev::ATADisk::flush(void) {
@@ -348,6 +370,29 @@ u64 dev::ATADisk::sector_count(void) {
 
 
 
+/*
+ * The PRD table lives in the first page of the DMA buffer and the data in the
+ * pages after it. The buffer is physically contiguous, but a single PRD may not
+ * cross a 64K boundary, so the data is described by one entry per run that
+ * stays inside a 64K window. Returns the kernel address of the data.
+ */
+void* dev::ATADisk::setup_prdt(void* buffer, size_t len) {
+  auto* prdt = static_cast<prdt_t*>(p2v(buffer));
+  off_t data = (off_t)buffer + PGSIZE;
+
+  for (off_t pa = data, end = data + len; pa < end; prdt++) {
+    off_t boundary = (pa + 0x10000) & ~0xFFFFLL;
+    size_t run = min(end, boundary) - pa;
+    prdt->buffer_phys = pa;
+    // a size of 0 means 64K, which fits the field exactly
+    prdt->transfer_size = run & 0xFFFF;
+    prdt->mark_end = (pa + run == end) ? 0x8000 : 0;
+    pa += run;
+  }
+
+  return p2v(data);
+}
+
 bool dev::ATADisk::read_blocks_dma(uint32_t sector, void* data, int n) {
   TRACE;
 
@@ -357,15 +402,9 @@ bool dev::ATADisk::read_blocks_dma(uint32_t sector, void* data, int n) {
   scoped_lock lck(drive_lock);
 
 
-  int buffer_pages = NPAGES(n * block_size() + sizeof(prdt_t));
+  int buffer_pages = 1 + NPAGES(n * block_size());
   auto buffer = phys::alloc(buffer_pages);
-  // setup the prdt for DMA
-  auto* prdt = static_cast<prdt_t*>(p2v(buffer));
-  prdt->transfer_size = sector_size;
-  prdt->buffer_phys = (u64)buffer + sizeof(prdt_t);
-  prdt->mark_end = 0x8000;
-
-  uint8_t* dma_dst = (uint8_t*)p2v(prdt->buffer_phys);
+  uint8_t* dma_dst = (uint8_t*)setup_prdt(buffer, sector_size * n);
 
   // stop bus master
   outb(bmr_command, 0);
@@ -420,15 +459,9 @@ bool dev::ATADisk::write_blocks_dma(uint32_t sector, const void* data, int n) {
   if (sector & 0xF0000000) return false;
   drive_lock.lock();
 
-  int buffer_pages = NPAGES(n * block_size() + sizeof(prdt_t));
+  int buffer_pages = 1 + NPAGES(n * block_size());
   auto buffer = phys::alloc(buffer_pages);
-  // setup the prdt for DMA
-  auto* prdt = static_cast<prdt_t*>(p2v(buffer));
-  prdt->transfer_size = sector_size * n;
-  prdt->buffer_phys = (u64)buffer + sizeof(prdt_t);
-  prdt->mark_end = 0x8000;
-
-  uint8_t* dma_dst = (uint8_t*)p2v(prdt->buffer_phys);
+  uint8_t* dma_dst = (uint8_t*)setup_prdt(buffer, sector_size * n);
 
   // copy our data
   memcpy(dma_dst, data, sector_size * n);
@@ -90,6 +90,7 @@ namespace dev {
     virtual int read_blocks(uint32_t sector, void* data, int n);
     virtual int write_blocks(uint32_t sector, const void* data, int n);
 
+    void* setup_prdt(void* buffer, size_t len);
     bool read_blocks_dma(uint32_t sector, void* data, int n);
     bool write_blocks_dma(uint32_t sector, const void* data, int n);
 
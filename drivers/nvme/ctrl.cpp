@@ -1,9 +1,20 @@
 #include <cpu.h>
 #include <mem.h>
 #include <phys.h>
+#include <printf.h>
+#include <time.h>
+#include <util.h>
 #include <ck/vec.h>
 #include "nvme.h"
 
+#define LOG(...) PFXLOG(BLU "NVMe", __VA_ARGS__)
+
+// The deepest I/O queue we will create. Command ids are tracked in a 64 bit bitmap
+#define NVME_IO_QUEUE_DEPTH 64
+#define NVME_ADMIN_QUEUE_DEPTH 32
+// Cap a single transfer so the PRP list always fits in one page
+#define NVME_MAX_TRANSFER_PAGES 256
+
 static int ilog2(int x) {
   /*
    * Find the leftmost 1. Use a method that is similar to
@@ -21,109 +32,367 @@ static int ilog2(int x) {
 
 
 
-nvme::ctrl::ctrl(pci::device &dev) : dev(dev) {
-  dev.enable_bus_mastering();
+int nvme::queue_pair::process_completions(void) {
+  int found = 0;
 
-  /* Grab the mmio region from the bar0 of the pci device */
-  mmio = (volatile nvme::mmio *)p2v(dev.get_bar(0).addr);
-  printf(KERN_INFO "Found NVMe Controller at version %d.%d.%d\n", mmio->vs.mjr, mmio->vs.mnr, mmio->vs.ter);
-  printf(KERN_INFO "mqes:                      %d\n", mqes());
-  printf(KERN_INFO "timeout:                   %d\n", timeout());
-  printf(KERN_INFO "stride:                    %d\n", stride());
-  printf(KERN_INFO "command sets supported:    %d\n", css());
-  printf(KERN_INFO "Memory Page Size Minimum:  %d\n", mps_min());
-  printf(KERN_INFO "Memory Page Size Maximum:  %d\n", mps_max());
-  printf(KERN_INFO "Subsystem Reset Control:   %d\n", subsystem_reset_control());
-  printf(KERN_INFO "\n");
+  while (true) {
+    bool expect_phase;
+    auto *ent = (volatile nvme::cmpl *)&cq.at_head(found, expect_phase);
+    uint32_t dw3 = ent->cmp_dword[3];
+    if (NVME_CMP_DW3_P_GET(dw3) != expect_phase) break;
 
+    auto &req = reqs[NVME_CMP_DW3_CID_GET(dw3)];
+    req.result = ent->cmp_dword[0];
+    req.status = (NVME_CMP_DW3_SCT_GET(dw3) << 8) | NVME_CMP_DW3_SC_GET(dw3);
+    // The controller tells us how far it has consumed the submission queue
+    sq.take_until(NVME_CMP_DW2_SQHD_GET(ent->cmp_dword[2]));
 
+    barrier();
+    req.done = true;
+    req.wq.wake_up_all();
+    found++;
+  }
 
-  return;
-  /* idk, honestly */
-  size_t requested_queue_count = cpu::nproc() + 1;
+  // ring the head doorbell once for the whole batch
+  if (found) cq.take(found);
+  return found;
+}
 
 
-  // 7.6.1 Initialization
+int nvme::queue_pair::alloc_cid(bool poll) {
+  while (true) {
+    bool f = lock.lock_irqsave();
+    if (free_cids != 0) {
+      int cid = __builtin_ctzll(free_cids);
+      free_cids &= ~(1ULL << cid);
+      lock.unlock_irqrestore(f);
+      return cid;
+    }
+
+    if (poll) {
+      process_completions();
+      lock.unlock_irqrestore(f);
+      arch_relax();
+      continue;
+    }
+
+    struct wait_entry ent;
+    prepare_to_wait(cid_wq, ent, false);
+    lock.unlock_irqrestore(f);
+    do_wait(ent);
+    finish_wait(cid_wq, ent);
+  }
+}
 
-  // Enable bus master DMA, enable MMIO, disable port I/O
-  dev.adjust_ctrl_bits(PCI_CMD_BME | PCI_CMD_MSE, PCI_CMD_IOSE);
 
-  // Disable the controller
-  if (mmio->cc & NVME_CC_EN) mmio->cc = mmio->cc & ~NVME_CC_EN;
+void nvme::queue_pair::free_cid(int cid) {
+  bool f = lock.lock_irqsave();
+  free_cids |= (1ULL << cid);
+  lock.unlock_irqrestore(f);
+  cid_wq.wake_up();
+}
+
 
-  // 7.6.1 2) Wait for the controller to indicate that any previous
-  // reset is complete
-  while ((mmio->csts & NVME_CSTS_RDY) != 0)
-    arch_relax();
 
-  // Attempt to use 64KB/16KB submission/completion queue sizes
-  size_t queue_slots = 1024;
-  assert(queue_slots <= 4096);
-  size_t max_queue_slots = NVME_CAP_MQES_GET(mmio->cap) + 1;
+nvme::queue_pair *nvme::ctrl::create_queue_pair(uint16_t id, uint32_t depth) {
+  auto *qp = new nvme::queue_pair;
+  qp->id = id;
+  qp->depth = depth;
 
-  if (queue_slots > max_queue_slots) queue_slots = max_queue_slots;
+  auto sq_pages = NPAGES(depth * sizeof(nvme::cmd));
+  auto cq_pages = NPAGES(depth * sizeof(nvme::cmpl));
+  auto *sq = (nvme::cmd *)phys::kalloc(sq_pages);
+  auto *cq = (nvme::cmpl *)phys::kalloc(cq_pages);
+  memset(sq, 0, sq_pages * PGSIZE);
+  memset(cq, 0, cq_pages * PGSIZE);
 
-  // Size of one queue, in bytes
-  size_t queue_bytes = queue_slots * sizeof(nvme::cmd) + queue_slots * sizeof(nvme::cmpl);
+  // 3.1.16/17: SQ y tail doorbell is at index 2y, CQ y head doorbell is at 2y+1
+  qp->sq.init(sq, depth, nullptr, doorbell(2 * id), true);
+  qp->cq.init(cq, depth, doorbell(2 * id + 1), nullptr, true);
 
-  queue_count = 1;
-  queue_bytes *= requested_queue_count;
+  qp->reqs = new nvme::request[depth];
+  uint32_t ncids = min(depth - 1, 64);
+  qp->free_cids = ncids == 64 ? ~0ULL : (1ULL << ncids) - 1;
+  return qp;
+}
 
 
-  queue_memory_physaddr = (off_t)phys::alloc(round_up(queue_bytes, PGSIZE) / PGSIZE);
-  queue_memory = p2v(queue_memory_physaddr);
+int nvme::ctrl::submit(nvme::queue_pair &qp, nvme::cmd &cmd, uint32_t *result, bool poll) {
+  poll |= !irq_ready || !arch_irqs_enabled();
+  int cid = qp.alloc_cid(poll);
+  return execute(qp, cid, cmd, result, poll);
+}
 
-  // 7.6.1 3) Configure the Admin queue
-  mmio->aqa = NVME_AQA_ACQS_n(queue_slots) | NVME_AQA_ASQS_n(queue_slots);
 
+int nvme::ctrl::execute(nvme::queue_pair &qp, int cid, nvme::cmd &cmd, uint32_t *result, bool poll) {
+  auto &req = qp.reqs[cid];
+  req.done = false;
+  NVME_CMD_SDW0_CID_SET(cmd.hdr.cdw0, cid);
+
+  bool f = qp.lock.lock_irqsave();
+  qp.sq.enqueue(move(cmd));
+  qp.lock.unlock_irqrestore(f);
+
+  if (poll) {
+    while (!req.done) {
+      f = qp.lock.lock_irqsave();
+      qp.process_completions();
+      qp.lock.unlock_irqrestore(f);
+      if (!req.done) arch_relax();
+    }
+  } else {
+    while (!req.done) {
+      struct wait_entry ent;
+      prepare_to_wait(req.wq, ent, false);
+      if (!req.done) do_wait(ent);
+      finish_wait(req.wq, ent);
+    }
+  }
+  barrier();
+
+  int status = req.status;
+  if (result) *result = req.result;
+  qp.free_cid(cid);
+  return status;
+}
+
+
+bool nvme::ctrl::rw(uint32_t nsid, uint64_t lba, void *buf, uint32_t count, uint32_t block_size, bool write) {
+  if (!ready || io_queues.size() == 0) return false;
+
+  bool poll = !irq_ready || !arch_irqs_enabled();
+  // Each cpu gets its own queue, so there is (almost) never any contention
+  auto &qp = *io_queues[core_id() % io_queues.size()];
+  auto *p = (uint8_t *)buf;
+
+  while (count > 0) {
+    off_t page_off = (off_t)p & (PGSIZE - 1);
+    size_t max_bytes = max_transfer_pages * PGSIZE - page_off;
+    uint32_t n = min(count, max_bytes / block_size);
+    size_t bytes = n * block_size;
+
+    auto cmd = write ? nvme::cmd::create_write(lba, n, nsid, false) : nvme::cmd::create_read(lba, n, nsid);
+
+    int cid = qp.alloc_cid(poll);
+    auto &req = qp.reqs[cid];
+
+    // 4.3 Physical Region Page entries. The first entry may have an offset,
+    // every following entry must be page aligned
+    cmd.hdr.dptr.prpp[0].addr = (uintptr_t)v2p(p);
+    size_t first = min(bytes, PGSIZE - page_off);
+    if (bytes > first) {
+      size_t rest = bytes - first;
+      auto *next = p + first;
+      if (rest <= PGSIZE) {
+        cmd.hdr.dptr.prpp[1].addr = (uintptr_t)v2p(next);
+      } else {
+        if (req.prp_list == nullptr) req.prp_list = (uint64_t *)phys::kalloc(1);
+        int i = 0;
+        for (off_t o = 0; o < (off_t)rest; o += PGSIZE)
+          req.prp_list[i++] = (uint64_t)v2p(next + o);
+        cmd.hdr.dptr.prpp[1].addr = (uintptr_t)v2p(req.prp_list);
+      }
+    }
+
+    int status = execute(qp, cid, cmd, nullptr, poll);
+    if (status != 0) {
+      LOG("%s of %u blocks at lba %llu failed with status %03x\n", write ? "write" : "read", n, lba, status);
+      return false;
+    }
+
+    p += bytes;
+    lba += n;
+    count -= n;
+  }
+  return true;
+}
+
+
+void nvme::ctrl::handle_irq(void) {
+  // INTx is shared between every queue, so we have to look at all of them.
+  for (auto *qp : io_queues) {
+    qp->lock.lock();
+    qp->process_completions();
+    qp->lock.unlock();
+  }
+  admin->lock.lock();
+  admin->process_completions();
+  admin->lock.unlock();
+}
+
+
+static void nvme_irq_handler(int intr, reg_t *fr, void *data) {
+  auto *ctrl = (nvme::ctrl *)data;
+  ctrl->handle_irq();
+  irq::eoi(intr);
+}
+
+
+bool nvme::ctrl::create_io_queue(uint16_t id, uint32_t depth) {
+  auto *qp = create_queue_pair(id, depth);
+
+  // 5.3 the completion queue must exist before the submission queue that uses it.
+  // Everything shares interrupt vector 0 (INTx)
+  auto ccq = nvme::cmd::create_cmp_queue(qp->cq.data(), depth, id, 0);
+  if (int st = submit(*admin, ccq, nullptr, true); st != 0) {
+    LOG("failed to create completion queue %d: %03x\n", id, st);
+    return false;
+  }
+
+  auto csq = nvme::cmd::create_sub_queue(qp->sq.data(), depth, id, id, 0);
+  if (int st = submit(*admin, csq, nullptr, true); st != 0) {
+    LOG("failed to create submission queue %d: %03x\n", id, st);
+    return false;
+  }
+
+  io_queues.push(qp);
+  return true;
+}
 
-  // Submission queue address
-  mmio->asq = queue_memory_physaddr;
 
+void nvme::ctrl::probe_namespaces(uint32_t nn) {
+  auto *list = (uint32_t *)phys::kalloc(1);
+  auto *ns = (nvme::ident_ns *)phys::kalloc(1);
+  memset(list, 0, PGSIZE);
 
+  auto cmd = nvme::cmd::create_identify(list, IDENT_NS_LIST, 0);
+  if (submit(*admin, cmd, nullptr, true) != 0) {
+    // Pre 1.1 controllers don't have the active namespace list, so just try them all
+    for (uint32_t i = 0; i < min(nn, 1024); i++)
+      list[i] = i + 1;
+  }
+
+  for (int i = 0; i < 1024 && list[i] != 0; i++) {
+    uint32_t nsid = list[i];
+    memset(ns, 0, PGSIZE);
+    cmd = nvme::cmd::create_identify(ns, IDENT_NS, nsid);
+    if (submit(*admin, cmd, nullptr, true) != 0) continue;
+    if (ns->nsze == 0) continue;
+
+    auto &fmt = ns->lbaf[ns->flbas & 0xF];
+    size_t block_size = 1LU << fmt.lbads;
+    if (block_size < 512 || block_size > PGSIZE || fmt.ms != 0) {
+      LOG("namespace %u has an unsupported format (%zu byte blocks, %d byte metadata)\n", nsid, block_size, fmt.ms);
+      continue;
+    }
+
+    LOG("namespace %u: %llu blocks of %zu bytes\n", nsid, ns->nsze, block_size);
+    dev::register_disk(new nvme::Disk(*this, nsid, block_size, ns->nsze));
+  }
+
+  phys::kfree(list, 1);
+  phys::kfree(ns, 1);
+}
+
+
+
+nvme::ctrl::ctrl(pci::device &dev) : dev(dev) {
+  /* Grab the mmio region from the bar0 of the pci device */
+  mmio = (volatile nvme::mmio *)p2v(dev.get_bar(0).addr);
+  LOG("Found controller at version %d.%d.%d\n", mmio->vs.mjr, mmio->vs.mnr, mmio->vs.ter);
+  LOG("mqes: %d, timeout: %d, stride: %d, css: %d, mps: %d-%d\n", mqes(), timeout(), stride(), css(), mps_min(),
+      mps_max());
+
+  // 7.6.1 Initialization
+
+  // Enable bus master DMA, enable MMIO, disable port I/O and make sure INTx is on
+  dev.adjust_ctrl_bits(PCI_CMD_BME | PCI_CMD_MSE, PCI_CMD_IOSE | PCI_CMD_ID);
+
+  // CAP.TO is in 500ms units
+  auto wait_status = [&](uint32_t bits, uint32_t want) {
+    auto deadline = time::now_ms() + (timeout() + 1) * 500;
+    while ((mmio->csts & bits) != want) {
+      if (time::now_ms() > deadline) return false;
+      arch_relax();
+    }
+    return true;
+  };
+
+  // Disable the controller
+  if (mmio->cc & NVME_CC_EN) mmio->cc = mmio->cc & ~NVME_CC_EN;
+
+  // 7.6.1 2) Wait for the controller to indicate that any previous
+  // reset is complete
+  if (!wait_status(NVME_CSTS_RDY, 0)) {
+    LOG("controller did not reset\n");
+    return;
+  }
+
+  // Read the doorbell stride
+  doorbell_shift = NVME_CAP_DSTRD_GET(mmio->cap) + 1;
+
+  // 7.6.1 3) Configure the Admin queue
+  admin = create_queue_pair(0, NVME_ADMIN_QUEUE_DEPTH);
+  mmio->aqa = NVME_AQA_ACQS_n(NVME_ADMIN_QUEUE_DEPTH - 1) | NVME_AQA_ASQS_n(NVME_ADMIN_QUEUE_DEPTH - 1);
+  // Submission queue address
+  mmio->asq = (uint64_t)v2p(admin->sq.data());
   // 3.1.10 The vector for the admin queues is always 0
   // Completion queue address
-  mmio->acq = queue_memory_physaddr + (sizeof(nvme::cmd) * queue_slots * requested_queue_count);
+  mmio->acq = (uint64_t)v2p(admin->cq.data());
 
 
   // 7.6.1 4) The controller settings should be configured
   uint32_t cc =
       NVME_CC_IOCQES_n(ilog2(sizeof(nvme::cmpl))) | NVME_CC_IOSQES_n(ilog2(sizeof(nvme::cmd))) | NVME_CC_MPS_n(0) | NVME_CC_CCS_n(0);
-
-
-  // Try to enable weighted round robin with urgent
-  if (NVME_CAP_AMS_GET(mmio->cap) & 1) cc |= NVME_CC_AMS_n(1);
   mmio->cc = cc;
 
-
   // Set enable with a separate write
   cc |= NVME_CC_EN;
   mmio->cc = cc;
 
   // 7.6.1 4) Wait for ready
-  uint32_t ctrl_status;
-  while (!((ctrl_status = mmio->csts) & (NVME_CSTS_RDY | NVME_CSTS_CFS)))
-    arch_relax();
+  if (!wait_status(NVME_CSTS_RDY | NVME_CSTS_CFS, NVME_CSTS_RDY)) {
+    LOG("controller failed to become ready (csts=%08x)\n", mmio->csts);
+    return;
+  }
 
 
-  if (ctrl_status & NVME_CSTS_CFS) {
-    // Controller fatal status
-    printf("Controller fatal status!\n");
+  // Identify the controller to learn the max transfer size and namespace count
+  auto *ident = (nvme::ident_ctrl *)phys::kalloc(1);
+  memset(ident, 0, PGSIZE);
+  auto cmd = nvme::cmd::create_identify(ident, IDENT_CTRL, 0);
+  if (int st = submit(*admin, cmd, nullptr, true); st != 0) {
+    LOG("identify controller failed: %03x\n", st);
+    phys::kfree(ident, 1);
     return;
   }
 
-  // Read the doorbell stride
-  doorbell_shift = NVME_CAP_DSTRD_GET(mmio->cap) + 1;
+  // MDTS is a power of two in units of the minimum page size. 0 means no limit
+  max_transfer_pages = NVME_MAX_TRANSFER_PAGES;
+  if (ident->mdts != 0) max_transfer_pages = min(max_transfer_pages, (1LU << ident->mdts) << mps_min());
+  // We always need to be able to transfer a full (possibly unaligned) page
+  if (max_transfer_pages < 2) max_transfer_pages = 2;
+  uint32_t nn = ident->nn;
+  phys::kfree(ident, 1);
+
 
-  // 7.4 Initialize queues
+  // 5.21.1.7 Ask for one I/O queue pair per cpu. The controller tells us how many we got
+  size_t requested_queue_count = cpu::nproc();
+  uint32_t nq = 0;
+  cmd = nvme::cmd::create_setfeatures(requested_queue_count, requested_queue_count);
+  if (submit(*admin, cmd, &nq, true) != 0) nq = 0;
+  max_queues = min(NVME_CMP_SETFEAT_NQ_DW0_NSQA_GET(nq), NVME_CMP_SETFEAT_NQ_DW0_NCQA_GET(nq)) + 1;
 
-  // Initialize just the admin queue until we are sure about the
-  // number of supported queues
+  // queue depth must be a power of two for our ring masks
+  uint32_t depth = min(NVME_IO_QUEUE_DEPTH, mqes() + 1);
+  depth = 1 << ilog2(depth);
+
+  for (size_t i = 0; i < min(requested_queue_count, max_queues); i++) {
+    if (!create_io_queue(i + 1, depth)) break;
+  }
+  queue_count = io_queues.size() + 1;
+
+  if (io_queues.size() == 0) {
+    LOG("no I/O queues could be created\n");
+    return;
+  }
+  LOG("%zu I/O queues of depth %u, max transfer %zu pages\n", io_queues.size(), depth, max_transfer_pages);
 
-  // nvme::cmd *sub_queue_ptr = (nvme::cmd *)queue_memory;
-  // nvme::cmpl *cmp_queue_ptr = (nvme::cmpl *)(sub_queue_ptr + requested_queue_count *
-  // queue_slots);
+  ready = true;
 
+  // Completions from here on are interrupt driven
+  irq::install(dev.interrupt, nvme_irq_handler, "NVMe", (void *)this);
+  irq_ready = true;
 
-  // queues.reset(new (ext::nothrow) nvme_queue_state_t[requested_queue_count]);
+  probe_namespaces(nn);
 }
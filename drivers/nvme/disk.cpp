@@ -0,0 +1,25 @@
+#include <dev/driver.h>
+#include "nvme.h"
+
+DECLARE_STUB_DRIVER("nvme", nvme_driver)
+
+
+nvme::Disk::Disk(nvme::ctrl &ctrl, uint32_t nsid, size_t block_size, size_t block_count)
+    : dev::Disk(nvme_driver), m_ctrl(ctrl), m_nsid(nsid) {
+  set_block_size(block_size);
+  set_block_count(block_count);
+  set_size(block_size * block_count);
+}
+
+nvme::Disk::~Disk(void) {}
+
+
+int nvme::Disk::read_blocks(uint32_t sector, void *data, int n) {
+  if (n <= 0) return false;
+  return m_ctrl.rw(m_nsid, sector, data, n, block_size(), false);
+}
+
+int nvme::Disk::write_blocks(uint32_t sector, const void *data, int n) {
+  if (n <= 0) return false;
+  return m_ctrl.rw(m_nsid, sector, (void *)data, n, block_size(), true);
+}
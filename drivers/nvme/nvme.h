@@ -4,6 +4,9 @@
 #include <pci.h>
 #include <types.h>
 #include <wait.h>
+#include <lock.h>
+#include <asm.h>
+#include <dev/disk.h>
 #include "nvme.bits.h"
 
 #define NVME_VS(major, minor, tertiary) (((major) << 16) | ((minor) << 8) | (tertiary))
@@ -11,6 +14,48 @@
 
 namespace nvme {
 
+  // Command submission queue admin opcodes
+  enum struct admin_cmd_opcode : uint8_t {
+    delete_sq = 0x00,
+    create_sq = 0x01,
+    get_log_page = 0x02,
+    delete_cq = 0x04,
+    create_cq = 0x05,
+    identify = 0x06,
+    abort = 0x08,
+    set_features = 0x09,
+    get_features = 0x0A,
+    async_evnt_req = 0x0C,
+    firmware_commit = 0x10,
+    firmware_download = 0x11,
+    ns_attach = 0x15,
+    keep_alive = 0x18
+  };
+
+  // Command submission queue NVM opcodes
+  enum struct cmd_opcode : uint8_t {
+    flush = 0x00,
+    write = 0x01,
+    read = 0x02,
+    write_uncorrectable = 0x4,
+    compare = 0x05,
+    write_zeros = 0x08,
+    dataset_mgmt = 0x09,
+    reservation_reg = 0x0D,
+    reservation_rep = 0x0E,
+    reservation_acq = 0x11,
+    reservation_rel = 0x15
+  };
+
+  enum struct feat_id : uint8_t { num_queues = 0x07 };
+
+  // 5.15.2 Identify CNS values that we care about
+  enum ident_cns : uint8_t {
+    IDENT_NS = 0x00,
+    IDENT_CTRL = 0x01,
+    IDENT_NS_LIST = 0x02,
+  };
+
   /* A representation of the NVMe version */
   union version {
     uint32_t raw;
@@ -55,55 +100,6 @@ namespace nvme {
 
 
 
-  /* A kernel level representation of a controller */
-  struct ctrl {
-    /* Ideally, this would be abstracted and allow us to use fabrics, but I dont have that hardware
-     * so. */
-    pci::device &dev;
-    volatile nvme::mmio *mmio;
-    struct wait_queue wq;
-
-
-    // Queue count, including admin queue
-    size_t queue_count;
-    size_t max_queues;
-
-    off_t queue_memory_physaddr;
-    void *queue_memory;
-
-    size_t doorbell_shift;
-
-    ctrl(pci::device &dev);
-
-    /* Nice wrappers around the CAP field */
-    inline auto version(void) {
-      return mmio->vs.raw;
-    }
-    inline auto timeout(void) {
-      return NVME_CAP_TO_GET(mmio->cap);
-    }
-    inline auto mqes(void) {
-      return NVME_CAP_MQES_GET(mmio->cap);
-    }
-    inline auto stride(void) {
-      return NVME_CAP_DSTRD_GET(mmio->cap);
-    }
-    inline auto css(void) {
-      return NVME_CAP_CSS_GET(mmio->cap);
-    }
-    inline auto mps_min(void) {
-      return NVME_CAP_MPSMIN_GET(mmio->cap);
-    }
-    inline auto mps_max(void) {
-      return NVME_CAP_MPSMAX_GET(mmio->cap);
-    }
-    inline auto subsystem_reset_control(void) {
-      return NVME_CAP_NSSRS_GET(mmio->cap);
-    }
-  };
-
-
-
   // Scatter gather list
   struct sgl {
     char data[16];
@@ -144,24 +140,20 @@ namespace nvme {
     // cmd dwords 10 thru 15
     uint32_t cmd_dword_10[6];
 
-#if 0
     // 5.11 Identify command
-    static nvme::cmd create_identify(void *addr, uint8_t cns, uint8_t nsid);
+    static nvme::cmd create_identify(void *addr, uint8_t cns, uint32_t nsid);
     // Create a command that creates a submission queue
     static nvme::cmd create_sub_queue(void *addr, uint32_t size, uint16_t sqid, uint16_t cqid, uint8_t prio);
     // Create a command that creates a completion queue
     static nvme::cmd create_cmp_queue(void *addr, uint32_t size, uint16_t cqid, uint16_t intr);
     // Create a command that reads storage
-    static nvme::cmd create_read(uint64_t lba, uint32_t count, uint8_t ns);
+    static nvme::cmd create_read(uint64_t lba, uint32_t count, uint32_t ns);
     // Create a command that writes storage
-    static nvme::cmd create_write(uint64_t lba, uint32_t count, uint8_t ns, bool fua);
-    // Create a command that does a trim
-    static nvme::cmd create_trim(uint64_t lba, uint32_t count, uint8_t ns);
+    static nvme::cmd create_write(uint64_t lba, uint32_t count, uint32_t ns, bool fua);
     // Create a flush command
-    static nvme::cmd create_flush(uint8_t ns);
+    static nvme::cmd create_flush(uint32_t ns);
     // Create a command that sets the completion and submission queue counts
     static nvme::cmd create_setfeatures(uint16_t ncqr, uint16_t nsqr);
-#endif
   };
 
 
@@ -172,6 +164,52 @@ namespace nvme {
   };
 
 
+  /* 5.15.2.1 Identify Controller data structure (only the fields we use) */
+  struct ident_ctrl {
+    uint16_t vid;
+    uint16_t ssvid;
+    char sn[20];
+    char mn[40];
+    char fr[8];
+    uint8_t rab;
+    uint8_t ieee[3];
+    uint8_t cmic;
+    // Maximum data transfer size, in units of the minimum page size (2^n)
+    uint8_t mdts;
+    uint8_t reserved1[516 - 78];
+    // Number of namespaces
+    uint32_t nn;
+    uint8_t reserved2[4096 - 520];
+  } __attribute__((packed));
+
+
+  /* LBA format data structure */
+  struct lba_format {
+    uint16_t ms;
+    uint8_t lbads;
+    uint8_t rp;
+  } __attribute__((packed));
+
+
+  /* 5.15.2.2 Identify Namespace data structure (only the fields we use) */
+  struct ident_ns {
+    // Namespace size, in logical blocks
+    uint64_t nsze;
+    // Namespace capacity
+    uint64_t ncap;
+    // Namespace utilization
+    uint64_t nuse;
+    uint8_t nsfeat;
+    // Number of lba formats
+    uint8_t nlbaf;
+    // Formatted lba size
+    uint8_t flbas;
+    uint8_t reserved1[128 - 27];
+    nvme::lba_format lbaf[16];
+    uint8_t reserved2[4096 - 192];
+  } __attribute__((packed));
+
+
   template <typename T>
   struct queue {
    public:
@@ -281,7 +319,11 @@ namespace nvme {
 
       head = new_head;
 
-      if (head_doorbell) *head_doorbell = head;
+      if (head_doorbell) {
+        // make sure the controller sees the consumed entries before the doorbell
+        barrier();
+        *head_doorbell = head;
+      }
 
       return wrapped;
     }
@@ -292,7 +334,11 @@ namespace nvme {
 
       tail = new_tail;
 
-      if (tail_doorbell) *tail_doorbell = tail;
+      if (tail_doorbell) {
+        // the submission entry must be visible before the controller reads it
+        barrier();
+        *tail_doorbell = tail;
+      }
 
       return wrapped;
     }
@@ -308,4 +354,131 @@ namespace nvme {
 
 
 
+  /* An in-flight command. Indexed by the command id (cid) */
+  struct request {
+    volatile bool done = false;
+    // Status field from the completion entry (0 is success)
+    uint16_t status = 0;
+    // Command specific dword 0 from the completion entry
+    uint32_t result = 0;
+    struct wait_queue wq;
+
+    // A page used as the PRP list when a transfer spans more than two pages
+    uint64_t *prp_list = nullptr;
+  };
+
+
+  /* A submission queue and its completion queue. There is one of these per cpu */
+  struct queue_pair {
+    uint16_t id;
+    uint32_t depth;
+    nvme::queue<nvme::cmd> sq;
+    nvme::queue<nvme::cmpl> cq;
+
+    spinlock lock;
+    // bitmap of free command ids. We use at most `depth - 1` of them so the
+    // submission queue can never overflow
+    uint64_t free_cids = 0;
+    struct wait_queue cid_wq;
+    nvme::request *reqs = nullptr;
+
+    /* Reap every available completion entry, waking up the waiters. Returns how many were found */
+    int process_completions(void);
+    /* Allocate a command id, waiting for one to become free if none are available */
+    int alloc_cid(bool poll);
+    void free_cid(int cid);
+  };
+
+
+  /* A kernel level representation of a controller */
+  struct ctrl {
+    /* Ideally, this would be abstracted and allow us to use fabrics, but I dont have that hardware
+     * so. */
+    pci::device &dev;
+    volatile nvme::mmio *mmio;
+    struct wait_queue wq;
+
+
+    // Queue count, including admin queue
+    size_t queue_count;
+    size_t max_queues;
+
+    // queue 0 is the admin queue, the rest are I/O queues (one per cpu)
+    nvme::queue_pair *admin = nullptr;
+    ck::vec<nvme::queue_pair *> io_queues;
+
+    // maximum number of pages in a single I/O command
+    size_t max_transfer_pages = 1;
+    // have we installed an irq handler that can complete requests?
+    bool irq_ready = false;
+    // did the controller come up?
+    bool ready = false;
+
+    size_t doorbell_shift;
+
+    ctrl(pci::device &dev);
+
+    /* Submit a command to a queue and wait for it to complete. Returns the NVMe status field */
+    int submit(nvme::queue_pair &qp, nvme::cmd &cmd, uint32_t *result = nullptr, bool poll = false);
+    /* Like submit, but with a command id that was already allocated from the queue */
+    int execute(nvme::queue_pair &qp, int cid, nvme::cmd &cmd, uint32_t *result, bool poll);
+    /* Issue a read or write of `count` blocks at `lba`, splitting by max_transfer_pages */
+    bool rw(uint32_t nsid, uint64_t lba, void *buf, uint32_t count, uint32_t block_size, bool write);
+
+    /* Called from the interrupt handler, reaps completions from every queue */
+    void handle_irq(void);
+
+   private:
+    nvme::queue_pair *create_queue_pair(uint16_t id, uint32_t depth);
+    bool create_io_queue(uint16_t id, uint32_t depth);
+    void probe_namespaces(uint32_t nn);
+
+    inline volatile uint32_t *doorbell(int index) {
+      auto *base = (volatile uint32_t *)((char *)mmio + 0x1000);
+      return base + (index << (doorbell_shift - 1));
+    }
+
+   public:
+
+    /* Nice wrappers around the CAP field */
+    inline auto version(void) {
+      return mmio->vs.raw;
+    }
+    inline auto timeout(void) {
+      return NVME_CAP_TO_GET(mmio->cap);
+    }
+    inline auto mqes(void) {
+      return NVME_CAP_MQES_GET(mmio->cap);
+    }
+    inline auto stride(void) {
+      return NVME_CAP_DSTRD_GET(mmio->cap);
+    }
+    inline auto css(void) {
+      return NVME_CAP_CSS_GET(mmio->cap);
+    }
+    inline auto mps_min(void) {
+      return NVME_CAP_MPSMIN_GET(mmio->cap);
+    }
+    inline auto mps_max(void) {
+      return NVME_CAP_MPSMAX_GET(mmio->cap);
+    }
+    inline auto subsystem_reset_control(void) {
+      return NVME_CAP_NSSRS_GET(mmio->cap);
+    }
+  };
+
+
+  /* A single NVMe namespace exposed to the rest of the kernel as a disk */
+  class Disk : public dev::Disk {
+    nvme::ctrl &m_ctrl;
+    uint32_t m_nsid;
+
+   public:
+    Disk(nvme::ctrl &ctrl, uint32_t nsid, size_t block_size, size_t block_count);
+    virtual ~Disk();
+
+    virtual int read_blocks(uint32_t sector, void *data, int n);
+    virtual int write_blocks(uint32_t sector, const void *data, int n);
+  };
+
 };  // namespace nvme
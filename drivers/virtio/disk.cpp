@@ -82,7 +82,6 @@ int VirtioMMIODisk::disk_rw(uint32_t sector, void *data, int n, int write) {
 
   scoped_irqlock l(vdisk_lock);
 
-  assert(size == 512);
   struct virtio_blk_req req;
   req.sector = sector;
   req.reserved = 0;
@@ -52,10 +52,31 @@ typedef struct __ext2_dir_entry {
   /* name here */
 } __attribute__((packed)) ext2_dir;
 
+mutex ext2::filesystems_lock;
+ck::vec<ext2::FileSystem *> ext2::filesystems;
+
 ext2::FileSystem::FileSystem(void) { TRACE; }
 
 ext2::FileSystem::~FileSystem(void) {
   TRACE;
+  {
+    scoped_lock l(ext2::filesystems_lock);
+    for (int i = 0; i < ext2::filesystems.size(); i++) {
+      if (ext2::filesystems[i] == this) {
+        ext2::filesystems.remove(i);
+        break;
+      }
+    }
+  }
+
+  bglock.lock();
+  if (sb_dirty) write_superblock();
+  bglock.unlock();
+
+  for (auto *b : bitmaps)
+    if (b) bput(b);
+  if (gdt) bput(gdt);
+  if (sb_buf) bput(sb_buf);
 }
 
 bool ext2::FileSystem::probe(ck::ref<dev::BlockDevice> bdev) {
@@ -98,20 +119,48 @@ bool ext2::FileSystem::probe(ck::ref<dev::BlockDevice> bdev) {
 
   first_bgd = block_size == 1024 ? 2 : 1;
 
-  root = get_inode(2);
-
-  if (!write_superblock()) {
-    printf("failed to write superblock\n");
+  // the superblock lives 1024 bytes into the first block
+  sb_buf = bget(0);
+  gdt = bget(first_bgd);
+  if (sb_buf->data() == nullptr || gdt->data() == nullptr) {
+    printf("failed to read the block group descriptors\n");
     return false;
   }
+  for (uint32_t i = 0; i < blockgroups; i++) {
+    bitmaps.push(nullptr);
+    group_hint.push(0);
+  }
+
+  root = get_inode(2);
+
+  bglock.lock();
+  write_superblock();
+  bglock.unlock();
 
+  scoped_lock l(ext2::filesystems_lock);
+  ext2::filesystems.push(this);
   return true;
 }
 
 int ext2::FileSystem::write_superblock(void) {
-  // TODO: lock
-  disk->seek(1024, SEEK_SET);
-  return disk->write(&sb, 1024);
+  memcpy((char *)sb_buf->data() + 1024, &sb, 1024);
+  sb_buf->register_write();
+  sb_dirty = false;
+  return 1;
+}
+
+
+// Allocations only update the superblock in memory. Copy it into the buffer
+// cache before each writeback pass, so the counters reach the disk along
+// with the bitmaps that changed them. An allocator may be sleeping on I/O
+// with bglock held, so busy filesystems are left for the next pass.
+static void ext2_writeback_hook(void) {
+  scoped_lock l(ext2::filesystems_lock);
+  for (auto *efs : ext2::filesystems) {
+    if (!efs->bglock.try_lock()) continue;
+    if (efs->sb_dirty) efs->write_superblock();
+    efs->bglock.unlock();
+  }
 }
 
 bool ext2::FileSystem::read_inode(ext2_inode_info &dst, u32 inode) {
@@ -167,16 +216,10 @@ long ext2::FileSystem::allocate_inode(void) {
   int bgs = blockgroups;
   int res = -1;
 
-  // now that we have which BGF the inode is in, load that desc
-  auto first_bgd_bb = bref::get(*bdev, first_bgd);
-
-  // space for the bitmap (a little wasteful with memory, but fast)
-  //    (allocates a full page)
-
   int nfree = 0;
 
   for (int i = 0; i < bgs; i++) {
-    auto *bgd = (block_group_desc *)first_bgd_bb->data() + i;
+    auto *bgd = (block_group_desc *)gdt->data() + i;
 
     if (res == -1 && bgd->num_of_unalloc_inode > 0) {
       auto bitmap_bb = bref::get(*bdev, bgd->inode_bitmap);
@@ -191,8 +234,8 @@ long ext2::FileSystem::allocate_inode(void) {
       bitmap_bb->register_write();
       sb.unallocatedinodes--;
       bgd->num_of_unalloc_inode--;
-      first_bgd_bb->register_write();
-      write_superblock();
+      gdt->register_write();
+      sb_dirty = true;
       return res;
     }
 
@@ -204,66 +247,130 @@ long ext2::FileSystem::allocate_inode(void) {
 
 
 
-uint32_t ext2::FileSystem::balloc(void) {
-  scoped_lock l(bglock);
-
-  unsigned int block_no = 0;
-
-  auto first_bgd_bb = bref::get(*bdev, first_bgd);
-  auto *bgd = (block_group_desc *)first_bgd_bb->data();
-
-  auto blocks_in_group = sb.blocks_in_blockgroup;
+struct block::Buffer *ext2::FileSystem::group_bitmap(uint32_t bg) {
+  if (bitmaps[bg] == nullptr) {
+    auto *bgd = (block_group_desc *)gdt->data() + bg;
+    bitmaps[bg] = bget(bgd->block_bitmap);
+  }
+  return bitmaps[bg];
+}
 
 
-  for (uint32_t bg_idx = 0; bg_idx < blockgroups; bg_idx++) {
-    if (bgd[bg_idx].num_of_unalloc_block == 0) continue;
+uint32_t ext2::FileSystem::group_blocks(uint32_t bg) {
+  uint32_t first = bg * sb.blocks_in_blockgroup + sb.first_data_block;
+  return min(sb.blocks_in_blockgroup, sb.blocks - first);
+}
 
-    auto bgblk = bref::get(*bdev, bgd[bg_idx].block_bitmap);
-    auto bg_buffer = bgblk->data();
 
-    // hexdump(bg_buffer, block_size, true);
+// Find the first free bit at or after `from` in a group's bitmap, and take up
+// to `want` free bits from there. Returns the first bit, or -1 if the rest of
+// the group is full
+static long take_bits(uint32_t *words, uint32_t nbits, uint32_t from, uint32_t want, uint32_t &got) {
+  for (uint32_t w = from / 32; w * 32 < nbits; w++) {
+    uint32_t avail = ~words[w];
+    if (w == from / 32) avail &= ~0U << (from % 32);
+    if (avail == 0) continue;
+
+    uint32_t bit = w * 32 + __builtin_ctz(avail);
+    if (bit >= nbits) return -1;
+
+    got = 0;
+    while (got < want && bit + got < nbits) {
+      uint32_t b = bit + got;
+      uint32_t mask = 1U << (b % 32);
+      if (words[b / 32] & mask) break;
+      words[b / 32] |= mask;
+      got++;
+    }
+    return bit;
+  }
+  return -1;
+}
 
-    auto words = reinterpret_cast<uint32_t *>(bg_buffer);
 
-    for (int i = 0; i < (blocks_in_group + 31) / 32; i++) {
-      if (words[i] == 0xFFFFFFFF) continue;
+uint32_t ext2::FileSystem::balloc(uint32_t goal, uint32_t want, uint32_t *got) {
+  scoped_lock l(bglock);
 
-      for (int bit = 0; bit < 32; bit++) {
-        if (words[i] & (1 << bit)) continue;
+  auto *bgd = (block_group_desc *)gdt->data();
+  auto blocks_in_group = sb.blocks_in_blockgroup;
+  if (want == 0) want = 1;
 
-        block_no = (bg_idx * blocks_in_group) + (i * 32) + bit;
-        block_no += sb.first_data_block;
-        bgd[bg_idx].num_of_unalloc_block--;
-        sb.unallocatedblocks--;
+  uint32_t goal_group = 0;
+  uint32_t goal_bit = 0;
+  if (goal >= sb.first_data_block && goal < sb.blocks) {
+    goal_group = (goal - sb.first_data_block) / blocks_in_group;
+    goal_bit = (goal - sb.first_data_block) % blocks_in_group;
+  }
 
-        assert(block_no);
-        words[i] |= static_cast<uint32_t>(1) << bit;
+  // Look after the goal in its own group, then in every other group in
+  // turn, and finally in the part of the goal's group before the goal
+  for (uint32_t i = 0; i <= blockgroups; i++) {
+    uint32_t bg = (goal_group + i) % blockgroups;
+    if (bgd[bg].num_of_unalloc_block == 0) continue;
+
+    uint32_t from = max(i == 0 ? goal_bit : 0, group_hint[bg]);
+    auto *bitmap = group_bitmap(bg);
+    uint32_t n = 0;
+    long bit = take_bits((uint32_t *)bitmap->data(), group_blocks(bg), from, want, n);
+    if (bit < 0) continue;
+
+    // everything between the hint and what we found is in use
+    if (from == group_hint[bg]) group_hint[bg] = bit + n;
+
+    bgd[bg].num_of_unalloc_block -= n;
+    sb.unallocatedblocks -= n;
+    bitmap->register_write();
+    gdt->register_write();
+    sb_dirty = true;
+
+    if (got) *got = n;
+    return bg * blocks_in_group + bit + sb.first_data_block;
+  }
 
-        write_superblock();
+  printf(KERN_WARN "No Space left on disk\n");
+  if (got) *got = 0;
+  return 0;
+}
 
 
-        // clear out the new block we just allocated
-        // TODO: allow this to happen without reading the block
-        auto newblk = bref::get(*bdev, block_no);
-        memset(newblk->data(), 0x00, block_size);
+void ext2::FileSystem::bfree(uint32_t block, uint32_t count) {
+  scoped_lock l(bglock);
 
-        // register everything we've changed :^)
-        newblk->register_write();
-        first_bgd_bb->register_write();
-        bgblk->register_write();
+  auto *bgd = (block_group_desc *)gdt->data();
+  auto blocks_in_group = sb.blocks_in_blockgroup;
 
-        return block_no;
-      }
-      panic("Failed to find zero-bit");
+  for (uint32_t blk = block; blk < block + count; blk++) {
+    if (blk < sb.first_data_block || blk >= sb.blocks) {
+      printf(KERN_WARN "ext2: freeing block %u, which is out of range\n", blk);
+      continue;
     }
-  }
+    uint32_t bg = (blk - sb.first_data_block) / blocks_in_group;
+    uint32_t bit = (blk - sb.first_data_block) % blocks_in_group;
+
+    auto *bitmap = group_bitmap(bg);
+    auto *words = (uint32_t *)bitmap->data();
+    uint32_t mask = 1U << (bit % 32);
+    if ((words[bit / 32] & mask) == 0) {
+      printf(KERN_WARN "ext2: block %u freed twice\n", blk);
+      continue;
+    }
+    words[bit / 32] &= ~mask;
 
+    bgd[bg].num_of_unalloc_block++;
+    sb.unallocatedblocks++;
+    if (bit < group_hint[bg]) group_hint[bg] = bit;
+    bitmap->register_write();
+  }
 
-  printf(KERN_WARN "No Space left on disk\n");
-  return 0;
+  gdt->register_write();
+  sb_dirty = true;
 }
 
-void ext2::FileSystem::bfree(uint32_t block) {
+
+void ext2::FileSystem::zero_block(uint32_t block) {
+  auto b = bref::get(*bdev, block);
+  b->zero();
+  b->register_write();
 }
 
 bool ext2::FileSystem::read_block(u32 block, void *buf) {
@@ -278,14 +385,6 @@ bool ext2::FileSystem::write_block(u32 block, const void *buf) {
 
 ck::ref<fs::Node> ext2::FileSystem::get_root(void) { return root; }
 
-ck::ref<fs::Node> ext2::FileSystem::get_inode(u32 index) {
-  TRACE;
-  scoped_lock lck(m_lock);
-  if (inodes[index] == nullptr) {
-    inodes[index] = create_inode(index);
-  }
-  return inodes[index];
-}
 
 
 static ck::ref<fs::FileSystem> ext2_mount(ck::string args, int flags, ck::string device) {
@@ -311,6 +410,9 @@ static ck::ref<fs::FileSystem> ext2_mount(ck::string args, int flags, ck::string
   return filesystem;
 }
 
-static void ext2_init(void) { vfs::register_filesystem("ext2", ext2_mount); }
+static void ext2_init(void) {
+  vfs::register_filesystem("ext2", ext2_mount);
+  block::register_writeback_hook(ext2_writeback_hook);
+}
 
 module_init("fs::ext2", ext2_init);
@@ -0,0 +1,187 @@
+#include <fs/ext2.h>
+#include <module.h>
+#include <phys.h>
+
+/**
+ * The ext2 inode cache.
+ *
+ * Inodes are kept in EXT2_ICACHE_SHARDS hash maps, picked by inode number.
+ * The cache holds a reference to every inode in it, so an inode is unused
+ * when the cache's reference is the only one left. Unused inodes are evicted
+ * least recently used first, either when a shard grows past
+ * EXT2_ICACHE_SHARD_MAX or when the physical allocator runs low on memory.
+ *
+ * ext2 writes inode metadata back as soon as it changes (see flush_info), so
+ * every cached inode is clean and can be dropped without any I/O.
+ */
+
+static uint64_t icache_hits = 0;
+static uint64_t icache_misses = 0;
+static uint64_t icache_evictions = 0;
+
+
+static inline void icache_touch(ext2::FileSystem &efs, fs::Node *ino) {
+  static_cast<ext2::Node *>(ino)->icache_last_used = __atomic_add_fetch(&efs.icache_clock, 1, __ATOMIC_RELAXED);
+}
+
+
+ck::ref<fs::Node> ext2::FileSystem::get_inode(u32 index) {
+  auto &shard = icache[index % EXT2_ICACHE_SHARDS];
+
+  shard.lock.lock();
+  auto it = shard.inodes.find(index);
+  if (it != shard.inodes.end()) {
+    ck::ref<fs::Node> ino = it->value;
+    icache_touch(*this, ino.get());
+    shard.lock.unlock();
+    __atomic_add_fetch(&icache_hits, 1, __ATOMIC_RELAXED);
+    return ino;
+  }
+  shard.lock.unlock();
+
+  // read the inode without holding the shard lock
+  __atomic_add_fetch(&icache_misses, 1, __ATOMIC_RELAXED);
+  auto ino = create_inode(index);
+
+  shard.lock.lock();
+  auto raced = shard.inodes.find(index);
+  if (raced != shard.inodes.end()) {
+    // someone else read it in while we were
+    ino = raced->value;
+    shard.lock.unlock();
+    return ino;
+  }
+  icache_touch(*this, ino.get());
+  shard.inodes.set(index, ino);
+  bool over = shard.inodes.size() > EXT2_ICACHE_SHARD_MAX;
+  shard.lock.unlock();
+
+  // evict in chunks so the cost is spread over many misses
+  if (over) shrink_icache(EXT2_ICACHE_SHARD_MAX / 4);
+
+  return ino;
+}
+
+
+struct icache_victim {
+  u32 index;
+  uint64_t last_used;
+};
+
+static void sort_victims(ck::vec<icache_victim> &v) {
+  int n = v.size();
+  for (int gap = n / 2; gap > 0; gap /= 2) {
+    for (int i = gap; i < n; i++) {
+      auto tmp = v[i];
+      int j = i;
+      for (; j >= gap && tmp.last_used < v[j - gap].last_used; j -= gap)
+        v[j] = v[j - gap];
+      v[j] = tmp;
+    }
+  }
+}
+
+
+size_t ext2::FileSystem::shrink_icache(size_t count) {
+  // Directories pin every child that has been looked up in them. Drop those
+  // entries first, or nothing below the root could ever be evicted.
+  ck::vec<ck::ref<fs::Node>> dirs;
+  for (auto &shard : icache) {
+    shard.lock.lock();
+    for (auto &[index, ino] : shard.inodes) {
+      if (ino->is_dir()) dirs.push(ino);
+    }
+    shard.lock.unlock();
+  }
+
+  // Entries that a lookup is still holding stay alive until it lets go, and
+  // so does the inode they pin
+  ck::vec<ck::ref<fs::DirectoryEntry>> pruned;
+  for (auto &dir : dirs)
+    static_cast<ext2::DirectoryNode *>(dir.get())->prune(pruned);
+  pruned.clear();
+  dirs.clear();
+
+  // find the unused inodes, oldest first
+  ck::vec<icache_victim> victims;
+  for (auto &shard : icache) {
+    shard.lock.lock();
+    for (auto &[index, ino] : shard.inodes) {
+      // the root is also held by the filesystem
+      if (ino->ref_count() == 1) victims.push({index, static_cast<ext2::Node *>(ino.get())->icache_last_used});
+    }
+    shard.lock.unlock();
+  }
+  sort_victims(victims);
+
+  // inodes are destroyed outside of the shard locks
+  ck::vec<ck::ref<fs::Node>> dead;
+  for (auto &v : victims) {
+    if ((size_t)dead.size() >= count) break;
+    auto &shard = icache[v.index % EXT2_ICACHE_SHARDS];
+    shard.lock.lock();
+    auto it = shard.inodes.find(v.index);
+    // it might have been picked up again since we looked
+    if (it != shard.inodes.end() && it->value->ref_count() == 1) {
+      dead.push(it->value);
+      shard.inodes.remove(v.index);
+    }
+    shard.lock.unlock();
+  }
+
+  __atomic_add_fetch(&icache_evictions, dead.size(), __ATOMIC_RELAXED);
+  return dead.size();
+}
+
+
+void ext2::DirectoryNode::prune(ck::vec<ck::ref<fs::DirectoryEntry>> &retired) {
+  // we may be called while a lookup in this directory is reading an inode
+  if (!dir_lock.try_lock()) return;
+
+  ck::vec<ck::string> drop;
+  for (auto &[name, ent] : entries) {
+    if (ent->mount_shadow || !ent->ino) continue;
+    // "." and ".." form reference cycles, and are cheap to look up again
+    bool dots = name == "." || name == "..";
+    // the child is referenced by the inode cache and by this entry, and
+    // nobody else is holding the entry
+    if (dots || (ent->ref_count() == 1 && ent->ino->ref_count() == 2)) drop.push(name);
+  }
+
+  for (auto &name : drop) {
+    auto it = entries.find(name);
+    retired.push(move(it->value));
+    entries.remove(name);
+  }
+
+  dir_lock.unlock();
+}
+
+
+void ext2::get_icache_stats(struct ext2::icache_stats &st) {
+  st.cached = 0;
+  {
+    scoped_lock l(ext2::filesystems_lock);
+    for (auto *efs : ext2::filesystems) {
+      for (auto &shard : efs->icache)
+        st.cached += shard.inodes.size();
+    }
+  }
+  st.hits = __atomic_load_n(&icache_hits, __ATOMIC_RELAXED);
+  st.misses = __atomic_load_n(&icache_misses, __ATOMIC_RELAXED);
+  st.evictions = __atomic_load_n(&icache_evictions, __ATOMIC_RELAXED);
+}
+
+
+static size_t ext2_reclaim(void) {
+  size_t evicted = 0;
+  scoped_lock l(ext2::filesystems_lock);
+  for (auto *efs : ext2::filesystems)
+    evicted += efs->shrink_icache(~0UL);
+
+  return evicted * sizeof(ext2::FileNode);
+}
+
+static void ext2_icache_init(void) { phys::register_reclaimer(ext2_reclaim); }
+
+module_init("fs::ext2::icache", ext2_icache_init);
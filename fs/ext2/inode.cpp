@@ -12,6 +12,13 @@
 #define EXT2_TIND_BLOCK (EXT2_DIND_BLOCK + 1)
 #define EXT2_N_BLOCKS (EXT2_TIND_BLOCK + 1)
 
+// how many blocks to reserve ahead of a file that is being extended
+#define EXT2_PREALLOC_BLOCKS 8
+// how many extents each inode remembers
+#define EXT2_EXTENT_CACHE 16
+// the longest run of blocks map_blocks will look for
+#define EXT2_MAX_RUN 64
+
 
 ext2::Node &downcast(fs::Node &n) { return *(ext2::Node *)(&n); }
 
@@ -105,6 +112,9 @@ int block_from_index(fs::Node &_n, int i_block, int set_to = 0) {
         return -EIO;
       }
       node.cached_path[i] = off;
+      // the tables below this one were reached through a different block
+      for (int j = i + 1; j < 4; j++)
+        node.cached_path[j] = -1;
     }
     table = node.blk_bufs[i];
   }
@@ -112,6 +122,54 @@ int block_from_index(fs::Node &_n, int i_block, int set_to = 0) {
   return table[path[n - 1]];
 }
 
+// Map file block `lblk` to where it is on disk, and find how many blocks from
+// there on are contiguous (in `len`). Returns 0 if the block isn't mapped
+static uint32_t map_blocks(ext2::Node &node, uint32_t lblk, uint32_t &len) {
+  ext2::FileSystem *efs = static_cast<ext2::FileSystem *>(node.sb.get());
+  len = 0;
+
+  scoped_rsem m(node.map_lock);
+  {
+    scoped_lock l(node.extent_lock);
+    for (auto &e : node.extents) {
+      if (lblk >= e.lblk && lblk < e.lblk + e.len) {
+        len = e.len - (lblk - e.lblk);
+        return e.pblk + (lblk - e.lblk);
+      }
+    }
+  }
+
+  // walk the block pointers, but not past the end of the file
+  uint32_t nblocks = ceil_div((off_t)node.size(), (off_t)efs->block_size);
+  if (lblk >= nblocks) return 0;
+  uint32_t max = min(nblocks - lblk, EXT2_MAX_RUN);
+
+  int first = block_from_index(node, lblk);
+  if (first <= 0) return 0;
+  uint32_t n = 1;
+  while (n < max && (uint32_t)block_from_index(node, lblk + n) == first + n)
+    n++;
+
+  scoped_lock l(node.extent_lock);
+  // grow an extent that this one continues, or take a new slot
+  for (auto &e : node.extents) {
+    if (e.lblk + e.len == lblk && e.pblk + e.len == (uint32_t)first) {
+      e.len += n;
+      len = n;
+      return first;
+    }
+  }
+  ext2::Node::extent ext = {lblk, (uint32_t)first, n};
+  if (node.extents.size() < EXT2_EXTENT_CACHE) {
+    node.extents.push(ext);
+  } else {
+    node.extents[node.extent_next] = ext;
+    node.extent_next = (node.extent_next + 1) % EXT2_EXTENT_CACHE;
+  }
+  len = n;
+  return first;
+}
+
 static int access_block_path(fs::Node &ino, int n, int *path, ck::func<bool(uint32_t &)> cb) {
   ext2::FileSystem *efs = static_cast<ext2::FileSystem *>(ino.sb.get());
   auto &node = downcast(ino);
@@ -131,17 +189,18 @@ static int access_block_path(fs::Node &ino, int n, int *path, ck::func<bool(uint
 
   // make sure that the first index is valid as to avoid duplication of work
   if (info.block_pointers[path[0]] == 0) {
-    info.block_pointers[path[0]] = efs->balloc();
-    assert(info.block_pointers[path[0]]);
+    uint32_t blk = 0;
+    cb(blk);
+    assert(blk);
+    info.block_pointers[path[0]] = blk;
+    node.cached_path[0] = -1;
   }
 
-  // TODO: lock the path nonsense
-  // make sure the path bits are setup right.
-  for (int i = 0; i < n; i++) {
-    int off = path[i];
-    if (node.blk_bufs[i] == NULL || node.cached_path[i] != off) {
-      if (node.blk_bufs[i] == NULL) node.blk_bufs[i] = (int *)malloc(blocksize);
-      node.cached_path[i] = off;
+  // make sure there is somewhere to read each level of the path into
+  for (int i = 0; i < n - 1; i++) {
+    if (node.blk_bufs[i] == NULL) {
+      node.blk_bufs[i] = (int *)malloc(blocksize);
+      node.cached_path[i] = -1;
     }
   }
 
@@ -163,12 +222,14 @@ static int access_block_path(fs::Node &ino, int n, int *path, ck::func<bool(uint
   if (node.cached_path[0] != single_index) {
     efs->read_block(singly, single_block);
     node.cached_path[0] = single_index;
+    node.cached_path[1] = node.cached_path[2] = -1;
   }
 
 
   // make sure there is a block
   if (single_block[double_index] == 0) {
     if (cb(single_block[double_index])) efs->write_block(singly, single_block);
+    node.cached_path[1] = node.cached_path[2] = -1;
   }
 
   // Early return
@@ -179,12 +240,14 @@ static int access_block_path(fs::Node &ino, int n, int *path, ck::func<bool(uint
   if (node.cached_path[1] != double_index) {
     efs->read_block(doubly, double_block);
     node.cached_path[1] = double_index;
+    node.cached_path[2] = -1;
   }
 
 
   // make sure there is a block
   if (double_block[triple_index] == 0) {
     if (cb(double_block[triple_index])) efs->write_block(doubly, double_block);
+    node.cached_path[2] = -1;
   }
 
 
@@ -201,7 +264,6 @@ static int access_block_path(fs::Node &ino, int n, int *path, ck::func<bool(uint
 
   // make sure there is a block
   if (triple_block[path[3]] == 0) {
-    triple_block[path[3]] = efs->balloc();
     if (cb(triple_block[path[3]])) efs->write_block(triply, triple_block);
   }
 
@@ -215,19 +277,75 @@ static int access_block_path(fs::Node &ino, int n, int *path, ck::func<bool(uint
 }
 
 
-// TODO: used to add a single block to the end of a file
+// Where a new block of the file should go: right after the block before it,
+// or for the first block, at the start of the inode's block group
+static uint32_t block_goal(ext2::Node &node, int index) {
+  ext2::FileSystem *efs = static_cast<ext2::FileSystem *>(node.sb.get());
+  if (index > 0) {
+    int prev = block_from_index(node, index - 1);
+    if (prev > 0) return prev + 1;
+  }
+  uint32_t bg = (node.inode() - 1) / efs->sb.inodes_in_blockgroup;
+  return bg * efs->sb.blocks_in_blockgroup + efs->sb.first_data_block;
+}
+
+
+// Allocate a block for a file, zeroed. Files grow a block at a time, so
+// blocks are taken from the node's preallocation window while the file is
+// growing into it, and a new window is reserved at the goal when it is not.
+static uint32_t alloc_block(ext2::Node &node, uint32_t goal) {
+  ext2::FileSystem *efs = static_cast<ext2::FileSystem *>(node.sb.get());
+  uint32_t blk = 0;
+
+  node.prealloc_lock.lock();
+  if (node.prealloc_count > 0) {
+    // the window is no good if the file has moved away from it
+    if (goal > node.prealloc_start || node.prealloc_start - goal > EXT2_PREALLOC_BLOCKS) {
+      efs->bfree(node.prealloc_start, node.prealloc_count);
+      node.prealloc_count = 0;
+    }
+  }
+  if (node.prealloc_count == 0) {
+    uint32_t got = 0;
+    node.prealloc_start = efs->balloc(goal, EXT2_PREALLOC_BLOCKS, &got);
+    node.prealloc_count = got;
+  }
+  if (node.prealloc_count > 0) {
+    blk = node.prealloc_start++;
+    node.prealloc_count--;
+  }
+  node.prealloc_lock.unlock();
+
+  if (blk != 0) efs->zero_block(blk);
+  return blk;
+}
+
+
+void ext2::Node::discard_prealloc(void) {
+  ext2::FileSystem *efs = static_cast<ext2::FileSystem *>(sb.get());
+  scoped_lock l(prealloc_lock);
+  if (prealloc_count > 0) efs->bfree(prealloc_start, prealloc_count);
+  prealloc_count = 0;
+}
+
+
+// used to add a single block to the end of a file
 static int append_block(fs::Node &ino, int dest) {
   int path[4];
   memset(path, 0, 4 * 4);
   int n = block_to_path(&ino, dest, path);
 
+  auto &node = downcast(ino);
+  uint32_t goal = block_goal(node, dest);
 
-  ext2::FileSystem *efs = static_cast<ext2::FileSystem *>(ino.sb.get());
-
+  // indirect blocks are allocated on the way to the data block, and sit
+  // right before it on disk
   return access_block_path(ino, n, path, [&](uint32_t &dst) -> bool {
-    int blk = efs->balloc();
+    uint32_t blk = alloc_block(node, goal);
+    if (blk == 0) return false;
     if (dst) printf("%d becomes %d\n", dst, blk);
     dst = blk;
+    goal = blk + 1;
     // we wrote
     return true;
   });
@@ -235,9 +353,54 @@ static int append_block(fs::Node &ino, int dest) {
 
 
 
+// Remove the last block of a file, used for shrinking. Indirect blocks that
+// only held that block are freed as well
+static int pop_block(fs::Node &ino, int index) {
+  auto &node = downcast(ino);
+  ext2::FileSystem *efs = static_cast<ext2::FileSystem *>(ino.sb.get());
+  int ptrs = EXT2_ADDR_PER_BLOCK((&ino));
+
+  int path[4];
+  int n = block_to_path(&ino, index, path);
 
-// TODO: remove a block from the end of a file, used for shrinking
-static int pop_block(fs::Node &ino) { return 0; }
+  scoped_lock l(node.path_cache_lock);
+
+  // blocks[i] is the block pointed to by path[i], and tables[i] is the
+  // contents of blocks[i] if it is an indirect block
+  uint32_t blocks[4] = {0, 0, 0, 0};
+  uint32_t *tables = n > 1 ? (uint32_t *)malloc(efs->block_size * (n - 1)) : nullptr;
+
+  blocks[0] = node.info.block_pointers[path[0]];
+  for (int i = 1; i < n; i++) {
+    if (blocks[i - 1] == 0) break;
+    auto *table = tables + (i - 1) * ptrs;
+    efs->read_block(blocks[i - 1], table);
+    blocks[i] = table[path[i]];
+  }
+
+  // free from the data block up. Blocks are removed from the end, so a table
+  // is empty once its first entry is gone
+  for (int i = n - 1; i >= 0; i--) {
+    if (blocks[i]) efs->bfree(blocks[i]);
+    if (i == 0) {
+      node.info.block_pointers[path[0]] = 0;
+      break;
+    }
+    auto *table = tables + (i - 1) * ptrs;
+    table[path[i]] = 0;
+    if (path[i] != 0) {
+      efs->write_block(blocks[i - 1], table);
+      break;
+    }
+  }
+
+  // the cached tables no longer match the disk
+  for (int i = 0; i < 4; i++)
+    node.cached_path[i] = -1;
+
+  if (tables) free(tables);
+  return 0;
+}
 
 static int truncate(fs::Node &node, size_t new_size) {
   auto &ino = downcast(node);
@@ -271,10 +434,17 @@ static int truncate(fs::Node &node, size_t new_size) {
     }
 
   } else if (bafter < bbefore) {
-    // auto blocks_to_remove = bbefore - bafter;
-    // printf("need to remove %d\n", blocks_to_remove);
-    pop_block(ino);
-    return -ENOTIMPL;
+    // the page cache holds on to the blocks that are about to be freed
+    if (ino.is_file()) static_cast<ext2::FileNode &>(ino).pcache.truncate(bafter);
+    ino.discard_prealloc();
+    // map_blocks may not cache the blocks being freed until they are gone
+    scoped_wsem m(ino.map_lock);
+    ino.extent_lock.lock();
+    ino.extents.clear();
+    ino.extent_next = 0;
+    ino.extent_lock.unlock();
+    for (size_t i = bbefore; i > bafter; i--)
+      pop_block(ino, i - 1);
   }
 
   // :^)
@@ -308,15 +478,17 @@ static ssize_t ext2_raw_rw(fs::Node &node, char *buf, size_t sz, off_t offset, b
   auto bsize = efs->block_size;
 
   off_t first_blk_ind = offset / bsize;
-  off_t last_blk_ind = (offset + sz) / bsize;
   off_t offset_into_first_block = offset % bsize;
 
   auto *given_buf = (u8 *)buf;
 
   int remaining_count = min((off_t)sz, (off_t)ino.size() - offset);
 
-  for (int bi = first_blk_ind; remaining_count && bi <= last_blk_ind; bi++) {
-    u32 blk = block_from_index(ino, bi);
+  off_t bi = first_blk_ind;
+  while (remaining_count > 0) {
+    // find the next run of blocks that are contiguous on disk
+    uint32_t run = 0;
+    u32 blk = map_blocks(ino, bi, run);
     if (blk == 0) {
       int path[4];
       memset(path, 0, 4 * 4);
@@ -333,26 +505,36 @@ static ssize_t ext2_raw_rw(fs::Node &node, char *buf, size_t sz, off_t offset, b
     }
 
     int offset_into_block = (bi == first_blk_ind) ? offset_into_first_block : 0;
-    int num_bytes_to_copy = min(bsize - offset_into_block, remaining_count);
-
-
-    // load the buffer from the buffer cache
-    auto buf_bb = bref::get(*efs->bdev, blk);
-    auto *buf = (u8 *)buf_bb->data();
+    // only the part of the run that this request touches
+    run = min(run, ceil_div(offset_into_block + remaining_count, (int)bsize));
+
+    // Read the whole run into the buffer cache with one request. Writes
+    // only need to read the blocks they don't completely overwrite
+    if (!write && run > 1) block::read_pages(*efs->bdev, blk, run);
+
+    for (uint32_t j = 0; j < run; j++, bi++) {
+      int num_bytes_to_copy = min(bsize - offset_into_block, remaining_count);
+
+      // load the buffer from the buffer cache
+      auto buf_bb = bref::get(*efs->bdev, blk + j);
+
+      if (write) {
+        if (num_bytes_to_copy == (int)bsize && !buf_bb->present()) buf_bb->zero();
+        auto *buf = (u8 *)buf_bb->data();
+        // write to the buffer
+        memcpy(buf + offset_into_block, given_buf, num_bytes_to_copy);
+        buf_bb->register_write();
+      } else {
+        auto *buf = (u8 *)buf_bb->data();
+        // read from the buffer
+        memcpy(given_buf, buf + offset_into_block, num_bytes_to_copy);
+      }
 
-    if (write) {
-      // write to the buffer
-      memcpy(buf + offset_into_block, given_buf, num_bytes_to_copy);
-      buf_bb->register_write();
-    } else {
-      // read from the buffer
-      memcpy(given_buf, buf + offset_into_block, num_bytes_to_copy);
+      remaining_count -= num_bytes_to_copy;
+      nread += num_bytes_to_copy;
+      given_buf += num_bytes_to_copy;
+      offset_into_block = 0;
     }
-
-
-    remaining_count -= num_bytes_to_copy;
-    nread += num_bytes_to_copy;
-    given_buf += num_bytes_to_copy;
   }
   return nread;
 }
@@ -450,96 +632,172 @@ static int injest_info(fs::Node &node, ext2::ext2_inode_info &info) {
 }
 
 
-struct Ext2VMObject final : public mm::VMObject {
-  Ext2VMObject(ck::ref<fs::Node> ino, size_t npages, off_t off) : VMObject(npages) {
-    m_ino = ino;
-    m_off = off;
+int ext2::FileNode::seek_check(fs::File &, off_t old_off, off_t new_off) {
+  EXT_DEBUG("seek, %zu %zu\n", old_off, new_off);
+  return 0;  // allow seek
+}
+
+// Queue the blocks backing pages [start, start + npages) of the file to be
+// loaded into the buffer cache in the background
+static void ext2_readahead(ext2::FileNode &ino, off_t start, int npages) {
+  auto *efs = static_cast<ext2::FileSystem *>(ino.sb.get());
+  auto bsize = efs->block_size;
+
+  off_t first = (start * PGSIZE) / bsize;
+  off_t end = ceil_div((start + npages) * PGSIZE, (off_t)bsize);
+  end = min(end, ceil_div((off_t)ino.size(), (off_t)bsize));
+
+  for (off_t bi = first; bi < end;) {
+    uint32_t run = 0;
+    u32 blk = map_blocks(ino, bi, run);
+    if (blk == 0) break;
+    for (uint32_t j = 0; j < run && bi < end; j++, bi++)
+      block::prefetch(*efs->bdev, blk + j);
   }
+}
 
-  virtual ~Ext2VMObject(void) {
-    for (auto &kv : buffers) {
-      bput(kv.value);
-    }
-  };
+// Load the blocks behind a large read with as few requests as possible. The
+// page cache then finds them in the block cache
+static void ext2_load(ext2::FileNode &ino, off_t off, size_t count) {
+  if (count <= PGSIZE) return;
+
+  auto *efs = static_cast<ext2::FileSystem *>(ino.sb.get());
+  off_t end = ceil_div(off + count, (off_t)efs->block_size);
+  for (off_t bi = off / efs->block_size; bi < end;) {
+    uint32_t run = 0;
+    u32 blk = map_blocks(ino, bi, run);
+    if (blk == 0) break;
+    run = min(run, end - bi);
+    block::read_pages(*efs->bdev, blk, run);
+    bi += run;
+  }
+}
 
+void ext2::FileNode::prefetch(off_t index, size_t npages) { ext2_load(*this, index * PGSIZE, npages * PGSIZE); }
 
-  struct block::Buffer *bget(uint32_t n) {
-    scoped_lock l(m_lock);
+static void ext2_read_done(ext2::FileNode &ino, fs::File &f, off_t off, size_t nread) {
+  off_t ra_start;
+  int ra_pages;
+  if (f.ra.update(off, nread, ra_start, ra_pages)) ext2_readahead(ino, ra_start, ra_pages);
+}
 
-    struct block::Buffer *buf = buffers[n];
+ssize_t ext2::FileNode::pread(fs::File &f, char *buf, size_t count, off_t off) {
+  EXT_DEBUG("pread %p %zu\n", buf, count);
+  if (off >= (off_t)size()) return 0;
+  count = min(count, size() - off);
 
-    if (buf == NULL) {
-      ext2::FileSystem *efs = static_cast<ext2::FileSystem *>(m_ino->sb.get());
+  ext2_load(*this, off, count);
+  ssize_t nread = pcache.read(buf, count, off);
+  if (nread >= 0) ext2_read_done(*this, f, off, nread);
+  return nread;
+}
 
-      auto i_block = (m_off / efs->block_size) + ((n * PGSIZE) / efs->block_size);
-      int block = block_from_index(*m_ino, i_block);
+ssize_t ext2::FileNode::pwrite(fs::File &f, const char *buf, size_t count, off_t off) {
+  EXT_DEBUG("pwrite %p %zu\n", buf, count);
+  off_t end = off + count;
+  if ((off_t)size() < end) {
+    int err = truncate(*this, end);
+    if (err < 0) return err;
+  }
 
-      // we hold the buffer hostage and don't release it back till this region
-      // is destructed
-      buf = efs->bget(block);
-      buffers[n] = buf;
-    }
+  return pcache.write(buf, count, off);
+}
+
+ssize_t ext2::FileNode::read(fs::File &f, char *buf, size_t count) {
+  ssize_t nread = pread(f, buf, count, f.offset());
+  if (nread > 0) f.seek(nread, SEEK_CUR);
+  return nread;
+}
 
-    return buf;
+ssize_t ext2::FileNode::write(fs::File &f, const char *buf, size_t count) {
+  ssize_t nwrite = pwrite(f, buf, count, f.offset());
+  if (nwrite > 0) f.seek(nwrite, SEEK_CUR);
+  return nwrite;
+}
+
+// The vectored versions treat the segments as one span of the file, so a
+// large readv is loaded in one go and a writev extends the file only once
+ssize_t ext2::FileNode::readv(fs::File &f, const struct iovec *iov, int iovcnt, off_t off) {
+  bool advance = off == -1;
+  if (advance) off = f.offset();
+  if (off >= (off_t)size()) return 0;
+
+  size_t count = 0;
+  for (int i = 0; i < iovcnt; i++)
+    count += iov[i].iov_len;
+  count = min(count, size() - off);
+
+  ext2_load(*this, off, count);
+  size_t done = 0;
+  for (int i = 0; i < iovcnt && done < count; i++) {
+    size_t len = min(iov[i].iov_len, count - done);
+    ssize_t n = pcache.read(iov[i].iov_base, len, off + done);
+    if (n < 0) return done ? done : n;
+    done += n;
+    if ((size_t)n < len) break;
   }
 
-  // get a shared page (page #n in the mapping)
-  virtual ck::ref<mm::Page> get_shared(off_t n) override {
-    // printf("get_shared(%d)\n", n);
-    auto blk = bget(n);
+  ext2_read_done(*this, f, off, done);
+  if (advance && done > 0) f.seek(done, SEEK_CUR);
+  return done;
+}
 
-    // hexdump(blk->data(), PGSIZE, true);
+ssize_t ext2::FileNode::writev(fs::File &f, const struct iovec *iov, int iovcnt, off_t off) {
+  bool advance = off == -1;
+  if (advance) off = f.offset();
 
-    return blk->page();
+  size_t count = 0;
+  for (int i = 0; i < iovcnt; i++)
+    count += iov[i].iov_len;
+  if ((off_t)size() < off + (off_t)count) {
+    int err = truncate(*this, off + count);
+    if (err < 0) return err;
   }
 
-  virtual void flush(off_t n) override {
-    auto blk = bget(n);
-    // TODO: do this in a more async way (hand off to syncd or something)
-    blk->flush();
+  size_t done = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    ssize_t n = pcache.write(iov[i].iov_base, iov[i].iov_len, off + done);
+    if (n < 0) return done ? done : n;
+    done += n;
+    if ((size_t)n < iov[i].iov_len) break;
   }
 
+  if (advance && done > 0) f.seek(done, SEEK_CUR);
+  return done;
+}
+
+int ext2::FileNode::resize(fs::File &, size_t size) { return truncate(*this, size); }
 
- private:
-  // offset -> block
-  spinlock m_lock;
-  ck::map<uint32_t, block::Buffer *> buffers;
-  ck::ref<fs::Node> m_ino;
-  off_t m_off = 0;
-};
+// the file isn't being extended by this opener anymore
+void ext2::FileNode::close(fs::File &) { discard_prealloc(); }
 
+ext2::FileNode::~FileNode() {
+  // the cache pins buffers, so let them go while we still can
+  pcache.truncate(0);
+}
 
 
+ck::ref<mm::Page> ext2::FileNode::get_page(off_t index, bool fill, void *&priv) {
+  auto *efs = static_cast<ext2::FileSystem *>(sb.get());
 
-int ext2::FileNode::seek_check(fs::File &, off_t old_off, off_t new_off) {
-  EXT_DEBUG("seek, %zu %zu\n", old_off, new_off);
-  return 0;  // allow seek
-}
+  // blocks are the same size as pages
+  uint32_t run = 0;
+  u32 blk = map_blocks(*this, index, run);
+  if (blk == 0) return nullptr;
 
-ssize_t ext2::FileNode::read(fs::File &f, char *buf, size_t count) {
-  EXT_DEBUG("read %p %zu\n", buf, count);
-  ssize_t nread = ext2_raw_rw(*this, buf, count, f.offset(), false);
-  if (nread >= 0) {
-    f.seek(nread, SEEK_CUR);
-  }
-  return nread;
-}
-ssize_t ext2::FileNode::write(fs::File &f, const char *buf, size_t count) {
-  EXT_DEBUG("write %p %zu\n", buf, count);
-  ssize_t nwrite = ext2_raw_rw(*this, (char *)buf, count, f.offset(), true);
-  if (nwrite >= 0) {
-    f.seek(nwrite, SEEK_CUR);
-  }
-  return nwrite;
+  auto *buf = efs->bget(blk);
+  if (!fill && !buf->present()) buf->zero();
+  priv = buf;
+  return buf->page();
 }
 
-int ext2::FileNode::resize(fs::File &, size_t) {
-  UNIMPL();
-  return -ENOTIMPL;
-}
+void ext2::FileNode::dirty_page(off_t index, mm::Page &, void *priv) { ((block::Buffer *)priv)->register_write(); }
+
+void ext2::FileNode::put_page(off_t index, mm::Page &, void *priv) { bput((block::Buffer *)priv); }
 
 
 ext2::Node::~Node() {
+  discard_prealloc();
   for (int i = 0; i < 4; i++) {
     if (blk_bufs[i] != nullptr) {
       free(blk_bufs[i]);
@@ -552,69 +810,83 @@ ck::ref<mm::VMObject> ext2::FileNode::mmap(fs::File &f, size_t npages, int prot,
   // XXX: this is invalid, should be asserted before here :^)
   if (off & 0xFFF) return nullptr;
 
-  // if (flags & MAP_PRIVATE) printf("ext2 map private\n");
-  // if (flags & MAP_SHARED) printf("ext2 map shared\n");
-
-  return ck::make_ref<Ext2VMObject>(f.ino, npages, off);
+  return pcache.mmap(f.ino, npages, off);
 }
 
 
 
 
 void ext2::DirectoryNode::ensure(void) {
+  if (loaded) return;
   EXT_DEBUG("ensure\n");
-  if (entries.size() == 0) {
-    ext2::FileSystem *efs = static_cast<ext2::FileSystem *>(sb.get());
-    ext2_traverse_dir(*this, [&](uint32_t ino, const char *name) {
-      auto n = efs->get_inode(ino);
-      ck::string newname = name;
-      link(name, n);
-      EXT_DEBUG(" - %d: %s\n", ino, name);
-    });
-  }
+  ext2_traverse_dir(*this, [&](uint32_t ino, const char *name) {
+    names.set(name, ino);
+    EXT_DEBUG(" - %d: %s\n", ino, name);
+  });
+  loaded = true;
+}
+
+
+ck::ref<fs::DirectoryEntry> ext2::DirectoryNode::instantiate(const ck::string &name) {
+  auto e = entries.find(name);
+  if (e != entries.end()) return e->value;
+
+  auto n = names.find(name);
+  if (n == names.end()) return nullptr;
+
+  ext2::FileSystem *efs = static_cast<ext2::FileSystem *>(sb.get());
+  auto ino = efs->get_inode(n->value);
+  if (!ino) return nullptr;
+
+  ck::string newname = name;
+  auto ent = ck::make_ref<fs::DirectoryEntry>(newname, ino);
+  entries.set(name, ent);
+  return ent;
 }
 
 
 int ext2::DirectoryNode::touch(ck::string name, fs::Ownership &own) {
-  ensure();
   UNIMPL();
   return -ENOTIMPL;
 }
 
 int ext2::DirectoryNode::mkdir(ck::string name, fs::Ownership &own) {
-  ensure();
   UNIMPL();
   return -ENOTIMPL;
 }
 
 int ext2::DirectoryNode::unlink(ck::string name) {
-  ensure();
   UNIMPL();
   return -ENOTIMPL;
 }
 
-ck::vec<fs::DirectoryEntry *> ext2::DirectoryNode::dirents(void) {
+ck::vec<ck::ref<fs::DirectoryEntry>> ext2::DirectoryNode::dirents(void) {
   EXT_DEBUG("dirents\n");
+  scoped_lock l(dir_lock);
   ensure();
-  ck::vec<fs::DirectoryEntry *> res;
-  for (auto &[name, ent] : entries) {
-    res.push(ent.get());
+  // listing a directory hands out every entry, so they all need inodes
+  ck::vec<ck::ref<fs::DirectoryEntry>> res;
+  for (auto &[name, ino] : names) {
+    auto ent = instantiate(name);
+    if (ent) res.push(move(ent));
   }
   return res;
 }
 
-fs::DirectoryEntry *ext2::DirectoryNode::get_direntry(ck::string name) {
+ck::ref<fs::DirectoryEntry> ext2::DirectoryNode::get_direntry(ck::string name) {
   EXT_DEBUG("get_direntry %s\n", name.get());
+  scoped_lock l(dir_lock);
   ensure();
-  auto f = entries.find(name);
-  if (f == entries.end()) return nullptr;
-  return f->value.get();
+  return instantiate(name);
 }
 
 int ext2::DirectoryNode::link(ck::string name, ck::ref<fs::Node> node) {
   EXT_DEBUG("link %s\n", name.get());
-  if (entries.contains(name)) return -EEXIST;
-  auto ent = ck::make_box<fs::DirectoryEntry>(name, node);
+  scoped_lock l(dir_lock);
+  ensure();
+  if (names.contains(name)) return -EEXIST;
+  names.set(name, node->inode());
+  auto ent = ck::make_ref<fs::DirectoryEntry>(name, node);
   entries[name] = move(ent);
   return 0;
 }
@@ -6,6 +6,7 @@
 
 procfs::FileSystem::FileSystem(ck::string args, int flags) {
   /* TODO */
+  dcache = false;
 
   /* Create the root INODE */
   root = create_inode(T_DIR);
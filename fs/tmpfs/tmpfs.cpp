@@ -15,70 +15,50 @@ int tmpfs::FileNode::seek_check(fs::File &, off_t old_off, off_t new_off) {
   return 0;
 }
 
-ssize_t tmpfs::FileNode::read(fs::File &f, char *buf, size_t count) {
+ssize_t tmpfs::FileNode::pread(fs::File &f, char *buf, size_t count, off_t off) {
   scoped_lock l(m_lock);
-  return access(f, (void *)buf, count, false);
+  if (off >= (off_t)size()) return 0;
+  count = min(count, size() - off);
+
+  return m_pages.read(buf, count, off);
 }
 
 
-ssize_t tmpfs::FileNode::write(fs::File &f, const char *buf, size_t count) {
+ssize_t tmpfs::FileNode::pwrite(fs::File &f, const char *buf, size_t count, off_t off) {
   scoped_lock l(m_lock);
-  auto end = f.offset() + count;
+  auto end = off + count;
   // try to resize the file to have enough space
-  if (int err = resize_r(f, end); err != 0) {
-    return err;
+  if (end > size()) {
+    if (int err = resize_r(f, end); err != 0) {
+      return err;
+    }
   }
-  return access(f, (void *)buf, count, true);
-}
 
+  return m_pages.write(buf, count, off);
+}
 
-ssize_t tmpfs::FileNode::access(fs::File &f, void *dst, size_t size, bool write) {
-  if (this->size() == 0) return 0;
-
-  size_t byte_offset = f.offset();
-  long to_access = size;
-  // the offset within the current page
-  ssize_t offset = byte_offset % PGSIZE;
-
-  char *udata = (char *)dst;
-  // write(13)
-  // read(4096) -> read(13)
-  if (this->size() <= byte_offset + size) {
-    size = this->size() - byte_offset;  // ??
-  }
 
-  for (off_t blk = byte_offset / PGSIZE; to_access > 0; blk++) {
-    if (m_pages.size() < blk) break;
-    // get the block we are looking at.
-    auto page = get_page(blk);
-    if (!page) {
-      break;
-    }
-    auto data = (char *)p2v(page->pa());
+ssize_t tmpfs::FileNode::read(fs::File &f, char *buf, size_t count) {
+  auto did_access = pread(f, buf, count, f.offset());
+  if (did_access > 0) f.seek(did_access, SEEK_CUR);
+  return did_access;
+}
 
-    size_t space_left = PGSIZE - offset;
-    size_t can_access = min(space_left, to_access);
 
-    if (write) {
-      memcpy(data + offset, udata, can_access);
-      page->fset(PG_DIRTY);
-    } else {
-      memcpy(udata, data + offset, can_access);
-    }
+ssize_t tmpfs::FileNode::write(fs::File &f, const char *buf, size_t count) {
+  auto did_access = pwrite(f, buf, count, f.offset());
+  if (did_access > 0) f.seek(did_access, SEEK_CUR);
+  return did_access;
+}
 
-    // moving on to the next block, we reset the offset
-    offset = 0;
-    to_access -= can_access;
-    udata += can_access;
 
-    if (to_access <= 0) break;
-  }
+ck::ref<mm::Page> tmpfs::FileNode::get_page(off_t index, bool fill, void *&priv) {
+  if (index >= (off_t)(round_up(size(), PGSIZE) / PGSIZE)) return nullptr;
+  // pages come zeroed, which is what a new part of a file should read as
+  return mm::Page::alloc();
+}
 
-  auto did_access = size - to_access;
-  f.seek(did_access, SEEK_CUR);
 
-  return did_access;
-}
 int tmpfs::FileNode::resize(fs::File &file, size_t new_size) {
   scoped_lock l(m_lock);
   return resize_r(file, new_size);
@@ -89,70 +69,27 @@ int tmpfs::FileNode::resize_r(fs::File &file, size_t new_size) {
   // early return if the size doesn't need to change
   if (current_size == new_size) return 0;
 
-  auto old_page_count = round_up(current_size, 0x1000) >> 12;
-  auto new_page_count = round_up(new_size, 0x1000) >> 12;
-
-  if (new_page_count > old_page_count) {
-    auto delta = new_page_count - old_page_count;
-    ck::vec<ck::ref<mm::Page>> to_add;
-    for (int i = 0; i < delta; i++) {
-      auto page = mm::Page::alloc();
-      if (!page) {
-        return -ENOSPC;
-      }
-      to_add.push(page);
-    }
+  // pages are allocated as they are first used
+  if (new_size < current_size) {
+    m_pages.truncate(round_up(new_size, PGSIZE) / PGSIZE);
 
-    for (auto p : to_add) {
-      m_pages.push(p);
+    // clear what is left of the last page, in case the file grows again
+    if (new_size % PGSIZE) {
+      auto page = m_pages.get(new_size / PGSIZE);
+      if (page) memset((char *)p2v(page->pa()) + new_size % PGSIZE, 0, PGSIZE - new_size % PGSIZE);
     }
   }
-
-  if (new_page_count < old_page_count) {
-    m_pages.shrink(new_page_count);
-  }
   set_size(new_size);
   return 0;
 }
 
 
 
-struct TmpfsVMObject final : public mm::VMObject {
-  TmpfsVMObject(ck::ref<tmpfs::FileNode> ino, size_t npages, off_t off) : VMObject(npages) {
-    m_ino = ino;
-    m_off = off;
-  }
-
-  virtual ~TmpfsVMObject(void){};
-
-
-  // get a shared page (page #n in the mapping)
-  virtual ck::ref<mm::Page> get_shared(off_t n) override {
-    // printf("get_shared(%d)\n", n);
-    return m_ino->get_page(m_off + n);
-  }
-
-  virtual void flush(off_t n) override {}
-
-
- private:
-  // offset -> block
-  spinlock m_lock;
-  ck::ref<tmpfs::FileNode> m_ino;
-  off_t m_off = 0;
-};
-
-
-
 ck::ref<mm::VMObject> tmpfs::FileNode::mmap(fs::File &f, size_t npages, int prot, int flags, off_t off) {
-  printf("mmap!\n");
   // XXX: this is invalid, should be asserted before here :^)
   if (off & 0xFFF) return nullptr;
 
-  // if (flags & MAP_PRIVATE) printf("ext2 map private\n");
-  // if (flags & MAP_SHARED) printf("ext2 map shared\n");
-
-  return ck::make_ref<TmpfsVMObject>(f.ino, npages, off);
+  return m_pages.mmap(f.ino, npages, off);
 }
 
 
@@ -179,23 +116,23 @@ int tmpfs::DirNode::unlink(ck::string name) { return -ENOTIMPL; }
 
 ck::ref<fs::Node> tmpfs::DirNode::lookup(ck::string name) { return nullptr; }
 
-ck::vec<fs::DirectoryEntry *> tmpfs::DirNode::dirents(void) {
-  ck::vec<fs::DirectoryEntry *> res;
+ck::vec<ck::ref<fs::DirectoryEntry>> tmpfs::DirNode::dirents(void) {
+  ck::vec<ck::ref<fs::DirectoryEntry>> res;
   for (auto &[name, ent] : entries) {
-    res.push(ent.get());
+    res.push(ent);
   }
   return res;
 }
 
-fs::DirectoryEntry *tmpfs::DirNode::get_direntry(ck::string name) {
+ck::ref<fs::DirectoryEntry> tmpfs::DirNode::get_direntry(ck::string name) {
   auto f = entries.find(name);
   if (f == entries.end()) return nullptr;
-  return f->value.get();
+  return f->value;
 }
 
 int tmpfs::DirNode::link(ck::string name, ck::ref<fs::Node> node) {
   if (entries.contains(name)) return -EEXIST;
-  auto ent = ck::make_box<fs::DirectoryEntry>(name, node);
+  auto ent = ck::make_ref<fs::DirectoryEntry>(name, node);
   entries[name] = move(ent);
   return 0;
 }
@@ -2,6 +2,7 @@
 
 #include <types.h>
 #include <fs/Node.h>
+#include <list_head.h>
 #include <mm.h>
 
 
@@ -28,6 +29,9 @@ namespace block {
 
     // return the backing page data.
     void *data(void);
+    // fill the buffer with zeroes, without reading it from disk first. The
+    // caller still has to register_write()
+    void zero(void);
     off_t index(void);
     int flush(void);
     inline uint64_t last_used(void) { return m_last_used; }
@@ -37,11 +41,32 @@ namespace block {
 
     size_t reclaim(void);
 
+    // Write back dirty buffers in sorted batches. If `all` is false, only the
+    // buffers that have been dirty long enough are written (unless too much
+    // of memory is dirty). Returns the number of buffers written
+    static size_t writeback(bool all);
+
     inline bool dirty(void) { return m_dirty; }
+    // does this buffer have its data loaded? (this is just a hint)
+    inline bool present(void) { return m_page.get() != nullptr; }
+
+    // note that I/O for this buffer has been requested but not yet started,
+    // so the wait can be accounted as queue time on the device.
+    void queue_io(void);
+
+    // Load the buffers for consecutive pages of one device with a single
+    // request. Buffers that are already present are left alone
+    static void read_run(struct Buffer **run, int n);
+    // Write back the buffers for consecutive pages of one device with a
+    // single request
+    static void flush_run(struct Buffer **run, int n);
 
    protected:
     inline static void release(struct blkdev *d) {}
 
+    // take the buffer off the dirty list. m_lock must be held
+    void mark_clean(void);
+
     Buffer(dev::BlockDevice &, off_t);
 
     bool m_dirty = false;
@@ -51,12 +76,46 @@ namespace block {
     off_t m_index;
     uint64_t m_last_used = 0;
     ck::ref<mm::Page> m_page;
+
+    // linkage on the dirty list, and when (in ms) we were put on it.
+    // Both are protected by the dirty list lock
+    struct list_head m_dirty_link;
+    uint64_t m_dirtied_at = 0;
+
+    // when (in us) the pending I/O on this buffer was requested. 0 if none
+    uint64_t m_queued_at = 0;
   };
 
 
+  struct writeback_stats {
+    uint64_t dirty;      // buffers currently on the dirty list
+    uint64_t written;    // buffers written back to disk
+    uint64_t batches;    // writeback passes that wrote anything
+    uint64_t coalesced;  // writes to buffers that were already dirty
+    uint64_t syncs;      // explicit sync requests
+  };
+
+  void get_writeback_stats(struct writeback_stats &);
+
+
   size_t reclaim_memory(void);
+  // write back every dirty buffer, and wait for it to hit the disk
   void sync_all(void);
 
+  // Filesystems that batch metadata updates in memory (superblocks and the
+  // like) register a hook to copy them into the buffer cache. Hooks run at
+  // the start of every writeback pass
+  using writeback_hook = void (*)(void);
+  void register_writeback_hook(writeback_hook fn);
+
+  // Asynchronously load a page of a block device into the buffer cache.
+  // Does nothing if the page is already cached.
+  void prefetch(dev::BlockDevice &, off_t page);
+
+  // Load `count` pages of a block device starting at `page` into the buffer
+  // cache, reading each run of missing pages with one request
+  void read_pages(dev::BlockDevice &, off_t page, int count);
+
 };  // namespace block
 
 
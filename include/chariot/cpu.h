@@ -43,6 +43,7 @@ struct xcall_command {
 
 struct sleep_waiter;
 struct ThreadContext;
+struct rcu_head;
 
 
 namespace cpu {
@@ -61,7 +62,21 @@ namespace cpu {
     bool active = false;      // filled out by the arch's initialization routine
     bool in_sched = false;    // the CPU has reached the scheduler
     bool timekeeper = false;  // this CPU does timekeeping stuff.
+    // the depth of RCU read-side sections on this core, plus one while queued
+    // on a qspinlock. Not preemptible while nonzero
     uint64_t preempt_count = 0;
+
+    // qspinlock queue nodes, and how many of them are in use
+    struct mcs_node mcs_nodes[MCS_NODES];
+    int mcs_depth = 0;
+
+    // RCU state, see kernel/rcu.cpp. The last grace period this core passed
+    // through a quiescent state in, and its callbacks: `rcu_wait` is waiting
+    // for grace period `rcu_wait_seq` to end, `rcu_next` for one to start
+    unsigned long rcu_qs_seq = 0;
+    unsigned long rcu_wait_seq = 0;
+    struct rcu_head *rcu_wait = nullptr;
+    struct rcu_head *rcu_next = nullptr;
     rt::Scheduler local_scheduler;
 
     // the intrusive linked list into the list of all cores
@@ -98,7 +113,6 @@ namespace cpu {
   };
 
   extern struct list_head cores;
-  cpu::Core *get(void);
 
   Process *proc(void);
 
@@ -108,7 +122,9 @@ namespace cpu {
   /**
    * These functions are all implemented in the arch directory
    */
-  cpu::Core &current(void);
+  // the current core, or null if it hasn't been set up yet
+  cpu::Core *get(void);
+  inline cpu::Core &current(void) { return *get(); }
   // setup CPU segment descriptors, run once per cpu
   void seginit(cpu::Core *c, void *local = nullptr);
   void switch_vm(ck::ref<Thread>);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <dev/hardware.h>
+#include <iostat.h>
 #include <fs.h>
 #include <ck/ptr.h>
 #include <ck/string.h>
@@ -105,22 +106,50 @@ namespace dev {
     virtual void irq(int num) { printf("irq handler!\n"); }
 
 
-    static scoped_irqlock lock_names(void);
-    static ck::map<ck::string, ck::box<fs::DirectoryEntry>> &get_names(void);
+    static scoped_irqlock<spinlock> lock_names(void);
+    static ck::map<ck::string, ck::ref<fs::DirectoryEntry>> &get_names(void);
 
     // ^fs::Node
     bool is_dev(void) override final { return true; }
   };
 
 
+  struct io_stats {
+    uint64_t reads;          // completed read requests
+    uint64_t writes;         // completed write requests
+    uint64_t read_sectors;   // sectors read
+    uint64_t write_sectors;  // sectors written
+    uint64_t merges;         // writes absorbed by a buffer that was already dirty
+    int64_t in_flight;       // requests handed to the driver and not complete
+    // time from dispatching a request to the driver until it completes
+    uint64_t lat_hist[IOSTAT_BUCKETS];
+    // time a request waited between being created and being dispatched
+    uint64_t queue_hist[IOSTAT_BUCKETS];
+  };
+
+
   class BlockDevice : public dev::Device {
+    dev::io_stats m_io;
+    // I/O to a partition is also accounted to the disk it lives on
+    dev::BlockDevice *m_io_parent = nullptr;
+
    public:
     using dev::Device::Device;
     virtual ~BlockDevice() {}
+
+    // I/O accounting, done by the buffer cache around every request it sends
+    // to the driver. Times are from time::now_us()
+    void io_dispatch(void);
+    void io_complete(bool write, int sectors, uint64_t queued_at, uint64_t dispatched_at);
+    void io_merge(void);
+    void get_io_stats(dev::io_stats &out);
+    inline void set_io_parent(dev::BlockDevice *p) { m_io_parent = p; }
     // ^fs::Node
     bool is_blockdev(void) override final { return true; }
     ssize_t read(fs::File &, char *dst, size_t count) override final;
     ssize_t write(fs::File &, const char *, size_t) override final;
+    ssize_t pread(fs::File &, char *dst, size_t count, off_t off) override final;
+    ssize_t pwrite(fs::File &, const char *, size_t count, off_t off) override final;
 
     // nice wrappers for filesystems and all that :)
     inline int read_block(void *data, int block) { return read_blocks(block, data, 1); }
@@ -46,3 +46,6 @@
 #define F_GETOWN_EX 16
 
 #define F_GETOWNER_UIDS 17
+
+// splice() flags
+#define SPLICE_F_NONBLOCK 2
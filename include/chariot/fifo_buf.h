@@ -2,49 +2,71 @@
 
 #include <lock.h>
 #include <mem.h>
+#include <ck/ptr.h>
 #include <ck/single_list.h>
 #include <ck/vec.h>
 #include <wait.h>
 #include <awaitfs.h>
 #include <fs.h>
 
+// how many pages a fifo_buf can hold
+#define FIFO_SEGMENTS 16
+
+namespace mm {
+  struct Page;
+}
+
+/**
+ * A byte fifo, kept as a ring of page sized segments. Data is copied in and
+ * out a page at a time, so the lock is never held for more than one page
+ * worth of memcpy. A segment is either one of the fifo's own pages, or a
+ * reference to someone else's page that was queued by write_page().
+ *
+ * User buffers are copied through a bounce page outside of the lock, as a
+ * fault on them may have to sleep while the lock keeps interrupts off.
+ */
 class fifo_buf {
  public:
-  inline fifo_buf() { init_if_needed(); }
-  inline ~fifo_buf() {
-    if (buffer != NULL) free(buffer);
-  }
+  fifo_buf();
+  ~fifo_buf();
 
   ssize_t write(const void *, ssize_t, bool block = false);
   ssize_t read(void *, ssize_t, bool block = true, long long timeout_us = -1);
-  inline int size(void) { return unread(); }
+  // Queue `len` bytes of `page` (starting at `off`) without copying them. The
+  // reference is held until the bytes have been read, and readers see the
+  // page as it is then, so it should not be written to in the meantime
+  ssize_t write_page(ck::ref<mm::Page> page, size_t off, size_t len, bool block = true);
+  inline int size(void) { return m_unread; }
 
 
-  inline size_t buffer_size(void) { return m_size; }
+  inline size_t buffer_size(void) { return FIFO_SEGMENTS * PGSIZE; }
   void close();
   int poll(poll_table &pt);
   void stats(size_t &avail, size_t &unread);
 
  private:
-  void init_if_needed(void);
-
-  char *get_buffer(void);
+  struct segment {
+    // only set for pages that were queued with write_page
+    ck::ref<mm::Page> page;
+    char *data = nullptr;
+    uint16_t start = 0;
+    uint16_t end = 0;
+  };
 
   bool m_closed = false;
-  bool m_blocking;
-
 
   spinlock lock;
 
-  /*
-spinlock lock_write;
-spinlock lock_read;
-  */
+  // the fifo's own pages, and which of them aren't in a segment. They are
+  // only allocated by the first write(), so creating a fifo can't fail
+  char *m_pages = nullptr;
+  char *m_spare[FIFO_SEGMENTS];
+  int m_nspare = 0;
 
-  char *buffer;
-  size_t write_ptr = 0;
-  size_t read_ptr = 0;
-  size_t m_size;
+  segment m_segs[FIFO_SEGMENTS];
+  unsigned m_head = 0;
+  unsigned m_count = 0;
+  size_t m_unread = 0;
 
   struct wait_queue wq_readers;
   struct wait_queue wq_writers;
@@ -52,7 +74,17 @@ spinlock lock_read;
 
   size_t available(void);
   size_t unread(void);
-
-  void increment_read(void);
-  void increment_write(void);
+  // allocate m_pages if that hasn't happened yet. False if out of memory
+  bool alloc_pages(void);
+
+  // copy at most a page in or out. Both expect the lock to be held
+  size_t push(const char *src, size_t len);
+  size_t pop(char *dst, size_t len, ck::ref<mm::Page> &drop);
+  // wait on `wq` until the fifo is readable (or writable), or it is closed
+  wait_result wait_until(struct wait_queue &wq, bool readable);
+
+  // read() and write(). If `bounce` is set, the caller's buffer is only
+  // touched without the lock held, a page at a time through `bounce`
+  ssize_t do_write(const char *buf, ssize_t size, bool block, char *bounce);
+  ssize_t do_read(char *buf, ssize_t size, bool block, long long timeout_us, char *bounce);
 };
@@ -3,8 +3,26 @@
 #include <ck/ptr.h>
 #include <ck/map.h>
 #include <fs/Node.h>
+#include <rcu.h>
 
 namespace fs {
+
+  // Per-file sequential readahead state. Filesystems that read through the
+  // buffer cache feed every read into `update` and prefetch whatever window
+  // it hands back. The window grows while reads stay sequential and
+  // collapses as soon as they don't.
+  struct readahead_state {
+    // where the next read has to start to count as sequential
+    off_t next_off = 0;
+    // the most recently issued window, in pages
+    off_t start = 0;
+    int size = 0;
+
+    // Record a read of `len` bytes at `off`. Returns true if a new window of
+    // `ra_pages` pages starting at page `ra_start` should be prefetched
+    bool update(off_t off, size_t len, off_t &ra_start, int &ra_pages);
+  };
+
   // A `File` is an abstraction of all file-like objects
   // when they have been opened by a process. They are
   // basically just the backing structure referenced by
@@ -24,6 +42,12 @@ namespace fs {
     off_t seek(off_t offset, int whence = SEEK_SET);
     ssize_t read(void *, ssize_t);
     ssize_t write(void *data, ssize_t);
+    // positional and vectored I/O. These don't use or move the offset, except
+    // readv and writev with `off` == -1
+    ssize_t pread(void *, ssize_t, off_t off);
+    ssize_t pwrite(void *data, ssize_t, off_t off);
+    ssize_t readv(const struct iovec *iov, int iovcnt, off_t off = -1);
+    ssize_t writev(const struct iovec *iov, int iovcnt, off_t off = -1);
     int ioctl(int cmd, unsigned long arg);
     int stat(struct stat *stat) { return ino->stat(stat); }
     int close();
@@ -51,5 +75,20 @@ namespace fs {
     bool can_read = false;
 
     int pflags = 0;  // private flags. Also used to track ptmx id
+
+    fs::readahead_state ra;
+
+    // Process::get_fd looks files up without a lock, and may still be
+    // checking the refcount of one as the last reference goes away. The File
+    // is only destroyed after a grace period, so until then the count reads
+    // as zero and no new reference can be taken. Hides refcounted's version
+    void ref_release(void);
+    struct rcu_head rcu;
   };
+
+  // Move up to `len` bytes from `in` to `out` without going through
+  // userspace. An offset pointer means "start here and advance this instead
+  // of the file offset", just like the pointers to sendfile and splice.
+  // With SPLICE_F_NONBLOCK in `flags`, a full output pipe returns -EAGAIN
+  ssize_t splice(fs::File &in, off_t *in_off, fs::File &out, off_t *out_off, size_t len, unsigned flags = 0);
 }  // namespace fs
\ No newline at end of file
@@ -16,6 +16,9 @@ namespace fs {
     ck::ref<fs::Node> root;
     ck::string arguments;
     rwlock lock;
+    // can the vfs cache name lookups in this filesystem? Filesystems whose
+    // names change without going through the vfs must clear this
+    bool dcache = true;
   };
 
 }  // namespace fs
\ No newline at end of file
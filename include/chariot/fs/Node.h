@@ -7,6 +7,7 @@
 #include <errno.h>
 #include <lock.h>
 #include <ck/map.h>
+#include <uio.h>
 
 #define T_INVA 0
 #define T_DIR 1
@@ -38,15 +39,19 @@ namespace net {
 namespace devfs {
   class DirectoryNode;
 }
+class fifo_buf;
 
 namespace fs {
   // More forward declarations
   class Node;
   class File;
   class FileSystem;
+  class PageCache;
 
   // A DirectoryNode has many DirectoryEntries, which give fs::Nodes names.
-  struct DirectoryEntry {
+  // They are refcounted, so a filesystem can drop one from its directory
+  // while a lookup is still holding it.
+  struct DirectoryEntry : public ck::refcounted<DirectoryEntry> {
     DirectoryEntry(ck::string &name, ck::ref<fs::Node> ino) : name(name), ino(ino) {}
     ck::string name;
     ck::ref<fs::Node> ino;
@@ -92,6 +97,10 @@ namespace fs {
     // be placed here.
     ck::ref<net::Socket> bound_socket;
 
+    // Bumped (under the dcache lock) whenever a name in this directory is
+    // invalidated. See vfs::dcache_generation
+    uint32_t dcache_gen = 0;
+
     Node(ck::ref<fs::FileSystem> sb);
     virtual ~Node();
 
@@ -102,6 +111,15 @@ namespace fs {
     virtual ssize_t read(fs::File &file, char *buf, size_t sz);
     // Write some bytes
     virtual ssize_t write(fs::File &file, const char *buf, size_t sz);
+    // Read or write some bytes at `off`, without using or moving the file's
+    // offset. Nodes that can't seek (pipes, sockets, ttys...) don't implement these
+    virtual ssize_t pread(fs::File &file, char *buf, size_t sz, off_t off);
+    virtual ssize_t pwrite(fs::File &file, const char *buf, size_t sz, off_t off);
+    // Read or write many segments in one call. `off` is where to start, or -1
+    // to go through the file offset like read and write do. By default, each
+    // segment is handled on its own, stopping at the first short transfer
+    virtual ssize_t readv(fs::File &file, const struct iovec *iov, int iovcnt, off_t off);
+    virtual ssize_t writev(fs::File &file, const struct iovec *iov, int iovcnt, off_t off);
     // Implement ioctl functionality that is specific to the Node
     virtual int ioctl(fs::File &file, unsigned int cmd, off_t arg);
     // Notify the fs::Node implementation that it has been opened into a fs::File instance
@@ -116,6 +134,12 @@ namespace fs {
     virtual int seek_check(fs::File &file, off_t old_off, off_t new_off);
     // Populate a poll_table for usage with the `poll` systemcall
     virtual int poll(fs::File &file, int events, poll_table &pt);
+    // The page cache holding the node's data, if it has one. splice and
+    // sendfile copy straight out of it
+    virtual fs::PageCache *page_cache(void) { return nullptr; }
+    // The fifo that writes to this file end up in, if it is backed by one.
+    // splice queues page references in it instead of copying
+    virtual fifo_buf *write_fifo(fs::File &file) { return nullptr; }
 
 
     //
@@ -131,10 +155,9 @@ namespace fs {
     ck::ref<fs::Node> lookup(ck::string name);
     virtual int mknod(ck::string name, fs::Ownership &, int major, int minor) { return -EINVAL; }
     // Get a list of the directory entires in this directory.
-    virtual ck::vec<DirectoryEntry *> dirents(void) { return {}; }
-    // get a dirent (return null if it doesn't exist). It is assumed `lock` is held
-    // while the parent holds the borrowed DirectoryEntry.
-    virtual DirectoryEntry *get_direntry(ck::string name) { return nullptr; }
+    virtual ck::vec<ck::ref<DirectoryEntry>> dirents(void) { return {}; }
+    // get a dirent (return null if it doesn't exist)
+    virtual ck::ref<DirectoryEntry> get_direntry(ck::string name) { return nullptr; }
     // Link a Node as a DirectoryEntry (used for linking ".." and ".")
     virtual int link(ck::string name, ck::ref<fs::Node> node) { return -EINVAL; }
 
@@ -149,8 +172,8 @@ namespace fs {
     virtual bool is_tty(void) { return false; }       // TTYNode
 
     // Lock the fs::Node and return a scoped_*lock to ensure release at some point
-    scoped_lock lock(void) { return m_lock; }
-    scoped_irqlock irq_lock(void) { return m_lock; }
+    scoped_lock<spinlock> lock(void) { return m_lock; }
+    scoped_irqlock<spinlock> irq_lock(void) { return m_lock; }
 
 
     // Getters and setters for various fields. These are basically just
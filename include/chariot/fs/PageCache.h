@@ -0,0 +1,98 @@
+#pragma once
+
+#include <ck/map.h>
+#include <ck/ptr.h>
+#include <fs/Node.h>
+#include <list_head.h>
+#include <lock.h>
+#include <mm.h>
+
+namespace fs {
+
+  /**
+   * fs::PageCache - the pages holding a file's data, by page number in the file
+   *
+   * read(), write() and every mapping of the file go through the cache, so a
+   * page of a file is only ever in memory once, no matter how many processes
+   * read or map it. Where the pages come from, and how writes get to the disk,
+   * is up to the filesystem that owns the cache (see Backing).
+   *
+   * Clean pages that are not mapped anywhere are dropped when memory is low.
+   */
+  class PageCache {
+   public:
+    struct Backing {
+      // Return the page that holds page `index` of the file, or nullptr if
+      // there is no such page. If `fill` is false, the caller is going to
+      // overwrite all of it, so it doesn't need to be read. `priv` is handed
+      // back when the cache is done with the page
+      virtual ck::ref<mm::Page> get_page(off_t index, bool fill, void *&priv) = 0;
+      // The page was written to. Send it on its way to the disk
+      virtual void dirty_page(off_t index, mm::Page &page, void *priv) {}
+      // The cache has let go of the page
+      virtual void put_page(off_t index, mm::Page &page, void *priv) {}
+      // `npages` pages starting at `index` are about to be read. Load them
+      // in as few requests as possible, if that is cheaper than one by one
+      virtual void prefetch(off_t index, size_t npages) {}
+    };
+
+    // Pages that only live in memory (tmpfs) must never be dropped, so those
+    // caches are not `evictable`
+    PageCache(Backing &backing, bool evictable = true);
+    ~PageCache(void);
+
+    // Page `index` of the file, loaded in if needed. If `fill` is false, the
+    // caller will overwrite all of it.
+    ck::ref<mm::Page> get(off_t index, bool fill = true);
+    // note that page `index` was written to
+    void dirty(off_t index);
+    // drop every page from `index` on, when the file shrinks
+    void truncate(off_t index);
+    // Drop the pages nobody is using, writing back any that were dirtied
+    // through a mapping. Returns how many went
+    size_t shrink(void);
+    // how many pages are cached
+    size_t size(void);
+    // hint that pages `index` to `index + npages` will be read soon
+    void prefetch(off_t index, size_t npages) { backing.prefetch(index, npages); }
+
+    // Copy data between the file and a buffer. The caller has already made
+    // sure the range is inside the file. Returns how many bytes were copied
+    ssize_t read(void *dst, size_t count, off_t off);
+    ssize_t write(const void *src, size_t count, off_t off);
+
+    // A VMObject that maps pages of the file, starting at byte `off`. The
+    // VMObject keeps `owner` (which holds the cache) alive
+    ck::ref<mm::VMObject> mmap(ck::ref<fs::Node> owner, size_t npages, off_t off);
+
+    // every evictable page cache, for reclaim. Protected by a lock in pagecache.cpp
+    struct list_head cache_link;
+
+   private:
+    struct entry {
+      ck::ref<mm::Page> page;
+      void *priv = nullptr;
+      // the references held on the page when nobody is using it: ours, and
+      // whatever the backing holds
+      int idle_refs = 0;
+    };
+
+    // give an entry back to the backing. The lock must not be held
+    void put(off_t index, entry &e);
+
+    Backing &backing;
+    bool evictable;
+    spinlock lock;
+    ck::map<off_t, entry> pages;
+  };
+
+
+  struct pcache_stats {
+    uint64_t cached;     // pages in page caches right now
+    uint64_t hits;       // lookups that found the page cached
+    uint64_t misses;     // lookups that went to the filesystem
+    uint64_t evictions;  // pages dropped to free memory
+  };
+  void get_pcache_stats(struct pcache_stats &);
+
+}  // namespace fs
@@ -17,14 +17,14 @@ namespace devfs {
 
 		// Explicit entries. All device nodes are included as entries dynamically
 		// and do not live in this map. This map is mostly for . and ..
-    ck::map<ck::string, ck::box<fs::DirectoryEntry>> entries;
+    ck::map<ck::string, ck::ref<fs::DirectoryEntry>> entries;
 
     virtual int touch(ck::string name, fs::Ownership &);
     virtual int mkdir(ck::string name, fs::Ownership &);
     virtual int unlink(ck::string name);
     virtual ck::ref<fs::Node> lookup(ck::string name);
-    virtual ck::vec<fs::DirectoryEntry *> dirents(void);
-    virtual fs::DirectoryEntry *get_direntry(ck::string name);
+    virtual ck::vec<ck::ref<fs::DirectoryEntry>> dirents(void);
+    virtual ck::ref<fs::DirectoryEntry> get_direntry(ck::string name);
     virtual int link(ck::string name, ck::ref<fs::Node> node);
   };
 
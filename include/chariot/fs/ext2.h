@@ -3,8 +3,10 @@
 
 #include <dev/disk.h>
 #include <fs.h>
+#include <fs/PageCache.h>
 #include <ck/func.h>
 #include <lock.h>
+#include <mutex.h>
 #include <ck/map.h>
 #include <ck/vec.h>
 #include "types.h"
@@ -89,24 +91,68 @@ namespace ext2 {
    public:
     using fs::Node::Node;
     ext2::ext2_inode_info info;
-    spinlock path_cache_lock;
+    // when this inode was last looked up in the inode cache
+    uint64_t icache_last_used = 0;
+    // held across the disk reads and block allocation that fill the path cache
+    mutex path_cache_lock;
     int cached_path[4] = {0, 0, 0, 0};
     int *blk_bufs[4] = {NULL, NULL, NULL, NULL};
+
+    // Blocks allocated ahead of an extending write, so the file stays
+    // contiguous on disk. They are marked used in the bitmap, but not yet
+    // part of the file
+    mutex prealloc_lock;
+    uint32_t prealloc_start = 0;
+    uint32_t prealloc_count = 0;
+    // give any preallocated blocks back to the filesystem
+    void discard_prealloc(void);
+
+    // Runs of file blocks that are contiguous on disk, so reads and writes
+    // don't have to walk the indirect blocks for every block. Filled in as
+    // blocks are mapped, and dropped when the file shrinks
+    struct extent {
+      uint32_t lblk;  // first block in the file
+      uint32_t pblk;  // where it is on disk
+      uint32_t len;
+    };
+    spinlock extent_lock;
+    ck::vec<extent> extents;
+    int extent_next = 0;  // the slot to replace when the cache is full
+    // Held for reading while blocks are mapped and for writing while the file
+    // shrinks, so a lookup can't put an extent for a freed block back in
+    rwsem map_lock;
+
     virtual ~Node(void);
   };
 
-  class FileNode : public ext2::Node {
+  class FileNode : public ext2::Node, public fs::PageCache::Backing {
    public:
     using ext2::Node::Node;
-    virtual ~FileNode() {}
+    virtual ~FileNode();
     virtual bool is_file(void) final { return true; }
 
+    // The file's data. Blocks are the same size as pages, so each page in
+    // the cache is the page of a pinned buffer in the block cache
+    fs::PageCache pcache{*this};
+
+    // ^fs::PageCache::Backing
+    ck::ref<mm::Page> get_page(off_t index, bool fill, void *&priv) override;
+    void dirty_page(off_t index, mm::Page &, void *priv) override;
+    void put_page(off_t index, mm::Page &, void *priv) override;
+    void prefetch(off_t index, size_t npages) override;
+
     // ^fs::Node
     int seek_check(fs::File &, off_t old_off, off_t new_off) override;
     ssize_t read(fs::File &, char *dst, size_t count) override;
     ssize_t write(fs::File &, const char *, size_t) override;
+    ssize_t pread(fs::File &, char *dst, size_t count, off_t off) override;
+    ssize_t pwrite(fs::File &, const char *, size_t count, off_t off) override;
+    ssize_t readv(fs::File &, const struct iovec *iov, int iovcnt, off_t off) override;
+    ssize_t writev(fs::File &, const struct iovec *iov, int iovcnt, off_t off) override;
     int resize(fs::File &, size_t) override;
+    void close(fs::File &) override;
     ck::ref<mm::VMObject> mmap(fs::File &, size_t npages, int prot, int flags, off_t off) override;
+    fs::PageCache *page_cache(void) override { return &pcache; }
   };
 
 
@@ -116,21 +162,59 @@ namespace ext2 {
     virtual ~DirectoryNode() {}
     virtual bool is_dir(void) final { return true; }
 
-    ck::map<ck::string, ck::box<fs::DirectoryEntry>> entries;
+    // Every name in the directory and the inode number it refers to. This is
+    // read from disk the first time the directory is used, without touching
+    // any of the inodes it names.
+    ck::map<ck::string, uint32_t> names;
+    bool loaded = false;
+
+    // The entries that have been looked up, and so have an fs::Node behind
+    // them. Inodes are only instantiated on demand.
+    ck::map<ck::string, ck::ref<fs::DirectoryEntry>> entries;
+
+    // protects names, loaded and entries. Held across the disk reads that
+    // fill them, so it sleeps
+    mutex dir_lock;
 
-    // Entries are loaded lazily. this method does that.
+    // Names are loaded lazily. this method does that. dir_lock must be held
     void ensure(void);
+    // find or create the entry for a name. dir_lock must be held
+    ck::ref<fs::DirectoryEntry> instantiate(const ck::string &name);
+    // drop cached entries so the inodes they pin can be evicted from the
+    // inode cache. The removed entries are handed back in `retired`, so they
+    // are released outside of dir_lock
+    void prune(ck::vec<ck::ref<fs::DirectoryEntry>> &retired);
 
 
     // ^fs::Node
     int touch(ck::string name, fs::Ownership &) override;
     int mkdir(ck::string name, fs::Ownership &) override;
     int unlink(ck::string name) override;
-    ck::vec<fs::DirectoryEntry *> dirents(void) override;
-    fs::DirectoryEntry *get_direntry(ck::string name) override;
+    ck::vec<ck::ref<fs::DirectoryEntry>> dirents(void) override;
+    ck::ref<fs::DirectoryEntry> get_direntry(ck::string name) override;
     int link(ck::string name, ck::ref<fs::Node> node) override;
   };
 
+  // Inode cache counters, summed over every mounted ext2 filesystem
+  struct icache_stats {
+    uint64_t cached;     // inodes in the cache right now
+    uint64_t hits;       // lookups that found the inode cached
+    uint64_t misses;     // lookups that had to read the inode from disk
+    uint64_t evictions;  // inodes dropped from the cache
+  };
+  void get_icache_stats(struct icache_stats &);
+  // Every mounted filesystem, so caches can be shrunk when memory is low and
+  // batched superblock updates can be written back. Implemented in ext2.cpp
+  extern mutex filesystems_lock;
+  extern ck::vec<ext2::FileSystem *> filesystems;
+
+
+  // The inode cache is split into shards by inode number, so lookups of
+  // different inodes don't all contend on one lock
+#define EXT2_ICACHE_SHARDS 16
+  // a shard evicts unused inodes once it holds more than this
+#define EXT2_ICACHE_SHARD_MAX 256
+
   class FileSystem final : public fs::FileSystem {
    public:
     struct [[gnu::packed]] superblock {
@@ -229,10 +313,15 @@ namespace ext2 {
 
     inline struct block::Buffer *bget(uint32_t block) { return ::bget(*bdev, block); }
 
-    uint32_t balloc(void);
-    void bfree(uint32_t);
+    // Allocate up to `want` contiguous blocks, starting as close after
+    // `goal` as possible. Returns the first block (0 if the disk is full),
+    // and how many were allocated in `got`. New blocks are not zeroed
+    uint32_t balloc(uint32_t goal = 0, uint32_t want = 1, uint32_t *got = nullptr);
+    void bfree(uint32_t block, uint32_t count = 1);
+    // fill a block with zeroes in the buffer cache, without reading it first
+    void zero_block(uint32_t block);
 
-    // update the disk copy of the superblock
+    // copy the superblock into the buffer cache. bglock must be held
     int write_superblock(void);
 
     long allocate_inode(void);
@@ -240,12 +329,26 @@ namespace ext2 {
     superblock sb;
 
 
-    // lock the block groups
-    spinlock bglock;
+    // lock the block groups. Held across bitmap reads from the disk
+    mutex bglock;
 
     // how many blockgroups are in the filesystem
     uint32_t blockgroups = 0;
 
+    // The superblock, descriptor table and block bitmaps are pinned in the
+    // buffer cache while mounted. Changes to the in memory superblock set
+    // `sb_dirty`, and are copied out at the next writeback instead of on
+    // every allocation. All protected by bglock
+    struct block::Buffer *sb_buf = nullptr;
+    struct block::Buffer *gdt = nullptr;
+    ck::vec<struct block::Buffer *> bitmaps;
+    // there are no free blocks below this bit in each group
+    ck::vec<uint32_t> group_hint;
+    bool sb_dirty = false;
+    struct block::Buffer *group_bitmap(uint32_t bg);
+    // how many blocks are in a group. The last one may be short
+    uint32_t group_blocks(uint32_t bg);
+
     // the location of the first block group descriptor
     uint32_t first_bgd = 0;
 
@@ -255,7 +358,17 @@ namespace ext2 {
     // the size of a single disk sector
     long sector_size;
 
-    ck::map<u32, ck::ref<fs::Node>> inodes;
+    // implemented in ext2/icache.cpp
+    struct icache_shard {
+      spinlock lock;
+      ck::map<u32, ck::ref<fs::Node>> inodes;
+    };
+    icache_shard icache[EXT2_ICACHE_SHARDS];
+    uint64_t icache_clock = 0;
+
+    // Evict up to `count` inodes that nothing outside the cache references,
+    // least recently used first. Returns how many went
+    size_t shrink_icache(size_t count);
 
     // how many entries in the disk cache
     int cache_size;
@@ -2,47 +2,47 @@
 
 
 #include <fs.h>
+#include <fs/PageCache.h>
 #include <mm.h>
 #include <ck/vec.h>
 
 namespace tmpfs {
 
 
-  struct FileNode : public fs::FileNode {
+  struct FileNode : public fs::FileNode, public fs::PageCache::Backing {
     using fs::FileNode::FileNode;
 
 
     int seek_check(fs::File &, off_t old_off, off_t new_off) override;
     ssize_t read(fs::File &, char *dst, size_t count) override;
     ssize_t write(fs::File &, const char *, size_t) override;
+    ssize_t pread(fs::File &, char *dst, size_t count, off_t off) override;
+    ssize_t pwrite(fs::File &, const char *, size_t count, off_t off) override;
     int resize(fs::File &, size_t) override;
     ck::ref<mm::VMObject> mmap(fs::File &, size_t npages, int prot, int flags, off_t off) override;
+    fs::PageCache *page_cache(void) override { return &m_pages; }
 
-    ck::ref<mm::Page> get_page(off_t off) const {
-      if (off >= 0 && off < m_pages.size()) {
-      	return m_pages[off];
-			}
-      return nullptr;
-    }
+    // ^fs::PageCache::Backing
+    ck::ref<mm::Page> get_page(off_t index, bool fill, void *&priv) override;
 
    private:
     int resize_r(fs::File &, size_t);
 
-    ssize_t access(fs::File &f, void *data, size_t count, bool write);
     spinlock m_lock;
-    ck::vec<ck::ref<mm::Page>> m_pages;
+    // tmpfs files only exist in memory, so their pages can't be dropped
+    fs::PageCache m_pages{*this, false};
   };
 
   struct DirNode : public fs::DirectoryNode {
     using fs::DirectoryNode::DirectoryNode;
-    ck::map<ck::string, ck::box<fs::DirectoryEntry>> entries;
+    ck::map<ck::string, ck::ref<fs::DirectoryEntry>> entries;
 
     virtual int touch(ck::string name, fs::Ownership &);
     virtual int mkdir(ck::string name, fs::Ownership &);
     virtual int unlink(ck::string name);
     virtual ck::ref<fs::Node> lookup(ck::string name);
-    virtual ck::vec<fs::DirectoryEntry *> dirents(void);
-    virtual fs::DirectoryEntry *get_direntry(ck::string name);
+    virtual ck::vec<ck::ref<fs::DirectoryEntry>> dirents(void);
+    virtual ck::ref<fs::DirectoryEntry> get_direntry(ck::string name);
     virtual int link(ck::string name, ck::ref<fs::Node> node);
   };
 
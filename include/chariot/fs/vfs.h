@@ -58,6 +58,25 @@ namespace vfs {
 
   int unlink(const char *path, ck::ref<fs::Node> cwd);
 
+
+  /*
+   * The dentry cache (kernel/fs/dcache.cpp)
+   *
+   * Caches the result of looking up a name in a directory, including names
+   * that don't exist. dcache_lookup returns true on a hit, with res set to
+   * the node or to nullptr for a negative entry. Anything that adds, removes
+   * or shadows a name must invalidate it.
+   *
+   * A miss is filled by sampling dcache_generation(dir) before asking the
+   * directory, then passing it to dcache_insert. If an invalidation landed
+   * in between, the insert is dropped instead of caching a stale answer.
+   */
+  bool dcache_lookup(fs::Node *dir, const char *name, ck::ref<fs::Node> &res);
+  uint64_t dcache_generation(fs::Node *dir);
+  void dcache_insert(fs::Node *dir, const char *name, ck::ref<fs::Node> node, uint64_t gen);
+  void dcache_invalidate(fs::Node *dir, const char *name);
+  void dcache_purge(void);
+
   /*
    * cwd()
    *
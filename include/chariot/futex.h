@@ -2,6 +2,37 @@
 
 
 
-#define FUTEX_WAIT 1 /* If the  */
-#define FUTEX_WAKE 2
+#define FUTEX_WAIT 1 /* Sleep if *uaddr == val. val2 is a timeout in microseconds (0 waits forever) */
+#define FUTEX_WAKE 2 /* Wake up to val waiters on uaddr, returning how many were woken */
 #define FUTEX_DSTR 3 /* Destroy the futex at this location */
+#define FUTEX_REQUEUE 4     /* Wake up to val waiters, and move up to val2 of the rest to uaddr2 */
+#define FUTEX_CMP_REQUEUE 5 /* FUTEX_REQUEUE, but only if *uaddr == val3 (otherwise EAGAIN) */
+#define FUTEX_WAKE_OP 6     /* Apply the op encoded in val3 to *uaddr2, wake val on uaddr and maybe val2 on uaddr2 */
+
+/*
+ * The futex is only used by this process, so it doesn't have to be looked up
+ * through a shared mapping. Without it, futexes in MAP_SHARED memory are
+ * matched by physical address, so they work across processes
+ */
+#define FUTEX_PRIVATE_FLAG 128
+#define FUTEX_CMD_MASK (~FUTEX_PRIVATE_FLAG)
+
+
+/* FUTEX_WAKE_OP: the operation applied to *uaddr2 ... */
+#define FUTEX_OP_SET 0  /* *uaddr2 = oparg */
+#define FUTEX_OP_ADD 1  /* *uaddr2 += oparg */
+#define FUTEX_OP_OR 2   /* *uaddr2 |= oparg */
+#define FUTEX_OP_ANDN 3 /* *uaddr2 &= ~oparg */
+#define FUTEX_OP_XOR 4  /* *uaddr2 ^= oparg */
+#define FUTEX_OP_OPARG_SHIFT 8 /* use (1 << oparg) as the operand */
+
+/* ... and the comparison of its old value that decides if uaddr2 is woken */
+#define FUTEX_OP_CMP_EQ 0
+#define FUTEX_OP_CMP_NE 1
+#define FUTEX_OP_CMP_LT 2
+#define FUTEX_OP_CMP_LE 3
+#define FUTEX_OP_CMP_GT 4
+#define FUTEX_OP_CMP_GE 5
+
+#define FUTEX_OP(op, oparg, cmp, cmparg) \
+  (((op & 0xf) << 28) | ((cmp & 0xf) << 24) | ((oparg & 0xfff) << 12) | (cmparg & 0xfff))
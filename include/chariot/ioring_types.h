@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Asynchronous syscall rings, shared between the kernel and userspace.
+ *
+ * `ioring_setup` returns an fd for a new ring. Mapping that fd (MAP_SHARED,
+ * offset 0, `params.map_size` bytes) gives the process the ring header
+ * (struct ioring_rings), followed by the submission queue entries at
+ * `params.sqes_off` and the completion queue entries at `params.cqes_off`.
+ *
+ * To submit, fill sqes[sq_tail & (sq_entries - 1)] and release-store
+ * sq_tail + 1. The kernel advances sq_head as it takes entries. Completions
+ * are posted to cqes[cq_tail & (cq_entries - 1)] before cq_tail is advanced,
+ * and the process release-stores cq_head once it has consumed them.
+ */
+
+#define IORING_OP_NOP 0
+#define IORING_OP_READ 1     // pread, or read if off == -1
+#define IORING_OP_WRITE 2    // pwrite, or write if off == -1
+#define IORING_OP_OPEN 3     // open((char *)addr, len, mode)
+#define IORING_OP_CLOSE 4    // close(fd)
+#define IORING_OP_ACCEPT 5   // accept(fd, (struct sockaddr *)addr, len)
+#define IORING_OP_TIMEOUT 6  // complete after `off` microseconds
+#define IORING_OP_FSYNC 7    // fsync(fd)
+#define IORING_OP_LAST 7
+
+struct ioring_sqe {
+  uint8_t opcode;
+  uint8_t flags;
+  uint16_t pad;
+  int32_t fd;
+  int64_t off;     // file offset (-1 for the current offset), or a timeout in us
+  uint64_t addr;   // buffer or path
+  uint32_t len;    // buffer length, open flags, or sockaddr length
+  uint32_t mode;   // mode for open
+  uint64_t user_data;  // handed back untouched in the completion
+};
+
+struct ioring_cqe {
+  uint64_t user_data;
+  int64_t res;  // what the syscall would have returned
+};
+
+// sq_flags
+#define IORING_SQ_NEED_WAKEUP (1 << 0)  // the poller thread is asleep, use IORING_ENTER_SQ_WAKEUP
+
+struct ioring_rings {
+  // written by the kernel, read by the process
+  uint32_t sq_head;
+  uint32_t sq_flags;
+  uint32_t cq_tail;
+  uint32_t cq_overflow;  // completions dropped because the queue was full
+  // written by the process, read by the kernel
+  uint32_t sq_tail;
+  uint32_t cq_head;
+};
+
+// setup flags
+#define IORING_SETUP_SQPOLL (1 << 0)  // a kernel thread polls the submission queue
+
+struct ioring_params {
+  uint32_t sq_entries;     // in: requested size (rounded up to a power of 2), out: actual
+  uint32_t cq_entries;     // out
+  uint32_t flags;          // in: IORING_SETUP_*
+  uint32_t sq_thread_idle;  // in: ms the poller spins before sleeping (0 for the default)
+  // out: the layout of the mapping
+  uint32_t sqes_off;
+  uint32_t cqes_off;
+  uint32_t map_size;
+  uint32_t resv;
+};
+
+// ioring_enter flags
+#define IORING_ENTER_GETEVENTS (1 << 0)  // wait for `min_complete` completions
+#define IORING_ENTER_SQ_WAKEUP (1 << 1)  // wake the poller thread
+
+#define IORING_MAX_ENTRIES 4096
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,8 @@
+#pragma once
+
+// the user/kernel block device I/O statistics definitions (see kctl blk.io)
+
+
+// Latency histograms have log2 buckets of microseconds. Bucket i counts
+// samples in [2^i, 2^(i+1)) us, and bucket 0 also holds anything under 1us
+#define IOSTAT_BUCKETS 24
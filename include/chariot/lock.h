@@ -32,6 +32,61 @@ class spinlock {
   bool try_lock(void);
 };
 
+
+// A waiter's place in a qspinlock's queue. Each core has MCS_NODES of them,
+// one for every context that can nest while spinning (thread, irq, ...).
+// Padded so each waiter spins on its own cache line
+struct mcs_node {
+  struct mcs_node *next;
+  int wait;
+  char pad[64 - sizeof(void *) - sizeof(int)];
+};
+#define MCS_NODES 4
+
+
+// Counters shared by every qspinlock created with it. Only kept track of with
+// CONFIG_LOCK_STATS, and shown by the `locks` kshell command
+struct lock_class {
+  const char *name;
+  unsigned long acquisitions = 0;
+  unsigned long contended = 0;
+  unsigned long spin_cycles = 0;
+  struct lock_class *next = nullptr;
+
+  lock_class(const char *name);
+};
+
+
+// A fair (FIFO) spinlock, MCS style. Waiters queue up and each spins on its
+// own core's node until the one before it hands the lock over, so the lock's
+// cache line isn't bounced between every waiter. Has the same interface as
+// spinlock. A queued waiter can't be preempted, so if the holder could be
+// preempted (or interrupted by someone taking the lock) on the same core, the
+// waiter would spin forever: always take it with lock_irqsave. That keeps
+// interrupts off, so it must not be held while waiting for another core to
+// take an interrupt
+class qspinlock {
+ private:
+  int locked = 0;
+  struct mcs_node *tail = nullptr;
+  struct lock_class *cls;
+
+  void lock_slow(void);
+
+ public:
+  inline qspinlock(struct lock_class *cls = nullptr) : cls(cls) {}
+
+  void lock(void);
+  void unlock(void);
+
+  bool lock_irqsave(void);
+  bool /* was_enabled */ try_lock_irqsave(bool &success);
+  void unlock_irqrestore(bool was_enabled);
+
+  bool is_locked(void);
+  bool try_lock(void);
+};
+
 class rwlock {
  public:
   int read_lock();
@@ -74,11 +129,13 @@ class scoped_wlock {
 
 
 
+// works with anything that has lock() and unlock(), like spinlock or mutex
+template <typename L>
 class scoped_lock {
-  spinlock &lck;
+  L &lck;
 
  public:
-  inline scoped_lock(spinlock &lck) : lck(lck) {
+  inline scoped_lock(L &lck) : lck(lck) {
     lck.lock();
   }
 
@@ -88,12 +145,13 @@ class scoped_lock {
 };
 
 
+template <typename L>
 class scoped_irqlock {
   bool f;
-  spinlock &lck;
+  L &lck;
 
  public:
-  inline scoped_irqlock(spinlock &lck) : lck(lck) {
+  inline scoped_irqlock(L &lck) : lck(lck) {
     f = lck.lock_irqsave();
   }
   inline ~scoped_irqlock(void) {
@@ -12,6 +12,7 @@
 #include <ck/vec.h>
 
 #include <process.h>
+#include <mutex.h>
 
 #define VPROT_READ (1 << 0)
 #define VPROT_WRITE (1 << 1)
@@ -231,6 +232,8 @@ namespace mm {
     virtual ck::ref<mm::Page> get_shared(off_t n) = 0;
     // tell the region to flush a page
     virtual void flush(off_t n) {}
+    // is this an mshare region (that can be passed over an IPC socket)?
+    virtual bool is_mshare(void) { return false; }
 
     inline size_t size(void) { return n_pages * PGSIZE; }
 
@@ -252,7 +255,8 @@ namespace mm {
     int prot = 0;
     int flags = 0;
 
-    spinlock lock;
+    // held across faults, which may have to read the page in from disk
+    mutex lock;
 
     // TODO: unify shared mappings in the fileriptor somehow
     ck::ref<fs::File> fd;
@@ -297,6 +301,8 @@ namespace mm {
     off_t mmap(off_t req, size_t size, int prot, int flags, ck::ref<fs::File>, off_t off);
 
     off_t mmap(ck::string name, off_t req, size_t size, int prot, int flags, ck::ref<fs::File>, off_t off);
+    // map `obj` directly. The region is backed by it from the start
+    off_t mmap(ck::string name, off_t req, size_t size, int prot, int flags, ck::ref<mm::VMObject> obj);
     int unmap(off_t addr, size_t sz);
 
 
@@ -358,7 +364,8 @@ namespace mm {
 
 
 
-    spinlock lock;
+    // held across faults, which may have to read from a file
+    mutex lock;
     rb_root regions;
 
    protected:
@@ -376,6 +383,9 @@ namespace mm {
     ck::ref<mm::Page> get_page(off_t uaddr);
     // expects the area, and space to be locked
     ck::ref<mm::Page> get_page_internal(off_t uaddr, mm::MappedRegion &area, int pagefault_err, bool do_map);
+    // both versions of mmap. The object comes from `fd` if there is one
+    off_t map_object(
+        ck::string name, off_t req, size_t size, int prot, int flags, ck::ref<fs::File> fd, off_t off, ck::ref<mm::VMObject> obj);
 
     struct RegionCacheEntry {
       mm::MappedRegion *region = NULL;
@@ -11,8 +11,10 @@ extern "C" {
 #define MSHARE_NAMESZ 128
 
 struct mshare_create {
-  unsigned long size;        // the size of the region
-  char name[MSHARE_NAMESZ];  // eventual name of the region
+  unsigned long size;  // the size of the region
+  // eventual name of the region. If it's empty, the region can't be acquired
+  // by name, only passed over an IPC socket (SCM_MSHARE)
+  char name[MSHARE_NAMESZ];
 };
 
 struct mshare_acquire {
@@ -25,3 +27,20 @@ struct mshare_acquire {
 #ifdef __cplusplus
 }
 #endif
+
+
+#if defined(KERNEL) && defined(__cplusplus)
+#include <ck/ptr.h>
+
+namespace mm {
+  struct VMObject;
+}
+
+// The mshare object behind the shared mapping at `addr` in the current
+// process, or null if there isn't one. `prot` is set to how it is mapped
+// there. Used to pass mappings between processes
+ck::ref<mm::VMObject> mshare_get(void *addr, int &prot);
+// Map all of `obj` into the current process with `prot`. Returns MAP_FAILED
+// on failure
+void *mshare_map(ck::ref<mm::VMObject> obj, int prot);
+#endif
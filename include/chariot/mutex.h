@@ -0,0 +1,83 @@
+#pragma once
+
+#include <lock.h>
+#include <wait.h>
+
+class Thread;
+
+/*
+ * A sleeping lock for critical sections that can be long, or that block on
+ * I/O. While the owner is running on another core, waiters spin for a bit on
+ * the assumption it will let go soon. Otherwise (or once they have spun for
+ * long enough) they sleep until the owner unlocks. Must not be taken in
+ * interrupt context. Before there are threads to sleep, it only spins.
+ */
+class mutex final {
+  Thread *m_owner = nullptr;
+  int m_waiters = 0;
+  struct wait_queue m_wq;
+
+  void lock_slow(void);
+
+ public:
+  inline mutex() {}
+
+  void lock(void);
+  void unlock(void);
+  bool try_lock(void);
+
+  inline bool is_locked(void) { return __atomic_load_n(&m_owner, __ATOMIC_RELAXED) != nullptr; }
+};
+
+
+/*
+ * A sleeping reader/writer lock. Any number of readers can hold it at once,
+ * or a single writer. Writers are preferred: once one is waiting, new readers
+ * wait behind it, so a stream of readers can't starve it.
+ */
+class rwsem final {
+  spinlock m_lock;
+  // the number of readers holding it, or -1 while a writer does
+  int m_count = 0;
+  int m_writers_waiting = 0;
+  struct wait_queue m_readq;
+  struct wait_queue m_writeq;
+
+ public:
+  inline rwsem() {}
+
+  void read_lock(void);
+  void read_unlock(void);
+  bool try_read_lock(void);
+
+  void write_lock(void);
+  void write_unlock(void);
+  bool try_write_lock(void);
+};
+
+
+class scoped_rsem {
+  rwsem &lck;
+
+ public:
+  inline scoped_rsem(rwsem &lck) : lck(lck) {
+    lck.read_lock();
+  }
+
+  inline ~scoped_rsem(void) {
+    lck.read_unlock();
+  }
+};
+
+class scoped_wsem {
+  rwsem &lck;
+
+ public:
+  inline scoped_wsem(rwsem &lck) : lck(lck) {
+    lck.write_lock();
+  }
+
+  inline ~scoped_wsem(void) {
+    lck.write_unlock();
+  }
+};
@@ -3,6 +3,8 @@
 #include <chan.h>
 #include <fifo_buf.h>
 #include <lock.h>
+#include <mm.h>
+#include <mutex.h>
 #include <net/ipv4.h>
 #include <net/socket.h>
 #include <ck/ptr.h>
@@ -72,6 +74,25 @@ namespace net {
     virtual ssize_t sendto(fs::File &, void *data, size_t len, int flags, const sockaddr *, size_t);
     virtual ssize_t recvfrom(fs::File &, void *data, size_t len, int flags, const sockaddr *, size_t);
 
+    // Files and shared mappings passed along with a message (SCM_RIGHTS and
+    // SCM_MSHARE). They are only turned back into fds and mappings when they
+    // reach the receiving process. IPC sockets themselves can't be passed
+    struct rights {
+      struct region {
+        ck::ref<mm::VMObject> obj;
+        // the sender's protection, which the receiver gets as well
+        int prot;
+      };
+      ck::vec<ck::ref<fs::File>> files;
+      ck::vec<region> regions;
+
+      inline bool empty(void) { return files.size() == 0 && regions.size() == 0; }
+    };
+
+    // By default, sockets can't carry rights, and these are sendto/recvfrom
+    virtual ssize_t sendmsg(fs::File &, void *data, size_t len, int flags, rights &);
+    virtual ssize_t recvmsg(fs::File &, void *data, size_t len, int flags, rights &);
+
     virtual int bind(const struct sockaddr *addr, size_t len);
 
    private:
@@ -96,6 +117,8 @@ namespace net {
 
     virtual int poll(fs::File &f, int events, poll_table &pt);
 
+    virtual fifo_buf *write_fifo(fs::File &f) override { return (f.pflags & PFLAGS_SERVER) ? &for_client : &for_server; }
+
 
     void dump_stats(void);
 
@@ -117,16 +140,11 @@ namespace net {
 
 
 
-  // ipc messages cannot be partially consumed,
-  // they must be entirely read at once
-  struct ipcmsg {
-    ck::vec<uint8_t> data;
-
-    inline ipcmsg(void *buf, size_t sz) {
-      data.ensure_capacity(sz);
-      data.push((uint8_t *)buf, sz);
-    }
-  };
+  // how many pages each direction of an IPC connection can buffer
+#define IPCSOCK_RING_PAGES 16
+#define IPCSOCK_RING_SIZE (IPCSOCK_RING_PAGES * PGSIZE)
+// set in ipc_batch_hdr::resv on the ring if the message carries rights
+#define IPCSOCK_RIGHTS 1
 
   struct IPCSock : public net::Socket {
     IPCSock(int type);
@@ -139,6 +157,8 @@ namespace net {
     // implemented by the network layer (OSI)
     virtual ssize_t sendto(fs::File &, void *data, size_t len, int flags, const sockaddr *, size_t);
     virtual ssize_t recvfrom(fs::File &, void *data, size_t len, int flags, const sockaddr *, size_t);
+    virtual ssize_t sendmsg(fs::File &, void *data, size_t len, int flags, rights &);
+    virtual ssize_t recvmsg(fs::File &, void *data, size_t len, int flags, rights &);
 
     virtual int bind(const struct sockaddr *addr, size_t len);
 
@@ -151,11 +171,35 @@ namespace net {
     ck::ref<IPCSock> peer;
 
 
-    struct {
-      ck::single_list<ipcmsg> msgs;
-      struct wait_queue wq;
-      spinlock lock;
+    // One direction of a connection. Messages are kept back to back in a ring,
+    // in the same format MSG_IPC_BATCH hands them to the user: a header, then
+    // the message padded to 8 bytes. Headers never wrap around the end, but
+    // messages can. The rings are allocated by connect()
+    struct ring {
+      char *data = nullptr;
+      // free running, so tail - head is how much is in use
+      size_t head = 0;
+      size_t tail = 0;
+      // the rights carried by messages on the ring that are marked with
+      // IPCSOCK_RIGHTS, in order
+      ck::single_list<rights> pending;
+      struct wait_queue wq;        // readers
+      struct wait_queue wq_space;  // writers waiting for room
+      // a mutex, as messages are copied straight to and from user memory
+      // with it held, which can fault
+      mutex lock;
       bool closed = false;
+
+      inline bool is_empty(void) { return head == tail; }
+      inline size_t space(void) { return IPCSOCK_RING_SIZE - (tail - head); }
+      // The rest are called with the lock held. Rights are moved in and out,
+      // as dropping them might close a file, which can't be done here
+      void put(const void *msg, size_t len, rights &r);
+      ssize_t take(void *buf, size_t len, rights &r);
+      ssize_t take_batch(void *buf, size_t len, rights &r);
+      ipc_batch_hdr &front(void);
+      void copy_in(size_t pos, const void *src, size_t len);
+      void copy_out(size_t pos, void *dst, size_t len);
     } for_server, for_client;
 
 
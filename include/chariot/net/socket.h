@@ -9,8 +9,10 @@ extern "C" {
 
 #ifdef KERNEL
 #include <types.h>
+#include <uio.h>
 #else
 #include <unistd.h>
+#include <chariot/uio.h>
 #endif
 
 
@@ -30,6 +32,39 @@ struct sockaddr_storage {
 };
 
 
+struct msghdr {
+  void *msg_name;
+  socklen_t msg_namelen;
+  struct iovec *msg_iov;
+  int msg_iovlen;
+  void *msg_control;
+  socklen_t msg_controllen;
+  int msg_flags;
+};
+
+struct cmsghdr {
+  socklen_t cmsg_len;  // including this header
+  int cmsg_level;
+  int cmsg_type;
+};
+
+#define CMSG_ALIGN(len) (((len) + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1))
+#define CMSG_DATA(cmsg) ((unsigned char *)(((struct cmsghdr *)(cmsg)) + 1))
+#define CMSG_SPACE(len) (CMSG_ALIGN(len) + CMSG_ALIGN(sizeof(struct cmsghdr)))
+#define CMSG_LEN(len) (CMSG_ALIGN(sizeof(struct cmsghdr)) + (len))
+
+#define __CMSG_NEXT(cmsg) ((unsigned char *)(cmsg) + CMSG_ALIGN((cmsg)->cmsg_len))
+#define __MHDR_END(mhdr) ((unsigned char *)(mhdr)->msg_control + (mhdr)->msg_controllen)
+
+#define CMSG_FIRSTHDR(mhdr) \
+  ((size_t)(mhdr)->msg_controllen >= sizeof(struct cmsghdr) ? (struct cmsghdr *)(mhdr)->msg_control : (struct cmsghdr *)0)
+#define CMSG_NXTHDR(mhdr, cmsg)                                                     \
+  ((cmsg)->cmsg_len < sizeof(struct cmsghdr) ||                                     \
+           __CMSG_NEXT(cmsg) + sizeof(struct cmsghdr) > __MHDR_END(mhdr)            \
+       ? (struct cmsghdr *)0                                                        \
+       : (struct cmsghdr *)__CMSG_NEXT(cmsg))
+
+
 #define SHUT_RD 0
 #define SHUT_WR 1
 #define SHUT_RDWR 2
@@ -223,6 +258,9 @@ struct sockaddr_storage {
 #define SOL_SOCKET 1
 #endif
 
+// control messages at SOL_SOCKET
+#define SCM_RIGHTS 0x01
+
 #define SOL_IP 0
 #define SOL_IPV6 41
 #define SOL_ICMPV6 58
@@ -283,6 +321,32 @@ struct sockaddr_storage {
 // returns the size of the next message, -EAGAIN if there isn't one left.
 #define MSG_IPC_QUERY 0x80000000
 #define MSG_IPC_CLEAR 0x80000001
+// receive as many whole messages as fit in the buffer. Each one is an
+// ipc_batch_hdr followed by the message, padded out to 8 bytes. Returns the
+// size of all of the records, or -EMSGSIZE if not even the first one fits.
+#define MSG_IPC_BATCH 0x10000000
+
+struct ipc_batch_hdr {
+  unsigned int len;
+  unsigned int resv;
+};
+
+#define IPC_BATCH_RECORD_SIZE(len) (((len) + sizeof(struct ipc_batch_hdr) + 7) & ~(size_t)7)
+
+// A shared mapping passed over an AF_CKIPC socket. The sender can name any
+// address in a MAP_SHARED mapping that has an object behind it, like one from
+// mshare. The receiver gets a new mapping of the whole object, and the size
+// of it. A MSG_IPC_BATCH stops before a message that carries handles. Plain
+// recv() drops them, and so does a batch that starts with one.
+#define SCM_MSHARE 0x100
+
+struct mshare_handle {
+  void *addr;
+  size_t size;
+};
+
+// the most files and mappings one message can carry
+#define SCM_MAX_HANDLES 64
 
 
 #ifdef __cplusplus
@@ -25,6 +25,13 @@ namespace phys {
   u64 bytes_free(void);
 
 
+  // Caches that can give memory back register a reclaimer, which is called
+  // when free memory runs low and returns how many bytes it released. They
+  // run in the [reclaim] kernel thread, so they may allocate and sleep
+  using reclaimer = size_t (*)(void);
+  void register_reclaimer(reclaimer fn);
+
+
   inline void *kalloc(int npages) {
     return p2v(phys::alloc(npages));
   }
@@ -7,6 +7,8 @@
 #include <fs.h>
 
 #include <thread.h>
+#include <mutex.h>
+#include <rcu.h>
 // #include <mm.h>
 
 
@@ -119,28 +121,39 @@ struct Process final : public ck::refcounted<Process> {
   ck::ref<fs::Node> cwd = nullptr;
   ck::ref<fs::Node> root = nullptr;
   ck::string cwd_string;
-  spinlock datalock;
+  mutex datalock;
 
   /* threads stuck in a waitpid() call */
   // semaphore waiters = semaphore(0);
 
   wait_queue child_wq;
 
+  // Open files, indexed by fd. get_fd reads the table without taking any lock,
+  // under RCU. Changes are made with `file_lock` held, and growing the table
+  // publishes a bigger copy of it
+  struct fd_table {
+    struct rcu_head rcu;
+    int size;
+    // each one holds a reference
+    fs::File *files[];
+  };
   spinlock file_lock;
-  ck::map<int, ck::ref<fs::File>> open_files;
+  fd_table *fds = nullptr;
 
 
-  spinlock futex_lock;
-  wait_queue &futex_queue(int *);
-  ck::map<off_t, ck::box<wait_queue>> m_futex_queues;
-
   /**
    * exec() - execute a command (implementation for startpid())
    */
   int exec(ck::string &path, ck::vec<ck::string> &argv, ck::vec<ck::string> &envp);
 
   ck::ref<fs::File> get_fd(int fd);
+  // install a file at the lowest free fd
   int add_fd(ck::ref<fs::File>);
+  // install a file at `fd`, closing whatever was there
+  int set_fd(int fd, ck::ref<fs::File>);
+  int close_fd(int fd);
+  // close every fd from `from` up
+  void close_fds(int from = 0);
 
   long create_thread(void *ip, int state);
 
@@ -1,9 +1,14 @@
 #pragma once
 #include <asm.h>  // barrier
 
-// This version of the RCU is based heavily on the "toy" implementation from
-// https://www.kernel.org/doc/Documentation/RCU/whatisRCU.txt. It's not
-// perfect, but apparently it works -- just slowly.
+// Quiescent state based RCU. Readers only bump the core's preempt_count, which
+// keeps them from being preempted. A core passes through a quiescent state
+// whenever it is outside of every read-side section: each time its scheduler
+// switches threads, and on timer ticks that land outside of a reader. Once
+// every core has done so after a grace period starts, nothing can still see
+// what was unpublished before it, and it can be freed. See kernel/rcu.cpp.
+//
+// Read-side sections must not sleep.
 
 #define smp_store_release(p, v) \
   do {                          \
@@ -14,16 +19,38 @@
 
 #define rcu_assign_pointer(p, v) ({ __atomic_store_n(&(p), (v), __ATOMIC_RELEASE); })
 
-#define rcu_dereference(p)                \
-  ({                                      \
-    typeof(p) _________p1 = READ_ONCE(p); \
-    (_________p1);                        \
+#define rcu_dereference(p)                    \
+  ({                                          \
+    __typeof__(p) _________p1 = READ_ONCE(p); \
+    (_________p1);                            \
   })
 
+
+// Embedded in objects freed through call_rcu. Find the object from the head
+// with container_of in the callback
+struct rcu_head {
+  struct rcu_head *next;
+  void (*func)(struct rcu_head *);
+};
+
 // kernel/rcu.cpp
 extern void rcu_read_lock();
 extern void rcu_read_unlock();
 
+// Call `func(head)` once every reader that might have seen the object has
+// finished. Callbacks run in the [rcu] kernel thread, so they may sleep.
+// Safe from interrupt context
+extern void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *));
+// Wait for a full grace period. Must be called from a thread, outside of any
+// read-side section
+extern void synchronize_rcu(void);
+
+// Called by the scheduler: the current core is not in a read-side section
+extern void rcu_note_quiescent(void);
+// Called by the scheduler between threads. Notes a quiescent state, runs the
+// callbacks whose grace period ended and starts a new one if needed
+extern void rcu_check_callbacks(void);
+
 // STUBS
 #define rcu_check_sparse(p, space)
 
@@ -173,7 +173,7 @@ namespace rt {
 
     cpu::Core &core(void) { return m_core; }
 
-    scoped_irqlock lock(void);
+    scoped_irqlock<spinlock> lock(void);
 
     // Periodic and sporadic threads that have arrived (and are runnable)
     rt::PriorityQueue runnable = RUNNABLE_QUEUE;
@@ -193,6 +193,6 @@ namespace rt {
     bool in_kick = false;
   };
 
-  scoped_irqlock local_lock();
+  scoped_irqlock<spinlock> local_lock();
 
 }  // namespace rt
@@ -88,6 +88,11 @@ namespace sched {
 
     ck::ref<Thread> spawn_kthread(const char *name, int (*func)(void *), void *arg = NULL);
 
+    // Create a thread that runs `func` in kernel mode, but inside `proc`, so
+    // it can work with the process's memory and file descriptors. It dies
+    // with the process.
+    long create_kworker(Process &proc, const char *name, int (*func)(void *), void *arg = NULL);
+
     void dump_table();
 
     // spawn init (pid 1) and try to execute each of the paths in order,
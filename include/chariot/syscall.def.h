@@ -1,6 +1,8 @@
 #include <types.h>
 #include <mountopts.h>
 #include <cpu_usage.h>
+#include <uio.h>
+#include <ioring_types.h>
 namespace sys {
 void restart();
 void exit_thread(int code);
@@ -70,4 +72,18 @@ unsigned long getramusage();
 int get_core_usage(unsigned int core, struct chariot_core_usage * usage);
 int get_nproc();
 int kctl(off_t* name, unsigned namelen, char * oval, size_t* olen, char * nval, size_t nlen);
+int sync();
+int fsync(int fd);
+long pread(int fd, void* buf, size_t len, off_t off);
+long pwrite(int fd, void* buf, size_t len, off_t off);
+long readv(int fd, const struct iovec* iov, int iovcnt);
+long writev(int fd, const struct iovec* iov, int iovcnt);
+long preadv(int fd, const struct iovec* iov, int iovcnt, off_t off);
+long pwritev(int fd, const struct iovec* iov, int iovcnt, off_t off);
+long sendfile(int out_fd, int in_fd, off_t* offset, size_t count);
+long splice(int fd_in, off_t* off_in, int fd_out, off_t* off_out, size_t len, unsigned flags);
+int ioring_setup(unsigned entries, struct ioring_params* params);
+int ioring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags);
+ssize_t sendmsg(int sockfd, const struct msghdr* msg, int flags);
+ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags);
 }
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+// scatter/gather I/O (readv, writev, preadv, pwritev). Shared by the kernel
+// and libc, so it has to match libc's definition of iovec
+
+#if !defined(__DEFINED_struct_iovec)
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+#define __DEFINED_struct_iovec
+#endif
+
+// the most segments one call can take
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <ck/fsnotifier.h>
+#include <ck/future.h>
+#include <ck/map.h>
+#include <sys/ioring.h>
+#include <sys/types.h>
+
+namespace ck {
+
+
+  /**
+   * A thin wrapper around a kernel syscall ring.
+   *
+   * It can be driven by hand (get_sqe, submit and reap), or through the
+   * async_* functions, which queue an operation and hand back a future that is
+   * resolved with the syscall's return value once its completion arrives.
+   * Operations queued during one turn of the eventloop are handed to the
+   * kernel together, and completions are reaped when the eventloop sees the
+   * ring's fd become readable.
+   */
+  class ioring {
+   public:
+    ioring(void) {}
+    ~ioring(void);
+
+    // create the ring. Returns false (with errno set) if that fails
+    bool init(unsigned entries, unsigned flags = 0);
+    inline int fd(void) const { return m_fd; }
+
+    // the next free submission entry, zeroed, or NULL if the queue is full
+    struct ioring_sqe *get_sqe(void);
+    // Hand every queued entry to the kernel, waiting for `wait_for`
+    // completions. Returns how many entries were taken, or -1 and errno
+    int submit(unsigned wait_for = 0);
+    // Call `cb` for every completion that is ready. Returns how many there were
+    int reap(ck::func<void(struct ioring_cqe &)> cb);
+
+    async(long) async_read(int fd, void *buf, size_t len, off_t off = -1);
+    async(long) async_write(int fd, const void *buf, size_t len, off_t off = -1);
+    async(long) async_open(const char *path, int flags, int mode = 0);
+    async(long) async_accept(int fd, struct sockaddr *addr, size_t addrlen);
+    async(long) async_timeout(long long us);
+
+   private:
+    // queue an entry whose completion resolves a future
+    ck::future<long> queue_async(struct ioring_sqe *sqe);
+    void on_completions(void);
+
+    int m_fd = -1;
+    struct ioring_params m_params;
+    void *m_map = nullptr;
+    struct ioring_rings *m_rings = nullptr;
+    struct ioring_sqe *m_sqes = nullptr;
+    struct ioring_cqe *m_cqes = nullptr;
+    // where the next entry will go. Published to sq_tail by submit()
+    uint32_t m_sq_tail = 0;
+
+    ck::fsnotifier m_notifier;
+    bool m_submit_deferred = false;
+    long m_next_id = 1;
+    // futures waiting on a completion, by user_data
+    ck::map<long, ck::ref<ck::future_control<long>>> m_pending;
+  };
+}  // namespace ck
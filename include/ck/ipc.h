@@ -8,8 +8,6 @@
 #include <ck/pair.h>
 #include <ck/future.h>
 
-// #define IPC_USE_SHM
-
 
 namespace ck {
 
@@ -226,6 +224,9 @@ namespace ck {
           if (!closed()) close();
           // wait on the recv fiber to finish... We really do not want to leak memory
           m_recv_fiber_join.await();
+          teardown_shm();
+          free(msg_buffer);
+          free(m_sync_reply);
         }
 
         // a closed socket connection is just one without a socket :^)
@@ -244,7 +245,7 @@ namespace ck {
 
        protected:
         const char* side(void) { return is_server ? "server" : "client"; }
-        // the encoder writes directly to the send_queue, finish-send just hits the doorbell
+        // begin_send encodes into msg_buffer, finish_send puts it on the ring (or the socket)
         ipc::encoder begin_send(void);
         void finish_send();
         void dispatch(void* data, size_t len);
@@ -256,62 +257,78 @@ namespace ck {
         // if no message is found. Any other messages are placed
         // in the stored_messages vector that needs to be dispatched
         // via dispatch_stored
+        //
+        // The reply is a copy owned by the connection, which stays valid until
+        // the next sync_wait returns.
         ck::ipc::raw_msg sync_wait(uint32_t msg_type, ck::ipc::nonce_t nonce);
+        void* m_sync_reply = NULL;
 
         ck::vec<ck::ipc::raw_msg> stored_messages;
 
 
 
-        struct shared_msg_data {
-          size_t size;
-          uint8_t data[];
-        };
-
-        struct shared_msg_queue {
-          // we can use a mutex here because we know it's only an integer, nothing fancy
-          pthread_mutex_t lock;
-          ck::atom<int> count;
-          struct shared_msg_data data[];
+        /*
+         * Messages in each direction go through a single producer, single
+         * consumer ring in memory shared with the peer (see mshare), set up
+         * by handshake(). The socket is only used for messages that don't
+         * fit in the ring, and as a doorbell: the receiver sets `sleeping`
+         * before it waits on the socket, and the sender only sends a one
+         * byte wakeup when it sees it set.
+         *
+         * The server doesn't block waiting for the client to accept the
+         * rings. The reply is the first thing its receive fiber reads off
+         * the socket, and until then the server only uses the socket.
+         *
+         * To keep messages in order, the ring isn't used again until the
+         * receiver has dispatched every message sent through the socket,
+         * and it drains the ring before dispatching one of those.
+         */
+        static constexpr size_t ring_size = 64 * 1024;
+        struct shm_ring {
+          // written by the sender. Byte offsets, which are never wrapped
+          uint32_t tail;
+          uint32_t sock_sent;
+          char pad0[56];
+          // written by the receiver
+          uint32_t head;
+          uint32_t sock_done;
+          int sleeping;
+          char pad1[52];
+          // records of a uint32_t length and the message, 8 byte aligned
+          uint8_t data[ring_size];
         };
 
 
-
-
         struct msg_handshake {
-          size_t total_shared_msg_queue_size;
+          size_t shm_size;
           char shm_name[32];
         };
 
 
-        template <typename T>
-        T recv_sync(void) {
-          T out;
-          m_sock->recv((void*)&out, sizeof(T), 0);
-          return out;
-        }
-
-
         ck::ref<ck::ipcsocket> m_sock;
         const char* ns;
         bool is_server;
 
-        // each side gets 32kb of shared memory
-        size_t total_shared_msg_queue_size = 64 * 4096;
-        void* shared_msg_queue = NULL;
+        // both rings. The server sends on the first one
+        void* m_shm = NULL;
+        size_t m_shm_size = 0;
+        struct shm_ring* m_tx = NULL;
+        struct shm_ring* m_rx = NULL;
 
-        // server recvs from position 0, sends to position 1
-        // client recvs from position 1, sends to position 0
-        struct shared_msg_queue* recv_queue = NULL;
-        struct shared_msg_queue* send_queue = NULL;
+        // the server is waiting on the client's reply to the handshake
+        bool m_handshake_pending = false;
 
+        bool setup_shm(msg_handshake& hs);
+        void teardown_shm(void);
+        void finish_handshake(void* data, size_t len);
+        // try to queue the message on the ring. Fails if it doesn't fit
+        bool ring_send(const void* data, size_t len);
+        // dispatch everything on the receive ring
+        void ring_drain(void* buf);
 
-#ifdef IPC_USE_SHM
-        ck::string shm_name;
-#else
         static constexpr size_t max_message_size = 32 * 1024;
         void* msg_buffer = NULL;
         size_t msg_size = 0;
-#endif
 
         nonce_t get_nonce(void) {
           auto n = next_nonce++;
@@ -83,15 +83,36 @@ namespace ck {
     CK_OBJECT(ck::localsocket);
 
     /*
+     * Take every message waiting on the socket. Each one is malloc'd, and the
+     * caller frees them.
      */
     template <typename T>
     auto drain(void) {
       bool failed = false;
       ck::vec<T *> msgs;
+      // most batches fit here. A message that doesn't is taken on its own
+      alignas(8) uint8_t batch[1024];
 
       while (1) {
-        uint8_t buf;
-        int sz = recv(&buf, 1, MSG_IPC_QUERY | MSG_DONTWAIT);
+        int sz = recv(batch, sizeof(batch), MSG_IPC_BATCH | MSG_DONTWAIT);
+
+        if (sz < 0 && errno == EMSGSIZE) {
+          sz = recv(batch, 1, MSG_IPC_QUERY | MSG_DONTWAIT);
+          if (sz < 0 || eof()) {
+            failed = true;
+            break;
+          }
+
+          char *buffer = (char *)malloc(sz);
+          int nread = recv(buffer, sz, 0);
+          if (nread != sz || eof()) {
+            free(buffer);
+            failed = true;
+            break;
+          }
+          msgs.push((T *)buffer);
+          continue;
+        }
 
         if (sz < 0 || eof()) {
           if (errno == EAGAIN) break;
@@ -99,15 +120,13 @@ namespace ck {
           break;
         }
 
-        char *buffer = (char *)malloc(sz);
-        int nread = recv(buffer, sz, 0);
-        if (nread != sz || eof()) {
-          free(buffer);
-          failed = true;
-          break;
+        for (int off = 0; off < sz;) {
+          auto *hdr = (struct ipc_batch_hdr *)(batch + off);
+          char *buffer = (char *)malloc(hdr->len);
+          memcpy(buffer, hdr + 1, hdr->len);
+          msgs.push((T *)buffer);
+          off += IPC_BATCH_RECORD_SIZE(hdr->len);
         }
-        auto *msg = (T *)buffer;
-        msgs.push(msg);
       }
       if (failed) set_eof(true);
       return msgs;
@@ -6,7 +6,9 @@
 #include <mm.h>
 #include <module.h>
 #include <sched.h>
+#include <phys.h>
 #include <template_lib.h>
+#include <time.h>
 #include <dev/driver.h>
 
 
@@ -21,20 +23,84 @@ static uint64_t next_block_lru(void) {
 }
 
 
-static chan<block::Buffer *> dirty_buffers;
+// how often the flush daemon wakes up on its own
+#define WRITEBACK_INTERVAL_MS 1000
+// buffers that have been dirty for this long are written back
+#define DIRTY_EXPIRE_MS 5000
+// percent of (free + dirty) memory that can be dirty before we write back early
+#define DIRTY_BACKGROUND_RATIO 10
+// the most pages read or written back with a single request
+#define MAX_IO_RUN 32
+
+// Dirty buffers sit on this list (oldest first) until the flush daemon, or a
+// sync, writes them back. Writes to a buffer that is already dirty are
+// absorbed without any extra I/O.
+static spinlock dirty_lock;
+static struct list_head dirty_list;
+static size_t nr_dirty = 0;
+static wait_queue writeback_wq;
+static wait_queue writeback_done;
+static int writeback_inflight = 0;
+static block::writeback_stats wb_stats;
+
+#define MAX_WRITEBACK_HOOKS 8
+static block::writeback_hook writeback_hooks[MAX_WRITEBACK_HOOKS];
+static int nwriteback_hooks = 0;
+
+void block::register_writeback_hook(block::writeback_hook fn) {
+  scoped_irqlock l(dirty_lock);
+  assert(nwriteback_hooks < MAX_WRITEBACK_HOOKS);
+  writeback_hooks[nwriteback_hooks++] = fn;
+}
+
+static bool over_dirty_ratio(void) {
+  return nr_dirty * 100 > DIRTY_BACKGROUND_RATIO * (nr_dirty + phys::nfree());
+}
+
 static int block_flush_task(void *) {
   while (1) {
-    auto buffer = dirty_buffers.recv();
-    buffer->flush();
-    // 'recursively' put the buffer
-    bput(buffer);
+    writeback_wq.wait_timeout(WRITEBACK_INTERVAL_MS * 1000);
+    block::Buffer::writeback(false);
   }
 }
 
 
+// Buffers that readahead has asked to be loaded. The reference taken in
+// block::prefetch is dropped once the data is in the cache.
+static chan<block::Buffer *> readahead_buffers;
+static int block_readahead_task(void *) {
+  block::Buffer *batch[MAX_IO_RUN];
+  while (1) {
+    int n = 0;
+    batch[n++] = readahead_buffers.recv();
+    // readahead asks for consecutive pages, so take whatever else is waiting
+    // and read it together
+    while (n < MAX_IO_RUN && readahead_buffers.avail())
+      batch[n++] = readahead_buffers.recv();
+
+    for (int i = 0; i < n;) {
+      int len = 1;
+      while (i + len < n && &batch[i + len]->bdev == &batch[i]->bdev &&
+             batch[i + len]->index() == batch[i]->index() + len)
+        len++;
+
+      if (len == 1) {
+        (void)batch[i]->data();
+      } else {
+        block::Buffer::read_run(&batch[i], len);
+      }
+      i += len;
+    }
+
+    for (int i = 0; i < n; i++)
+      bput(batch[i]);
+  }
+}
+
 
 
-static spinlock buffer_cache_lock;
+static lock_class buffer_cache_lock_class("buffer_cache");
+static qspinlock buffer_cache_lock(&buffer_cache_lock_class);
 static uint64_t total_blocks_in_cache = 0;
 static ck::map<dev::BlockDevice *, ck::map<off_t, block::Buffer *>> buffer_cache;
 
@@ -45,7 +111,7 @@ static uint32_t to_key(dev_t device) { return ((uint32_t)device.major() << 16) |
 
 size_t block::reclaim_memory(void) {
   size_t reclaimed = 0;
-  buffer_cache_lock.lock();
+  scoped_irqlock l(buffer_cache_lock);
 
   for (auto &blk : buffer_cache) {
     for (auto &off : blk.value) {
@@ -55,23 +121,90 @@ size_t block::reclaim_memory(void) {
     }
   }
 
-  buffer_cache_lock.unlock();
   return reclaimed;
 }
 
 
 void block::sync_all(void) {
-  buffer_cache_lock.lock();
+  __atomic_add_fetch(&wb_stats.syncs, 1, __ATOMIC_RELAXED);
+  block::Buffer::writeback(true);
+
+  // a writeback that was already running might still hold some of the
+  // buffers that were dirty when we were called. Wait for it.
+  while (true) {
+    struct wait_entry ent;
+    prepare_to_wait(writeback_done, ent, false);
+    if (__atomic_load_n(&writeback_inflight, __ATOMIC_ACQUIRE) == 0) {
+      finish_wait(writeback_done, ent);
+      break;
+    }
+    do_wait(ent);
+    finish_wait(writeback_done, ent);
+  }
+}
 
-  for (auto &blk : buffer_cache) {
-    for (auto &off : blk.value) {
-      if (off.value && off.value->dirty()) {
-        off.value->flush();
+
+void block::get_writeback_stats(struct block::writeback_stats &out) {
+  scoped_irqlock l(dirty_lock);
+  out = wb_stats;
+  out.dirty = nr_dirty;
+}
+
+
+// order buffers by device and then by position so the disk sees a sweep
+static bool writeback_before(block::Buffer *a, block::Buffer *b) {
+  if (&a->bdev != &b->bdev) return &a->bdev < &b->bdev;
+  return a->index() < b->index();
+}
+
+static void sort_batch(ck::vec<block::Buffer *> &batch) {
+  int n = batch.size();
+  // shell sort. Batches are small enough that this is plenty
+  for (int gap = n / 2; gap > 0; gap /= 2) {
+    for (int i = gap; i < n; i++) {
+      auto *tmp = batch[i];
+      int j = i;
+      for (; j >= gap && writeback_before(tmp, batch[j - gap]); j -= gap)
+        batch[j] = batch[j - gap];
+      batch[j] = tmp;
+    }
+  }
+}
+
+void block::read_pages(dev::BlockDevice &device, off_t page, int count) {
+  block::Buffer *run[MAX_IO_RUN];
+
+  for (int i = 0; i < count;) {
+    int n = 0;
+    while (i < count && n < MAX_IO_RUN) {
+      auto *b = bget(device, page + i);
+      if (b->present()) {
+        bput(b);
+        // a cached page ends the run
+        if (n > 0) break;
+        i++;
+        continue;
       }
+      b->queue_io();
+      run[n++] = b;
+      i++;
     }
+
+    if (n > 0) block::Buffer::read_run(run, n);
+    for (int j = 0; j < n; j++)
+      bput(run[j]);
   }
+}
+
 
-  buffer_cache_lock.unlock();
+void block::prefetch(dev::BlockDevice &device, off_t page) {
+  auto buf = bget(device, page);
+  if (buf->present()) {
+    bput(buf);
+    return;
+  }
+  buf->queue_io();
+  readahead_buffers.send(move(buf));
 }
 
 struct block_cache_key {};
@@ -108,23 +241,87 @@ namespace block {
     return buf;
   }
 
-  void Buffer::register_write(void) { m_dirty = true; }
+  void Buffer::register_write(void) {
+    scoped_irqlock l(dirty_lock);
+    if (m_dirty) {
+      wb_stats.coalesced++;
+      bdev.io_merge();
+      return;
+    }
+
+    m_dirty = true;
+    m_dirtied_at = time::now_ms();
+    dirty_list.add_tail(&m_dirty_link);
+    nr_dirty++;
+
+    // don't wait for the timer if too much memory is dirty
+    if (over_dirty_ratio()) writeback_wq.wake_up();
+  }
+
 
-  void Buffer::release(struct Buffer *b) {
-    b->m_lock.lock();
+  size_t Buffer::writeback(bool all) {
+    ck::vec<block::Buffer *> batch;
 
-    if (b->m_dirty) {
-      b->m_lock.unlock();
-      dirty_buffers.send(move(b));
-      return;
+    // let filesystems dirty their batched metadata first, so it goes out
+    // in this pass
+    for (int i = 0; i < nwriteback_hooks; i++)
+      writeback_hooks[i]();
+
+    auto now = time::now_ms();
+
+    bool f = dirty_lock.lock_irqsave();
+    if (!all && over_dirty_ratio()) all = true;
+
+    block::Buffer *buf, *n;
+    list_for_each_entry_safe(buf, n, &dirty_list, m_dirty_link) {
+      // the list is in the order the buffers were dirtied
+      if (!all && now - buf->m_dirtied_at < DIRTY_EXPIRE_MS) break;
+      buf->m_dirty_link.del_init();
+      nr_dirty--;
+      batch.push(buf);
+    }
+    writeback_inflight++;
+    dirty_lock.unlock_irqrestore(f);
+
+    for (auto *b : batch) {
+      b->queue_io();
+    }
+
+    sort_batch(batch);
+    // buffers for consecutive pages of a device go out together
+    for (int i = 0; i < batch.size();) {
+      int n = 1;
+      while (i + n < batch.size() && n < MAX_IO_RUN && &batch[i + n]->bdev == &batch[i]->bdev &&
+             batch[i + n]->index() == batch[i]->index() + n)
+        n++;
+
+      if (n == 1) {
+        batch[i]->flush();
+      } else {
+        flush_run(&batch[i], n);
+      }
+      i += n;
     }
 
+    f = dirty_lock.lock_irqsave();
+    wb_stats.written += batch.size();
+    if (batch.size() > 0) wb_stats.batches++;
+    writeback_inflight--;
+    dirty_lock.unlock_irqrestore(f);
+    writeback_done.wake_up_all();
+
+    return batch.size();
+  }
+
+  void Buffer::release(struct Buffer *b) {
+    b->m_lock.lock();
 
-    // count is decremented here iff it is not dirty
+    // dirty buffers stay on the dirty list until they are written back, so
+    // we don't need to hold on to them here.
     b->m_count--;
 
 #if CONFIG_LOW_MEMORY
-    if (b->m_count == 0) {
+    if (b->m_count == 0 && !b->m_dirty) {
       b->m_page = nullptr;  // release the page
                             // return PGSIZE;
     }
@@ -133,24 +330,116 @@ namespace block {
     b->m_lock.unlock();
   }
 
+  void Buffer::queue_io(void) {
+    scoped_lock l(m_lock);
+    if (m_queued_at == 0) m_queued_at = time::now_us();
+  }
+
+  void Buffer::mark_clean(void) {
+    // We are no longer dirty. This is cleared before writing so a write that
+    // races with us will put the buffer back on the dirty list
+    bool f = dirty_lock.lock_irqsave();
+    if (!m_dirty_link.is_empty()) {
+      m_dirty_link.del_init();
+      nr_dirty--;
+    }
+    m_dirty = false;
+    dirty_lock.unlock_irqrestore(f);
+  }
+
   int Buffer::flush(void) {
     scoped_lock l(m_lock);
+    mark_clean();
 
     // flush even if we aren't dirty.
     if (m_page) {
-      auto bsize = bdev.block_size();
-      int blocks = PGSIZE / bsize;
+      int blocks = PGSIZE / bdev.block_size();
       auto *buf = (char *)p2v(m_page->pa());
 
-      for (int i = 0; i < blocks; i++) {
-        bdev.write_block(buf + (bsize * i), m_index * blocks + i);
-      }
+      auto dispatched = time::now_us();
+      auto queued = m_queued_at ? m_queued_at : dispatched;
+      bdev.io_dispatch();
+      bdev.write_blocks(m_index * blocks, buf, blocks);
+      bdev.io_complete(true, blocks, queued, dispatched);
     }
-    // we're no longer dirty!
-    m_dirty = false;
+    m_queued_at = 0;
     return 0;
   }
 
+  void Buffer::flush_run(struct Buffer **run, int n) {
+    auto &bdev = run[0]->bdev;
+    int blocks = PGSIZE / bdev.block_size();
+
+    // The pages aren't contiguous in memory, so the data is gathered into a
+    // bounce buffer. Each buffer is only locked while it is copied, and a
+    // write that races with us will dirty it again
+    auto *bounce = (char *)phys::kalloc(n);
+    auto dispatched = time::now_us();
+    auto queued = dispatched;
+    for (int i = 0; i < n; i++) {
+      auto *b = run[i];
+      scoped_lock l(b->m_lock);
+      b->mark_clean();
+      // dirty buffers always have a page, but be safe about it
+      if (b->m_page) {
+        memcpy(bounce + i * PGSIZE, p2v(b->m_page->pa()), PGSIZE);
+      } else {
+        memset(bounce + i * PGSIZE, 0, PGSIZE);
+      }
+      if (b->m_queued_at && b->m_queued_at < queued) queued = b->m_queued_at;
+      b->m_queued_at = 0;
+    }
+
+    bdev.io_dispatch();
+    bdev.write_blocks(run[0]->m_index * blocks, bounce, n * blocks);
+    bdev.io_complete(true, n * blocks, queued, dispatched);
+
+    phys::kfree(bounce, n);
+  }
+
+  void Buffer::read_run(struct Buffer **run, int n) {
+    auto &bdev = run[0]->bdev;
+    int blocks = PGSIZE / bdev.block_size();
+
+    // Read straight into physically contiguous pages, which are then
+    // handed to the buffers one page each
+    auto pa = (unsigned long)phys::alloc(n);
+    auto dispatched = time::now_us();
+    auto queued_at = dispatched;
+    for (int i = 0; i < n; i++) {
+      auto q = __atomic_load_n(&run[i]->m_queued_at, __ATOMIC_RELAXED);
+      if (q && q < queued_at) queued_at = q;
+    }
+    bdev.io_dispatch();
+    bdev.read_blocks(run[0]->m_index * blocks, p2v(pa), n * blocks);
+    bdev.io_complete(false, n * blocks, queued_at, dispatched);
+
+    for (int i = 0; i < n; i++) {
+      auto *b = run[i];
+      unsigned long page_pa = pa + i * PGSIZE;
+      scoped_lock l(b->m_lock);
+      if (b->m_page) {
+        // someone loaded (or wrote) it while we were reading
+        phys::free((void *)page_pa, 1);
+        continue;
+      }
+      auto page = ck::make_ref<mm::Page>();
+      page->set_pa(page_pa);
+      page->fset(PG_OWNED | PG_BCACHE);
+      b->m_page = page;
+      b->m_queued_at = 0;
+    }
+  }
+
+  void Buffer::zero(void) {
+    scoped_lock l(m_lock);
+    if (!m_page) {
+      m_page = mm::Page::alloc();
+      m_page->fset(PG_BCACHE);
+    }
+    memset(p2v(m_page->pa()), 0, PGSIZE);
+  }
+
   size_t Buffer::reclaim(void) {
     scoped_lock l(m_lock);
     if (m_count == 0 && m_page && !m_dirty) {
@@ -163,6 +452,8 @@ namespace block {
 
 
   void *Buffer::data(void) {
+    // a synchronous read is queued from the moment it is asked for
+    auto requested = time::now_us();
     scoped_lock l(m_lock);
     if (!m_page) {
       // get the page if there isn't one and read the blocks
@@ -172,9 +463,12 @@ namespace block {
       int blocks = PGSIZE / bdev.block_size();
       auto *buf = (char *)p2v(m_page->pa());
 
-      for (int i = 0; i < blocks; i++) {
-        auto res = bdev.read_block(buf + (bdev.block_size() * i), m_index * blocks + i);
-      }
+      auto dispatched = time::now_us();
+      auto queued = m_queued_at ? m_queued_at : requested;
+      bdev.io_dispatch();
+      bdev.read_blocks(m_index * blocks, buf, blocks);
+      bdev.io_complete(false, blocks, queued, dispatched);
+      m_queued_at = 0;
     }
 
 
@@ -259,7 +553,7 @@ static unsigned long blk_kshell(ck::vec<ck::string> &args, void *data, int dlen)
 
 
     if (args[0] == "dump") {
-      buffer_cache_lock.lock();
+      scoped_irqlock l(buffer_cache_lock);
 
       for (auto &blk : buffer_cache) {
         for (auto &off : blk.value) {
@@ -269,8 +563,6 @@ static unsigned long blk_kshell(ck::vec<ck::string> &args, void *data, int dlen)
         }
       }
 
-      buffer_cache_lock.unlock();
-
       return 0;
     }
   }
@@ -279,6 +571,7 @@ static unsigned long blk_kshell(ck::vec<ck::string> &args, void *data, int dlen)
 }
 static void block_init(void) {
   sched::proc::create_kthread("[block flush]", block_flush_task);
+  sched::proc::create_kthread("[block readahead]", block_readahead_task);
   kshell::add("blk", "blk [reclaim, dump]", blk_kshell);
 }
 
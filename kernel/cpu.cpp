@@ -26,7 +26,6 @@ void cpu::add(cpu::Core *cpu) {
 
 int cpu::nproc(void) { return processor_count; }
 
-cpu::Core *cpu::get() { return &cpu::current(); }
 
 cpu::Core *cpu::get(int id) {
   cpu::Core *core;
@@ -1,12 +1,13 @@
 #include <dev/driver.h>
 #include <printf.h>
+#include <time.h>
 
 // dev::Device::Device(void) : fs::Node(nullptr) {}
 dev::Device::Device(dev::Driver &driver, ck::ref<hw::Device> dev) : fs::Node(nullptr), m_driver(driver), m_dev(dev) {
   if (m_dev) m_dev->attach_to(this);
 }
 static spinlock names_lock;
-static ck::map<ck::string, ck::box<fs::DirectoryEntry>> names;
+static ck::map<ck::string, ck::ref<fs::DirectoryEntry>> names;
 
 
 dev::Device::~Device(void) {
@@ -25,7 +26,7 @@ void dev::Device::bind(ck::string name) {
     return;
   }
 
-  names[name] = ck::make_box<fs::DirectoryEntry>(name, this);
+  names[name] = ck::make_ref<fs::DirectoryEntry>(name, this);
 }
 
 
@@ -42,11 +43,53 @@ void dev::Device::unbind(void) {
 }
 
 
-scoped_irqlock dev::Device::lock_names(void) { return names_lock; }
+scoped_irqlock<spinlock> dev::Device::lock_names(void) { return names_lock; }
 
-ck::map<ck::string, ck::box<fs::DirectoryEntry>> &dev::Device::get_names(void) { return names; }
+ck::map<ck::string, ck::ref<fs::DirectoryEntry>> &dev::Device::get_names(void) { return names; }
 
 
 
 ssize_t dev::BlockDevice::read(fs::File &f, char *dst, size_t bytes) { return bread(*this, (void *)dst, bytes, f.offset()); }
 ssize_t dev::BlockDevice::write(fs::File &f, const char *dst, size_t bytes) { return bwrite(*this, (void *)dst, bytes, f.offset()); }
+ssize_t dev::BlockDevice::pread(fs::File &, char *dst, size_t bytes, off_t off) { return bread(*this, (void *)dst, bytes, off); }
+ssize_t dev::BlockDevice::pwrite(fs::File &, const char *dst, size_t bytes, off_t off) {
+  return bwrite(*this, (void *)dst, bytes, off);
+}
+
+
+
+static int iostat_bucket(uint64_t us) {
+  int b = us == 0 ? 0 : 63 - __builtin_clzll(us);
+  return b < IOSTAT_BUCKETS ? b : IOSTAT_BUCKETS - 1;
+}
+
+void dev::BlockDevice::io_dispatch(void) {
+  __atomic_add_fetch(&m_io.in_flight, 1, __ATOMIC_RELAXED);
+  if (m_io_parent) m_io_parent->io_dispatch();
+}
+
+void dev::BlockDevice::io_complete(bool write, int sectors, uint64_t queued_at, uint64_t dispatched_at) {
+  auto now = time::now_us();
+  __atomic_sub_fetch(&m_io.in_flight, 1, __ATOMIC_RELAXED);
+  if (write) {
+    __atomic_add_fetch(&m_io.writes, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m_io.write_sectors, sectors, __ATOMIC_RELAXED);
+  } else {
+    __atomic_add_fetch(&m_io.reads, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m_io.read_sectors, sectors, __ATOMIC_RELAXED);
+  }
+  __atomic_add_fetch(&m_io.lat_hist[iostat_bucket(now - dispatched_at)], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&m_io.queue_hist[iostat_bucket(dispatched_at - queued_at)], 1, __ATOMIC_RELAXED);
+
+  if (m_io_parent) m_io_parent->io_complete(write, sectors, queued_at, dispatched_at);
+}
+
+void dev::BlockDevice::io_merge(void) {
+  __atomic_add_fetch(&m_io.merges, 1, __ATOMIC_RELAXED);
+  if (m_io_parent) m_io_parent->io_merge();
+}
+
+void dev::BlockDevice::get_io_stats(dev::io_stats &out) {
+  // The counters are updated without a lock, so this is only a snapshot
+  memcpy(&out, &m_io, sizeof(out));
+}
@@ -18,6 +18,7 @@ dev::DiskPartition::DiskPartition(dev::Disk* parent, u32 start, u32 len) : dev::
   set_block_count(len);
   set_block_size(parent->block_size());
   set_size(block_count() * block_size());
+  set_io_parent(parent);
 }
 dev::DiskPartition::~DiskPartition() {}
 
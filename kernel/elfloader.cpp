@@ -130,7 +130,7 @@ int elf::load(const char *path, struct Process &p, mm::AddressSpace &mm, ck::ref
 
 
   p.file_lock.lock();
-  p.open_files[MAGICFD_EXEC] = fd;
+  // get_fd(MAGICFD_EXEC) finds it here
   p.executable = fd;
   p.tls_info.exists = false;
   p.file_lock.unlock();
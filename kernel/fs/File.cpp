@@ -40,6 +40,12 @@ fs::File::~File(void) {
 }
 
 
+void fs::File::ref_release(void) {
+  if (__atomic_sub_fetch(&m_ref_count, 1, __ATOMIC_ACQ_REL) != 0) return;
+  call_rcu(&rcu, [](struct rcu_head *head) { delete container_of(head, fs::File, rcu); });
+}
+
+
 off_t fs::File::seek(off_t offset, int whence) {
   // TODO: check if the file is actually seekable
   //
@@ -84,7 +90,68 @@ ssize_t fs::File::write(void *data, ssize_t len) {
   return ino->write(*this, (char *)data, len);
 }
 
+ssize_t fs::File::pread(void *dst, ssize_t len, off_t off) {
+  if (!ino) return -ENOENT;
+  if (off < 0) return -EINVAL;
+  return ino->pread(*this, (char *)dst, len, off);
+}
+
+ssize_t fs::File::pwrite(void *data, ssize_t len, off_t off) {
+  if (!ino) return -ENOENT;
+  if (off < 0) return -EINVAL;
+  return ino->pwrite(*this, (char *)data, len, off);
+}
+
+ssize_t fs::File::readv(const struct iovec *iov, int iovcnt, off_t off) {
+  if (!ino) return -ENOENT;
+  if (off < -1) return -EINVAL;
+  return ino->readv(*this, iov, iovcnt, off);
+}
+
+ssize_t fs::File::writev(const struct iovec *iov, int iovcnt, off_t off) {
+  if (!ino) return -ENOENT;
+  if (off < -1) return -EINVAL;
+  return ino->writev(*this, iov, iovcnt, off);
+}
+
 int fs::File::ioctl(int cmd, unsigned long arg) {
   if (!ino) return -ENOENT;
   return ino->ioctl(*this, cmd, arg);
 }
+
+
+
+// readahead windows start small and double up to this many pages
+#define READAHEAD_MIN_PAGES 4
+#define READAHEAD_MAX_PAGES 64
+
+bool fs::readahead_state::update(off_t off, size_t len, off_t &ra_start, int &ra_pages) {
+  bool sequential = off == next_off;
+  next_off = off + len;
+
+  // random access (or a zero length read) collapses the window
+  if (!sequential || len == 0) {
+    start = 0;
+    size = 0;
+    return false;
+  }
+
+  off_t last = (off + len - 1) / PGSIZE;
+  if (size == 0) {
+    // start a new window right after this read
+    start = last + 1;
+    size = READAHEAD_MIN_PAGES;
+  } else if (last >= start) {
+    // the reader has caught up to the last window, so issue the next one
+    // ahead of it before it has to wait.
+    start = max(start + size, last + 1);
+    size = min(size * 2, READAHEAD_MAX_PAGES);
+  } else {
+    // still consuming the previous window
+    return false;
+  }
+
+  ra_start = start;
+  ra_pages = size;
+  return true;
+}
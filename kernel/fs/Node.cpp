@@ -21,6 +21,8 @@ fs::Node::~Node() {}
 int fs::Node::seek_check(fs::File &, off_t old_off, off_t new_off) { return 0; }
 ssize_t fs::Node::read(fs::File &, char *dst, size_t count) { return -ENOTIMPL; }
 ssize_t fs::Node::write(fs::File &, const char *, size_t) { return -ENOTIMPL; }
+ssize_t fs::Node::pread(fs::File &, char *, size_t, off_t) { return -ESPIPE; }
+ssize_t fs::Node::pwrite(fs::File &, const char *, size_t, off_t) { return -ESPIPE; }
 int fs::Node::ioctl(fs::File &, unsigned int, off_t) { return -ENOTIMPL; }
 int fs::Node::open(fs::File &) { return 0; }
 void fs::Node::close(fs::File &) {}
@@ -29,6 +31,34 @@ int fs::Node::resize(fs::File &, size_t) { return -ENOTIMPL; }
 int fs::Node::poll(fs::File &, int events, poll_table &pt) { return 0; }
 
 
+ssize_t fs::Node::readv(fs::File &file, const struct iovec *iov, int iovcnt, off_t off) {
+  ssize_t done = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    auto *buf = (char *)iov[i].iov_base;
+    size_t len = iov[i].iov_len;
+    ssize_t n = off == -1 ? read(file, buf, len) : pread(file, buf, len, off + done);
+    // report the error only if nothing was read before it
+    if (n < 0) return done ? done : n;
+    done += n;
+    if ((size_t)n < len) break;
+  }
+  return done;
+}
+
+ssize_t fs::Node::writev(fs::File &file, const struct iovec *iov, int iovcnt, off_t off) {
+  ssize_t done = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    auto *buf = (const char *)iov[i].iov_base;
+    size_t len = iov[i].iov_len;
+    ssize_t n = off == -1 ? write(file, buf, len) : pwrite(file, buf, len, off + done);
+    if (n < 0) return done ? done : n;
+    done += n;
+    if ((size_t)n < len) break;
+  }
+  return done;
+}
+
+
 int fs::Node::stat(struct stat *stat) {
   memset(stat, 0, sizeof(*stat));
 
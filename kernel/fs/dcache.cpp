@@ -0,0 +1,216 @@
+#include <cpu.h>
+#include <fs/FileSystem.h>
+#include <fs/vfs.h>
+#include <lock.h>
+#include <rcu.h>
+
+/**
+ * The dentry cache remembers what a name resolved to in a directory, keyed by
+ * (directory node, name). Both positive entries and negative (name does not
+ * exist) entries are kept, so repeated path walks never reach the filesystem.
+ *
+ * The cache is a fixed set-associative table. Lookups don't take any locks:
+ * each entry has a sequence count that is odd while it is being rewritten,
+ * and a reader only trusts an entry if the count was even and unchanged
+ * across its read. Updates are serialized by `dcache_lock` and evict the
+ * least recently used way of a set.
+ *
+ * The cache holds a reference to the directory and to the node of every
+ * entry. Lookups are RCU readers: one may still be looking at an entry a
+ * writer just replaced, so the old references are released with call_rcu
+ * once every lookup that could have seen them is done.
+ */
+
+#define DCACHE_SETS 256
+#define DCACHE_WAYS 4
+// names longer than this are not cached
+#define DNAME_INLINE_LEN 40
+
+struct dentry {
+  uint32_t seq;  // odd while the entry is being written
+  uint32_t hash;
+  uint64_t last_used;
+  fs::Node *dir;   // nullptr if the entry is unused
+  fs::Node *node;  // nullptr for a negative entry
+  uint8_t namelen;
+  char name[DNAME_INLINE_LEN];
+};
+
+static struct dentry dcache[DCACHE_SETS][DCACHE_WAYS];
+static spinlock dcache_lock;
+// bumped on every insert, and used to order entries for eviction
+static uint64_t dcache_clock = 0;
+// bumped by dcache_purge, which invalidates every directory at once
+static uint32_t dcache_purge_gen = 0;
+
+// references unpublished from the table, waiting for a grace period
+struct dcache_retired {
+  struct rcu_head rcu;
+  ck::vec<fs::Node *> nodes;
+};
+
+
+static inline uint32_t dcache_hash(fs::Node *dir, const char *name, int len) {
+  // FNV-1a over the name, mixed with the directory pointer
+  uint32_t h = 2166136261U;
+  for (int i = 0; i < len; i++) {
+    h ^= (uint8_t)name[i];
+    h *= 16777619U;
+  }
+  uint64_t p = (uint64_t)dir;
+  return h ^ (uint32_t)(p >> 4) ^ (uint32_t)(p >> 32);
+}
+
+
+// Names in synthetic filesystems (devfs, procfs...) come and go without
+// going through the vfs, so they can't be cached.
+static inline bool dcache_cacheable(fs::Node *dir) { return dir->sb && dir->sb->dcache; }
+
+
+// called with dcache_lock held. Unpublishes an entry, and adds its references
+// to `retired`
+static void dentry_clear(struct dentry &d, ck::vec<fs::Node *> &retired) {
+  if (d.dir == nullptr) return;
+  __atomic_add_fetch(&d.seq, 1, __ATOMIC_RELEASE);
+  retired.push(d.dir);
+  if (d.node) retired.push(d.node);
+  d.dir = nullptr;
+  d.node = nullptr;
+  __atomic_add_fetch(&d.seq, 1, __ATOMIC_RELEASE);
+}
+
+
+static void dcache_free_retired(struct rcu_head *head) {
+  auto *r = container_of(head, struct dcache_retired, rcu);
+  // this may destroy nodes, which is fine in the [rcu] thread
+  for (auto *n : r->nodes)
+    n->ref_release();
+  delete r;
+}
+
+
+// Called after dropping dcache_lock. Lookups that started before the
+// references were unpublished might still be using them, so they are
+// released after a grace period.
+static void dcache_retire(ck::vec<fs::Node *> &retired) {
+  if (retired.size() == 0) return;
+  auto *r = new dcache_retired;
+  r->nodes = move(retired);
+  call_rcu(&r->rcu, dcache_free_retired);
+}
+
+
+bool vfs::dcache_lookup(fs::Node *dir, const char *name, ck::ref<fs::Node> &res) {
+  int len = strlen(name);
+  if (len >= DNAME_INLINE_LEN || !dcache_cacheable(dir)) return false;
+
+  uint32_t hash = dcache_hash(dir, name, len);
+  auto &set = dcache[hash % DCACHE_SETS];
+
+  bool hit = false;
+  rcu_read_lock();
+  for (auto &d : set) {
+    uint32_t seq = __atomic_load_n(&d.seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) continue;
+
+    if (d.dir != dir || d.hash != hash || d.namelen != len || memcmp(d.name, name, len) != 0) continue;
+    fs::Node *node = d.node;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&d.seq, __ATOMIC_RELAXED) != seq) continue;
+
+    // We are in a read-side section, so even if this entry was replaced
+    // since we read it, the node can't have been released yet.
+    res = node;
+    hit = true;
+    // racy, but this only orders entries for eviction
+    if (d.last_used != dcache_clock) d.last_used = dcache_clock;
+    break;
+  }
+  rcu_read_unlock();
+
+  return hit;
+}
+
+
+uint64_t vfs::dcache_generation(fs::Node *dir) {
+  uint64_t purge = __atomic_load_n(&dcache_purge_gen, __ATOMIC_ACQUIRE);
+  return (purge << 32) | __atomic_load_n(&dir->dcache_gen, __ATOMIC_ACQUIRE);
+}
+
+
+void vfs::dcache_insert(fs::Node *dir, const char *name, ck::ref<fs::Node> node, uint64_t gen) {
+  int len = strlen(name);
+  if (len >= DNAME_INLINE_LEN || !dcache_cacheable(dir)) return;
+
+  uint32_t hash = dcache_hash(dir, name, len);
+  auto &set = dcache[hash % DCACHE_SETS];
+  ck::vec<fs::Node *> retired;
+
+  bool f = dcache_lock.lock_irqsave();
+
+  // the directory changed while the caller was looking the name up, so
+  // `node` may already be stale
+  if (vfs::dcache_generation(dir) != gen) {
+    dcache_lock.unlock_irqrestore(f);
+    return;
+  }
+
+  // replace an existing entry for this name, or the least recently used way
+  struct dentry *victim = &set[0];
+  for (auto &d : set) {
+    if (d.dir == dir && d.hash == hash && d.namelen == len && memcmp(d.name, name, len) == 0) {
+      victim = &d;
+      break;
+    }
+    if (victim->dir != nullptr && (d.dir == nullptr || d.last_used < victim->last_used)) victim = &d;
+  }
+
+  dentry_clear(*victim, retired);
+
+  __atomic_add_fetch(&victim->seq, 1, __ATOMIC_RELEASE);
+  dir->ref_retain();
+  victim->dir = dir;
+  victim->node = node.leak_ref();
+  victim->hash = hash;
+  victim->namelen = len;
+  memcpy(victim->name, name, len);
+  victim->last_used = ++dcache_clock;
+  __atomic_add_fetch(&victim->seq, 1, __ATOMIC_RELEASE);
+
+  dcache_lock.unlock_irqrestore(f);
+  dcache_retire(retired);
+}
+
+
+void vfs::dcache_invalidate(fs::Node *dir, const char *name) {
+  int len = strlen(name);
+  if (len >= DNAME_INLINE_LEN) return;
+
+  uint32_t hash = dcache_hash(dir, name, len);
+  auto &set = dcache[hash % DCACHE_SETS];
+  ck::vec<fs::Node *> retired;
+
+  bool f = dcache_lock.lock_irqsave();
+  __atomic_add_fetch(&dir->dcache_gen, 1, __ATOMIC_RELEASE);
+  for (auto &d : set) {
+    if (d.dir == dir && d.hash == hash && d.namelen == len && memcmp(d.name, name, len) == 0) {
+      dentry_clear(d, retired);
+    }
+  }
+  dcache_lock.unlock_irqrestore(f);
+  dcache_retire(retired);
+}
+
+
+void vfs::dcache_purge(void) {
+  ck::vec<fs::Node *> retired;
+  bool f = dcache_lock.lock_irqsave();
+  __atomic_add_fetch(&dcache_purge_gen, 1, __ATOMIC_RELEASE);
+  for (auto &set : dcache) {
+    for (auto &d : set)
+      dentry_clear(d, retired);
+  }
+  dcache_lock.unlock_irqrestore(f);
+  dcache_retire(retired);
+}
@@ -13,29 +13,29 @@ int devfs::DirectoryNode::mkdir(ck::string name, fs::Ownership &own) { return -E
 int devfs::DirectoryNode::unlink(ck::string name) { return -ENOTIMPL; }
 ck::ref<fs::Node> devfs::DirectoryNode::lookup(ck::string name) { return nullptr; }
 
-ck::vec<fs::DirectoryEntry *> devfs::DirectoryNode::dirents(void) {
-  ck::vec<fs::DirectoryEntry *> res;
+ck::vec<ck::ref<fs::DirectoryEntry>> devfs::DirectoryNode::dirents(void) {
+  ck::vec<ck::ref<fs::DirectoryEntry>> res;
   for (auto &[name, ent] : entries)
-    res.push(ent.get());
+    res.push(ent);
 
   auto l = dev::Device::lock_names();
   const auto &names = dev::Device::get_names();
   for (auto &[name, ent] : names)
-    res.push(ent.get());
+    res.push(ent);
   return res;
 }
 
-fs::DirectoryEntry *devfs::DirectoryNode::get_direntry(ck::string name) {
+ck::ref<fs::DirectoryEntry> devfs::DirectoryNode::get_direntry(ck::string name) {
   auto f = entries.find(name);
   if (f != entries.end()) {
-    return f->value.get();
+    return f->value;
   }
 
 
   auto l = dev::Device::lock_names();
   const auto &names = dev::Device::get_names();
   auto df = names.find(name);
-  if (df != names.end()) return df->value.get();
+  if (df != names.end()) return df->value;
 
   // TODO: search named device nodes
   return nullptr;
@@ -43,12 +43,14 @@ fs::DirectoryEntry *devfs::DirectoryNode::get_direntry(ck::string name) {
 
 int devfs::DirectoryNode::link(ck::string name, ck::ref<fs::Node> node) {
   if (entries.contains(name)) return -EEXIST;
-  auto ent = ck::make_box<fs::DirectoryEntry>(name, node);
+  auto ent = ck::make_ref<fs::DirectoryEntry>(name, node);
   entries[name] = move(ent);
   return 0;
 }
 
 devfs::FileSystem::FileSystem(ck::string args, int flags) {
+  // devices come and go behind the vfs' back
+  dcache = false;
   root = ck::make_ref<devfs::DirectoryNode>(this);
   root->link(".", root);
   root->link("..", root);
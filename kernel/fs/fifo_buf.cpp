@@ -1,49 +1,102 @@
 #include <cpu.h>
 #include <errno.h>
 #include <fifo_buf.h>
+#include <mm.h>
 #include <phys.h>
 #include <sched.h>
 #include <sleep.h>
 #include <util.h>
 
-size_t fifo_buf::available(void) {
-  if (read_ptr == write_ptr) {
-    return m_size - 1;
-  }
 
-  if (read_ptr > write_ptr) {
-    return read_ptr - write_ptr - 1;
-  } else {
-    return (m_size - write_ptr) + read_ptr - 1;
-  }
+fifo_buf::fifo_buf(void) {}
+
+
+fifo_buf::~fifo_buf(void) {
+  if (m_pages != nullptr) phys::kfree(m_pages, FIFO_SEGMENTS);
 }
 
 
-size_t fifo_buf::unread(void) {
-  if (read_ptr == write_ptr) {
-    return 0;
+bool fifo_buf::alloc_pages(void) {
+  if (__atomic_load_n(&m_pages, __ATOMIC_ACQUIRE) != nullptr) return true;
+
+  auto *pages = (char *)phys::kalloc(FIFO_SEGMENTS);
+  if (pages == nullptr) return false;
+
+  scoped_irqlock l(lock);
+  // someone else got here first
+  if (m_pages != nullptr) {
+    phys::kfree(pages, FIFO_SEGMENTS);
+    return true;
   }
-  if (read_ptr > write_ptr) {
-    return (m_size - read_ptr) + write_ptr;
-  } else {
-    return (write_ptr - read_ptr);
+  for (int i = 0; i < FIFO_SEGMENTS; i++)
+    m_spare[m_nspare++] = pages + i * PGSIZE;
+  __atomic_store_n(&m_pages, pages, __ATOMIC_RELEASE);
+  return true;
+}
+
+
+size_t fifo_buf::available(void) {
+  size_t avail = (FIFO_SEGMENTS - m_count) * PGSIZE;
+  if (m_count > 0) {
+    // the last segment can still be appended to if it is one of ours
+    auto &tail = m_segs[(m_head + m_count - 1) % FIFO_SEGMENTS];
+    if (!tail.page) avail += PGSIZE - tail.end;
   }
+  return avail;
 }
 
 
+size_t fifo_buf::unread(void) { return m_unread; }
+
 
-void fifo_buf::increment_read(void) {
-  read_ptr++;
-  if (read_ptr == m_size) {
-    read_ptr = 0;
+size_t fifo_buf::push(const char *src, size_t len) {
+  segment *seg = nullptr;
+  if (m_count > 0) {
+    seg = &m_segs[(m_head + m_count - 1) % FIFO_SEGMENTS];
+    if (seg->page || seg->end == PGSIZE) seg = nullptr;
   }
+
+  if (seg == nullptr) {
+    if (m_count == FIFO_SEGMENTS) return 0;
+    // There is always a spare page for a free segment, as each segment holds
+    // at most one of ours
+    seg = &m_segs[(m_head + m_count) % FIFO_SEGMENTS];
+    seg->data = m_spare[--m_nspare];
+    seg->start = seg->end = 0;
+    m_count++;
+  }
+
+  size_t n = min(len, PGSIZE - seg->end);
+  memcpy(seg->data + seg->end, src, n);
+  seg->end += n;
+  m_unread += n;
+  return n;
 }
 
-void fifo_buf::increment_write(void) {
-  write_ptr++;
-  if (write_ptr == m_size) {
-    write_ptr = 0;
+
+size_t fifo_buf::pop(char *dst, size_t len, ck::ref<mm::Page> &drop) {
+  if (m_count == 0) return 0;
+
+  auto &seg = m_segs[m_head];
+  size_t n = min(len, (size_t)(seg.end - seg.start));
+  memcpy(dst, seg.data + seg.start, n);
+  seg.start += n;
+  m_unread -= n;
+
+  if (seg.start == seg.end) {
+    // Release the segment. Someone else's page is dropped by the caller once
+    // the lock is released
+    if (seg.page) {
+      drop = seg.page;
+      seg.page = nullptr;
+    } else {
+      m_spare[m_nspare++] = seg.data;
+    }
+    seg.data = nullptr;
+    m_head = (m_head + 1) % FIFO_SEGMENTS;
+    m_count--;
   }
+  return n;
 }
 
 
@@ -56,89 +109,144 @@ void fifo_buf::close(void) {
 }
 
 
-void fifo_buf::init_if_needed(void) {
-  if (buffer == NULL) {
-    m_size = 4096 * 16;  // 16 pages
-    buffer = (char *)malloc(m_size);
-  }
+wait_result fifo_buf::wait_until(struct wait_queue &wq, bool readable) {
+  struct wait_entry ent;
+  wait_result res;
+
+  // queue up before checking, so a wakeup in between isn't lost
+  prepare_to_wait(wq, ent, true);
+  auto flags = lock.lock_irqsave();
+  bool ready = m_closed || (readable ? unread() > 0 : available() > 0);
+  lock.unlock_irqrestore(flags);
+
+  if (!ready) res = do_wait(ent);
+  finish_wait(wq, ent);
+  return res;
 }
 
 
+static inline bool is_user_buffer(const void *buf) { return (off_t)buf <= USERSPACE_HIGH_ADDR; }
+
+
 ssize_t fifo_buf::write(const void *vbuf, ssize_t size, bool block) {
-  init_if_needed();
+  if (!is_user_buffer(vbuf)) return do_write((const char *)vbuf, size, block, nullptr);
 
-  auto ibuf = (char *)vbuf;
+  auto *bounce = (char *)phys::kalloc(1);
+  if (bounce == nullptr) return -ENOMEM;
+  ssize_t res = do_write((const char *)vbuf, size, block, bounce);
+  phys::kfree(bounce, 1);
+  return res;
+}
 
-  size_t written = 0;
-  while (written < size) {
-    auto flags = lock.lock_irqsave();
 
-    while (available() > 0 && written < size) {
-      buffer[write_ptr] = ibuf[written];
-      increment_write();
-      written++;
+ssize_t fifo_buf::do_write(const char *ibuf, ssize_t size, bool block, char *bounce) {
+  if (size > 0 && !alloc_pages()) return -ENOMEM;
+
+  ssize_t written = 0;
+  while (written < size) {
+    const char *src = ibuf + written;
+    size_t want = size - written;
+    if (bounce != nullptr) {
+      want = min(want, PGSIZE);
+      memcpy(bounce, src, want);
+      src = bounce;
     }
 
-    wq_readers.wake_up_all();
+    auto flags = lock.lock_irqsave();
+    size_t n = push(src, want);
+    if (n > 0) wq_readers.wake_up_all();
     lock.unlock_irqrestore(flags);
 
-    if (!block) return -EAGAIN;
+    written += n;
+    if (n > 0) continue;
 
-    if (written < size) {
-      if (wq_writers.wait().interrupted()) {
-        if (written > 0) return written;
-        return -EINTR;
-      }
-      if (m_closed) return -ECONNRESET;
+    // the fifo is full
+    if (!block) break;
+    if (wait_until(wq_writers, false).interrupted()) {
+      if (written > 0) return written;
+      return -EINTR;
     }
+    if (m_closed) return -ECONNRESET;
   }
 
+  if (written == 0 && size > 0) return -EAGAIN;
   return written;
 }
 
 
-ssize_t fifo_buf::read(void *vbuf, ssize_t size, bool block, long long timeout_us) {
-  init_if_needed();
-
-  if (!block) {
-    scoped_irqlock l(lock);
+ssize_t fifo_buf::write_page(ck::ref<mm::Page> page, size_t off, size_t len, bool block) {
+  if (off + len > PGSIZE) return -EINVAL;
+  if (len == 0) return 0;
 
-    if (unread() == 0) {
-      if (m_closed) return 0;
-      return -EAGAIN;
+  while (true) {
+    auto flags = lock.lock_irqsave();
+    if (m_count < FIFO_SEGMENTS) {
+      auto &seg = m_segs[(m_head + m_count) % FIFO_SEGMENTS];
+      seg.page = page;
+      seg.data = (char *)p2v(page->pa());
+      seg.start = off;
+      seg.end = off + len;
+      m_count++;
+      m_unread += len;
+      wq_readers.wake_up_all();
+      lock.unlock_irqrestore(flags);
+      return len;
     }
+    lock.unlock_irqrestore(flags);
+
+    if (m_closed) return -ECONNRESET;
+    if (!block) return -EAGAIN;
+    if (wait_until(wq_writers, false).interrupted()) return -EINTR;
   }
+}
 
-  auto obuf = (char *)vbuf;
 
-  size_t collected = 0;
-  while (collected == 0) {
-    auto flags = lock.lock_irqsave();
+ssize_t fifo_buf::read(void *vbuf, ssize_t size, bool block, long long timeout_us) {
+  if (size <= 0) return 0;
+  if (!is_user_buffer(vbuf)) return do_read((char *)vbuf, size, block, timeout_us, nullptr);
+
+  auto *bounce = (char *)phys::kalloc(1);
+  if (bounce == nullptr) return -ENOMEM;
+  ssize_t res = do_read((char *)vbuf, size, block, timeout_us, bounce);
+  phys::kfree(bounce, 1);
+  return res;
+}
 
-    while (unread() > 0 && collected < size) {
-      obuf[collected] = buffer[read_ptr];
-      increment_read();
-      collected++;
+
+ssize_t fifo_buf::do_read(char *obuf, ssize_t size, bool block, long long timeout_us, char *bounce) {
+  ssize_t collected = 0;
+  while (true) {
+    char *dst = obuf + collected;
+    size_t want = size - collected;
+    if (bounce != nullptr) {
+      want = min(want, PGSIZE);
+      dst = bounce;
     }
 
-    wq_writers.wake_up_all();
+    ck::ref<mm::Page> drop;
+    auto flags = lock.lock_irqsave();
+    size_t n = pop(dst, want, drop);
+    if (n > 0) wq_writers.wake_up_all();
     lock.unlock_irqrestore(flags);
 
-    // break early if we are not meant to block
-    if (!block) break;
+    if (bounce != nullptr) memcpy(obuf + collected, bounce, n);
+
+    collected += n;
+    if (n > 0 && collected < size) continue;
+    if (collected > 0) break;
+
+    // there is nothing to read
+    if (m_closed) return 0;
+    if (!block) return -EAGAIN;
 
-    if (collected == 0) {
-      if (timeout_us != -1) {
-        auto result = wq_readers.wait_timeout(timeout_us);
-        if (result.interrupted()) return -EINTR;
-        if (result.timed_out()) return -ETIMEDOUT;
-      } else {
-        if (wq_readers.wait().interrupted()) {
-          // We haven't read anything anyways, just return that there was an
-          // interrupt due to signals.
-          return -EINTR;
-        }
-      }
+    if (timeout_us != -1) {
+      auto result = wq_readers.wait_timeout(timeout_us);
+      if (result.interrupted()) return -EINTR;
+      if (result.timed_out()) return -ETIMEDOUT;
+    } else {
+      // We haven't read anything anyways, just return that there was an
+      // interrupt due to signals.
+      if (wait_until(wq_readers, true).interrupted()) return -EINTR;
     }
   }
 
@@ -146,7 +254,7 @@ ssize_t fifo_buf::read(void *vbuf, ssize_t size, bool block, long long timeout_u
 }
 
 void fifo_buf::stats(size_t &avail, size_t &unread) {
-  scoped_lock l(lock);
+  scoped_irqlock l(lock);
 
   avail = this->available();
   unread = this->unread();
@@ -0,0 +1,245 @@
+#include <fs/Node.h>
+#include <fs/PageCache.h>
+#include <module.h>
+#include <mutex.h>
+#include <phys.h>
+#include <util.h>
+
+// every evictable page cache, so they can be shrunk when memory is low. Held
+// while they are, which can write dirty pages back
+static mutex pcache_list_lock;
+static struct list_head pcache_list;
+
+static uint64_t pcache_cached = 0;
+static uint64_t pcache_hits = 0;
+static uint64_t pcache_misses = 0;
+static uint64_t pcache_evictions = 0;
+
+
+fs::PageCache::PageCache(fs::PageCache::Backing &backing, bool evictable) : backing(backing), evictable(evictable) {
+  if (evictable) {
+    scoped_lock l(pcache_list_lock);
+    pcache_list.add_tail(&cache_link);
+  }
+}
+
+
+fs::PageCache::~PageCache(void) {
+  if (evictable) {
+    scoped_lock l(pcache_list_lock);
+    cache_link.del_init();
+  }
+  truncate(0);
+}
+
+
+void fs::PageCache::put(off_t index, entry &e) {
+  backing.put_page(index, *e.page, e.priv);
+  e.page = nullptr;
+  __atomic_sub_fetch(&pcache_cached, 1, __ATOMIC_RELAXED);
+}
+
+
+ck::ref<mm::Page> fs::PageCache::get(off_t index, bool fill) {
+  lock.lock();
+  auto it = pages.find(index);
+  if (it != pages.end()) {
+    ck::ref<mm::Page> page = it->value.page;
+    lock.unlock();
+    __atomic_add_fetch(&pcache_hits, 1, __ATOMIC_RELAXED);
+    return page;
+  }
+  lock.unlock();
+
+  // the filesystem might have to read from the disk, so don't hold the lock
+  __atomic_add_fetch(&pcache_misses, 1, __ATOMIC_RELAXED);
+  entry e;
+  e.page = backing.get_page(index, fill, e.priv);
+  if (!e.page) return nullptr;
+
+  lock.lock();
+  auto raced = pages.find(index);
+  if (raced != pages.end()) {
+    // someone else brought it in while we were
+    ck::ref<mm::Page> page = raced->value.page;
+    lock.unlock();
+    backing.put_page(index, *e.page, e.priv);
+    return page;
+  }
+  ck::ref<mm::Page> page = e.page;
+  // everything but the reference we are about to return
+  e.idle_refs = page->ref_count() - 1;
+  pages.set(index, e);
+  lock.unlock();
+
+  __atomic_add_fetch(&pcache_cached, 1, __ATOMIC_RELAXED);
+  return page;
+}
+
+
+void fs::PageCache::dirty(off_t index) {
+  lock.lock();
+  auto it = pages.find(index);
+  if (it == pages.end()) {
+    lock.unlock();
+    return;
+  }
+  entry e = it->value;
+  lock.unlock();
+
+  // our copy of the entry keeps the page alive even if it is evicted now
+  backing.dirty_page(index, *e.page, e.priv);
+}
+
+
+void fs::PageCache::truncate(off_t index) {
+  ck::vec<off_t> indexes;
+  ck::vec<entry> dropped;
+
+  lock.lock();
+  for (auto &[off, e] : pages) {
+    if (off >= index) indexes.push(off);
+  }
+  for (auto off : indexes) {
+    dropped.push(pages.find(off)->value);
+    pages.remove(off);
+  }
+  lock.unlock();
+
+  for (int i = 0; i < dropped.size(); i++)
+    put(indexes[i], dropped[i]);
+}
+
+
+size_t fs::PageCache::shrink(void) {
+  if (!evictable) return 0;
+
+  ck::vec<off_t> indexes;
+  ck::vec<entry> dropped;
+
+  lock.lock();
+
+  for (auto &[off, e] : pages) {
+    // still mapped, or someone is copying in or out of it right now
+    if (e.page->users() != 0 || e.page->ref_count() != e.idle_refs) continue;
+    indexes.push(off);
+  }
+  for (auto off : indexes) {
+    dropped.push(pages.find(off)->value);
+    pages.remove(off);
+  }
+  lock.unlock();
+
+  for (int i = 0; i < dropped.size(); i++) {
+    auto &e = dropped[i];
+    // writes through a shared mapping are only noticed here
+    if (e.page->fcheck(PG_DIRTY)) {
+      e.page->fclr(PG_DIRTY);
+      backing.dirty_page(indexes[i], *e.page, e.priv);
+    }
+    put(indexes[i], e);
+  }
+
+  __atomic_add_fetch(&pcache_evictions, dropped.size(), __ATOMIC_RELAXED);
+  return dropped.size();
+}
+
+
+size_t fs::PageCache::size(void) {
+  scoped_lock l(lock);
+  return pages.size();
+}
+
+
+ssize_t fs::PageCache::read(void *dst, size_t count, off_t off) {
+  auto *out = (char *)dst;
+  size_t done = 0;
+
+  while (done < count) {
+    off_t pos = off + done;
+    size_t page_off = pos % PGSIZE;
+    size_t n = min(PGSIZE - page_off, count - done);
+
+    auto page = get(pos / PGSIZE);
+    if (!page) break;
+    memcpy(out + done, (char *)p2v(page->pa()) + page_off, n);
+    done += n;
+  }
+
+  return done;
+}
+
+
+ssize_t fs::PageCache::write(const void *src, size_t count, off_t off) {
+  auto *in = (const char *)src;
+  size_t done = 0;
+
+  while (done < count) {
+    off_t pos = off + done;
+    size_t page_off = pos % PGSIZE;
+    size_t n = min(PGSIZE - page_off, count - done);
+
+    // a page that is completely overwritten doesn't have to be read first
+    auto page = get(pos / PGSIZE, n != PGSIZE);
+    if (!page) break;
+    memcpy((char *)p2v(page->pa()) + page_off, in + done, n);
+    dirty(pos / PGSIZE);
+    done += n;
+  }
+
+  return done;
+}
+
+
+
+struct PageCacheVMObject final : public mm::VMObject {
+  PageCacheVMObject(ck::ref<fs::Node> owner, fs::PageCache &cache, size_t npages, off_t first)
+      : VMObject(npages), m_owner(owner), m_cache(cache), m_first(first) {}
+
+  virtual ~PageCacheVMObject(void) {}
+
+  virtual ck::ref<mm::Page> get_shared(off_t n) override {
+    auto page = m_cache.get(m_first + n);
+    // past the end of the file, the mapping is zero filled
+    if (!page) page = mm::Page::alloc();
+    return page;
+  }
+
+  virtual void flush(off_t n) override { m_cache.dirty(m_first + n); }
+
+ private:
+  ck::ref<fs::Node> m_owner;
+  fs::PageCache &m_cache;
+  off_t m_first;
+};
+
+
+ck::ref<mm::VMObject> fs::PageCache::mmap(ck::ref<fs::Node> owner, size_t npages, off_t off) {
+  if (off & (PGSIZE - 1)) return nullptr;
+  return ck::make_ref<PageCacheVMObject>(owner, *this, npages, off / PGSIZE);
+}
+
+
+void fs::get_pcache_stats(struct fs::pcache_stats &st) {
+  st.cached = __atomic_load_n(&pcache_cached, __ATOMIC_RELAXED);
+  st.hits = __atomic_load_n(&pcache_hits, __ATOMIC_RELAXED);
+  st.misses = __atomic_load_n(&pcache_misses, __ATOMIC_RELAXED);
+  st.evictions = __atomic_load_n(&pcache_evictions, __ATOMIC_RELAXED);
+}
+
+
+static size_t pcache_reclaim(void) {
+  size_t evicted = 0;
+  scoped_lock l(pcache_list_lock);
+
+  fs::PageCache *cache;
+  list_for_each_entry(cache, &pcache_list, cache_link) {
+    evicted += cache->shrink();
+  }
+
+  return evicted * PGSIZE;
+}
+
+static void pcache_init(void) { phys::register_reclaimer(pcache_reclaim); }
+
+module_init("fs::pagecache", pcache_init);
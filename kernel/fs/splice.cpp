@@ -0,0 +1,152 @@
+#include <fcntl.h>
+#include <fifo_buf.h>
+#include <fs.h>
+#include <fs/PageCache.h>
+#include <phys.h>
+
+// how many pages of the source to load ahead of the copy at once
+#define SPLICE_PREFETCH 32
+
+
+// Write `len` bytes from a kernel buffer to `out`, at `*out_off` if there is one
+static ssize_t splice_out(fs::File &out, off_t *out_off, void *src, size_t len) {
+  if (!out_off) return out.write(src, len);
+
+  ssize_t n = out.pwrite(src, len, *out_off);
+  if (n > 0) *out_off += n;
+  return n;
+}
+
+
+static void splice_consumed(fs::File &in, off_t *in_off, size_t n) {
+  if (in_off)
+    *in_off += n;
+  else
+    in.seek(n, SEEK_CUR);
+}
+
+
+// The source keeps its data in a page cache, so write straight from the cached
+// pages. The reference we hold keeps each page alive while it is written out
+static ssize_t splice_cached(fs::File &in, fs::PageCache &cache, off_t *in_off, fs::File &out, off_t *out_off,
+                             size_t len) {
+  ssize_t done = 0;
+  off_t prefetched = 0;
+
+  while ((size_t)done < len) {
+    off_t pos = in_off ? *in_off : in.offset();
+    off_t size = in.ino->size();
+    if (pos >= size) break;
+
+    off_t index = pos / PGSIZE;
+    if (index >= prefetched) {
+      off_t last = (min(pos + (off_t)(len - done), size) - 1) / PGSIZE;
+      size_t npages = min(last - index + 1, SPLICE_PREFETCH);
+      cache.prefetch(index, npages);
+      prefetched = index + npages;
+    }
+
+    size_t page_off = pos % PGSIZE;
+    size_t n = min(min(PGSIZE - page_off, len - done), size - pos);
+    auto page = cache.get(index);
+    if (!page) break;
+
+    ssize_t w = splice_out(out, out_off, (char *)p2v(page->pa()) + page_off, n);
+    if (w < 0) return done ? done : w;
+    splice_consumed(in, in_off, w);
+    done += w;
+    if ((size_t)w < n) break;
+  }
+
+  return done;
+}
+
+
+// Both ends are pages: queue references to the cached pages in the fifo the
+// output writes to, without copying anything
+static ssize_t splice_to_fifo(fs::File &in, fs::PageCache &cache, off_t *in_off, fifo_buf &out, size_t len, bool block) {
+  ssize_t done = 0;
+  off_t prefetched = 0;
+
+  while ((size_t)done < len) {
+    off_t pos = in_off ? *in_off : in.offset();
+    off_t size = in.ino->size();
+    if (pos >= size) break;
+
+    off_t index = pos / PGSIZE;
+    if (index >= prefetched) {
+      off_t last = (min(pos + (off_t)(len - done), size) - 1) / PGSIZE;
+      size_t npages = min(last - index + 1, SPLICE_PREFETCH);
+      cache.prefetch(index, npages);
+      prefetched = index + npages;
+    }
+
+    size_t page_off = pos % PGSIZE;
+    size_t n = min(min(PGSIZE - page_off, len - done), size - pos);
+    auto page = cache.get(index);
+    if (!page) break;
+
+    ssize_t w = out.write_page(page, page_off, n, block);
+    if (w < 0) return done ? done : w;
+    splice_consumed(in, in_off, w);
+    done += w;
+  }
+
+  return done;
+}
+
+
+// Anything else goes through a kernel bounce buffer. That is still one copy
+// less than a read() and write() through userspace
+static ssize_t splice_copy(fs::File &in, off_t *in_off, fs::File &out, off_t *out_off, size_t len) {
+  auto *buf = (char *)phys::kalloc(1);
+  if (buf == nullptr) return -ENOMEM;
+  ssize_t done = 0;
+
+  while ((size_t)done < len) {
+    size_t want = min(len - done, PGSIZE);
+
+    // Read from a seekable source without moving its offset, so only what
+    // was actually written out is consumed. A stream can't be put back
+    ssize_t r = in.pread(buf, want, in_off ? *in_off : in.offset());
+    bool stream = r == -ESPIPE;
+    if (stream) {
+      if (in_off) {
+        r = -ESPIPE;
+      } else {
+        r = in.read(buf, want);
+      }
+    }
+    if (r <= 0) {
+      if (r < 0 && done == 0) done = r;
+      break;
+    }
+
+    ssize_t w = splice_out(out, out_off, buf, r);
+    if (w < 0) {
+      if (done == 0) done = w;
+      break;
+    }
+    if (!stream) splice_consumed(in, in_off, w);
+    done += w;
+    if (w < r) break;
+  }
+
+  phys::kfree(buf, 1);
+  return done;
+}
+
+
+ssize_t fs::splice(fs::File &in, off_t *in_off, fs::File &out, off_t *out_off, size_t len, unsigned flags) {
+  if (!in || !out) return -EBADF;
+  if ((in_off && *in_off < 0) || (out_off && *out_off < 0)) return -EINVAL;
+  if (len == 0) return 0;
+
+  auto *cache = in.ino->page_cache();
+  if (cache && !out_off) {
+    auto *fifo = out.ino->write_fifo(out);
+    if (fifo) return splice_to_fifo(in, *cache, in_off, *fifo, len, (flags & SPLICE_F_NONBLOCK) == 0);
+  }
+  if (cache) return splice_cached(in, *cache, in_off, out, out_off, len);
+  return splice_copy(in, in_off, out, out_off, len);
+}
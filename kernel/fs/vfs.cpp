@@ -116,6 +116,9 @@ int vfs::mount(const char *src, const char *targ, const char *type, unsigned lon
     auto mountpoint_dirent = parent->get_direntry(end.get());
     assert(mountpoint_dirent->mount_shadow == nullptr);
     mountpoint_dirent->mount_shadow = mp->sb->root;
+
+    // lookups that went through the mountpoint now resolve somewhere else
+    vfs::dcache_purge();
   }
 
   mountpoints.push(mp);
@@ -167,6 +170,7 @@ int sys::mkdir(const char *upath, int mode) {
   fown.gid = curproc->user.gid;
   fown.mode = mode;  // from the argument passed from the user
   int res = dir->mkdir(name, fown);
+  vfs::dcache_invalidate(dir.get(), name);
 
   return res;
 }
@@ -230,6 +234,18 @@ static const char *skipelem(const char *path, char *name, bool &last) {
   return path;
 }
 
+// Find `name` in the directory `dir`, through the dentry cache.
+static ck::ref<fs::Node> lookup(ck::ref<fs::Node> &dir, const char *name) {
+  ck::ref<fs::Node> res = nullptr;
+  if (vfs::dcache_lookup(dir.get(), name, res)) return res;
+
+  uint64_t gen = vfs::dcache_generation(dir.get());
+  auto ent = dir->get_direntry(name);
+  if (ent != nullptr) res = ent->get();
+  vfs::dcache_insert(dir.get(), name, res, gen);
+  return res;
+}
+
 int vfs::namei(const char *path, int flags, int mode, ck::ref<fs::Node> cwd, ck::ref<fs::Node> &res, bool get_last) {
   assert(path != NULL);
   auto ino = cwd;
@@ -258,7 +274,7 @@ int vfs::namei(const char *path, int flags, int mode, ck::ref<fs::Node> cwd, ck:
       res = ino;
       return 0;
     }
-    auto found = ino->get_direntry(name);
+    auto found = lookup(ino, name);
 
     if (found == nullptr) {
       if (last && (flags & O_CREAT)) {
@@ -267,6 +283,8 @@ int vfs::namei(const char *path, int flags, int mode, ck::ref<fs::Node> cwd, ck:
         own.gid = curproc->user.gid;
         own.mode = mode;
         int r = ino->touch(name, own);
+        // drop the negative entry
+        vfs::dcache_invalidate(ino.get(), name);
         if (r == 0) {
           res = ino->get_direntry(name)->ino;
         }
@@ -276,7 +294,7 @@ int vfs::namei(const char *path, int flags, int mode, ck::ref<fs::Node> cwd, ck:
       res = nullptr;
       return -ENOENT;
     }
-    ino = found->get();
+    ino = found;
   }
 
   res = ino;
@@ -320,7 +338,9 @@ int vfs::unlink(const char *path, ck::ref<fs::Node> cwd) {
       if (!ino->is_dir()) {
         return -ENOTDIR;
       }
-      return ino->unlink(name);
+      int r = ino->unlink(name);
+      vfs::dcache_invalidate(ino.get(), name);
+      return r;
     }
 
 
@@ -0,0 +1,335 @@
+#include <cpu.h>
+#include <errno.h>
+#include <futex.h>
+#include <mm.h>
+#include <mmap_flags.h>
+#include <sleep.h>
+#include <syscall.h>
+#include <time.h>
+
+#define FUTEX_HASH_BITS 8
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+
+// Which futex word a waiter is on. Private futexes are keyed by their address
+// space and virtual address. Futexes in shared memory are keyed by physical
+// address (with a null space), so every process mapping them agrees
+struct futex_key {
+  unsigned long space;
+  unsigned long addr;
+
+  inline bool operator==(const futex_key &o) const { return space == o.space && addr == o.addr; }
+};
+
+struct futex_bucket {
+  spinlock lock;
+  struct list_head waiters;
+};
+
+// A thread sleeping in FUTEX_WAIT. This lives on the waiting thread's stack,
+// so there is nothing to allocate (or leak) per futex
+struct futex_waiter {
+  struct list_head link;
+  struct futex_key key;
+  // the bucket `link` is on. Only changed by a requeue, with both locks held
+  futex_bucket *bucket = nullptr;
+  bool woken = false;
+  struct wait_queue wq;
+};
+
+static futex_bucket futex_table[FUTEX_HASH_SIZE];
+
+
+static futex_bucket &futex_hash(const futex_key &key) {
+  unsigned long h = (key.addr >> 2) ^ (key.space >> 4);
+  return futex_table[(h * 0x9E3779B97F4A7C15ull) >> (64 - FUTEX_HASH_BITS)];
+}
+
+
+static int futex_get_key(int *uaddr, bool priv, int mode, futex_key &key) {
+  off_t va = (off_t)uaddr;
+  /* the address must be word aligned (4 bytes) */
+  if ((va & 0x3) != 0) return -EINVAL;
+  if (!curproc->mm->validate_pointer(uaddr, sizeof(int), mode)) return -EFAULT;
+
+  // Fault the page in now. The word is read again with a bucket lock held,
+  // where we can't sleep on the address space's lock
+  (void)__atomic_load_n(uaddr, __ATOMIC_RELAXED);
+
+  auto &mm = *curproc->mm;
+  key.space = (unsigned long)&mm;
+  key.addr = va;
+  if (priv) return 0;
+
+  scoped_lock l(mm.lock);
+  auto *r = mm.lookup(va);
+  if (r == NULL || (r->flags & MAP_SHARED) == 0) return 0;
+
+  scoped_lock rl(r->lock);
+  size_t ind = (va >> 12) - (r->va >> 12);
+  if (ind < r->mappings.size() && r->mappings[ind]) {
+    key.space = 0;
+    key.addr = r->mappings[ind]->pa() + (va & 0xFFF);
+  }
+  return 0;
+}
+
+
+static void futex_lock_pair(futex_bucket &a, futex_bucket &b) {
+  if (&a == &b) {
+    a.lock.lock();
+  } else if (&a < &b) {
+    a.lock.lock();
+    b.lock.lock();
+  } else {
+    b.lock.lock();
+    a.lock.lock();
+  }
+}
+
+
+static void futex_unlock_pair(futex_bucket &a, futex_bucket &b) {
+  a.lock.unlock();
+  if (&a != &b) b.lock.unlock();
+}
+
+
+// Wake up to `n` waiters on `key`. Expects the bucket to be locked
+static int futex_wake_locked(futex_bucket &b, const futex_key &key, int n) {
+  int woken = 0;
+  futex_waiter *w, *tmp;
+  list_for_each_entry_safe(w, tmp, &b.waiters, link) {
+    if (woken >= n) break;
+    if (!(w->key == key)) continue;
+    // The waiter can't return (and take `w` with it) until it gets the
+    // bucket lock, which we are holding
+    w->link.del_init();
+    w->woken = true;
+    w->wq.wake_up_all();
+    woken++;
+  }
+  return woken;
+}
+
+
+// Take a waiter off its bucket after it stopped sleeping. Returns if it was
+// woken by a FUTEX_WAKE (and so was already taken off)
+static bool futex_unqueue(futex_waiter &w) {
+  while (true) {
+    auto *b = __atomic_load_n(&w.bucket, __ATOMIC_ACQUIRE);
+    scoped_lock l(b->lock);
+    if (w.woken) return true;
+    // requeued while we were getting the lock
+    if (w.bucket != b) continue;
+    w.link.del_init();
+    return false;
+  }
+}
+
+
+static int futex_wait(int *uaddr, bool priv, int val, long long timeout_us) {
+  futex_key key;
+  int err = futex_get_key(uaddr, priv, PROT_READ, key);
+  if (err < 0) return err;
+
+  futex_waiter w;
+  w.key = key;
+  w.bucket = &futex_hash(key);
+
+  /*
+   * This follows the general idea of Linux's: the load of the futex word, the
+   * comparison with the expected value and starting to sleep are totally
+   * ordered with respect to other futex operations on the same word. Wakers
+   * change the word before taking the bucket lock, so checking it with the
+   * waiter queued under that lock can't miss a wakeup.
+   */
+  struct wait_entry ent;
+  w.bucket->lock.lock();
+  prepare_to_wait(w.wq, ent, true);
+  if (__atomic_load_n(uaddr, __ATOMIC_ACQUIRE) != val) {
+    w.bucket->lock.unlock();
+    finish_wait(w.wq, ent);
+    return -EAGAIN;
+  }
+  w.bucket->waiters.add_tail(&w.link);
+  w.bucket->lock.unlock();
+
+  wait_result res;
+  bool timed_out = false;
+  if (timeout_us > 0) {
+    sleep_waiter sw(timeout_us);
+    struct wait_entry tent;
+    prepare_to_wait(sw.wq, tent, true);
+    // the timer may have gone off before we started listening for it
+    if (time::now_us() < sw.wakeup_us) res = ent.start();
+    timed_out = time::now_us() >= sw.wakeup_us;
+    finish_wait(sw.wq, tent);
+  } else {
+    res = ent.start();
+  }
+
+  bool woken = futex_unqueue(w);
+  finish_wait(w.wq, ent);
+
+  if (woken) return 0;
+  if (res.interrupted()) return -EINTR;
+  if (timed_out) return -ETIMEDOUT;
+  return 0;
+}
+
+
+static int futex_wake(int *uaddr, bool priv, int n) {
+  futex_key key;
+  int err = futex_get_key(uaddr, priv, PROT_READ, key);
+  if (err < 0) return err;
+  if (n <= 0) return 0;
+
+  auto &b = futex_hash(key);
+  scoped_lock l(b.lock);
+  return futex_wake_locked(b, key, n);
+}
+
+
+// Wake `nr_wake` waiters on uaddr and move up to `nr_requeue` of the others to
+// wait on uaddr2 instead. Used for broadcasts, so they don't all wake up just
+// to fight over the mutex
+static int futex_requeue(int *uaddr, int *uaddr2, bool priv, int nr_wake, int nr_requeue, bool cmp, int val3) {
+  if (nr_wake < 0 || nr_requeue < 0) return -EINVAL;
+
+  futex_key key1, key2;
+  int err = futex_get_key(uaddr, priv, PROT_READ, key1);
+  if (err < 0) return err;
+  err = futex_get_key(uaddr2, priv, PROT_READ, key2);
+  if (err < 0) return err;
+
+  auto &b1 = futex_hash(key1);
+  auto &b2 = futex_hash(key2);
+  futex_lock_pair(b1, b2);
+
+  if (cmp && __atomic_load_n(uaddr, __ATOMIC_ACQUIRE) != val3) {
+    futex_unlock_pair(b1, b2);
+    return -EAGAIN;
+  }
+
+  int done = futex_wake_locked(b1, key1, nr_wake);
+
+  int moved = 0;
+  futex_waiter *w, *tmp;
+  list_for_each_entry_safe(w, tmp, &b1.waiters, link) {
+    if (moved >= nr_requeue) break;
+    if (!(w->key == key1)) continue;
+    if (&b1 != &b2) {
+      w->link.del_init();
+      b2.waiters.add_tail(&w->link);
+      __atomic_store_n(&w->bucket, &b2, __ATOMIC_RELEASE);
+    }
+    w->key = key2;
+    moved++;
+  }
+
+  futex_unlock_pair(b1, b2);
+  return done + moved;
+}
+
+
+static bool futex_op_cmp(int cmp, int oldval, int cmparg) {
+  switch (cmp) {
+    case FUTEX_OP_CMP_EQ:
+      return oldval == cmparg;
+    case FUTEX_OP_CMP_NE:
+      return oldval != cmparg;
+    case FUTEX_OP_CMP_LT:
+      return oldval < cmparg;
+    case FUTEX_OP_CMP_LE:
+      return oldval <= cmparg;
+    case FUTEX_OP_CMP_GT:
+      return oldval > cmparg;
+    case FUTEX_OP_CMP_GE:
+      return oldval >= cmparg;
+  }
+  return false;
+}
+
+
+// Atomically modify *uaddr2, then wake `nr_wake` waiters on uaddr and, if the
+// old value of *uaddr2 passes the comparison, `nr_wake2` waiters on uaddr2
+static int futex_wake_op(int *uaddr, int *uaddr2, bool priv, int nr_wake, int nr_wake2, int encoded) {
+  int op = (encoded >> 28) & 0xf;
+  int cmp = (encoded >> 24) & 0xf;
+  // both arguments are sign extended 12 bit numbers
+  int oparg = (encoded << 8) >> 20;
+  int cmparg = (encoded << 20) >> 20;
+
+  if (op & FUTEX_OP_OPARG_SHIFT) {
+    if (oparg < 0 || oparg > 31) return -EINVAL;
+    oparg = 1 << oparg;
+    op &= ~FUTEX_OP_OPARG_SHIFT;
+  }
+  if (cmp > FUTEX_OP_CMP_GE) return -ENOSYS;
+
+  futex_key key1, key2;
+  int err = futex_get_key(uaddr, priv, PROT_READ, key1);
+  if (err < 0) return err;
+  err = futex_get_key(uaddr2, priv, PROT_READ | PROT_WRITE, key2);
+  if (err < 0) return err;
+
+  // Done before taking the locks. A waiter either sees the new value, or is
+  // already queued by the time we look
+  int oldval;
+  switch (op) {
+    case FUTEX_OP_SET:
+      oldval = __atomic_exchange_n(uaddr2, oparg, __ATOMIC_SEQ_CST);
+      break;
+    case FUTEX_OP_ADD:
+      oldval = __atomic_fetch_add(uaddr2, oparg, __ATOMIC_SEQ_CST);
+      break;
+    case FUTEX_OP_OR:
+      oldval = __atomic_fetch_or(uaddr2, oparg, __ATOMIC_SEQ_CST);
+      break;
+    case FUTEX_OP_ANDN:
+      oldval = __atomic_fetch_and(uaddr2, ~oparg, __ATOMIC_SEQ_CST);
+      break;
+    case FUTEX_OP_XOR:
+      oldval = __atomic_fetch_xor(uaddr2, oparg, __ATOMIC_SEQ_CST);
+      break;
+    default:
+      return -ENOSYS;
+  }
+
+  auto &b1 = futex_hash(key1);
+  auto &b2 = futex_hash(key2);
+  futex_lock_pair(b1, b2);
+  int woken = futex_wake_locked(b1, key1, nr_wake);
+  if (futex_op_cmp(cmp, oldval, cmparg)) woken += futex_wake_locked(b2, key2, nr_wake2);
+  futex_unlock_pair(b1, b2);
+
+  return woken;
+}
+
+
+int sys::futex(int *uaddr, int op, int val, int val2, int *uaddr2, int val3) {
+  bool priv = (op & FUTEX_PRIVATE_FLAG) != 0;
+
+  switch (op & FUTEX_CMD_MASK) {
+    case FUTEX_WAIT:
+      return futex_wait(uaddr, priv, val, val2);
+
+    case FUTEX_WAKE:
+      return futex_wake(uaddr, priv, val);
+
+    case FUTEX_REQUEUE:
+      return futex_requeue(uaddr, uaddr2, priv, val, val2, false, 0);
+
+    case FUTEX_CMP_REQUEUE:
+      return futex_requeue(uaddr, uaddr2, priv, val, val2, true, val3);
+
+    case FUTEX_WAKE_OP:
+      return futex_wake_op(uaddr, uaddr2, priv, val, val2, val3);
+
+    case FUTEX_DSTR:
+      // futexes don't have any state outside of their waiters
+      return 0;
+  }
+
+  return -EINVAL;
+}
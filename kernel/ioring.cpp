@@ -0,0 +1,609 @@
+#include <awaitfs.h>
+#include <ck/set.h>
+#include <cpu.h>
+#include <fs.h>
+#include <ioring_types.h>
+#include <mm.h>
+#include <mmap_flags.h>
+#include <phys.h>
+#include <sched.h>
+#include <sleep.h>
+#include <syscall.h>
+#include <thread.h>
+#include <time.h>
+
+/**
+ * Asynchronous syscall rings (see ioring_types.h for the userspace view).
+ *
+ * A ring is a file descriptor whose mapping holds a submission queue (SQ)
+ * and a completion queue (CQ). Entries are taken off the SQ either by
+ * ioring_enter, or by a poller thread if the ring was set up with
+ * IORING_SETUP_SQPOLL, and handed to a pool of workers. The workers are
+ * kernel threads that live in the process that owns the ring, so they can
+ * simply run the regular syscall on the process's memory and fds. Because
+ * of that, only the process that set the ring up may enter it: a child
+ * that inherited the fd across fork would otherwise have its entries run
+ * against its parent. Each
+ * result is posted to the CQ, which wakes anyone in ioring_enter or polling
+ * the ring fd for AWAITFS_READ.
+ *
+ * Entries that only wait don't tie up a worker: timeouts are kept in a
+ * deadline ordered list that a single timer thread completes, and an accept,
+ * which can block for as long as nobody connects, gets a thread of its own
+ * that isn't counted against IORING_MAX_WORKERS.
+ *
+ * An entry is only taken off the SQ if its completion is guaranteed a slot
+ * in the CQ, so completions are never lost as long as userspace keeps up
+ * with cq_head.
+ */
+
+// workers are started as needed, up to this many per ring
+#define IORING_MAX_WORKERS 8
+// how long the poller spins on an empty SQ before sleeping
+#define IORING_DEFAULT_IDLE_MS 10
+
+
+struct ioring_work {
+  struct list_head link;
+  struct ioring_sqe sqe;
+  class IORing *ring;
+  // when an IORING_OP_TIMEOUT completes
+  uint64_t deadline_us;
+};
+
+
+class IORing final : public fs::Node {
+ public:
+  IORing(unsigned entries, struct ioring_params &p);
+  virtual ~IORing(void);
+
+  // ^fs::Node
+  ck::ref<mm::VMObject> mmap(fs::File &, size_t npages, int prot, int flags, off_t off) override;
+  int poll(fs::File &, int events, poll_table &pt) override;
+  void close(fs::File &) override;
+
+  // take up to `count` entries off the SQ. Returns how many were taken
+  int submit(unsigned count);
+  // wait until at least `count` completions are ready
+  int wait_cqes(unsigned count);
+  void wake_poller(void) { sq_wq.wake_up_all(); }
+
+  void work_loop(void);
+  void poll_loop(void);
+  void timer_loop(void);
+  // run an entry and post its completion. Frees the work
+  void complete(struct ioring_work *w);
+
+  ck::vec<ck::ref<mm::Page>> pages;
+  bool sqpoll;
+  // pid of the process that set the ring up, which its threads live in
+  long owner = 0;
+
+ private:
+  void queue(struct list_head &batch);
+  void add_timeout(struct ioring_work *w);
+  void post(uint64_t user_data, int64_t res);
+  uint32_t cq_ready(void) { return rings->cq_tail - __atomic_load_n(&rings->cq_head, __ATOMIC_ACQUIRE); }
+  bool sq_pending(void) { return __atomic_load_n(&rings->sq_tail, __ATOMIC_ACQUIRE) != sq_head; }
+
+  // the shared memory
+  struct ioring_rings *rings;
+  struct ioring_sqe *sqes;
+  struct ioring_cqe *cqes;
+  uint32_t sq_entries, cq_entries;
+
+  // our own copy of sq_head. Userspace can scribble over the shared one
+  spinlock sq_lock;
+  uint32_t sq_head = 0;
+  // entries taken off the SQ whose completions haven't been posted
+  uint32_t inflight = 0;
+
+  spinlock cq_lock;
+  wait_queue cq_wq;
+
+  // queued work, and the workers that run it
+  spinlock work_lock;
+  struct list_head work;
+  wait_queue work_wq;
+  int nworkers = 0;
+  int idle_workers = 0;
+
+  wait_queue sq_wq;
+  uint64_t idle_us;
+
+  // pending timeouts, soonest first, and the thread that completes them
+  spinlock timeout_lock;
+  struct list_head timeouts;
+  wait_queue timeout_wq;
+  bool timer_running = false;
+
+  bool dead = false;
+};
+
+
+static spinlock ioring_lock;
+// every live ring, so ioring_enter can check that it was given one
+static ck::set<IORing *> ioring_table;
+
+
+struct IORingVMObject final : public mm::VMObject {
+  IORingVMObject(ck::ref<IORing> ring, size_t npages) : VMObject(npages), m_ring(ring) {}
+  virtual ~IORingVMObject(void) {}
+
+  virtual ck::ref<mm::Page> get_shared(off_t n) override { return m_ring->pages[n]; }
+
+ private:
+  ck::ref<IORing> m_ring;
+};
+
+
+IORing::IORing(unsigned entries, struct ioring_params &p) : fs::Node(nullptr) {
+  sq_entries = entries;
+  cq_entries = entries * 2;
+  sqpoll = (p.flags & IORING_SETUP_SQPOLL) != 0;
+  idle_us = (p.sq_thread_idle ?: IORING_DEFAULT_IDLE_MS) * 1000ULL;
+
+  size_t sqes_off = round_up(sizeof(struct ioring_rings), 64);
+  size_t cqes_off = round_up(sqes_off + sq_entries * sizeof(struct ioring_sqe), 64);
+  size_t size = round_up(cqes_off + cq_entries * sizeof(struct ioring_cqe), PGSIZE);
+
+  // contiguous, so the kernel can use the rings through one mapping. Each
+  // page is freed on its own once neither the ring nor a mapping holds it
+  int npages = size / PGSIZE;
+  auto pa = (unsigned long)phys::alloc(npages);
+  for (int i = 0; i < npages; i++) {
+    auto page = mm::Page::create(pa + i * PGSIZE);
+    page->fset(PG_OWNED);
+    pages.push(page);
+  }
+
+  auto *base = (char *)p2v(pa);
+  rings = (struct ioring_rings *)base;
+  sqes = (struct ioring_sqe *)(base + sqes_off);
+  cqes = (struct ioring_cqe *)(base + cqes_off);
+
+  p.sq_entries = sq_entries;
+  p.cq_entries = cq_entries;
+  p.sqes_off = sqes_off;
+  p.cqes_off = cqes_off;
+  p.map_size = size;
+
+  scoped_irqlock l(ioring_lock);
+  ioring_table.add(this);
+}
+
+
+IORing::~IORing(void) {
+  {
+    scoped_irqlock l(ioring_lock);
+    ioring_table.remove(this);
+  }
+
+  // work nobody got to before the ring was closed
+  while (!work.is_empty()) {
+    auto *w = list_first_entry(&work, struct ioring_work, link);
+    w->link.del();
+    delete w;
+  }
+  while (!timeouts.is_empty()) {
+    auto *w = list_first_entry(&timeouts, struct ioring_work, link);
+    w->link.del();
+    delete w;
+  }
+}
+
+
+ck::ref<mm::VMObject> IORing::mmap(fs::File &, size_t npages, int prot, int flags, off_t off) {
+  if (off != 0 || npages > (size_t)pages.size()) return nullptr;
+  if ((flags & MAP_SHARED) == 0) return nullptr;
+  return ck::make_ref<IORingVMObject>(this, npages);
+}
+
+
+int IORing::poll(fs::File &, int events, poll_table &pt) {
+  pt.wait(cq_wq, AWAITFS_READ);
+  return cq_ready() > 0 ? AWAITFS_READ : 0;
+}
+
+
+void IORing::close(fs::File &) {
+  __atomic_store_n(&dead, true, __ATOMIC_SEQ_CST);
+  work_wq.wake_up_all();
+  sq_wq.wake_up_all();
+  cq_wq.wake_up_all();
+  timeout_wq.wake_up_all();
+}
+
+
+static int ioring_worker(void *arg) {
+  auto *ring = (IORing *)arg;
+  ring->work_loop();
+  ring->ref_release();
+
+  // kernel workers can't return. The process will tear this thread down
+  curthd->exit();
+  while (1)
+    sched::yield();
+}
+
+
+// runs a single accept, then goes away
+static int ioring_accept_worker(void *arg) {
+  auto *w = (struct ioring_work *)arg;
+  auto *ring = w->ring;
+  ring->complete(w);
+  ring->ref_release();
+
+  curthd->exit();
+  while (1)
+    sched::yield();
+}
+
+
+static int ioring_timer(void *arg) {
+  auto *ring = (IORing *)arg;
+  ring->timer_loop();
+  ring->ref_release();
+
+  curthd->exit();
+  while (1)
+    sched::yield();
+}
+
+
+static int ioring_poller(void *arg) {
+  auto *ring = (IORing *)arg;
+  ring->poll_loop();
+  ring->ref_release();
+
+  curthd->exit();
+  while (1)
+    sched::yield();
+}
+
+
+int IORing::submit(unsigned count) {
+  struct list_head batch;
+  int n = 0;
+
+  sq_lock.lock();
+  uint32_t tail = __atomic_load_n(&rings->sq_tail, __ATOMIC_ACQUIRE);
+  while ((unsigned)n < count && sq_head != tail) {
+    // leave the entry on the SQ if its completion might not fit in the CQ
+    uint32_t used = __atomic_load_n(&inflight, __ATOMIC_SEQ_CST) + cq_ready();
+    if (used >= cq_entries) break;
+
+    auto *w = new ioring_work;
+    w->sqe = sqes[sq_head & (sq_entries - 1)];
+    w->ring = this;
+    batch.add_tail(&w->link);
+    sq_head++;
+    n++;
+    __atomic_add_fetch(&inflight, 1, __ATOMIC_SEQ_CST);
+  }
+  __atomic_store_n(&rings->sq_head, sq_head, __ATOMIC_RELEASE);
+  sq_lock.unlock();
+
+  if (n > 0) queue(batch);
+  return n;
+}
+
+
+void IORing::queue(struct list_head &batch) {
+  struct list_head accepts, timers;
+  int n = 0;
+  int spawn = 0;
+
+  work_lock.lock();
+  while (!batch.is_empty()) {
+    auto *w = list_first_entry(&batch, struct ioring_work, link);
+    w->link.del_init();
+    if (w->sqe.opcode == IORING_OP_TIMEOUT) {
+      timers.add_tail(&w->link);
+    } else if (w->sqe.opcode == IORING_OP_ACCEPT) {
+      accepts.add_tail(&w->link);
+    } else {
+      work.add_tail(&w->link);
+      n++;
+    }
+  }
+  // start a worker for every entry that no idle one can pick up
+  int want = n - idle_workers;
+  while (spawn < want && nworkers < IORING_MAX_WORKERS) {
+    nworkers++;
+    spawn++;
+  }
+  work_lock.unlock();
+
+  work_wq.wake_up_all();
+
+  for (int i = 0; i < spawn; i++) {
+    ref_retain();
+    sched::proc::create_kworker(*curproc, "[io worker]", ioring_worker, this);
+  }
+
+  while (!accepts.is_empty()) {
+    auto *w = list_first_entry(&accepts, struct ioring_work, link);
+    w->link.del_init();
+    ref_retain();
+    sched::proc::create_kworker(*curproc, "[io accept]", ioring_accept_worker, w);
+  }
+
+  while (!timers.is_empty()) {
+    auto *w = list_first_entry(&timers, struct ioring_work, link);
+    w->link.del_init();
+    add_timeout(w);
+  }
+}
+
+
+void IORing::add_timeout(struct ioring_work *w) {
+  if ((int64_t)w->sqe.off < 0) {
+    post(w->sqe.user_data, -EINVAL);
+    delete w;
+    return;
+  }
+  w->deadline_us = time::now_us() + w->sqe.off;
+
+  bool start = false;
+  timeout_lock.lock();
+  // keep the list sorted, so the timer only ever looks at the front
+  struct ioring_work *pos;
+  list_for_each_entry(pos, &timeouts, link) {
+    if (pos->deadline_us > w->deadline_us) break;
+  }
+  pos->link.add_tail(&w->link);
+  if (!timer_running) {
+    timer_running = true;
+    start = true;
+  }
+  timeout_lock.unlock();
+
+  if (start) {
+    ref_retain();
+    sched::proc::create_kworker(*curproc, "[io timer]", ioring_timer, this);
+  } else {
+    timeout_wq.wake_up_all();
+  }
+}
+
+
+static int64_t ioring_do(struct ioring_sqe &sqe) {
+  switch (sqe.opcode) {
+    case IORING_OP_NOP:
+      return 0;
+
+    case IORING_OP_READ:
+      if (sqe.off == -1) return sys::read(sqe.fd, (void *)sqe.addr, sqe.len);
+      return sys::pread(sqe.fd, (void *)sqe.addr, sqe.len, sqe.off);
+
+    case IORING_OP_WRITE:
+      if (sqe.off == -1) return sys::write(sqe.fd, (void *)sqe.addr, sqe.len);
+      return sys::pwrite(sqe.fd, (void *)sqe.addr, sqe.len, sqe.off);
+
+    case IORING_OP_OPEN:
+      return sys::open((const char *)sqe.addr, sqe.len, sqe.mode);
+
+    case IORING_OP_CLOSE:
+      return sys::close(sqe.fd);
+
+    case IORING_OP_ACCEPT:
+      return sys::accept(sqe.fd, (struct sockaddr *)sqe.addr, sqe.len);
+
+    case IORING_OP_FSYNC:
+      return sys::fsync(sqe.fd);
+  }
+  return -EINVAL;
+}
+
+
+void IORing::post(uint64_t user_data, int64_t res) {
+  cq_lock.lock();
+  uint32_t tail = rings->cq_tail;
+  if (tail - __atomic_load_n(&rings->cq_head, __ATOMIC_ACQUIRE) >= cq_entries) {
+    // only possible if userspace moved cq_head somewhere it shouldn't have
+    rings->cq_overflow++;
+  } else {
+    auto &cqe = cqes[tail & (cq_entries - 1)];
+    cqe.user_data = user_data;
+    cqe.res = res;
+    __atomic_store_n(&rings->cq_tail, tail + 1, __ATOMIC_RELEASE);
+  }
+  __atomic_sub_fetch(&inflight, 1, __ATOMIC_SEQ_CST);
+  cq_lock.unlock();
+
+  cq_wq.wake_up_all();
+}
+
+
+void IORing::work_loop(void) {
+  while (!curthd->should_die) {
+    struct ioring_work *w = nullptr;
+
+    struct wait_entry ent;
+    prepare_to_wait(work_wq, ent, true);
+    work_lock.lock();
+    if (!work.is_empty()) {
+      w = list_first_entry(&work, struct ioring_work, link);
+      w->link.del_init();
+    } else if (!__atomic_load_n(&dead, __ATOMIC_SEQ_CST)) {
+      idle_workers++;
+    }
+    work_lock.unlock();
+
+    if (w == nullptr) {
+      if (__atomic_load_n(&dead, __ATOMIC_SEQ_CST)) {
+        finish_wait(work_wq, ent);
+        break;
+      }
+      do_wait(ent);
+      finish_wait(work_wq, ent);
+      scoped_lock l(work_lock);
+      idle_workers--;
+      continue;
+    }
+    finish_wait(work_wq, ent);
+
+    complete(w);
+  }
+
+  scoped_lock l(work_lock);
+  nworkers--;
+}
+
+
+void IORing::complete(struct ioring_work *w) {
+  int64_t res = ioring_do(w->sqe);
+  post(w->sqe.user_data, res);
+  delete w;
+}
+
+
+void IORing::timer_loop(void) {
+  while (!curthd->should_die && !__atomic_load_n(&dead, __ATOMIC_SEQ_CST)) {
+    struct list_head expired;
+    uint64_t next = 0;
+
+    // Queue on timeout_wq before looking at the list, so a timeout added
+    // after the check still wakes us
+    struct wait_entry ent;
+    prepare_to_wait(timeout_wq, ent, true);
+
+    uint64_t now = time::now_us();
+    timeout_lock.lock();
+    while (!timeouts.is_empty()) {
+      auto *w = list_first_entry(&timeouts, struct ioring_work, link);
+      if (w->deadline_us > now) {
+        next = w->deadline_us;
+        break;
+      }
+      w->link.del_init();
+      expired.add_tail(&w->link);
+    }
+    timeout_lock.unlock();
+
+    if (expired.is_empty() && !__atomic_load_n(&dead, __ATOMIC_SEQ_CST)) {
+      if (next != 0) {
+        // sleep until the soonest deadline, or until a new timeout shows up
+        struct wait_entry sleep_ent;
+        sleep_waiter sw(next - now);
+        prepare_to_wait(sw.wq, sleep_ent, true);
+        do_wait(ent);
+        finish_wait(sw.wq, sleep_ent);
+      } else {
+        do_wait(ent);
+      }
+    }
+    finish_wait(timeout_wq, ent);
+
+    while (!expired.is_empty()) {
+      auto *w = list_first_entry(&expired, struct ioring_work, link);
+      w->link.del();
+      post(w->sqe.user_data, 0);
+      delete w;
+    }
+  }
+
+  scoped_lock l(timeout_lock);
+  timer_running = false;
+}
+
+
+void IORing::poll_loop(void) {
+  uint64_t last_work = time::now_us();
+
+  while (!curthd->should_die && !__atomic_load_n(&dead, __ATOMIC_SEQ_CST)) {
+    if (submit(sq_entries) > 0) {
+      last_work = time::now_us();
+      continue;
+    }
+
+    if (time::now_us() - last_work < idle_us) {
+      sched::yield();
+      continue;
+    }
+
+    // Go to sleep until ioring_enter wakes us. The SQ is checked again after
+    // the flag is set, so a submission that raced with it isn't missed
+    struct wait_entry ent;
+    prepare_to_wait(sq_wq, ent, true);
+    __atomic_or_fetch(&rings->sq_flags, IORING_SQ_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+    if (!sq_pending() && !__atomic_load_n(&dead, __ATOMIC_SEQ_CST)) do_wait(ent);
+    finish_wait(sq_wq, ent);
+    __atomic_and_fetch(&rings->sq_flags, ~IORING_SQ_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+    last_work = time::now_us();
+  }
+}
+
+
+int IORing::wait_cqes(unsigned count) {
+  while (true) {
+    struct wait_entry ent;
+    prepare_to_wait(cq_wq, ent, true);
+    if (cq_ready() >= count || __atomic_load_n(&dead, __ATOMIC_SEQ_CST)) {
+      finish_wait(cq_wq, ent);
+      return 0;
+    }
+    auto res = do_wait(ent);
+    finish_wait(cq_wq, ent);
+    if (res.interrupted()) return -EINTR;
+  }
+}
+
+
+int sys::ioring_setup(unsigned entries, struct ioring_params *params) {
+  if (!curproc->mm->validate_pointer(params, sizeof(*params), PROT_READ | PROT_WRITE)) return -EFAULT;
+  if (entries == 0 || entries > IORING_MAX_ENTRIES) return -EINVAL;
+  if (params->flags & ~IORING_SETUP_SQPOLL) return -EINVAL;
+
+  // round up to a power of two, so indexes can be masked
+  unsigned size = 1;
+  while (size < entries)
+    size <<= 1;
+
+  struct ioring_params p = *params;
+  auto ring = ck::make_ref<IORing>(size, p);
+  ring->owner = curproc->pid;
+  *params = p;
+
+  if (ring->sqpoll) {
+    ring->ref_retain();
+    sched::proc::create_kworker(*curproc, "[io poller]", ioring_poller, ring.get());
+  }
+
+  return curproc->add_fd(fs::File::create(ring, "[ioring]", FDIR_READ | FDIR_WRITE));
+}
+
+
+int sys::ioring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  ck::ref<fs::File> file = curproc->get_fd(fd);
+  if (!file) return -EBADF;
+
+  IORing *ring = nullptr;
+  {
+    scoped_irqlock l(ioring_lock);
+    auto *n = (IORing *)file->ino.get();
+    if (ioring_table.contains(n)) ring = n;
+  }
+  if (ring == nullptr) return -EINVAL;
+  // the workers are spawned into (and run entries as) the caller
+  if (ring->owner != curproc->pid) return -EPERM;
+
+  int submitted = 0;
+  if (ring->sqpoll) {
+    // the poller takes entries off the SQ, so just make sure it's awake
+    if (flags & IORING_ENTER_SQ_WAKEUP) ring->wake_poller();
+    submitted = to_submit;
+  } else if (to_submit > 0) {
+    submitted = ring->submit(to_submit);
+    // nothing could be taken because the CQ has no room
+    if (submitted == 0 && (flags & IORING_ENTER_GETEVENTS) == 0) return -EBUSY;
+  }
+
+  if (flags & IORING_ENTER_GETEVENTS) {
+    int err = ring->wait_cqes(min_complete);
+    if (err < 0 && submitted == 0) return err;
+  }
+
+  return submitted;
+}
@@ -1,6 +1,10 @@
 // #include <kctl.h>
 #include <syscall.h>
 #include <kctl.h>
+#include <block.h>
+#include <dev/driver.h>
+#include <fs/ext2.h>
+#include <fs/PageCache.h>
 #include <ck/option.h>
 
 #include <kctl_node.h>
@@ -42,39 +46,101 @@ class ProcNode : public kctl::Node {
 };
 
 
-extern bool hacky_proc_kctl_read(kctl::Path path, ck::string &out);
-static ck::string kctl_tostring(off_t *namepath, unsigned namelen) {
-  ck::string s;
-
-  for (int i = 0; i < namelen; i++) {
-    if (i != 0) s += '.';
-    off_t name = namepath[i];
-    if (KCTL_IS_NAME(name)) {
-#define __KCTL(number, _name, uppername) \
-  if (name == number) {                  \
-    s += #_name;                         \
-    continue;                            \
+static void format_hist(ck::string &out, uint64_t *hist) {
+  for (int i = 0; i < IOSTAT_BUCKETS; i++) {
+    if (i != 0) out += ',';
+    out.appendf("%llu", hist[i]);
   }
-      ENUMERATE_KCTL_NAMES
-#undef __KCTL
+}
+
+
+// kctl blk.wb
+//   -> "dirty 3 written 1200 batches 40 coalesced 9000 syncs 2"
+//
+// kctl blk.io, one line per block device:
+//   -> "<name> <reads> <writes> <rsect> <wsect> <merges> <inflight> <lat hist> <queue hist>"
+//   where each histogram is IOSTAT_BUCKETS comma separated log2(us) buckets
+class BlockNode : public kctl::Node {
+ public:
+  bool kctl_read(kctl::Path path, ck::string &out) override {
+    if (!path) return false;
+
+    if (path[0] == KCTL_WB) {
+      block::writeback_stats st;
+      block::get_writeback_stats(st);
+      out.appendf("dirty %llu written %llu batches %llu coalesced %llu syncs %llu", st.dirty, st.written, st.batches,
+                  st.coalesced, st.syncs);
+      return true;
     }
 
+    if (path[0] == KCTL_IO) {
+      auto l = dev::Device::lock_names();
+      for (auto &[name, ent] : dev::Device::get_names()) {
+        auto node = ent->get();
+        if (!node || !node->is_blockdev()) continue;
+
+        dev::io_stats st;
+        ((dev::BlockDevice *)node.get())->get_io_stats(st);
+        out.appendf("%s %llu %llu %llu %llu %llu %lld ", name.get(), st.reads, st.writes, st.read_sectors,
+                    st.write_sectors, st.merges, st.in_flight);
+        format_hist(out, st.lat_hist);
+        out += ' ';
+        format_hist(out, st.queue_hist);
+        out += '\n';
+      }
+      return true;
+    }
 
-    s.appendf("%lu", name);
+    return false;
   }
+};
 
-  return s;
-}
+
+// kctl fs.icache
+//   -> "cached 812 hits 90210 misses 1024 evictions 212"
+// kctl fs.pcache
+//   -> "cached 20480 hits 1048576 misses 30000 evictions 9520"
+class FsNode : public kctl::Node {
+ public:
+  bool kctl_read(kctl::Path path, ck::string &out) override {
+    if (!path) return false;
+
+    if (path[0] == KCTL_PCACHE) {
+      fs::pcache_stats st;
+      fs::get_pcache_stats(st);
+      out.appendf("cached %llu hits %llu misses %llu evictions %llu", st.cached, st.hits, st.misses, st.evictions);
+      return true;
+    }
+
+#ifdef CONFIG_EXT2
+    if (path[0] == KCTL_ICACHE) {
+      ext2::icache_stats st;
+      ext2::get_icache_stats(st);
+      out.appendf("cached %llu hits %llu misses %llu evictions %llu", st.cached, st.hits, st.misses, st.evictions);
+      return true;
+    }
+#endif
+
+    return false;
+  }
+};
+
+
+extern bool hacky_proc_kctl_read(kctl::Path path, ck::string &out);
 
 
 static HardwareNode node_hw;
+static BlockNode node_blk;
+static FsNode node_fs;
 
 int sys::kctl(off_t *_name, unsigned namelen, char *oval, size_t *olen, char *nval, size_t nlen) {
-  // Validate pointers
-  if (oval != NULL && !VALIDATE_RD(_name, namelen * sizeof(off_t))) return -EINVAL;
-  if (nval != NULL && !VALIDATE_RD(nval, nlen)) return -EINVAL;
   // Validate that the name is not too long
+  if (namelen == 0) return -EINVAL;
   if (namelen > KCTL_MAX_NAMELEN) return -ENAMETOOLONG;
+  // Validate pointers
+  if (!VALIDATE_RD(_name, namelen * sizeof(off_t))) return -EINVAL;
+  if (nval != NULL && !VALIDATE_RD(nval, nlen)) return -EINVAL;
+  if (olen != NULL && !VALIDATE_RDWR(olen, sizeof(*olen))) return -EINVAL;
   // Copy the name path to the kernel
   off_t name[KCTL_MAX_NAMELEN];
 
@@ -92,11 +158,25 @@ int sys::kctl(off_t *_name, unsigned namelen, char *oval, size_t *olen, char *nv
     case KCTL_PROC:
       success = hacky_proc_kctl_read(path.next(), read_out);
       break;
+    case KCTL_BLK:
+      success = node_blk.kctl_read(path.next(), read_out);
+      break;
+    case KCTL_FS:
+      success = node_fs.kctl_read(path.next(), read_out);
+      break;
   }
 
-  auto s = kctl_tostring(name, namelen);
-  printf("kctl: %s = '%s'\n", s.get(), read_out.get());
-  // TODO: validate oval if
-  // if (!VALIDATE_RD(oval, namelen * sizeof(int))) return -EINVAL;
+  if (!success) return -ENOENT;
+
+  if (olen != NULL) {
+    // copy out as much as fits (with a null terminator), and report the full length
+    if (oval != NULL && *olen > 0) {
+      if (!VALIDATE_WR(oval, *olen)) return -EINVAL;
+      size_t n = min(*olen - 1, read_out.size());
+      memcpy(oval, read_out.get(), n);
+      oval[n] = '\0';
+    }
+    *olen = read_out.size();
+  }
   return 0;
 }
@@ -1,5 +1,8 @@
+#include <arch.h>
 #include <cpu.h>
+#include <kshell.h>
 #include <lock.h>
+#include <module.h>
 #include <printf.h>
 #include <sched.h>
 
@@ -135,3 +138,147 @@ int rwlock::write_unlock(void) {
   m_lock.unlock();
   return 0;
 }
+
+
+
+static struct lock_class *lock_classes = nullptr;
+
+lock_class::lock_class(const char *name) : name(name) {
+  next = __atomic_load_n(&lock_classes, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&lock_classes, &next, this, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+}
+
+
+#ifdef CONFIG_LOCK_STATS
+static inline void lock_stat(struct lock_class *cls, bool contended, unsigned long cycles) {
+  if (cls == nullptr) return;
+  __atomic_add_fetch(&cls->acquisitions, 1, __ATOMIC_RELAXED);
+  if (contended) {
+    __atomic_add_fetch(&cls->contended, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&cls->spin_cycles, cycles, __ATOMIC_RELAXED);
+  }
+}
+#else
+static inline void lock_stat(struct lock_class *, bool, unsigned long) {}
+#endif
+
+
+bool qspinlock::try_lock(void) {
+  int expected = 0;
+  return __atomic_compare_exchange_n(&locked, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+
+void qspinlock::lock(void) {
+  // only take it straight away if nobody is queued, so waiters aren't starved
+  if (likely(__atomic_load_n(&tail, __ATOMIC_RELAXED) == nullptr && try_lock())) {
+    lock_stat(cls, false, 0);
+    return;
+  }
+  lock_slow();
+}
+
+
+void qspinlock::lock_slow(void) {
+#ifdef CONFIG_LOCK_STATS
+  unsigned long start = arch_read_timestamp();
+#endif
+
+  cpu::Core *c = cpu::get();
+  if (c == nullptr || c->mcs_depth >= MCS_NODES) {
+    // Too early to have a node, or nested too deep. Spin on the lock itself,
+    // which is correct, just not fair
+    while (!try_lock()) {
+      while (__atomic_load_n(&locked, __ATOMIC_RELAXED) != 0)
+        arch_relax();
+    }
+  } else {
+    // The node belongs to this core, so we can't be moved to another one
+    // while queued. Interrupts that nest on top use the next node
+    c->preempt_count++;
+    auto *node = &c->mcs_nodes[c->mcs_depth++];
+    node->next = nullptr;
+    node->wait = 1;
+
+    auto *prev = __atomic_exchange_n(&tail, node, __ATOMIC_ACQ_REL);
+    if (prev != nullptr) {
+      __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+      while (__atomic_load_n(&node->wait, __ATOMIC_ACQUIRE) != 0)
+        arch_relax();
+    }
+
+    // We're at the head of the queue, so the only other core that can take
+    // it is one that saw an empty queue just before we joined
+    while (!try_lock()) {
+      while (__atomic_load_n(&locked, __ATOMIC_RELAXED) != 0)
+        arch_relax();
+    }
+
+    // leave the queue, letting the next waiter move up to the head
+    auto *expected = node;
+    if (!__atomic_compare_exchange_n(&tail, &expected, nullptr, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      struct mcs_node *next;
+      // they swapped themselves in as the tail, but haven't linked up yet
+      while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == nullptr)
+        arch_relax();
+      __atomic_store_n(&next->wait, 0, __ATOMIC_RELEASE);
+    }
+
+    c->mcs_depth--;
+    c->preempt_count--;
+  }
+
+#ifdef CONFIG_LOCK_STATS
+  lock_stat(cls, true, arch_read_timestamp() - start);
+#endif
+}
+
+
+void qspinlock::unlock(void) { __atomic_store_n(&locked, 0, __ATOMIC_RELEASE); }
+
+bool qspinlock::is_locked(void) { return __atomic_load_n(&locked, __ATOMIC_RELAXED) != 0; }
+
+
+bool qspinlock::lock_irqsave(void) {
+  bool en = irq_disable_save();
+  lock();
+  return en;
+}
+
+
+bool qspinlock::try_lock_irqsave(bool &success) {
+  bool en = irq_disable_save();
+  success = try_lock();
+  if (success) {
+    lock_stat(cls, false, 0);
+  } else {
+    irq_enable_restore(en);
+  }
+  return en;
+}
+
+
+void qspinlock::unlock_irqrestore(bool flags) {
+  unlock();
+  irq_enable_restore(flags);
+}
+
+
+
+static unsigned long locks_kshell(ck::vec<ck::string> &args, void *data, int dlen) {
+#ifdef CONFIG_LOCK_STATS
+  printf("%-20s %12s %12s %14s\n", "class", "acquired", "contended", "avg spin cyc");
+  for (auto *cls = __atomic_load_n(&lock_classes, __ATOMIC_ACQUIRE); cls != nullptr; cls = cls->next) {
+    unsigned long acq = __atomic_load_n(&cls->acquisitions, __ATOMIC_RELAXED);
+    unsigned long cont = __atomic_load_n(&cls->contended, __ATOMIC_RELAXED);
+    unsigned long cycles = __atomic_load_n(&cls->spin_cycles, __ATOMIC_RELAXED);
+    printf("%-20s %12lu %12lu %14lu\n", cls->name, acq, cont, cont ? cycles / cont : 0);
+  }
+#else
+  printf("lock statistics are not enabled (CONFIG_LOCK_STATS)\n");
+#endif
+  return 0;
+}
+
+module_init_kshell("locks", "locks", locks_kshell);
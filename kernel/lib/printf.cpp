@@ -1038,19 +1038,22 @@ void printf_nolock(const char *format, ...) {
 }
 
 
-static spinlock printk_lock;
+static lock_class printk_lock_class("printk");
+// Interrupt handlers print too. One that queued behind the thread it
+// interrupted would spin forever, so the lock is taken with interrupts off
+static qspinlock printk_lock(&printk_lock_class);
 int printf(const char *format, ...) {
-  printk_lock.lock();
+  bool en = printk_lock.lock_irqsave();
   va_list va;
   va_start(va, format);
   const int ret = do_printf(format, va);
   va_end(va);
-  printk_lock.unlock();
+  printk_lock.unlock_irqrestore(en);
   return ret;
 }
 
 int pprintf(const char *format, ...) {
-  printk_lock.lock();
+  bool en = printk_lock.lock_irqsave();
   if (cpu::in_thread()) {
     int color = curthd->tid % 5 + 31;
     printf_nolock("\e[0;%dm(c:%d p:%d t:%d) %s:\e[0m ", color, cpu::current().id, curthd->pid, curthd->tid, curproc->name.get());
@@ -1059,7 +1062,7 @@ int pprintf(const char *format, ...) {
   va_start(va, format);
   const int ret = do_printf(format, va);
   va_end(va);
-  printk_lock.unlock();
+  printk_lock.unlock_irqrestore(en);
   return ret;
 }
 
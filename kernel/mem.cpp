@@ -24,18 +24,21 @@ extern "C" size_t strlen(const char *s) {
 
 
 // bindings for liballoc
-spinlock alloc_lock;
-static volatile long lock_flags = 0;
+static lock_class alloc_lock_class("alloc");
+qspinlock alloc_lock(&alloc_lock_class);
+// Interrupts are kept off while the lock is held. Waiters can't be preempted,
+// so a holder preempted on the same core (or an interrupt handler that
+// mallocs) would leave them spinning forever. Only the holder touches this
+static bool lock_flags = false;
 int liballoc_lock() {
-  alloc_lock.lock();
-  // lock_flags = alloc_lock.lock_irqsave();
+  bool en = alloc_lock.lock_irqsave();
+  lock_flags = en;
   return 0;
 }
 
 
 int liballoc_unlock() {
-  alloc_lock.unlock();
-  // alloc_lock.unlock_irqrestore(lock_flags);
+  alloc_lock.unlock_irqrestore(lock_flags);
   return 0;
 }
 
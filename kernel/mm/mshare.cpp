@@ -21,6 +21,7 @@ struct mshare_vmobject final : public mm::VMObject {
     for (int i = 0; i < npages; i++) {
       pages.push(nullptr);
     }
+    if (name.size() == 0) return;
     scoped_lock l(mshare_lock);
     mshare_regions[name] = this;
 
@@ -29,6 +30,7 @@ struct mshare_vmobject final : public mm::VMObject {
 
   virtual ~mshare_vmobject(void) {
     // printf("DROP %s! (pid=%d)\n", this->name.get(), curproc->pid);
+    if (name.size() == 0) return;
     scoped_lock l1(mshare_lock);
     scoped_lock l2(m_lock);
     assert(mshare_regions.contains(name));
@@ -50,6 +52,7 @@ struct mshare_vmobject final : public mm::VMObject {
 
 
   virtual void drop(void) override {}
+  virtual bool is_mshare(void) override { return true; }
 
  private:
   ck::string name;
@@ -60,10 +63,11 @@ struct mshare_vmobject final : public mm::VMObject {
 
 
 static void *msh_create(struct mshare_create *arg) {
-  ck::string name = ck::string(arg->name, MSHARE_NAMESZ);
+  // unnamed regions stay out of the global list
+  ck::string name = arg->name[0] == '\0' ? ck::string() : ck::string(arg->name, MSHARE_NAMESZ);
 
 
-  if (mshare_regions.contains(name)) return MAP_FAILED;
+  if (name.size() > 0 && mshare_regions.contains(name)) return MAP_FAILED;
   if (arg->size & 0xFFF) return MAP_FAILED;
 
   auto pages = NPAGES(arg->size);
@@ -73,12 +77,8 @@ static void *msh_create(struct mshare_create *arg) {
 
 
   auto addr = curproc->mm->mmap(
-      ck::string::format("[msh '%s' (created)]", name.get()), 0, pages * PGSIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, nullptr, 0);
-
-  auto region = curproc->mm->lookup(addr);
-  if (region == nullptr) return MAP_FAILED;
-
-  region->obj = obj;
+      ck::string::format("[msh '%s' (created)]", name.get()), 0, pages * PGSIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, obj);
+  if (addr == -1) return MAP_FAILED;
   return (void *)addr;
 }
 
@@ -98,24 +98,35 @@ static void *msh_acquire(struct mshare_acquire *arg) {
   // grab the object
   ck::ref<mm::VMObject> obj = mshare_regions.get(name);
 
-  obj->acquire();
-
   auto addr = curproc->mm->mmap(
-      ck::string::format("[msh '%s' (acquired)]", name.get()), 0, arg->size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, nullptr, 0);
+      ck::string::format("[msh '%s' (acquired)]", name.get()), 0, arg->size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, obj);
   if (addr == -1) return MAP_FAILED;
 
-  // printf("addr=%p\n", addr);
+  // printf("[mshare] get  '%s' %p\n", name.get(), obj.get());
+  // curproc->mm->dump();
 
-  auto region = curproc->mm->lookup(addr);
-  if (region == nullptr) {
-    return MAP_FAILED;
-  }
+  return (void *)addr;
+}
 
-  region->obj = obj;
 
-  // printf("[mshare] get  '%s' %p\n", name.get(), obj.get());
-  // curproc->mm->dump();
+ck::ref<mm::VMObject> mshare_get(void *addr, int &prot) {
+  auto &mm = *curproc->mm;
+  scoped_lock l(mm.lock);
 
+  auto region = mm.lookup((off_t)addr);
+  if (region == nullptr || region->obj == nullptr) return nullptr;
+  // Only mshare regions can be passed along. Anything else (a file mapping,
+  // say) would hand out access the receiver never had
+  if (!region->obj->is_mshare()) return nullptr;
+  if ((region->flags & MAP_SHARED) == 0) return nullptr;
+  prot = region->prot & (PROT_READ | PROT_WRITE);
+  return region->obj;
+}
+
+
+void *mshare_map(ck::ref<mm::VMObject> obj, int prot) {
+  auto addr = curproc->mm->mmap("[msh (received)]", 0, obj->size(), prot, MAP_ANON | MAP_SHARED, obj);
+  if (addr == -1) return MAP_FAILED;
   return (void *)addr;
 }
 
@@ -462,6 +462,15 @@ off_t mm::AddressSpace::mmap(off_t req, size_t size, int prot, int flags, ck::re
 }
 
 off_t mm::AddressSpace::mmap(ck::string name, off_t addr, size_t size, int prot, int flags, ck::ref<fs::File> fd, off_t off) {
+  return map_object(name, addr, size, prot, flags, move(fd), off, nullptr);
+}
+
+off_t mm::AddressSpace::mmap(ck::string name, off_t addr, size_t size, int prot, int flags, ck::ref<mm::VMObject> obj) {
+  return map_object(name, addr, size, prot, flags, nullptr, 0, move(obj));
+}
+
+off_t mm::AddressSpace::map_object(
+    ck::string name, off_t addr, size_t size, int prot, int flags, ck::ref<fs::File> fd, off_t off, ck::ref<mm::VMObject> obj) {
   if (addr & 0xFFF) return -1;
 
   if ((flags & (MAP_PRIVATE | MAP_SHARED)) == 0) {
@@ -480,8 +489,6 @@ off_t mm::AddressSpace::mmap(ck::string name, off_t addr, size_t size, int prot,
 
   off_t pages = round_up(size, 4096) / 4096;
 
-  ck::ref<mm::VMObject> obj = nullptr;
-
   // if there is a file descriptor, try to call it's mmap. Otherwise fail
   if (fd) {
     obj = fd->ino->mmap(*fd, pages, prot, flags, off);
@@ -489,8 +496,8 @@ off_t mm::AddressSpace::mmap(ck::string name, off_t addr, size_t size, int prot,
     if (!obj) {
       return -1;
     }
-    obj->acquire();
   }
+  if (obj) obj->acquire();
 
 
   auto r = new mm::MappedRegion();
@@ -523,11 +530,11 @@ int mm::AddressSpace::unmap(off_t ptr, size_t ulen) {
 
   size_t len = round_up(ulen, 4096);
 
-  scoped_irqlock l1(lock);
+  scoped_lock l1(lock);
   auto *region = lookup(va);
   if (region == NULL) return -ESRCH;
 
-  scoped_irqlock l2(region->lock);
+  scoped_lock l2(region->lock);
 
   for (int i = 0; i < MM_REGION_CACHE_SIZE; i++) {
     if (region_cache[i].region == region) {
@@ -0,0 +1,144 @@
+#include <arch.h>
+#include <cpu.h>
+#include <mutex.h>
+#include <sched.h>
+
+// How many times a waiter checks the lock while the owner is running before
+// giving up and going to sleep
+#define MUTEX_SPIN_MAX 4096
+
+// Who the lock is held by. Before there are any threads, anything non-null
+// will do
+static inline Thread *mutex_self(void) {
+  Thread *t = curthd;
+  return t ? t : (Thread *)-1;
+}
+
+
+// Is `owner` on a core right now? This only compares pointers, so it is fine
+// if the owner exits while we look
+static bool owner_running(Thread *owner) {
+  bool running = false;
+  cpu::each([&](cpu::Core *core) {
+    if (core->current_thread.get() == owner) running = true;
+  });
+  return running;
+}
+
+
+bool mutex::try_lock(void) {
+  Thread *expected = nullptr;
+  return __atomic_compare_exchange_n(&m_owner, &expected, mutex_self(), false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+
+void mutex::lock(void) {
+  if (likely(try_lock())) return;
+  lock_slow();
+}
+
+
+void mutex::lock_slow(void) {
+  while (true) {
+    // spin while whoever has it is making progress on another core
+    for (int i = 0; i < MUTEX_SPIN_MAX; i++) {
+      Thread *owner = __atomic_load_n(&m_owner, __ATOMIC_RELAXED);
+      if (owner == nullptr) {
+        if (try_lock()) return;
+        continue;
+      }
+      if (curthd != nullptr && !owner_running(owner)) break;
+      arch_relax();
+    }
+
+    // nothing to sleep with yet
+    if (curthd == nullptr) continue;
+
+    struct wait_entry ent;
+    prepare_to_wait_exclusive(m_wq, ent, false);
+    // Count ourselves before checking the lock again. unlock() releases it
+    // before it checks for waiters, so one of us sees the other
+    __atomic_fetch_add(&m_waiters, 1, __ATOMIC_SEQ_CST);
+    bool got = try_lock();
+    if (!got) ent.start();
+    __atomic_fetch_sub(&m_waiters, 1, __ATOMIC_SEQ_CST);
+    finish_wait(m_wq, ent);
+
+    if (got) return;
+  }
+}
+
+
+void mutex::unlock(void) {
+  __atomic_store_n(&m_owner, nullptr, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&m_waiters, __ATOMIC_SEQ_CST) > 0) m_wq.wake_up();
+}
+
+
+
+void rwsem::read_lock(void) {
+  m_lock.lock();
+  while (m_count < 0 || m_writers_waiting > 0) {
+    struct wait_entry ent;
+    prepare_to_wait(m_readq, ent, false);
+    m_lock.unlock();
+    ent.start();
+    m_lock.lock();
+    finish_wait(m_readq, ent);
+  }
+  m_count++;
+  m_lock.unlock();
+}
+
+
+bool rwsem::try_read_lock(void) {
+  scoped_lock l(m_lock);
+  if (m_count < 0 || m_writers_waiting > 0) return false;
+  m_count++;
+  return true;
+}
+
+
+void rwsem::read_unlock(void) {
+  scoped_lock l(m_lock);
+  m_count--;
+  if (m_count == 0 && m_writers_waiting > 0) m_writeq.wake_up();
+}
+
+
+void rwsem::write_lock(void) {
+  m_lock.lock();
+  // from here on, new readers wait for us
+  m_writers_waiting++;
+  while (m_count != 0) {
+    struct wait_entry ent;
+    prepare_to_wait_exclusive(m_writeq, ent, false);
+    m_lock.unlock();
+    ent.start();
+    m_lock.lock();
+    finish_wait(m_writeq, ent);
+  }
+  m_writers_waiting--;
+  m_count = -1;
+  m_lock.unlock();
+}
+
+
+bool rwsem::try_write_lock(void) {
+  scoped_lock l(m_lock);
+  if (m_count != 0) return false;
+  m_count = -1;
+  return true;
+}
+
+
+void rwsem::write_unlock(void) {
+  scoped_lock l(m_lock);
+  m_count = 0;
+  // hand it to the next writer if there is one, otherwise let every reader in
+  if (m_writers_waiting > 0) {
+    m_writeq.wake_up();
+  } else {
+    m_readq.wake_up_all();
+  }
+}
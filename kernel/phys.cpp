@@ -3,12 +3,15 @@
 #include <fs.h>
 #include <lock.h>
 #include <mem.h>
+#include <module.h>
 #include <phys.h>
 #include <printf.h>
+#include <sched.h>
 #include <time.h>
 #include <types.h>
 #include <syscall.h>
 #include <thread.h>
+#include <wait.h>
 
 #include <crypto.h>
 
@@ -27,7 +30,8 @@ struct frame {
   inline void setnext(frame *f) { next = (frame *)v2p(f); }
 };
 
-static spinlock phys_lck;
+static lock_class phys_lck_class("phys");
+static qspinlock phys_lck(&phys_lck_class);
 
 static struct {
   int use_lock;
@@ -97,13 +101,55 @@ static void *late_phys_alloc(size_t npages) {
   return v2p(a);
 }
 
-// physical memory allocator implementation
-void *phys::alloc(int npages) {
-  // reclaim block cache if the free pages drops below 32 pages
-  if (kmem.nfree < 32) {
-    printf("gotta reclaim!\n");
+#define MAX_RECLAIMERS 8
+static phys::reclaimer reclaimers[MAX_RECLAIMERS];
+static int nreclaimers = 0;
+
+// Reclaimers free (and allocate) memory themselves, and phys::alloc can be
+// called with the kernel heap's lock held, so they can't run from inside
+// it. The allocator only asks the [reclaim] thread to run them.
+static bool reclaim_requested = false;
+static bool reclaim_ready = false;
+static wait_queue reclaim_wq;
+
+void phys::register_reclaimer(phys::reclaimer fn) {
+  scoped_irqlock l(phys_lck);
+  assert(nreclaimers < MAX_RECLAIMERS);
+  reclaimers[nreclaimers++] = fn;
+}
+
+static void request_reclaim(void) {
+  if (!__atomic_load_n(&reclaim_ready, __ATOMIC_ACQUIRE)) return;
+  // only the first request until the thread gets to it wakes it
+  if (__atomic_exchange_n(&reclaim_requested, true, __ATOMIC_SEQ_CST)) return;
+  reclaim_wq.wake_up();
+}
+
+static int reclaim_task(void *) {
+  while (true) {
+    struct wait_entry ent;
+    prepare_to_wait(reclaim_wq, ent, false);
+    if (!__atomic_exchange_n(&reclaim_requested, false, __ATOMIC_SEQ_CST)) ent.start();
+    finish_wait(reclaim_wq, ent);
+
     block::reclaim_memory();
+    for (int i = 0; i < nreclaimers; i++)
+      reclaimers[i]();
   }
+  return 0;
+}
+
+static void reclaim_init(void) {
+  sched::proc::create_kthread("[reclaim]", reclaim_task);
+  __atomic_store_n(&reclaim_ready, true, __ATOMIC_RELEASE);
+}
+
+module_init("reclaim", reclaim_init);
+
+// physical memory allocator implementation
+void *phys::alloc(int npages) {
+  // reclaim caches if the free pages drops below 32 pages
+  if (kmem.nfree < 32) request_reclaim();
 
   scoped_irqlock l(phys_lck);
   void *p = late_phys_alloc(npages);
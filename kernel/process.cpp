@@ -8,7 +8,7 @@
 #include <errno.h>
 #include <fs.h>
 #include <fs/vfs.h>
-#include <futex.h>
+#include <fs/magicfd.h>
 #include <chan.h>
 #include <lock.h>
 #include <mem.h>
@@ -67,6 +67,20 @@ void sched::proc::in_pgrp(long pgid, ck::func<bool(struct Process &)> cb) {
   }
 }
 
+
+// fds can't be above this, so a stray dup2 can't make the table huge
+#define FD_MAX 65536
+
+static Process::fd_table *fd_table_alloc(int size) {
+  auto *t = (Process::fd_table *)zalloc(sizeof(Process::fd_table) + size * sizeof(fs::File *));
+  t->size = size;
+  return t;
+}
+
+
+static void fd_table_free_rcu(struct rcu_head *head) { free(container_of(head, Process::fd_table, rcu)); }
+
+
 static ck::ref<Process> do_spawn_proc(ck::ref<Process> proc_ptr, int flags) {
   // get a reference, they are nicer to look at.
   // (and we spend less time in ck::ref<process>::{ref,deref}())
@@ -95,15 +109,21 @@ static ck::ref<Process> do_spawn_proc(ck::ref<Process> proc_ptr, int flags) {
     if (flags & SPAWN_FORK) {
       // inherit all file descriptors
       proc.parent->file_lock.lock();
-      for (auto &kv : proc.parent->open_files) {
-        proc.open_files[kv.key] = kv.value;
+      if (auto *pt = proc.parent->fds) {
+        auto *t = fd_table_alloc(pt->size);
+        for (int i = 0; i < pt->size; i++) {
+          if (pt->files[i] == nullptr) continue;
+          pt->files[i]->ref_retain();
+          t->files[i] = pt->files[i];
+        }
+        proc.fds = t;
       }
       proc.parent->file_lock.unlock();
 
     } else {
       // inherit stdin(0) stdout(1) and stderr(2)
       for (int i = 0; i < 3; i++) {
-        proc.open_files[i] = proc.parent->get_fd(i);
+        if (auto f = proc.parent->get_fd(i)) proc.set_fd(i, f);
       }
     }
   }
@@ -248,31 +268,135 @@ long sched::proc::create_kthread(const char *name, int (*func)(void *), void *ar
   return tid;
 }
 
-ck::ref<fs::File> Process::get_fd(int fd) {
-  ck::ref<fs::File> file;
+long sched::proc::create_kworker(Process &proc, const char *name, int (*func)(void *), void *arg) {
+  auto tid = get_next_pid();
 
-  scoped_lock l(file_lock);
-  auto it = open_files.find(fd);
-  if (it != open_files.end()) {
-    file = it->value;
+  auto thd = ck::make_ref<Thread>(tid, proc);
+  // the thread belongs to a user process, but never leaves the kernel
+  arch_initialize_trapframe(false, thd->trap_frame);
+  thd->trap_frame[1] = (unsigned long)arg;
+  thd->name = name;
+
+  thd->kickoff((void *)func, PS_RUNNING);
+
+  return tid;
+}
+
+// Take a reference, unless the last one is being dropped by a concurrent
+// close. fs::File frees its memory after a grace period, so it can still be
+// looked at
+static bool file_get_unless_zero(fs::File *file) {
+  unsigned int count = __atomic_load_n(&file->m_ref_count, __ATOMIC_RELAXED);
+  while (count != 0) {
+    if (__atomic_compare_exchange_n(&file->m_ref_count, &count, count + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return true;
+    }
   }
+  return false;
+}
+
 
-  return file;
+ck::ref<fs::File> Process::get_fd(int fd) {
+  if ((fd & MAGICFD_MASK) != 0) {
+    scoped_lock l(file_lock);
+    if (fd == MAGICFD_EXEC) return executable;
+    return nullptr;
+  }
+  if (fd < 0) return nullptr;
+
+  fs::File *file = nullptr;
+  rcu_read_lock();
+  auto *t = rcu_dereference(fds);
+  if (t != nullptr && fd < t->size) {
+    file = rcu_dereference(t->files[fd]);
+    if (file != nullptr && !file_get_unless_zero(file)) file = nullptr;
+  }
+  rcu_read_unlock();
+
+  if (file == nullptr) return nullptr;
+  return ck::ref<fs::File>(ck::ref<fs::File>::Adopt, *file);
 }
 
+
+// Make sure `fd` fits in the table. Expects file_lock to be held
+static Process::fd_table *fd_table_expand(Process &p, int fd) {
+  auto *old = p.fds;
+  if (old != nullptr && fd < old->size) return old;
+
+  int size = old ? old->size : 0;
+  if (size < 16) size = 16;
+  while (size <= fd)
+    size *= 2;
+  if (size > FD_MAX) size = FD_MAX;
+
+  auto *t = fd_table_alloc(size);
+  if (old != nullptr) {
+    // the references move over with the pointers
+    memcpy(t->files, old->files, old->size * sizeof(fs::File *));
+  }
+  rcu_assign_pointer(p.fds, t);
+  // lookups might still be reading the old one
+  if (old != nullptr) call_rcu(&old->rcu, fd_table_free_rcu);
+  return t;
+}
+
+
 int Process::add_fd(ck::ref<fs::File> file) {
-  int fd = 0;
   scoped_lock l(file_lock);
 
-  while (1) {
-    if (!open_files.contains(fd)) break;
-    fd++;
+  int fd = 0;
+  if (fds != nullptr) {
+    while (fd < fds->size && fds->files[fd] != nullptr)
+      fd++;
   }
+  if (fd >= FD_MAX) return -EMFILE;
+
+  auto *t = fd_table_expand(*this, fd);
+  rcu_assign_pointer(t->files[fd], file.leak_ref());
+  return fd;
+}
+
 
-  open_files.set(fd, file);
+int Process::set_fd(int fd, ck::ref<fs::File> file) {
+  if (fd < 0 || fd >= FD_MAX) return -EBADF;
+
+  ck::ref<fs::File> old;
+  {
+    scoped_lock l(file_lock);
+    auto *t = fd_table_expand(*this, fd);
+    if (t->files[fd] != nullptr) old = ck::ref<fs::File>(ck::ref<fs::File>::Adopt, *t->files[fd]);
+    rcu_assign_pointer(t->files[fd], file.leak_ref());
+  }
+  // released without the lock, as closing a file can sleep
   return fd;
 }
 
+
+int Process::close_fd(int fd) {
+  ck::ref<fs::File> old;
+  {
+    scoped_lock l(file_lock);
+    if (fds == nullptr || fd < 0 || fd >= fds->size || fds->files[fd] == nullptr) return -ENOENT;
+    old = ck::ref<fs::File>(ck::ref<fs::File>::Adopt, *fds->files[fd]);
+    rcu_assign_pointer(fds->files[fd], nullptr);
+  }
+  return 0;
+}
+
+
+void Process::close_fds(int from) {
+  ck::vec<ck::ref<fs::File>> closed;
+  {
+    scoped_lock l(file_lock);
+    if (fds == nullptr) return;
+    for (int fd = from; fd < fds->size; fd++) {
+      if (fds->files[fd] == nullptr) continue;
+      closed.push(ck::ref<fs::File>(ck::ref<fs::File>::Adopt, *fds->files[fd]));
+      rcu_assign_pointer(fds->files[fd], nullptr);
+    }
+  }
+}
+
 Process::~Process(void) {
   if (threads.size() != 0) {
     KWARN("destruction of proc %d still has threads!\n", this->pid);
@@ -280,6 +404,10 @@ Process::~Process(void) {
 
   sched::proc::ptable_remove(this->pid);
   delete mm;
+
+  close_fds();
+  // nobody can look the table up anymore
+  if (fds != nullptr) free(fds);
 }
 
 bool Process::is_dead(void) {
@@ -372,7 +500,7 @@ int sched::proc::reap(ck::ref<Process> p) {
 
   /* remove the child from our list */
   {
-    scoped_irqlock l(me->datalock);
+    scoped_lock l(me->datalock);
     for (int i = 0; i < me->children.size(); i++) {
       if (me->children[i] == p) {
         me->children.remove(i);
@@ -666,7 +794,7 @@ void sys::exit_proc(int code) { curproc->exit(code); }
 
 void Process::exit(int code) {
   {
-    scoped_irqlock l(datalock);
+    scoped_lock l(datalock);
     auto all = threads;
     for (auto t : all) {
       t->exit();
@@ -690,88 +818,6 @@ void sys::exit_thread(int code) {
 
 
 
-wait_queue &Process::futex_queue(int *uaddr) {
-  futex_lock.lock();
-  if (!m_futex_queues.contains((off_t)uaddr)) {
-    m_futex_queues.set((off_t)uaddr, ck::make_box<wait_queue>());
-  }
-  auto &wq = *m_futex_queues.ensure((off_t)uaddr);
-  futex_lock.unlock();
-  return wq;
-}
-
-
-
-
-int sys::futex(int *uaddr, int op, int val, int val2, int *uaddr2, int val3) {
-  // printf("call futex %p %d\n", uaddr, op);
-  /* If the user can't read the address, it's invalid. */
-  if (!VALIDATE_RD(uaddr, 4)) return -EINVAL;
-
-  auto &mm = *curproc->mm;
-
-  off_t addr = (off_t)uaddr;
-  /* the address must be word aligned (4 bytes) */
-  if ((addr & 0x3) != 0) return -EINVAL;
-
-  /*
-   * This follows the general idea of Linux's:
-   * This operation tests that the value at the futex word pointed to by the address uaddr still
-   * contains the expected value val, and if so, then sleeps waiting for  a  FU‐ TEX_WAKE  operation
-   * on  the futex word.  The load of the value of the futex word is an atomic memory access (i.e.,
-   * using atomic machine instructions of the respective architecture).  This load, the comparison
-   * with the expected value, and starting to sleep are performed atomically and totally ordered
-   * with respect to other futex oper‐ ations  on  the  same  futex  word.  If the thread starts to
-   * sleep, it is considered a waiter on this futex word.  If the futex value does not match val,
-   * then the call fails immediately with the error EAGAIN.
-   */
-  if (op == FUTEX_WAIT) {
-    // printf("futex_wait(%p, %d)\n", uaddr, val);
-    auto &wq = curproc->futex_queue(uaddr);
-
-    wait_entry ent;
-    prepare_to_wait_exclusive(wq, ent, true);
-    // prepare_to_wait(wq, ent, true);
-    // printf("[%2d] FUTEX_WAIT - wq: %p\n", curthd->tid, &wq);
-    /* Load the item atomically. (ATOMIC ACQUIRE makes sense here I think) */
-    int current_value = __atomic_load_n(uaddr, __ATOMIC_ACQUIRE);
-    /* If the value is not the expected value, return EAGAIN */
-    if (current_value != val) return -EAGAIN;
-
-    // printf("WAIT BEGIN!\n");
-
-    if (ent.start().interrupted()) {
-      // printf("FUTEX WAIT WAKEUP (RUDE)\n");
-      return -EINTR;
-    }
-    // printf("FUTEX WAIT WAKEUP\n");
-
-    return 0;
-  }
-
-  if (op == FUTEX_WAKE) {
-    // printf("futex_wake(%p, %d)\n", uaddr, val);
-    auto &wq = curproc->futex_queue(uaddr);
-
-    if (val == 0) return 0;
-
-    if (wq.task_list.is_empty_careful()) {
-      return 0;
-    }
-    // printf("[%2d] FUTEX_WAKE - wq: %p\n", curthd->tid, &wq);
-
-    wq.__wake_up(0, val, NULL);
-    return 1; /* if someone was woken up, return one */
-  }
-
-  if (op == FUTEX_DSTR) {
-  }
-
-  return -EINVAL;
-}
-
-
-
 int sys::kill(int pid, int sig) { return sched::proc::send_signal(pid, sig); }
 
 int sys::prctl(int option, unsigned long a1, unsigned long a2, unsigned long a3, unsigned long a4, unsigned long a5) { return -ENOTIMPL; }
@@ -1,18 +1,162 @@
 #include <rcu.h>
+#include <arch.h>
 #include <cpu.h>
-#include <lock.h>
+#include <module.h>
+#include <sched.h>
+#include <wait.h>
+
+/*
+ * Grace periods are numbered. Starting one bumps `rcu_gp_seq`, and a core
+ * reports a quiescent state by copying the current number into its
+ * `rcu_qs_seq`. Grace period N is over once every core in the scheduler has
+ * reported N or later, since each of them has been outside of all readers at
+ * some point after N started. Cores that haven't reached the scheduler yet
+ * don't run readers, so they aren't waited for.
+ *
+ * Nothing is done on the read side besides keeping the core from switching
+ * threads, which is what makes a context switch a quiescent state.
+ *
+ * Callbacks whose grace period is over are handed to the [rcu] thread. They
+ * usually free memory, which can't be done from the scheduler: the thread
+ * it switched away from might be holding the allocator's lock.
+ */
+
+// the most recently started grace period
+static unsigned long rcu_gp_seq = 0;
+// every grace period up to this one is over
+static unsigned long rcu_gp_completed = 0;
+
+// callbacks that are ready to run, in no particular order
+static spinlock rcu_ready_lock;
+static struct rcu_head *rcu_ready = nullptr;
+static wait_queue rcu_ready_wq;
+
+static inline bool seq_after_eq(unsigned long a, unsigned long b) { return (long)(a - b) >= 0; }
 
-// define the global rwlock
-rwlock rcu_gp_mutex;
 
 void rcu_read_lock(void) {
   core().preempt_count++;
   barrier();
-  rcu_gp_mutex.read_lock();
 }
 
-void rcu_read_unlock() {
-  core().preempt_count--;
+void rcu_read_unlock(void) {
   barrier();
-  rcu_gp_mutex.read_unlock();
+  core().preempt_count--;
+}
+
+
+void rcu_note_quiescent(void) {
+  auto &c = core();
+  if (c.preempt_count != 0) return;
+  // everything this core read before now is ordered before the report
+  __atomic_store_n(&c.rcu_qs_seq, __atomic_load_n(&rcu_gp_seq, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+
+static unsigned long rcu_start_gp(void) { return __atomic_add_fetch(&rcu_gp_seq, 1, __ATOMIC_SEQ_CST); }
+
+
+static bool rcu_gp_done(unsigned long seq) {
+  if (seq_after_eq(__atomic_load_n(&rcu_gp_completed, __ATOMIC_ACQUIRE), seq)) return true;
+
+  bool done = true;
+  cpu::each([&](cpu::Core *c) {
+    if (!__atomic_load_n(&c->in_sched, __ATOMIC_ACQUIRE)) return;
+    if (!seq_after_eq(__atomic_load_n(&c->rcu_qs_seq, __ATOMIC_ACQUIRE), seq)) done = false;
+  });
+  if (!done) return false;
+
+  // let the next caller skip the scan
+  unsigned long cur = __atomic_load_n(&rcu_gp_completed, __ATOMIC_RELAXED);
+  while (!seq_after_eq(cur, seq)) {
+    if (__atomic_compare_exchange_n(&rcu_gp_completed, &cur, seq, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) break;
+  }
+  return true;
+}
+
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *)) {
+  head->func = func;
+
+  // keep the tick from moving us, or running the scheduler's half of this,
+  // in between
+  bool ints = arch_irqs_enabled();
+  arch_disable_ints();
+  auto &c = core();
+  head->next = c.rcu_next;
+  c.rcu_next = head;
+  if (ints) arch_enable_ints();
+}
+
+
+void rcu_check_callbacks(void) {
+  bool ints = arch_irqs_enabled();
+  arch_disable_ints();
+
+  rcu_note_quiescent();
+
+  auto &c = core();
+  if (c.rcu_wait != nullptr && rcu_gp_done(c.rcu_wait_seq)) {
+    auto *last = c.rcu_wait;
+    while (last->next != nullptr)
+      last = last->next;
+
+    rcu_ready_lock.lock();
+    last->next = rcu_ready;
+    rcu_ready = c.rcu_wait;
+    rcu_ready_lock.unlock();
+
+    c.rcu_wait = nullptr;
+    rcu_ready_wq.wake_up_all();
+  }
+
+  // Everything queued since the last batch waits for a grace period that
+  // starts now, after they were all unpublished
+  if (c.rcu_wait == nullptr && c.rcu_next != nullptr) {
+    c.rcu_wait = c.rcu_next;
+    c.rcu_next = nullptr;
+    c.rcu_wait_seq = rcu_start_gp();
+  }
+
+  if (ints) arch_enable_ints();
 }
+
+
+static int rcu_task(void *) {
+  while (true) {
+    struct wait_entry ent;
+    prepare_to_wait(rcu_ready_wq, ent, false);
+
+    auto flags = rcu_ready_lock.lock_irqsave();
+    auto *done = rcu_ready;
+    rcu_ready = nullptr;
+    rcu_ready_lock.unlock_irqrestore(flags);
+
+    if (done == nullptr) ent.start();
+    finish_wait(rcu_ready_wq, ent);
+
+    while (done != nullptr) {
+      auto *next = done->next;
+      done->func(done);
+      done = next;
+    }
+  }
+  return 0;
+}
+
+
+void synchronize_rcu(void) {
+  unsigned long seq = rcu_start_gp();
+  // we aren't in a reader, so this core is already quiescent
+  rcu_note_quiescent();
+
+  while (!rcu_gp_done(seq)) {
+    // the other cores report in at their next tick or context switch
+    sched::yield();
+  }
+}
+
+
+static void rcu_init(void) { sched::proc::create_kthread("[rcu]", rcu_task); }
+
+module_init("rcu", rcu_init);
@@ -8,6 +8,7 @@
 #include <time.h>
 #include <wait.h>
 #include <printf.h>
+#include <rcu.h>
 #include <realtime.h>
 #include "arch.h"
 
@@ -194,9 +195,9 @@ void rt::Scheduler::kick(void) {
 }
 
 
-scoped_irqlock rt::Scheduler::lock(void) { return m_lock; }
+scoped_irqlock<spinlock> rt::Scheduler::lock(void) { return m_lock; }
 
-scoped_irqlock rt::local_lock(void) { return core().local_scheduler.lock(); }
+scoped_irqlock<spinlock> rt::local_lock(void) { return core().local_scheduler.lock(); }
 
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -477,6 +478,9 @@ void sched::run() {
     slack_test_count++;
     if (slack_test_count == slack_test_interval) slack_test_count = 0;
 
+    // No thread is running on this core, so it isn't in an RCU reader
+    rcu_check_callbacks();
+
     sched.reschedule();
     ck::ref<Thread> thd = sched.claim();
 
@@ -539,6 +543,9 @@ void sched::run() {
 
 void sched::handle_tick(u64 ticks) {
   if (!core().in_sched) return;
+  // If we didn't interrupt an RCU reader, this is a quiescent state. That
+  // keeps grace periods moving on cores that are idle or running one thread
+  rcu_note_quiescent();
   if (!cpu::in_thread()) return;
 
   check_wakeups();
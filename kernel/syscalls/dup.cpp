@@ -1,8 +1,10 @@
 #include <syscall.h>
 #include <cpu.h>
+#include <fs/magicfd.h>
 
 int sys::dup(int fd) {
   auto f = curproc->get_fd(fd);
+  if (!f) return -EBADFD;
   return curproc->add_fd(f);
 }
 
@@ -12,9 +14,6 @@ int sys::dup2(int oldfd, int newfd) {
   if (!f) return -EBADFD;
 
 
-  sys::close(newfd);
-
-  scoped_lock l(curproc->file_lock);
-  curproc->open_files.set(newfd, f);
-  return newfd;
+  if ((newfd & MAGICFD_MASK) != 0) return -EPERM;
+  return curproc->set_fd(newfd, f);
 }
@@ -75,19 +75,7 @@ int sys::execve(const char *path, const char **uargv, const char **uenvp) {
     fd = ck::make_ref<fs::File>(exe, FDIR_READ);
   }
 
-  {
-    ck::vec<int> to_close;
-    scoped_lock l(curproc->file_lock);
-    for (auto [fd, file] : curproc->open_files) {
-      if (fd >= 3) {
-        to_close.push(fd);
-      }
-    }
-
-    for (int fd : to_close) {
-      curproc->open_files.remove(fd);
-    }
-  }
+  curproc->close_fds(3);
 
   off_t entry = 0;
   mm::AddressSpace *new_addr_space = nullptr;
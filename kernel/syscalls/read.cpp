@@ -14,3 +14,11 @@ ssize_t sys::read(int fd, void *data, size_t len) {
 
   return n;
 }
+
+ssize_t sys::pread(int fd, void *data, size_t len, off_t off) {
+  if (!curproc->mm->validate_pointer(data, len, PROT_WRITE)) return -EINVAL;
+
+  ck::ref<fs::File> file = curproc->get_fd(fd);
+  if (!file) return -EBADF;
+  return file->pread(data, len, off);
+}
@@ -0,0 +1,31 @@
+#include <cpu.h>
+#include <syscall.h>
+
+// copy in an optional offset argument
+static bool get_off(off_t *uoff, off_t &off) {
+  if (uoff == NULL) return true;
+  if (!curproc->mm->validate_pointer(uoff, sizeof(*uoff), PROT_READ | PROT_WRITE)) return false;
+  off = *uoff;
+  return true;
+}
+
+
+long sys::splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned flags) {
+  off_t in_off = 0, out_off = 0;
+  if (!get_off(off_in, in_off) || !get_off(off_out, out_off)) return -EFAULT;
+
+  ck::ref<fs::File> in = curproc->get_fd(fd_in);
+  ck::ref<fs::File> out = curproc->get_fd(fd_out);
+  if (!in || !out) return -EBADF;
+
+  long n = fs::splice(*in, off_in ? &in_off : NULL, *out, off_out ? &out_off : NULL, len, flags);
+
+  if (off_in) *off_in = in_off;
+  if (off_out) *off_out = out_off;
+  return n;
+}
+
+
+long sys::sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+  return sys::splice(in_fd, offset, out_fd, NULL, count, 0);
+}
@@ -0,0 +1,18 @@
+#include <block.h>
+#include <cpu.h>
+#include <syscall.h>
+
+int sys::sync(void) {
+  block::sync_all();
+  return 0;
+}
+
+int sys::fsync(int fd) {
+  auto f = cpu::proc()->get_fd(fd);
+  if (!f) return -EBADF;
+
+  // The buffer cache doesn't know which file a buffer belongs to, so the
+  // best we can do is write back everything.
+  block::sync_all();
+  return 0;
+}
@@ -0,0 +1,62 @@
+#include <cpu.h>
+#include <syscall.h>
+
+// the most one call can transfer, so the total fits in the return value
+#define IOV_TOTAL_MAX (~0UL >> 1)
+
+// Copy the segment list in from userspace and check every segment. `prot` is
+// the access the kernel will need to the segments
+static int copy_iov(const struct iovec *uiov, int iovcnt, ck::vec<struct iovec> &iov, int prot) {
+  if (iovcnt < 0 || iovcnt > IOV_MAX) return -EINVAL;
+  if (iovcnt == 0) return 0;
+  if (!curproc->mm->validate_pointer((void *)uiov, iovcnt * sizeof(*uiov), PROT_READ)) return -EFAULT;
+
+  iov.push(uiov, iovcnt);
+
+  size_t total = 0;
+  for (auto &seg : iov) {
+    if (seg.iov_len > IOV_TOTAL_MAX - total) return -EINVAL;
+    total += seg.iov_len;
+    if (seg.iov_len == 0) continue;
+    if (!curproc->mm->validate_pointer(seg.iov_base, seg.iov_len, prot)) return -EFAULT;
+  }
+  return 0;
+}
+
+
+static long do_readv(int fd, const struct iovec *uiov, int iovcnt, off_t off) {
+  ck::vec<struct iovec> iov;
+  int err = copy_iov(uiov, iovcnt, iov, PROT_WRITE);
+  if (err < 0) return err;
+
+  ck::ref<fs::File> file = curproc->get_fd(fd);
+  if (!file) return -EBADF;
+  if (iov.size() == 0) return 0;
+  return file->readv(iov.data(), iov.size(), off);
+}
+
+
+static long do_writev(int fd, const struct iovec *uiov, int iovcnt, off_t off) {
+  ck::vec<struct iovec> iov;
+  int err = copy_iov(uiov, iovcnt, iov, PROT_READ);
+  if (err < 0) return err;
+
+  ck::ref<fs::File> file = curproc->get_fd(fd);
+  if (!file) return -EBADF;
+  if (iov.size() == 0) return 0;
+  return file->writev(iov.data(), iov.size(), off);
+}
+
+
+long sys::readv(int fd, const struct iovec *iov, int iovcnt) { return do_readv(fd, iov, iovcnt, -1); }
+long sys::writev(int fd, const struct iovec *iov, int iovcnt) { return do_writev(fd, iov, iovcnt, -1); }
+
+long sys::preadv(int fd, const struct iovec *iov, int iovcnt, off_t off) {
+  if (off < 0) return -EINVAL;
+  return do_readv(fd, iov, iovcnt, off);
+}
+
+long sys::pwritev(int fd, const struct iovec *iov, int iovcnt, off_t off) {
+  if (off < 0) return -EINVAL;
+  return do_writev(fd, iov, iovcnt, off);
+}
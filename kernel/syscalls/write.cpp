@@ -11,3 +11,11 @@ ssize_t sys::write(int fd, void *data, size_t len) {
   if (file) n = file->write(data, len);
   return n;
 }
+
+ssize_t sys::pwrite(int fd, void *data, size_t len, off_t off) {
+  if (!curproc->mm->validate_pointer(data, len, PROT_READ)) return -EINVAL;
+
+  ck::ref<fs::File> file = curproc->get_fd(fd);
+  if (!file) return -EBADF;
+  return file->pwrite(data, len, off);
+}
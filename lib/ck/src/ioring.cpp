@@ -0,0 +1,180 @@
+#include <ck/eventloop.h>
+#include <ck/ioring.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+ck::ioring::~ioring(void) {
+  if (m_fd == -1) return;
+  m_notifier.set_active(false);
+  munmap(m_map, m_params.map_size);
+  close(m_fd);
+}
+
+
+bool ck::ioring::init(unsigned entries, unsigned flags) {
+  memset(&m_params, 0, sizeof(m_params));
+  m_params.flags = flags;
+
+  int fd = ioring_setup(entries, &m_params);
+  if (fd < 0) return false;
+
+  void *map = mmap(NULL, m_params.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  m_fd = fd;
+  m_map = map;
+  m_rings = (struct ioring_rings *)map;
+  m_sqes = (struct ioring_sqe *)((char *)map + m_params.sqes_off);
+  m_cqes = (struct ioring_cqe *)((char *)map + m_params.cqes_off);
+  m_sq_tail = m_rings->sq_tail;
+
+  m_notifier.init(m_fd, AWAITFS_READ);
+  m_notifier.on_event = [this](int) { on_completions(); };
+  return true;
+}
+
+
+struct ioring_sqe *ck::ioring::get_sqe(void) {
+  uint32_t head = __atomic_load_n(&m_rings->sq_head, __ATOMIC_ACQUIRE);
+  if (m_sq_tail - head >= m_params.sq_entries) return NULL;
+
+  auto *sqe = &m_sqes[m_sq_tail & (m_params.sq_entries - 1)];
+  m_sq_tail++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+
+int ck::ioring::submit(unsigned wait_for) {
+  uint32_t queued = m_sq_tail - __atomic_load_n(&m_rings->sq_tail, __ATOMIC_RELAXED);
+  __atomic_store_n(&m_rings->sq_tail, m_sq_tail, __ATOMIC_RELEASE);
+
+  unsigned flags = wait_for ? IORING_ENTER_GETEVENTS : 0;
+  if (m_params.flags & IORING_SETUP_SQPOLL) {
+    // the kernel is already watching the queue, unless the poller went to sleep
+    if (__atomic_load_n(&m_rings->sq_flags, __ATOMIC_SEQ_CST) & IORING_SQ_NEED_WAKEUP) {
+      flags |= IORING_ENTER_SQ_WAKEUP;
+    } else if (wait_for == 0) {
+      return queued;
+    }
+  }
+
+  return ioring_enter(m_fd, queued, wait_for, flags);
+}
+
+
+int ck::ioring::reap(ck::func<void(struct ioring_cqe &)> cb) {
+  uint32_t head = m_rings->cq_head;
+  uint32_t tail = __atomic_load_n(&m_rings->cq_tail, __ATOMIC_ACQUIRE);
+  int n = 0;
+
+  for (; head != tail; head++, n++) {
+    // copy it out, so the slot can be reused while the callback runs
+    struct ioring_cqe cqe = m_cqes[head & (m_params.cq_entries - 1)];
+    __atomic_store_n(&m_rings->cq_head, head + 1, __ATOMIC_RELEASE);
+    cb(cqe);
+  }
+  return n;
+}
+
+
+ck::future<long> ck::ioring::queue_async(struct ioring_sqe *sqe) {
+  ck::future<long> fut;
+  if (sqe == NULL) {
+    fut.resolve(-EBUSY);
+    return fut;
+  }
+
+  long id = m_next_id++;
+  sqe->user_data = id;
+  m_pending.set(id, fut.get_control());
+
+  // everything queued during this turn of the eventloop goes in with one call
+  if (!m_submit_deferred) {
+    m_submit_deferred = true;
+    ck::eventloop::defer([this] {
+      m_submit_deferred = false;
+      submit();
+    });
+  }
+  return fut;
+}
+
+
+void ck::ioring::on_completions(void) {
+  reap([this](struct ioring_cqe &cqe) {
+    long id = cqe.user_data;
+    auto it = m_pending.find(id);
+    if (it == m_pending.end()) return;
+    auto ctrl = it->value;
+    m_pending.remove(id);
+    long res = cqe.res;
+    ctrl->resolve(move(res));
+  });
+}
+
+
+async(long) ck::ioring::async_read(int fd, void *buf, size_t len, off_t off) {
+  auto *sqe = get_sqe();
+  if (sqe) {
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+  }
+  return queue_async(sqe);
+}
+
+
+async(long) ck::ioring::async_write(int fd, const void *buf, size_t len, off_t off) {
+  auto *sqe = get_sqe();
+  if (sqe) {
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+  }
+  return queue_async(sqe);
+}
+
+
+async(long) ck::ioring::async_open(const char *path, int flags, int mode) {
+  auto *sqe = get_sqe();
+  if (sqe) {
+    sqe->opcode = IORING_OP_OPEN;
+    sqe->addr = (uint64_t)path;
+    sqe->len = flags;
+    sqe->mode = mode;
+  }
+  return queue_async(sqe);
+}
+
+
+async(long) ck::ioring::async_accept(int fd, struct sockaddr *addr, size_t addrlen) {
+  auto *sqe = get_sqe();
+  if (sqe) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)addr;
+    sqe->len = addrlen;
+  }
+  return queue_async(sqe);
+}
+
+
+async(long) ck::ioring::async_timeout(long long us) {
+  auto *sqe = get_sqe();
+  if (sqe) {
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->off = us;
+  }
+  return queue_async(sqe);
+}
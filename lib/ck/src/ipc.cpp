@@ -9,11 +9,13 @@
 #include <ck/time.h>
 #include <errno.h>
 #include <sys/syscall.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
 
 #define round_up(x, y) (((x) + (y)-1) & ~((y)-1))
 
 
-#ifdef IPC_USE_SHM
 static void *mshare_create(const char *name, size_t size) {
   struct mshare_create arg;
   arg.size = size;
@@ -28,7 +30,18 @@ static void *mshare_acquire(const char *name, size_t size) {
   strncpy(arg.name, name, MSHARE_NAMESZ - 1);
   return (void *)sysbind_mshare(MSHARE_ACQUIRE, &arg);
 }
-#endif
+
+
+// records on the rings are a length followed by the message
+#define RING_RECORD_SIZE(len) round_up(sizeof(uint32_t) + (len), 8)
+// sent through the socket to wake up a receiver. Messages are never this short
+#define DOORBELL_SIZE 1
+
+
+struct msg_header {
+  uint32_t type;
+  ck::ipc::nonce_t nonce;
+};
 
 
 ck::ipc::impl::socket_connection::socket_connection(ck::ref<ck::ipcsocket> s, const char *ns, bool is_server)
@@ -37,42 +50,151 @@ ck::ipc::impl::socket_connection::socket_connection(ck::ref<ck::ipcsocket> s, co
 
   handshake();
   m_recv_fiber_join = ck::spawn([this] {
-    // This is just the maximum size of a message in the IPC protocol :)
-    constexpr size_t receive_buffer_size = 1024 * 32;
-    void *recv_buf = malloc(max_message_size);
+    // room for a batch holding at least one message of the largest size
+    size_t recv_buf_size = IPC_BATCH_RECORD_SIZE(max_message_size);
+    void *recv_buf = malloc(recv_buf_size);
+    // messages from the ring are copied out here, as recv_buf might be
+    // holding a message from the socket that has to wait for them
+    void *ring_buf = m_shm ? malloc(max_message_size) : NULL;
+
     while (!closed()) {
-      // printf("%s reading...\n", side());
-      auto recv_size = m_sock->async_recv(recv_buf, max_message_size, MSG_DONTWAIT).await();
+      if (m_rx != NULL) {
+        ring_drain(ring_buf);
+        if (closed()) break;
+
+        // Ask for a doorbell, then look again in case a message showed up
+        // before the sender could have seen the request
+        __atomic_store_n(&m_rx->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&m_rx->tail, __ATOMIC_SEQ_CST) != m_rx->head) {
+          __atomic_store_n(&m_rx->sleeping, 0, __ATOMIC_RELAXED);
+          continue;
+        }
+      }
 
-      // printf("%s got something:  %d!\n", side(), recv_size);
+      // take everything that is waiting on the socket at once
+      auto recv_size = m_sock->async_recv(recv_buf, recv_buf_size, MSG_DONTWAIT | MSG_IPC_BATCH).await();
       if (recv_size <= 0) {
-        // printf("%s: closed!\n", side());
         close();
         break;
-      } else {
-        // ck::hexdump(recv_buf, recv_size);
-        dispatch(recv_buf, recv_size);
+      }
+
+      if (m_rx != NULL) __atomic_store_n(&m_rx->sleeping, 0, __ATOMIC_RELAXED);
+
+      for (size_t off = 0; off < (size_t)recv_size && !closed();) {
+        auto *hdr = (struct ipc_batch_hdr *)((uint8_t *)recv_buf + off);
+        void *msg = hdr + 1;
+        off += IPC_BATCH_RECORD_SIZE(hdr->len);
+
+        if (m_handshake_pending) {
+          finish_handshake(msg, hdr->len);
+          continue;
+        }
+
+        if (m_rx == NULL) {
+          dispatch(msg, hdr->len);
+          continue;
+        }
+
+        if (hdr->len == DOORBELL_SIZE) continue;
+
+        // everything on the ring was sent before this message
+        ring_drain(ring_buf);
+        if (closed()) break;
+        dispatch(msg, hdr->len);
+        // let the sender go back to the ring
+        __atomic_add_fetch(&m_rx->sock_done, 1, __ATOMIC_RELEASE);
       }
     }
 
 
     free(recv_buf);
+    free(ring_buf);
   });
 }
 
 
 
+bool ck::ipc::impl::socket_connection::setup_shm(msg_handshake &hs) {
+  static int next_id = 0;
+
+  m_shm_size = round_up(sizeof(shm_ring) * 2, 4096);
+  snprintf(hs.shm_name, sizeof(hs.shm_name), "ipc:%d:%d", getpid(), next_id++);
+  m_shm = mshare_create(hs.shm_name, m_shm_size);
+  if (m_shm == MAP_FAILED) {
+    m_shm = NULL;
+    return false;
+  }
+  hs.shm_size = m_shm_size;
+  // the rings are used once the client accepts them (finish_handshake)
+  return true;
+}
+
+
+void ck::ipc::impl::socket_connection::teardown_shm(void) {
+  if (m_shm != NULL) munmap(m_shm, m_shm_size);
+  m_shm = NULL;
+  m_tx = m_rx = NULL;
+}
+
+
 void ck::ipc::impl::socket_connection::handshake(void) {
   if (is_server) {
-    int x = 42;
-    if (m_sock->send(&x, sizeof(x), 0) < 0) close();
+    msg_handshake hs;
+    memset(&hs, 0, sizeof(hs));
+    // without shared memory, everything just goes through the socket
+    setup_shm(hs);
+
+    if (m_sock->send(&hs, sizeof(hs), 0) < 0) {
+      close();
+      return;
+    }
+    // don't wait on a client that may never answer. The receive fiber
+    // picks up the reply
+    m_handshake_pending = true;
   } else {
-    int x = 0;
-    if (m_sock->recv(&x, sizeof(x), 0) < 0) close();
-    assert(x == 42);
+    msg_handshake hs;
+    if (m_sock->recv(&hs, sizeof(hs), 0) < 0) {
+      close();
+      return;
+    }
+
+    int accepted = 0;
+    if (hs.shm_name[0] != '\0' && hs.shm_size == round_up(sizeof(shm_ring) * 2, 4096)) {
+      hs.shm_name[sizeof(hs.shm_name) - 1] = '\0';
+      m_shm = mshare_acquire(hs.shm_name, hs.shm_size);
+      if (m_shm == MAP_FAILED) {
+        m_shm = NULL;
+      } else {
+        m_shm_size = hs.shm_size;
+        auto *rings = (shm_ring *)m_shm;
+        m_tx = &rings[1];
+        m_rx = &rings[0];
+        accepted = 1;
+      }
+    }
+
+    if (m_sock->send(&accepted, sizeof(accepted), 0) < 0) close();
   }
 }
 
+void ck::ipc::impl::socket_connection::finish_handshake(void *data, size_t len) {
+  m_handshake_pending = false;
+
+  if (len != sizeof(int)) {
+    close();
+    return;
+  }
+
+  if (*(int *)data && m_shm != NULL) {
+    auto *rings = (shm_ring *)m_shm;
+    m_tx = &rings[0];
+    m_rx = &rings[1];
+  } else {
+    teardown_shm();
+  }
+}
+
+
 ck::ipc::encoder ck::ipc::impl::socket_connection::begin_send(void) {
   if (msg_buffer == NULL) msg_buffer = malloc(max_message_size);
   msg_size = 0;
@@ -82,9 +204,80 @@ ck::ipc::encoder ck::ipc::impl::socket_connection::begin_send(void) {
 }
 
 
+bool ck::ipc::impl::socket_connection::ring_send(const void *data, size_t len) {
+  auto *r = m_tx;
+
+  // messages are still in flight on the socket
+  if (r->sock_sent != __atomic_load_n(&r->sock_done, __ATOMIC_ACQUIRE)) return false;
+
+  uint32_t tail = r->tail;
+  uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+  size_t rec = RING_RECORD_SIZE(len);
+  if (rec > ring_size - (tail - head)) return false;
+
+  // the length never wraps, as records are 8 byte aligned
+  uint32_t off = tail % ring_size;
+  *(uint32_t *)(r->data + off) = len;
+  off = (off + sizeof(uint32_t)) % ring_size;
+
+  size_t first = len < ring_size - off ? len : ring_size - off;
+  memcpy(r->data + off, data, first);
+  memcpy(r->data, (const uint8_t *)data + first, len - first);
+
+  // seq_cst, so it's ordered before we look at `sleeping`
+  __atomic_store_n(&r->tail, tail + rec, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&r->sleeping, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&r->sleeping, 0, __ATOMIC_SEQ_CST)) {
+    char bell = 0;
+    if (m_sock->send(&bell, DOORBELL_SIZE, 0) <= 0) close();
+  }
+  return true;
+}
+
+
+void ck::ipc::impl::socket_connection::ring_drain(void *buf) {
+  auto *r = m_rx;
+
+  // The ring is shared with the peer, so nothing on it can be trusted. Only
+  // look at what was published when we started, and give up on the
+  // connection if a record doesn't fit in it or in `buf`
+  uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+  uint32_t head = r->head;
+  if (tail - head > ring_size) {
+    close();
+    return;
+  }
+
+  while (!closed() && head != tail) {
+    uint32_t off = head % ring_size;
+    uint32_t len = __atomic_load_n((uint32_t *)(r->data + off), __ATOMIC_RELAXED);
+    if (len < sizeof(msg_header) || len > max_message_size || RING_RECORD_SIZE(len) > tail - head) {
+      close();
+      return;
+    }
+    off = (off + sizeof(uint32_t)) % ring_size;
+
+    size_t first = len < ring_size - off ? len : ring_size - off;
+    memcpy(buf, r->data + off, first);
+    memcpy((uint8_t *)buf + first, r->data, len - first);
+
+    // the space can be reused once it's copied out
+    head += RING_RECORD_SIZE(len);
+    __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+    dispatch(buf, len);
+  }
+}
+
+
 void ck::ipc::impl::socket_connection::finish_send(void) {
   if (closed()) return;
 
+  if (m_tx != NULL) {
+    if (ring_send(msg_buffer, msg_size)) return;
+    // the receiver counts it off once it's dispatched
+    __atomic_store_n(&m_tx->sock_sent, m_tx->sock_sent + 1, __ATOMIC_RELEASE);
+  }
+
   if (m_sock->send(msg_buffer, msg_size, 0) <= 0) {
     close();
     return;
@@ -93,11 +286,6 @@ void ck::ipc::impl::socket_connection::finish_send(void) {
 
 
 
-struct msg_header {
-  uint32_t type;
-  ck::ipc::nonce_t nonce;
-};
-
 void ck::ipc::impl::socket_connection::dispatch(void *data, size_t len) {
   // was consumed by sync_wait
   if (data == NULL) return;
@@ -109,8 +297,11 @@ void ck::ipc::impl::socket_connection::dispatch(void *data, size_t len) {
 
 
   if (sync_wait_futures.contains(header->nonce)) {
+    // `data` is reused for the next message before the waiter gets to run
+    void *copy = malloc(len);
+    memcpy(copy, data, len);
     auto f = sync_wait_futures.get(header->nonce);
-    f.resolve(ck::ipc::raw_msg{data, len});
+    f.resolve(ck::ipc::raw_msg{copy, len});
   } else {
     dispatch_received_message(data, len);
   }
@@ -133,5 +324,9 @@ ck::ipc::raw_msg ck::ipc::impl::socket_connection::sync_wait(uint32_t msg_type,
   res.sz = sz;
   sync_wait_futures.remove(nonce);
 
+  // the previous reply has been decoded by now
+  free(m_sync_reply);
+  m_sync_reply = data;
+
   return res;
 }
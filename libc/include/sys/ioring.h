@@ -0,0 +1,21 @@
+#pragma once
+
+#ifndef _SYS_IORING_H
+#define _SYS_IORING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <chariot/ioring_types.h>
+
+// create a ring, returning its fd. See <chariot/ioring_types.h> for how to use it
+int ioring_setup(unsigned entries, struct ioring_params *params);
+// submit queued entries and/or wait for completions
+int ioring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
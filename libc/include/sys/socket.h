@@ -33,6 +33,9 @@ ssize_t recv(int socket, void *buffer, size_t length, int flags);
 
 ssize_t send(int socket, const void *buffer, size_t length, int flags);
 
+ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags);
+ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags);
+
 #ifdef __cplusplus
 }
 #endif
@@ -13,10 +13,14 @@
 #include <sys/sysinfo.h>
 #include <sys/netdb.h>
 #include <chariot/cpu_usage.h>
+#include <chariot/uio.h>
+#include <chariot/ioring_types.h>
 #else
 #include <types.h>
 #include <mountopts.h>
 #include <cpu_usage.h>
+#include <uio.h>
+#include <ioring_types.h>
 #endif
 
 #ifdef __cplusplus
@@ -91,6 +95,20 @@ unsigned long sysbind_getramusage();
 int sysbind_get_core_usage(unsigned int core, struct chariot_core_usage * usage);
 int sysbind_get_nproc();
 int sysbind_kctl(off_t* name, unsigned namelen, char * oval, size_t* olen, char * nval, size_t nlen);
+int sysbind_sync();
+int sysbind_fsync(int fd);
+long sysbind_pread(int fd, void* buf, size_t len, off_t off);
+long sysbind_pwrite(int fd, void* buf, size_t len, off_t off);
+long sysbind_readv(int fd, const struct iovec* iov, int iovcnt);
+long sysbind_writev(int fd, const struct iovec* iov, int iovcnt);
+long sysbind_preadv(int fd, const struct iovec* iov, int iovcnt, off_t off);
+long sysbind_pwritev(int fd, const struct iovec* iov, int iovcnt, off_t off);
+long sysbind_sendfile(int out_fd, int in_fd, off_t* offset, size_t count);
+long sysbind_splice(int fd_in, off_t* off_in, int fd_out, off_t* off_out, size_t len, unsigned flags);
+int sysbind_ioring_setup(unsigned entries, struct ioring_params* params);
+int sysbind_ioring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags);
+ssize_t sysbind_sendmsg(int sockfd, const struct msghdr* msg, int flags);
+ssize_t sysbind_recvmsg(int sockfd, struct msghdr* msg, int flags);
 #ifdef __cplusplus
 }
 namespace sys {
@@ -162,5 +180,19 @@ namespace sys {
    inline int get_core_usage(unsigned int core, struct chariot_core_usage * usage) { return sysbind_get_core_usage(core, usage); }
    inline int get_nproc() { return sysbind_get_nproc(); }
    inline int kctl(off_t* name, unsigned namelen, char * oval, size_t* olen, char * nval, size_t nlen) { return sysbind_kctl(name, namelen, oval, olen, nval, nlen); }
+   inline int sync() { return sysbind_sync(); }
+   inline int fsync(int fd) { return sysbind_fsync(fd); }
+   inline long pread(int fd, void* buf, size_t len, off_t off) { return sysbind_pread(fd, buf, len, off); }
+   inline long pwrite(int fd, void* buf, size_t len, off_t off) { return sysbind_pwrite(fd, buf, len, off); }
+   inline long readv(int fd, const struct iovec* iov, int iovcnt) { return sysbind_readv(fd, iov, iovcnt); }
+   inline long writev(int fd, const struct iovec* iov, int iovcnt) { return sysbind_writev(fd, iov, iovcnt); }
+   inline long preadv(int fd, const struct iovec* iov, int iovcnt, off_t off) { return sysbind_preadv(fd, iov, iovcnt, off); }
+   inline long pwritev(int fd, const struct iovec* iov, int iovcnt, off_t off) { return sysbind_pwritev(fd, iov, iovcnt, off); }
+   inline long sendfile(int out_fd, int in_fd, off_t* offset, size_t count) { return sysbind_sendfile(out_fd, in_fd, offset, count); }
+   inline long splice(int fd_in, off_t* off_in, int fd_out, off_t* off_out, size_t len, unsigned flags) { return sysbind_splice(fd_in, off_in, fd_out, off_out, len, flags); }
+   inline int ioring_setup(unsigned entries, struct ioring_params* params) { return sysbind_ioring_setup(entries, params); }
+   inline int ioring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) { return sysbind_ioring_enter(fd, to_submit, min_complete, flags); }
+   inline ssize_t sendmsg(int sockfd, const struct msghdr* msg, int flags) { return sysbind_sendmsg(sockfd, msg, flags); }
+   inline ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags) { return sysbind_recvmsg(sockfd, msg, flags); }
 } // namespace sys
 #endif
@@ -66,3 +66,17 @@
 #define SYS_get_core_usage           (0x41)
 #define SYS_get_nproc                (0x42)
 #define SYS_kctl                     (0x43)
+#define SYS_sync                     (0x44)
+#define SYS_fsync                    (0x45)
+#define SYS_pread                    (0x46)
+#define SYS_pwrite                   (0x47)
+#define SYS_readv                    (0x48)
+#define SYS_writev                   (0x49)
+#define SYS_preadv                   (0x4a)
+#define SYS_pwritev                  (0x4b)
+#define SYS_sendfile                 (0x4c)
+#define SYS_splice                   (0x4d)
+#define SYS_ioring_setup             (0x4e)
+#define SYS_ioring_enter             (0x4f)
+#define SYS_sendmsg                  (0x50)
+#define SYS_recvmsg                  (0x51)
@@ -21,6 +21,9 @@ extern "C" {
 
 ssize_t read(int fd, void *buf, size_t count);
 ssize_t write(int fd, const void *buf, size_t count);
+// the same, but at `offset` in the file, which leaves the file offset alone
+ssize_t pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset);
 
 int close(int fd);
 
@@ -41,6 +44,7 @@ void exit(int status);
 off_t lseek(int fd, off_t offset, int whence);
 int ftruncate(int fildes, off_t length);
 int fsync(int fd);
+void sync(void);
 
 pid_t gettid(void);
 pid_t getpid(void);
@@ -35,3 +35,7 @@ int open(const char *filename, int flags, ...) {
 
   return __syscall_ret(fd);
 }
+
+ssize_t splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned flags) {
+  return errno_wrap(sysbind_splice(fd_in, off_in, fd_out, off_out, len, flags));
+}
@@ -0,0 +1,11 @@
+#include <sys/ioring.h>
+#include <sys/syscall.h>
+#include <sys/sysbind.h>
+
+int ioring_setup(unsigned entries, struct ioring_params *params) {
+  return errno_wrap(sysbind_ioring_setup(entries, params));
+}
+
+int ioring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return errno_wrap(sysbind_ioring_enter(fd, to_submit, min_complete, flags));
+}
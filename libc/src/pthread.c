@@ -212,15 +212,3 @@ int pthread_setspecific(pthread_key_t key, const void *data) {
 
 
 
-int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr) { return -1; }
-int pthread_cond_destroy(pthread_cond_t *cond) { return 0; }
-
-
-static int cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime) { return -1; }
-
-int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) { return 0; }
-
-
-int pthread_cond_timedwait(pthread_cond_t *c, pthread_mutex_t *m, const struct timespec *ts) { return -1; }
-int pthread_cond_broadcast(pthread_cond_t *c) { return -1; }
-int pthread_cond_signal(pthread_cond_t *c) { return -1; }
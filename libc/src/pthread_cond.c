@@ -0,0 +1,129 @@
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include "pthread_impl.h"
+
+
+/*
+ * Waiters sleep on `seq`, which is bumped by every signal and broadcast, so
+ * a wakeup that lands between unlocking the mutex and sleeping isn't lost.
+ * Broadcast wakes one waiter and requeues the rest onto the mutex. They are
+ * then woken one at a time as the mutex is handed on, instead of all waking
+ * up at once just to fight over it.
+ */
+struct cond {
+  int seq;
+  int waiters;
+  int shared;
+  int clock;
+  pthread_mutex_t *mutex;
+};
+
+_Static_assert(sizeof(struct cond) <= sizeof(pthread_cond_t), "struct cond doesn't fit in pthread_cond_t");
+
+#define COND(c) ((struct cond *)(c)->__u.__i)
+#define COND_PRIV(cv) ((cv)->shared ? 0 : FUTEX_PRIVATE_FLAG)
+
+
+// condattr: bit 0 is PTHREAD_PROCESS_SHARED, the clock is kept above it
+int pthread_condattr_init(pthread_condattr_t *a) {
+  *a = 0;
+  return 0;
+}
+
+int pthread_condattr_destroy(pthread_condattr_t *a) { return 0; }
+
+int pthread_condattr_setpshared(pthread_condattr_t *a, int pshared) {
+  if (pshared != PTHREAD_PROCESS_PRIVATE && pshared != PTHREAD_PROCESS_SHARED) return EINVAL;
+  *a = (*a & ~1) | pshared;
+  return 0;
+}
+
+int pthread_condattr_getpshared(const pthread_condattr_t *a, int *pshared) {
+  *pshared = *a & 1;
+  return 0;
+}
+
+int pthread_condattr_setclock(pthread_condattr_t *a, clockid_t clock) {
+  if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC) return EINVAL;
+  *a = (*a & 1) | (clock << 1);
+  return 0;
+}
+
+int pthread_condattr_getclock(const pthread_condattr_t *a, clockid_t *clock) {
+  *clock = *a >> 1;
+  return 0;
+}
+
+
+int pthread_cond_init(pthread_cond_t *c, const pthread_condattr_t *a) {
+  memset(c, 0, sizeof(*c));
+  if (a != NULL) {
+    COND(c)->shared = *a & 1;
+    COND(c)->clock = *a >> 1;
+  }
+  return 0;
+}
+
+
+int pthread_cond_destroy(pthread_cond_t *c) { return 0; }
+
+
+static int cond_wait(pthread_cond_t *c, pthread_mutex_t *m, const struct timespec *abstime) {
+  struct cond *cv = COND(c);
+
+  __atomic_store_n(&cv->mutex, m, __ATOMIC_RELAXED);
+  // Count ourselves before sampling seq: a signaller bumps seq before it
+  // looks at waiters, so one of us sees the other
+  __atomic_fetch_add(&cv->waiters, 1, __ATOMIC_SEQ_CST);
+  int seq = __atomic_load_n(&cv->seq, __ATOMIC_SEQ_CST);
+
+  pthread_mutex_unlock(m);
+  int r = __timedwait(&cv->seq, seq, abstime, cv->clock, COND_PRIV(cv));
+  __atomic_fetch_sub(&cv->waiters, 1, __ATOMIC_SEQ_CST);
+
+  // we may have been requeued onto the mutex behind other waiters
+  __pthread_mutex_lock_contended(m);
+  return r;
+}
+
+
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m) { return cond_wait(c, m, NULL); }
+
+
+int pthread_cond_timedwait(pthread_cond_t *c, pthread_mutex_t *m, const struct timespec *ts) {
+  if (ts == NULL || ts->tv_nsec < 0 || ts->tv_nsec >= 1000000000L) return EINVAL;
+  return cond_wait(c, m, ts);
+}
+
+
+int pthread_cond_signal(pthread_cond_t *c) {
+  struct cond *cv = COND(c);
+
+  __atomic_fetch_add(&cv->seq, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&cv->waiters, __ATOMIC_SEQ_CST) > 0) __futex_wake(&cv->seq, 1, COND_PRIV(cv));
+  return 0;
+}
+
+
+int pthread_cond_broadcast(pthread_cond_t *c) {
+  struct cond *cv = COND(c);
+
+  int seq = __atomic_add_fetch(&cv->seq, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&cv->waiters, __ATOMIC_SEQ_CST) == 0) return 0;
+
+  pthread_mutex_t *m = __atomic_load_n(&cv->mutex, __ATOMIC_RELAXED);
+  if (m == NULL) {
+    __futex_wake(&cv->seq, INT_MAX, COND_PRIV(cv));
+    return 0;
+  }
+
+  // Wake one, and move the rest onto the mutex. The one we woke takes the
+  // mutex as contended, so unlocking it wakes the next. If seq moved in the
+  // meantime, try again with the new value
+  while (sysbind_futex(&cv->seq, FUTEX_CMP_REQUEUE | COND_PRIV(cv), 1, INT_MAX, &m->word, seq) == -EAGAIN) {
+    seq = __atomic_load_n(&cv->seq, __ATOMIC_SEQ_CST);
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chariot/futex.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/sysbind.h>
+#include <time.h>
+
+// Shared by the pthread synchronization objects. `priv` is either 0 or
+// FUTEX_PRIVATE_FLAG, depending on PTHREAD_PROCESS_SHARED
+
+
+static inline int __futex_wait(int *addr, int val, int timeout_us, int priv) {
+  return sysbind_futex(addr, FUTEX_WAIT | priv, val, timeout_us, 0, 0);
+}
+
+static inline int __futex_wake(int *addr, int n, int priv) { return sysbind_futex(addr, FUTEX_WAKE | priv, n, 0, 0, 0); }
+
+
+/*
+ * Sleep while *addr == val, until `abstime` (on `clock`) if it isn't NULL.
+ * Returns ETIMEDOUT once abstime has passed, and 0 otherwise (which might
+ * be spurious, so the caller has to check its condition again)
+ */
+static inline int __timedwait(int *addr, int val, const struct timespec *abstime, clockid_t clock, int priv) {
+  int timeout = 0;
+  int clamped = 0;
+
+  if (abstime != NULL) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    long long us = (abstime->tv_sec - now.tv_sec) * 1000000LL + (abstime->tv_nsec - now.tv_nsec) / 1000;
+    if (us <= 0) return ETIMEDOUT;
+    // the kernel takes an int, so very long waits just wake up early
+    if (us > INT_MAX) {
+      us = INT_MAX;
+      clamped = 1;
+    }
+    timeout = us;
+  }
+
+  int r = __futex_wait(addr, val, timeout, priv);
+  if (r == -ETIMEDOUT && !clamped) return ETIMEDOUT;
+  return 0;
+}
+
+
+// Take a mutex assuming there are other waiters on it, so it is left marked
+// as contended. Used by condition variables, as broadcast moves waiters
+// straight onto the mutex
+void __pthread_mutex_lock_contended(pthread_mutex_t *m);
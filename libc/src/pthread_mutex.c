@@ -6,6 +6,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
+#include "pthread_impl.h"
 
 
 #define unlikely(c) __builtin_expect((c), 0)
@@ -37,6 +38,23 @@ int pthread_mutex_lock(pthread_mutex_t *m) {
 }
 
 
+int pthread_mutex_timedlock(pthread_mutex_t *m, const struct timespec *abstime) {
+  if (cmpxchg32(&m->word, 0, 1)) return 0;
+  // Same as pthread_mutex_lock, but give up at abstime. Leaving the mutex
+  // marked as contended then only costs its owner a wakeup
+  while (__atomic_exchange_n(&m->word, 2, __ATOMIC_SEQ_CST) != 0) {
+    if (__timedwait(&m->word, 2, abstime, CLOCK_REALTIME, 0) == ETIMEDOUT) return ETIMEDOUT;
+  }
+  return 0;
+}
+
+
+void __pthread_mutex_lock_contended(pthread_mutex_t *m) {
+  while (__atomic_exchange_n(&m->word, 2, __ATOMIC_SEQ_CST) != 0)
+    futex_wait(&m->word, 2);
+}
+
+
 int pthread_mutex_trylock(pthread_mutex_t *m) {
   // try to atimically swap 0 -> 1
   if (cmpxchg32(&m->word, 0, 1)) return 0;  // success
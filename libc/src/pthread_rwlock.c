@@ -0,0 +1,160 @@
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include "pthread_impl.h"
+
+
+/*
+ * `state` is the number of readers holding the lock, or -1 while a writer
+ * does. Writers are preferred: once one is waiting, new readers queue up
+ * behind it instead of starving it. Readers and writers sleep on separate
+ * sequence words, so a writer unlocking with another writer waiting doesn't
+ * wake every reader.
+ */
+struct rwlock {
+  int state;
+  int writers;  // waiting for the lock
+  int readers;  // waiting for the lock
+  int rseq;
+  int wseq;
+  int shared;
+};
+
+_Static_assert(sizeof(struct rwlock) <= sizeof(pthread_rwlock_t), "struct rwlock doesn't fit in pthread_rwlock_t");
+
+#define RWLOCK(l) ((struct rwlock *)(l)->__u.__i)
+#define RWLOCK_PRIV(rw) ((rw)->shared ? 0 : FUTEX_PRIVATE_FLAG)
+
+
+int pthread_rwlockattr_init(pthread_rwlockattr_t *a) {
+  memset(a, 0, sizeof(*a));
+  return 0;
+}
+
+int pthread_rwlockattr_destroy(pthread_rwlockattr_t *a) { return 0; }
+
+int pthread_rwlockattr_setpshared(pthread_rwlockattr_t *a, int pshared) {
+  if (pshared != PTHREAD_PROCESS_PRIVATE && pshared != PTHREAD_PROCESS_SHARED) return EINVAL;
+  a->__attr[0] = pshared;
+  return 0;
+}
+
+int pthread_rwlockattr_getpshared(const pthread_rwlockattr_t *a, int *pshared) {
+  *pshared = a->__attr[0];
+  return 0;
+}
+
+
+int pthread_rwlock_init(pthread_rwlock_t *l, const pthread_rwlockattr_t *a) {
+  memset(l, 0, sizeof(*l));
+  if (a != NULL) RWLOCK(l)->shared = a->__attr[0];
+  return 0;
+}
+
+int pthread_rwlock_destroy(pthread_rwlock_t *l) { return 0; }
+
+
+static void wake_readers(struct rwlock *rw) {
+  __atomic_fetch_add(&rw->rseq, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&rw->readers, __ATOMIC_SEQ_CST) > 0) __futex_wake(&rw->rseq, INT_MAX, RWLOCK_PRIV(rw));
+}
+
+static void wake_writer(struct rwlock *rw) {
+  __atomic_fetch_add(&rw->wseq, 1, __ATOMIC_SEQ_CST);
+  __futex_wake(&rw->wseq, 1, RWLOCK_PRIV(rw));
+}
+
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *l) {
+  struct rwlock *rw = RWLOCK(l);
+
+  int s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+  while (s >= 0 && __atomic_load_n(&rw->writers, __ATOMIC_SEQ_CST) == 0) {
+    if (s == INT_MAX) return EAGAIN;
+    if (__atomic_compare_exchange_n(&rw->state, &s, s + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return 0;
+  }
+  return EBUSY;
+}
+
+
+int pthread_rwlock_timedrdlock(pthread_rwlock_t *l, const struct timespec *abstime) {
+  struct rwlock *rw = RWLOCK(l);
+
+  while (1) {
+    int r = pthread_rwlock_tryrdlock(l);
+    if (r != EBUSY) return r;
+
+    __atomic_fetch_add(&rw->readers, 1, __ATOMIC_SEQ_CST);
+    int seq = __atomic_load_n(&rw->rseq, __ATOMIC_SEQ_CST);
+    // sample seq, then check again, so an unlock in between isn't missed
+    int blocked = __atomic_load_n(&rw->state, __ATOMIC_SEQ_CST) < 0 || __atomic_load_n(&rw->writers, __ATOMIC_SEQ_CST) > 0;
+    if (blocked) r = __timedwait(&rw->rseq, seq, abstime, CLOCK_REALTIME, RWLOCK_PRIV(rw));
+    __atomic_fetch_sub(&rw->readers, 1, __ATOMIC_SEQ_CST);
+
+    if (r == ETIMEDOUT) return ETIMEDOUT;
+  }
+}
+
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *l) { return pthread_rwlock_timedrdlock(l, NULL); }
+
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t *l) {
+  int s = 0;
+  if (__atomic_compare_exchange_n(&RWLOCK(l)->state, &s, -1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return 0;
+  return EBUSY;
+}
+
+
+int pthread_rwlock_timedwrlock(pthread_rwlock_t *l, const struct timespec *abstime) {
+  struct rwlock *rw = RWLOCK(l);
+
+  if (pthread_rwlock_trywrlock(l) == 0) return 0;
+
+  // from here on, new readers wait for us
+  __atomic_fetch_add(&rw->writers, 1, __ATOMIC_SEQ_CST);
+  while (1) {
+    int seq = __atomic_load_n(&rw->wseq, __ATOMIC_SEQ_CST);
+    if (pthread_rwlock_trywrlock(l) == 0) break;
+
+    if (__timedwait(&rw->wseq, seq, abstime, CLOCK_REALTIME, RWLOCK_PRIV(rw)) == ETIMEDOUT) {
+      // Readers might only have been waiting on us, and an unlock may have
+      // picked us to wake just as we gave up. Pass either on
+      if (__atomic_sub_fetch(&rw->writers, 1, __ATOMIC_SEQ_CST) == 0) {
+        wake_readers(rw);
+      } else {
+        wake_writer(rw);
+      }
+      return ETIMEDOUT;
+    }
+  }
+  __atomic_fetch_sub(&rw->writers, 1, __ATOMIC_SEQ_CST);
+  return 0;
+}
+
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *l) { return pthread_rwlock_timedwrlock(l, NULL); }
+
+
+int pthread_rwlock_unlock(pthread_rwlock_t *l) {
+  struct rwlock *rw = RWLOCK(l);
+
+  // seq_cst, so the release can't be reordered after the check for waiters
+  int s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+  if (s == -1) {
+    __atomic_store_n(&rw->state, 0, __ATOMIC_SEQ_CST);
+  } else if (__atomic_sub_fetch(&rw->state, 1, __ATOMIC_SEQ_CST) != 0) {
+    // other readers still hold it
+    return 0;
+  }
+
+  // The lock is free. Hand it to a writer if one is waiting, otherwise let
+  // every waiting reader in
+  if (__atomic_load_n(&rw->writers, __ATOMIC_SEQ_CST) > 0) {
+    wake_writer(rw);
+  } else {
+    wake_readers(rw);
+  }
+  return 0;
+}
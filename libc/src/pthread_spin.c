@@ -0,0 +1,41 @@
+#include <pthread.h>
+#include <errno.h>
+
+
+static inline void spin_relax(void) {
+#if defined(__x86_64__)
+  __asm__ volatile("pause");
+#elif defined(__aarch64__)
+  __asm__ volatile("yield");
+#endif
+}
+
+
+int pthread_spin_init(pthread_spinlock_t *l, int pshared) {
+  *l = 0;
+  return 0;
+}
+
+int pthread_spin_destroy(pthread_spinlock_t *l) { return 0; }
+
+
+int pthread_spin_lock(pthread_spinlock_t *l) {
+  while (__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE) != 0) {
+    // wait with plain loads, so the cache line isn't bounced by the exchange
+    while (__atomic_load_n(l, __ATOMIC_RELAXED) != 0)
+      spin_relax();
+  }
+  return 0;
+}
+
+
+int pthread_spin_trylock(pthread_spinlock_t *l) {
+  if (__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE) != 0) return EBUSY;
+  return 0;
+}
+
+
+int pthread_spin_unlock(pthread_spinlock_t *l) {
+  __atomic_store_n(l, 0, __ATOMIC_RELEASE);
+  return 0;
+}
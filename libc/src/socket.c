@@ -252,3 +252,12 @@ ssize_t recv(int socket, void *buffer, size_t length, int flags) {
 ssize_t send(int socket, const void *buffer, size_t length, int flags) {
   return sendto(socket, buffer, length, flags, NULL, 0);
 }
+
+
+ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
+  return errno_wrap(sysbind_sendmsg(sockfd, msg, flags));
+}
+
+ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
+  return errno_wrap(sysbind_recvmsg(sockfd, msg, flags));
+}
@@ -683,3 +683,143 @@ int sysbind_kctl(off_t* name, unsigned namelen, char * oval, size_t* olen, char
                (unsigned long long)nlen);
 }
 
+int sysbind_sync() {
+    return (int)__syscall_eintr(SYS_sync,
+               0,
+               0,
+               0,
+               0,
+               0,
+               0);
+}
+
+int sysbind_fsync(int fd) {
+    return (int)__syscall_eintr(SYS_fsync,
+               (unsigned long long)fd,
+               0,
+               0,
+               0,
+               0,
+               0);
+}
+
+long sysbind_pread(int fd, void* buf, size_t len, off_t off) {
+    return (long)__syscall_eintr(SYS_pread,
+               (unsigned long long)fd,
+               (unsigned long long)buf,
+               (unsigned long long)len,
+               (unsigned long long)off,
+               0,
+               0);
+}
+
+long sysbind_pwrite(int fd, void* buf, size_t len, off_t off) {
+    return (long)__syscall_eintr(SYS_pwrite,
+               (unsigned long long)fd,
+               (unsigned long long)buf,
+               (unsigned long long)len,
+               (unsigned long long)off,
+               0,
+               0);
+}
+
+long sysbind_readv(int fd, const struct iovec* iov, int iovcnt) {
+    return (long)__syscall_eintr(SYS_readv,
+               (unsigned long long)fd,
+               (unsigned long long)iov,
+               (unsigned long long)iovcnt,
+               0,
+               0,
+               0);
+}
+
+long sysbind_writev(int fd, const struct iovec* iov, int iovcnt) {
+    return (long)__syscall_eintr(SYS_writev,
+               (unsigned long long)fd,
+               (unsigned long long)iov,
+               (unsigned long long)iovcnt,
+               0,
+               0,
+               0);
+}
+
+long sysbind_preadv(int fd, const struct iovec* iov, int iovcnt, off_t off) {
+    return (long)__syscall_eintr(SYS_preadv,
+               (unsigned long long)fd,
+               (unsigned long long)iov,
+               (unsigned long long)iovcnt,
+               (unsigned long long)off,
+               0,
+               0);
+}
+
+long sysbind_pwritev(int fd, const struct iovec* iov, int iovcnt, off_t off) {
+    return (long)__syscall_eintr(SYS_pwritev,
+               (unsigned long long)fd,
+               (unsigned long long)iov,
+               (unsigned long long)iovcnt,
+               (unsigned long long)off,
+               0,
+               0);
+}
+
+long sysbind_sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
+    return (long)__syscall_eintr(SYS_sendfile,
+               (unsigned long long)out_fd,
+               (unsigned long long)in_fd,
+               (unsigned long long)offset,
+               (unsigned long long)count,
+               0,
+               0);
+}
+
+long sysbind_splice(int fd_in, off_t* off_in, int fd_out, off_t* off_out, size_t len, unsigned flags) {
+    return (long)__syscall_eintr(SYS_splice,
+               (unsigned long long)fd_in,
+               (unsigned long long)off_in,
+               (unsigned long long)fd_out,
+               (unsigned long long)off_out,
+               (unsigned long long)len,
+               (unsigned long long)flags);
+}
+
+int sysbind_ioring_setup(unsigned entries, struct ioring_params* params) {
+    return (int)__syscall_eintr(SYS_ioring_setup,
+               (unsigned long long)entries,
+               (unsigned long long)params,
+               0,
+               0,
+               0,
+               0);
+}
+
+int sysbind_ioring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)__syscall_eintr(SYS_ioring_enter,
+               (unsigned long long)fd,
+               (unsigned long long)to_submit,
+               (unsigned long long)min_complete,
+               (unsigned long long)flags,
+               0,
+               0);
+}
+
+ssize_t sysbind_sendmsg(int sockfd, const struct msghdr* msg, int flags) {
+    return (ssize_t)__syscall_eintr(SYS_sendmsg,
+               (unsigned long long)sockfd,
+               (unsigned long long)msg,
+               (unsigned long long)flags,
+               0,
+               0,
+               0);
+}
+
+ssize_t sysbind_recvmsg(int sockfd, struct msghdr* msg, int flags) {
+    return (ssize_t)__syscall_eintr(SYS_recvmsg,
+               (unsigned long long)sockfd,
+               (unsigned long long)msg,
+               (unsigned long long)flags,
+               0,
+               0,
+               0);
+}
+
@@ -28,7 +28,7 @@ int clock_getres(int id, struct timespec *s) {
 
 int clock_gettime(int id, struct timespec *s) {
   long us = sysbind_gettime_microsecond();
-  s->tv_nsec = us * 1000;
+  s->tv_nsec = (us % (1000 * 1000)) * 1000;
   s->tv_sec = us / 1000 / 1000;
   return 0;
 }
@@ -0,0 +1,15 @@
+#include <sys/syscall.h>
+#include <sys/sysbind.h>
+#include <sys/uio.h>
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt) { return errno_wrap(sysbind_readv(fd, iov, iovcnt)); }
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) { return errno_wrap(sysbind_writev(fd, iov, iovcnt)); }
+
+ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+  return errno_wrap(sysbind_preadv(fd, iov, iovcnt, offset));
+}
+
+ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+  return errno_wrap(sysbind_pwritev(fd, iov, iovcnt, offset));
+}
@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <termios.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
 
 pid_t fork(void) {
   return sysbind_fork();
@@ -27,6 +28,14 @@ ssize_t read(int fd, void *buf, size_t count) {
   return errno_wrap(sysbind_read(fd, buf, count));
 }
 
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+  return errno_wrap(sysbind_pread(fd, buf, count, offset));
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+  return errno_wrap(sysbind_pwrite(fd, (void *)buf, count, offset));
+}
+
 off_t lseek(int fd, off_t offset, int whence) {
   return errno_wrap(sysbind_lseek(fd, offset, whence));
 }
@@ -140,7 +149,11 @@ int ftruncate(int fildes, off_t length) {
 }
 
 int fsync(int fd) {
-  return -ENOSYS;
+  return errno_wrap(sysbind_fsync(fd));
+}
+
+void sync(void) {
+  sysbind_sync();
 }
 
 char *getcwd(char *buf, size_t sz) {
@@ -153,3 +166,7 @@ char *getcwd(char *buf, size_t sz) {
 int isatty(int fd) {
   return ioctl(fd, TIOISATTY) == TIOISATTY_RET;
 }
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+  return errno_wrap(sysbind_sendfile(out_fd, in_fd, offset, count));
+}
@@ -4,6 +4,7 @@
 #include <lock.h>
 #include <net/sock.h>
 #include <net/un.h>
+#include <phys.h>
 #include <syscall.h>
 #include <template_lib.h>
 #include <util.h>
@@ -17,6 +18,78 @@ net::IPCSock::~IPCSock(void) {
     // we don't need to
     bindpoint->bound_socket = nullptr;
   }
+  if (for_server.data != nullptr) phys::kfree(for_server.data, IPCSOCK_RING_PAGES);
+  if (for_client.data != nullptr) phys::kfree(for_client.data, IPCSOCK_RING_PAGES);
+}
+
+
+void net::IPCSock::ring::copy_in(size_t pos, const void *src, size_t len) {
+  size_t off = pos % IPCSOCK_RING_SIZE;
+  size_t first = min(len, IPCSOCK_RING_SIZE - off);
+  memcpy(data + off, src, first);
+  memcpy(data, (const char *)src + first, len - first);
+}
+
+
+void net::IPCSock::ring::copy_out(size_t pos, void *dst, size_t len) {
+  size_t off = pos % IPCSOCK_RING_SIZE;
+  size_t first = min(len, IPCSOCK_RING_SIZE - off);
+  memcpy(dst, data + off, first);
+  memcpy((char *)dst + first, data, len - first);
+}
+
+
+ipc_batch_hdr &net::IPCSock::ring::front(void) { return *(ipc_batch_hdr *)(data + head % IPCSOCK_RING_SIZE); }
+
+
+void net::IPCSock::ring::put(const void *msg, size_t len, rights &r) {
+  auto &hdr = *(ipc_batch_hdr *)(data + tail % IPCSOCK_RING_SIZE);
+  hdr.len = len;
+  hdr.resv = 0;
+  if (!r.empty()) {
+    hdr.resv = IPCSOCK_RIGHTS;
+    pending.append(move(r));
+  }
+  copy_in(tail + sizeof(hdr), msg, len);
+  tail += IPC_BATCH_RECORD_SIZE(len);
+}
+
+
+ssize_t net::IPCSock::ring::take(void *buf, size_t len, rights &r) {
+  // the buffer needs to be big enough
+  auto &hdr = front();
+  size_t msglen = hdr.len;
+  if (msglen > len) return -EMSGSIZE;
+  copy_out(head + sizeof(ipc_batch_hdr), buf, msglen);
+  if (hdr.resv & IPCSOCK_RIGHTS) r = pending.take_first();
+  head += IPC_BATCH_RECORD_SIZE(msglen);
+  return msglen;
+}
+
+
+ssize_t net::IPCSock::ring::take_batch(void *buf, size_t len, rights &r) {
+  // The ring is already laid out the way the user wants it, so find how many
+  // whole records fit and copy them out together. Messages with rights end
+  // the batch, as there'd be no way to tell which message they came with
+  size_t n = 0;
+  while (head + n != tail) {
+    auto &hdr = *(ipc_batch_hdr *)(data + (head + n) % IPCSOCK_RING_SIZE);
+    size_t rec = IPC_BATCH_RECORD_SIZE(hdr.len);
+    if (n + rec > len) break;
+
+    if (hdr.resv & IPCSOCK_RIGHTS) {
+      if (n > 0) break;
+      hdr.resv = 0;
+      r = pending.take_first();
+      n = rec;
+      break;
+    }
+    n += rec;
+  }
+  if (n == 0) return -EMSGSIZE;
+  copy_out(head, buf, n);
+  head += n;
+  return n;
 }
 
 
@@ -38,7 +111,6 @@ int net::IPCSock::connect(struct sockaddr *addr, int len) {
     if (c == '\0') break;
     path.push(c);
   }
-	printf("connect %s\n", path.get());
 
   auto in = vfs::open(path, O_RDWR);
   if (in == nullptr) return -ENOENT;
@@ -47,6 +119,11 @@ int net::IPCSock::connect(struct sockaddr *addr, int len) {
     return -ENOENT;
   }
 
+  if (for_server.data == nullptr) for_server.data = (char *)phys::kalloc(IPCSOCK_RING_PAGES);
+  if (for_client.data == nullptr) for_client.data = (char *)phys::kalloc(IPCSOCK_RING_PAGES);
+  // the destructor frees whichever one we did get
+  if (for_server.data == nullptr || for_client.data == nullptr) return -ENOMEM;
+
   this->peer = in->bound_socket;
   // send, and wait. This will always succeed if we are here.
   this->peer->pending_connections.send(this, true);
@@ -56,115 +133,133 @@ int net::IPCSock::connect(struct sockaddr *addr, int len) {
 
 
 int net::IPCSock::disconnect(int flags) {
-  auto &state = (flags & PFLAGS_CLIENT) ? for_server : for_client;
+  // Once either end is gone, nothing more can be read from or written to the
+  // connection. What is already buffered can still be read.
+  auto close = [](ring &r) {
+    r.lock.lock();
+    r.closed = true;
+    r.lock.unlock();
+    r.wq.wake_up_all();
+    r.wq_space.wake_up_all();
+  };
+  close(for_server);
+  close(for_client);
 
-  state.lock.lock();
-  // printf("%3d - close %s!\n", curproc->pid, (flags & PFLAGS_CLIENT) ? "client" : "server");
+  return 0;
+}
 
-  state.closed = true;
-  state.wq.wake_up_all();
-  state.lock.unlock();
 
-  return 0;
+ssize_t net::IPCSock::sendto(fs::File &fd, void *data, size_t len, int flags, const sockaddr *, size_t) {
+  rights none;
+  return sendmsg(fd, data, len, flags, none);
 }
 
 
-static spinlock loglock;
-void named_hexdump(const char *msg, void *buf, size_t sz) {
-  loglock.lock();
-  printf(
-      " %s "
-      "===================================================================\n",
-      msg);
-  hexdump(buf, sz, true);
-  /*
-printf(
-" !!!! "
-"===================================================================\n");
-                  */
-  loglock.unlock();
+ssize_t net::IPCSock::recvfrom(fs::File &fd, void *data, size_t len, int flags, const sockaddr *, size_t) {
+  // anything that was passed with the message is dropped
+  rights dropped;
+  return recvmsg(fd, data, len, flags, dropped);
 }
 
-// #define IPCSOCK_DEBUG
 
 
-ssize_t net::IPCSock::sendto(fs::File &fd, void *data, size_t len, int flags, const sockaddr *, size_t) {
-  auto &state = (fd.pflags & PFLAGS_SERVER) ? for_client : for_server;
-
-  printf("%3d - send message, %d live\n", curproc->pid, state.msgs.size_slow());
-	hexdump(data, len, true);
-  {
-    scoped_lock l(state.lock);
-    if (state.closed) {
-      return 0;
-    }
-    // printf_nolock("%d send\n", curproc->pid);
-    // printf("%3d - send message, %d live\n", curproc->pid, state.msgs.size_slow());
+ssize_t net::IPCSock::sendmsg(fs::File &fd, void *data, size_t len, int flags, rights &passed) {
+  auto &r = (fd.pflags & PFLAGS_SERVER) ? for_client : for_server;
+  if (IPC_BATCH_RECORD_SIZE(len) > IPCSOCK_RING_SIZE) return -EMSGSIZE;
 
-    state.msgs.append(ipcmsg(data, len));
-  }
-  state.wq.wake_up_all();
+  bool block = (flags & MSG_DONTWAIT) == 0;
+  ssize_t res = len;
+  bool sent = false;
+  while (1) {
+    struct wait_entry ent;
+    {
+      scoped_lock l(r.lock);
+      if (r.closed) {
+        res = 0;
+        break;
+      }
+      if (r.data == nullptr) {
+        res = -ENOTCONN;
+        break;
+      }
 
-  // sched::yield();
+      if (IPC_BATCH_RECORD_SIZE(len) <= r.space()) {
+        r.put(data, len, passed);
+        sent = true;
+        break;
+      }
 
+      if (!block) {
+        res = -EAGAIN;
+        break;
+      }
+      prepare_to_wait(r.wq_space, ent, true);
+    }
 
-  return len;
+    if (ent.start().interrupted()) {
+      res = -EINTR;
+      break;
+    }
+  }
+  if (sent) r.wq.wake_up_all();
+
+  return res;
 }
 
 
 
-ssize_t net::IPCSock::recvfrom(fs::File &fd, void *data, size_t len, int flags, const sockaddr *, size_t) {
-  auto &state = (fd.pflags & PFLAGS_SERVER) ? for_server : for_client;
+ssize_t net::IPCSock::recvmsg(fs::File &fd, void *data, size_t len, int flags, rights &passed) {
+  auto &r = (fd.pflags & PFLAGS_SERVER) ? for_server : for_client;
   bool block = (flags & MSG_DONTWAIT) == 0;
+  ssize_t nread = 0;
+  bool took = false;
+  // cleared rights are dropped once the lock is released
+  ck::vec<rights> cleared;
+
   while (1) {
     struct wait_entry ent;
     {
-      // printf("%3d - recv message, %d live. block: %d\n", curproc->pid, state.msgs.size_slow(), block);
-
-      scoped_lock l(state.lock);
-
+      scoped_lock l(r.lock);
 
       if (flags == MSG_IPC_CLEAR) {
-        state.msgs.clear();
+        r.head = r.tail;
+        while (!r.pending.is_empty())
+          cleared.push(r.pending.take_first());
         // return the len :)
-        return len;
+        nread = len;
+        took = true;
+        break;
       }
 
-      if (!state.msgs.is_empty()) {
-        // pprintf("take data!\n");
-        auto &front = state.msgs.first();
+      if (!r.is_empty()) {
         if (flags & MSG_IPC_QUERY) {
-          return front.data.size();
+          nread = r.front().len;
+          break;
         }
 
-
-        // the buffer needs to be big enough
-        if (front.data.size() > len) return -EMSGSIZE;
-        size_t nread = front.data.size();
-        if (len < nread) nread = len;
-
-        memcpy(data, front.data.data(), nread);
-        state.msgs.take_first();
-
-
-        return nread;
+        nread = (flags & MSG_IPC_BATCH) ? r.take_batch(data, len, passed) : r.take(data, len, passed);
+        took = nread >= 0;
+        break;
       }
 
-      if (state.closed) {
-        // printf("%3d - recv message, closed.\n", curproc->pid);
-        return 0;
+      if (r.closed) break;
+      if (!block) {
+        nread = -EAGAIN;
+        break;
       }
-      if (!block) return -EAGAIN;
-      prepare_to_wait(state.wq, ent, true);
+      prepare_to_wait(r.wq, ent, true);
     }
 
-
-
     if (ent.start().interrupted()) {
-      printf("WAIT!\n");
-      return -EINTR;
+      nread = -EINTR;
+      break;
     }
   }
+
+  // there is room for whoever was waiting to send
+  if (took) r.wq_space.wake_up_all();
+
+  return nread;
 }
 
 
@@ -204,7 +299,7 @@ int net::IPCSock::poll(fs::File &f, int events, poll_table &pt) {
     scoped_lock l(for_client.lock);
 
     pt.wait(for_client.wq, AWAITFS_READ);
-    if (!for_client.msgs.is_empty()) {
+    if (!for_client.is_empty()) {
       res |= AWAITFS_READ;
     }
 
@@ -218,7 +313,7 @@ int net::IPCSock::poll(fs::File &f, int events, poll_table &pt) {
     scoped_lock l(for_server.lock);
 
     pt.wait(for_server.wq, AWAITFS_READ);
-    if (!for_server.msgs.is_empty()) {
+    if (!for_server.is_empty()) {
       res |= AWAITFS_READ;
     }
     if (for_server.closed) {
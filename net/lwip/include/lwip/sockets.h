@@ -94,22 +94,7 @@ struct lwip_setgetsockopt_data {
 };
 #endif /* !LWIP_TCPIP_CORE_LOCKING */
 
-#if !defined(iovec)
-struct iovec {
-  void *iov_base;
-  size_t iov_len;
-};
-#endif
-
-struct msghdr {
-  void *msg_name;
-  socklen_t msg_namelen;
-  struct iovec *msg_iov;
-  int msg_iovlen;
-  void *msg_control;
-  socklen_t msg_controllen;
-  int msg_flags;
-};
+/* struct iovec and struct msghdr come from <net/socket.h> */
 
 
 /*
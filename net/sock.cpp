@@ -6,6 +6,7 @@
 #include <lwip/netdb.h>
 #endif
 #include <ck/map.h>
+#include <mshare.h>
 #include <net/sock.h>
 #include <sched.h>
 #include <syscall.h>
@@ -131,6 +132,166 @@ ssize_t sys::recvfrom(int sockfd, void *buf, size_t len, int flags, const struct
   return res;
 }
 
+// Messages are a single buffer, so so is the data of sendmsg and recvmsg
+static int msg_buffer(const struct msghdr &msg, void *&buf, size_t &len, int prot) {
+  buf = nullptr;
+  len = 0;
+  if (msg.msg_iovlen == 0) return 0;
+  if (msg.msg_iovlen != 1) return -EINVAL;
+  if (!curproc->mm->validate_pointer(msg.msg_iov, sizeof(struct iovec), PROT_READ)) return -EFAULT;
+
+  buf = msg.msg_iov[0].iov_base;
+  len = msg.msg_iov[0].iov_len;
+  if (!curproc->mm->validate_pointer(buf, len, prot)) return -EFAULT;
+  return 0;
+}
+
+
+// Take references to everything named by the control messages
+static int rights_from_user(const struct msghdr &msg, net::Socket::rights &r) {
+  if (msg.msg_controllen == 0) return 0;
+  if (!VALIDATE_RD(msg.msg_control, msg.msg_controllen)) return -EFAULT;
+
+  auto *end = (unsigned char *)msg.msg_control + msg.msg_controllen;
+  for (auto *c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_len < CMSG_LEN(0) || (unsigned char *)c + c->cmsg_len > end) return -EINVAL;
+    if (c->cmsg_level != SOL_SOCKET) return -EINVAL;
+    size_t datalen = c->cmsg_len - CMSG_LEN(0);
+
+    if (c->cmsg_type == SCM_RIGHTS) {
+      auto *fds = (int *)CMSG_DATA(c);
+      for (size_t i = 0; i < datalen / sizeof(int); i++) {
+        auto file = curproc->get_fd(fds[i]);
+        if (!file) return -EBADF;
+        // An IPC socket parked on a ring holds a reference to the socket that
+        // owns the ring (maybe itself), which would keep both alive forever
+        if (file->ino->is_sock() && ((net::Socket *)file->ino.get())->domain == AF_CKIPC) return -EINVAL;
+        r.files.push(move(file));
+      }
+    } else if (c->cmsg_type == SCM_MSHARE) {
+      auto *handles = (struct mshare_handle *)CMSG_DATA(c);
+      for (size_t i = 0; i < datalen / sizeof(struct mshare_handle); i++) {
+        int prot = 0;
+        auto obj = mshare_get(handles[i].addr, prot);
+        if (!obj) return -EINVAL;
+        r.regions.push({move(obj), prot});
+      }
+    } else {
+      return -EINVAL;
+    }
+
+    if (r.files.size() + r.regions.size() > SCM_MAX_HANDLES) return -ETOOMANYREFS;
+  }
+  return 0;
+}
+
+
+// Room for how many `each` byte values in a control message at `used`
+static size_t cmsg_room(const struct msghdr &msg, size_t used, size_t each) {
+  if (msg.msg_controllen < used + CMSG_LEN(0)) return 0;
+  return (msg.msg_controllen - used - CMSG_LEN(0)) / each;
+}
+
+
+// Install what was received in the current process and describe it in the
+// control buffer. Whatever doesn't fit is dropped and MSG_CTRUNC is set
+static void rights_to_user(struct msghdr &msg, net::Socket::rights &r) {
+  size_t used = 0;
+
+  if (r.files.size() > 0) {
+    auto *c = (struct cmsghdr *)((unsigned char *)msg.msg_control + used);
+    size_t room = cmsg_room(msg, used, sizeof(int));
+    size_t n = 0;
+    for (; n < r.files.size() && n < room; n++) {
+      int fd = curproc->add_fd(r.files[n]);
+      if (fd < 0) break;
+      ((int *)CMSG_DATA(c))[n] = fd;
+    }
+    if (n < r.files.size()) msg.msg_flags |= MSG_CTRUNC;
+
+    if (n > 0) {
+      c->cmsg_len = CMSG_LEN(n * sizeof(int));
+      c->cmsg_level = SOL_SOCKET;
+      c->cmsg_type = SCM_RIGHTS;
+      used += CMSG_SPACE(n * sizeof(int));
+    }
+  }
+
+  if (r.regions.size() > 0) {
+    auto *c = (struct cmsghdr *)((unsigned char *)msg.msg_control + used);
+    size_t room = cmsg_room(msg, used, sizeof(struct mshare_handle));
+    size_t n = 0;
+    for (; n < r.regions.size() && n < room; n++) {
+      void *addr = mshare_map(r.regions[n].obj, r.regions[n].prot);
+      if (addr == MAP_FAILED) break;
+      auto &h = ((struct mshare_handle *)CMSG_DATA(c))[n];
+      h.addr = addr;
+      h.size = r.regions[n].obj->size();
+    }
+    if (n < r.regions.size()) msg.msg_flags |= MSG_CTRUNC;
+
+    if (n > 0) {
+      c->cmsg_len = CMSG_LEN(n * sizeof(struct mshare_handle));
+      c->cmsg_level = SOL_SOCKET;
+      c->cmsg_type = SCM_MSHARE;
+      used += CMSG_SPACE(n * sizeof(struct mshare_handle));
+    }
+  }
+
+  // the padding after the last one doesn't have to fit
+  msg.msg_controllen = min(used, msg.msg_controllen);
+}
+
+
+ssize_t sys::sendmsg(int sockfd, const struct msghdr *umsg, int flags) {
+  if (!VALIDATE_RD((void *)umsg, sizeof(*umsg))) return -EFAULT;
+  struct msghdr msg = *umsg;
+
+  void *buf;
+  size_t len;
+  int err = msg_buffer(msg, buf, len, PROT_READ);
+  if (err < 0) return err;
+
+  ck::ref<fs::File> file = curproc->get_fd(sockfd);
+  if (!file) return -EBADF;
+  if (!file->ino->is_sock()) return -ENOTSOCK;
+
+  net::Socket::rights r;
+  err = rights_from_user(msg, r);
+  if (err < 0) return err;
+
+  auto *sock = (net::Socket *)file->ino.get();
+  return sock->sendmsg(*file, buf, len, flags, r);
+}
+
+
+ssize_t sys::recvmsg(int sockfd, struct msghdr *umsg, int flags) {
+  if (!VALIDATE_RDWR((void *)umsg, sizeof(*umsg))) return -EFAULT;
+  struct msghdr msg = *umsg;
+
+  void *buf;
+  size_t len;
+  int err = msg_buffer(msg, buf, len, PROT_WRITE);
+  if (err < 0) return err;
+  if (msg.msg_controllen != 0 && !VALIDATE_WR(msg.msg_control, msg.msg_controllen)) return -EFAULT;
+
+  ck::ref<fs::File> file = curproc->get_fd(sockfd);
+  if (!file) return -EBADF;
+  if (!file->ino->is_sock()) return -ENOTSOCK;
+
+  net::Socket::rights r;
+  auto *sock = (net::Socket *)file->ino.get();
+  ssize_t res = sock->recvmsg(*file, buf, len, flags, r);
+  if (res < 0) return res;
+
+  msg.msg_flags = 0;
+  rights_to_user(msg, r);
+  umsg->msg_controllen = msg.msg_controllen;
+  umsg->msg_flags = msg.msg_flags;
+  return res;
+}
+
+
 int sys::bind(int sockfd, const struct sockaddr *addr, size_t len) {
   if (!curproc->mm->validate_pointer((void *)addr, len, VALIDATE_READ)) {
     return -EINVAL;
@@ -224,6 +385,15 @@ ck::ref<net::Socket> net::Socket::accept(struct sockaddr *uaddr, int addr_len, i
 ssize_t net::Socket::sendto(fs::File &, void *data, size_t len, int flags, const sockaddr *, size_t) { return -ENOTIMPL; }
 ssize_t net::Socket::recvfrom(fs::File &, void *data, size_t len, int flags, const sockaddr *, size_t) { return -ENOTIMPL; }
 
+ssize_t net::Socket::sendmsg(fs::File &f, void *data, size_t len, int flags, rights &r) {
+  if (!r.empty()) return -EOPNOTSUPP;
+  return sendto(f, data, len, flags, nullptr, 0);
+}
+
+ssize_t net::Socket::recvmsg(fs::File &f, void *data, size_t len, int flags, rights &) {
+  return recvfrom(f, data, len, flags, nullptr, 0);
+}
+
 
 int net::Socket::bind(const struct sockaddr *addr, size_t len) { return -ENOTIMPL; }
 
@@ -7,6 +7,16 @@ names = [
 
     # proc.PID.*
     'name',
+
+    # blk.* (buffer cache)
+    'blk',
+    'wb',
+    'io',
+
+    # fs.* (filesystem caches)
+    'fs',
+    'icache',
+    'pcache',
 ]
 
 def name_to_int(name: str) -> str:
@@ -31,6 +31,19 @@ case $ARCH in
 		# QEMU_FLAGS+="-machine q35 "
 		QEMU_FLAGS+="-m 4G "
 		QEMU_FLAGS+="-hda $BUILD/chariot.img "
+		if [ "$CONFIG_NVME" = "y" ]; then
+			# a scratch disk to exercise the NVMe driver with
+			[ -f $BUILD/nvme.img ] || qemu-img create -f raw $BUILD/nvme.img 64M >/dev/null
+			QEMU_FLAGS+="-drive file=$BUILD/nvme.img,if=none,format=raw,id=nvm0 "
+			QEMU_FLAGS+="-device nvme,serial=chariot,drive=nvm0 "
+		fi
+		if [ "$CONFIG_AHCI" = "y" ]; then
+			# and one on an ich9-ahci controller for the AHCI driver
+			[ -f $BUILD/sata.img ] || qemu-img create -f raw $BUILD/sata.img 64M >/dev/null
+			QEMU_FLAGS+="-device ich9-ahci,id=ahci0 "
+			QEMU_FLAGS+="-drive file=$BUILD/sata.img,if=none,format=raw,id=sata0 "
+			QEMU_FLAGS+="-device ide-hd,drive=sata0,bus=ahci0.0 "
+		fi
 
 		QEMU_FLAGS+="-device VGA,vgamem_mb=64 "
 		QEMU_FLAGS+="-netdev user,id=u1  -device e1000,netdev=u1 "